@@ -0,0 +1,1610 @@
+#include "common.hpp"
+#include "network.hpp"
+#include "multicast.hpp"
+#include "trace.hpp"
+#include "recording.hpp"
+#include "histogram.hpp"
+#include "channel.hpp"
+#include "compression.hpp"
+#include "mapped_file.hpp"
+#include "session.hpp"
+#include "impairment.hpp"
+#include "outbound_queue.hpp"
+#include "send_batching.hpp"
+#include "pointer_prediction.hpp"
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <mutex>
+#include <map>
+
+using namespace MouseShare;
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+// CPU time consumed by the calling thread, in microseconds
+static uint64_t thread_cpu_time_us() {
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+    ULARGE_INTEGER k, u;
+    k.LowPart = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+    return (k.QuadPart + u.QuadPart) / 10;
+#else
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+struct BenchOptions {
+    int clients = 8;
+    int events = 5000;
+    int rate_hz = 1000;
+    double loss = 0.0;
+    std::string file;
+    double speed = 0.0;
+    int rtt_ms = 20;
+};
+
+// Synthetic input: circular mouse motion with a key tap every 50 events
+static std::string make_event_frame(int i) {
+    if (i % 50 == 0 || i % 50 == 1) {
+        KeyEvent key = {0x41, 0x1e, 0};
+        return serialize_packet(i % 50 == 0 ? EventType::KEY_PRESS : EventType::KEY_RELEASE, key);
+    }
+    MouseMoveEvent move;
+    move.dx = static_cast<int32_t>(std::lround(4 * std::cos(i * 0.05)));
+    move.dy = static_cast<int32_t>(std::lround(4 * std::sin(i * 0.05)));
+    move.x = 960 + move.dx;
+    move.y = 540 + move.dy;
+    return serialize_packet(EventType::MOUSE_MOVE, move);
+}
+
+// Calls send(i) for every event at the configured rate
+template<typename SendFn>
+static void pace_events(const BenchOptions& opt, SendFn send) {
+    auto interval = std::chrono::microseconds(1000000 / (std::max)(1, opt.rate_hz));
+    auto next = std::chrono::steady_clock::now();
+    for (int i = 0; i < opt.events; i++) {
+        send(i);
+        next += interval;
+        std::this_thread::sleep_until(next);
+    }
+}
+
+static void print_result(const char* name, uint64_t cpu_us, uint64_t bytes, uint64_t delivered,
+                         uint64_t expected, const std::string& extra = std::string()) {
+    std::cout << std::left << std::setw(16) << name
+              << " cpu " << std::setw(8) << cpu_us / 1000.0 << " ms"
+              << "  bytes " << std::setw(10) << bytes
+              << "  delivered " << delivered << "/" << expected;
+    if (!extra.empty()) {
+        std::cout << "  " << extra;
+    }
+    std::cout << "\n";
+}
+
+// ============================================================================
+// multicast: reliable multicast vs per-client TCP fan-out
+// ============================================================================
+
+static void bench_tcp_fanout(const BenchOptions& opt) {
+    Socket listener;
+    listener.create();
+    listener.bind(0);
+    listener.listen(opt.clients);
+
+    sockaddr_in addr{};
+    int addr_len = sizeof(addr);
+    getsockname(listener.handle(), reinterpret_cast<sockaddr*>(&addr), &addr_len);
+    uint16_t port = ntohs(addr.sin_port);
+
+    std::vector<Socket> receivers(opt.clients);
+    std::vector<Socket> senders;
+    for (auto& r : receivers) {
+        r.create();
+        r.connect("127.0.0.1", port);
+        senders.push_back(listener.accept());
+    }
+
+    std::atomic<uint64_t> delivered{0};
+    std::vector<std::thread> threads;
+    for (auto& r : receivers) {
+        threads.emplace_back([&r, &delivered] {
+            std::string frame;
+            while (r.recv_frame(frame)) {
+                delivered++;
+            }
+        });
+    }
+
+    // What server_thread_func would do per event for every client
+    uint64_t bytes = 0;
+    uint64_t cpu_start = thread_cpu_time_us();
+    pace_events(opt, [&](int i) {
+        std::string frame = make_event_frame(i);
+        for (auto& s : senders) {
+            s.send(frame);
+            bytes += frame.size();
+        }
+    });
+    uint64_t cpu_us = thread_cpu_time_us() - cpu_start;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    for (auto& s : senders) s.close();
+    for (auto& t : threads) t.join();
+
+    print_result("tcp-fanout", cpu_us, bytes, delivered, (uint64_t)opt.events * opt.clients);
+}
+
+static void bench_multicast_group(const BenchOptions& opt) {
+    const uint16_t port = DEFAULT_PORT + 2;
+
+    MulticastSender sender;
+    sender.open(DEFAULT_MULTICAST_GROUP, port);
+    sender.set_loss(opt.loss);
+
+    std::atomic<uint64_t> delivered{0};
+    std::vector<std::unique_ptr<MulticastReceiver>> receivers;
+    for (int i = 0; i < opt.clients; i++) {
+        auto r = std::make_unique<MulticastReceiver>();
+        r->set_loss(opt.loss);
+        r->open(sender.info(), [&delivered](const std::string& frame) {
+            if (frame_type(frame) != EventType::KEY_STATE) {
+                delivered++;
+            }
+        });
+        receivers.push_back(std::move(r));
+    }
+
+    // Let every receiver join before the first frame
+    std::this_thread::sleep_for(std::chrono::milliseconds(MULTICAST_HEARTBEAT_MS * 2));
+
+    uint64_t cpu_start = thread_cpu_time_us();
+    pace_events(opt, [&](int i) {
+        sender.send_frame(make_event_frame(i));
+    });
+    uint64_t cpu_us = thread_cpu_time_us() - cpu_start;
+
+    // Allow repairs for the tail to complete
+    uint64_t expected = (uint64_t)opt.events * opt.clients;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(3);
+    while (delivered < expected && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    MulticastStats stats = sender.stats();
+    uint64_t resyncs = 0;
+    for (auto& r : receivers) {
+        resyncs += r->stats().resyncs;
+        r->close();
+    }
+    sender.close();
+
+    std::string extra = "repairs " + std::to_string(stats.repairs) +
+                        "  nacks " + std::to_string(stats.nacks) +
+                        "  resyncs " + std::to_string(resyncs);
+    print_result("multicast", cpu_us, stats.bytes, delivered, expected, extra);
+}
+
+static int bench_multicast(const BenchOptions& opt) {
+    std::cout << opt.clients << " clients, " << opt.events << " events at "
+              << opt.rate_hz << " Hz, " << opt.loss * 100 << "% simulated loss\n";
+    std::cout << "(cpu is the sending thread only)\n";
+
+    bench_tcp_fanout(opt);
+    bench_multicast_group(opt);
+    return 0;
+}
+
+// ============================================================================
+// trace: per-call cost of the trace stamps
+// ============================================================================
+
+// Average ns per iteration of a begin + five stages, as the pipeline does
+static double time_trace_calls(int iterations) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        trace_begin(TraceStage::HOOK);
+        trace_stage(TraceStage::ENQUEUE, EventType::MOUSE_MOVE);
+        trace_stage(TraceStage::SEND);
+        trace_stage(TraceStage::RECV, EventType::MOUSE_MOVE);
+        trace_stage(TraceStage::DECODE, EventType::MOUSE_MOVE);
+        trace_stage(TraceStage::INJECT);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / iterations / 6;
+}
+
+static int bench_trace(const BenchOptions& opt) {
+    int iterations = (std::max)(opt.events, 1000000);
+    std::cout << iterations << " iterations of 6 trace calls\n" << std::fixed << std::setprecision(2);
+
+    std::cout << "  disabled  " << time_trace_calls(iterations) << " ns/call\n";
+
+    // The always-on flight recorder alone, then with the tracer on top
+    if (g_flight.open(FlightRecorder::default_path("bench"))) {
+        std::cout << "  flight    " << time_trace_calls(iterations) << " ns/call\n";
+    }
+
+    g_tracer.enable();
+    std::cout << "  enabled   " << time_trace_calls(iterations) << " ns/call\n";
+    g_flight.close();
+    return 0;
+}
+
+// ============================================================================
+// replay: a recorded session over loopback TCP
+// ============================================================================
+
+static int bench_replay(const BenchOptions& opt) {
+    SessionReplay replay;
+    if (opt.file.empty()) {
+        std::cerr << "replay needs a recording (--file, made with mouse-share-server --record)\n";
+        return 1;
+    }
+    if (!replay.open(opt.file)) {
+        return 1;
+    }
+
+    std::cout << replay.size() << " events (" << replay.duration_us() / 1000 << " ms recorded) at "
+              << (opt.speed > 0 ? std::to_string(opt.speed) + "x" : std::string("full speed")) << "\n";
+
+    Socket listener;
+    listener.create();
+    listener.bind(0);
+    listener.listen(1);
+
+    sockaddr_in addr{};
+    int addr_len = sizeof(addr);
+    getsockname(listener.handle(), reinterpret_cast<sockaddr*>(&addr), &addr_len);
+
+    Socket receiver;
+    receiver.create();
+    receiver.connect("127.0.0.1", ntohs(addr.sin_port));
+    Socket sender = listener.accept();
+
+    // TCP keeps the order, so the n-th frame received is the n-th sent
+    std::vector<uint64_t> sent_us(replay.size());
+    LatencyHistogram latency;
+    std::atomic<uint64_t> delivered{0};
+    std::thread reader([&] {
+        std::string frame;
+        while (receiver.recv_frame(frame)) {
+            uint64_t n = delivered.fetch_add(1);
+            latency.record(get_timestamp_us() - sent_us[n]);
+        }
+    });
+
+    uint64_t bytes = 0;
+    uint64_t cpu_start = thread_cpu_time_us();
+    size_t i = 0;
+    replay.play(opt.speed, [&](const InputRecord& record) {
+        std::string frame = replay.to_frame(record);
+        sent_us[i++] = get_timestamp_us();
+        sender.send(frame);
+        bytes += frame.size();
+    });
+    uint64_t cpu_us = thread_cpu_time_us() - cpu_start;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    sender.close();
+    reader.join();
+
+    HistogramSnapshot s = latency.snapshot();
+    std::string extra = "latency us p50 " + std::to_string(s.percentile(50)) +
+                        "  p99 " + std::to_string(s.percentile(99)) +
+                        "  max " + std::to_string(s.max);
+    print_result("replay", cpu_us, bytes, delivered, replay.size(), extra);
+    return 0;
+}
+
+// ============================================================================
+// secure: what encryption adds to event latency
+// ============================================================================
+
+// How bench_link's two ends talk
+struct LinkSetup {
+    const PresharedKey* key = nullptr;  // seal every frame
+    bool shared_memory = false;         // --shm
+    bool receive_batching = true;       // Socket::set_receive_batching
+};
+
+struct LinkResult {
+    HistogramSnapshot latency;          // send to receive, us
+    uint64_t cpu_us = 0;                // sending thread
+    uint64_t receiver_cpu_us = 0;
+    uint64_t bytes = 0;
+    uint64_t delivered = 0;
+};
+
+// Paced events over one loopback connection, read the way the client
+// reads them (wait_readable, then recv_frame)
+static LinkResult bench_link(const BenchOptions& opt, const LinkSetup& setup) {
+    Socket listener;
+    listener.create();
+    listener.bind(0);
+    listener.listen(1);
+
+    sockaddr_in addr{};
+    int addr_len = sizeof(addr);
+    getsockname(listener.handle(), reinterpret_cast<sockaddr*>(&addr), &addr_len);
+
+    // The encrypted connect waits for the answer from accept_encryption
+    Socket receiver;
+    receiver.create();
+    receiver.offer_shared_memory(setup.shared_memory);
+    receiver.set_receive_batching(setup.receive_batching);
+    std::thread connector([&] {
+        receiver.connect("127.0.0.1", ntohs(addr.sin_port), std::string(), setup.key ? *setup.key : PresharedKey());
+    });
+    Socket sender = listener.accept();
+    if (setup.key) {
+        sender.accept_encryption(*setup.key);
+    }
+    sender.accept_shared_memory();
+    connector.join();
+    if (!sender.wait_confirmed()) {
+        throw NetworkError("The receiver did not prove the key");
+    }
+    if (setup.shared_memory && !sender.is_shared_memory()) {
+        throw NetworkError("The connection did not move to shared memory");
+    }
+
+    LinkResult result;
+    std::vector<uint64_t> sent_us(opt.events);
+    LatencyHistogram latency;
+    std::atomic<uint64_t> delivered{0};
+    std::thread reader([&] {
+        uint64_t cpu_start = thread_cpu_time_us();
+        std::string frame;
+        while (true) {
+            if (!receiver.wait_readable(100)) {
+                continue;
+            }
+            if (!receiver.recv_frame(frame)) {
+                break;
+            }
+            uint64_t n = delivered.fetch_add(1);
+            latency.record(get_timestamp_us() - sent_us[n]);
+        }
+        result.receiver_cpu_us = thread_cpu_time_us() - cpu_start;
+    });
+
+    uint64_t cpu_start = thread_cpu_time_us();
+    pace_events(opt, [&](int i) {
+        std::string frame = make_event_frame(i);
+        sent_us[i] = get_timestamp_us();
+        sender.send(frame);
+        result.bytes += frame.size() + (setup.key ? sizeof(PacketHeader) + SECURE_TAG_BYTES : 0);
+    });
+    result.cpu_us = thread_cpu_time_us() - cpu_start;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    sender.close();
+    reader.join();
+    result.delivered = delivered;
+    result.latency = latency.snapshot();
+    return result;
+}
+
+// Seal and open one record of size bytes, n times; microseconds per record
+static double bench_seal_open(const PresharedKey& key, size_t size, int n) {
+    SecureHello a = make_secure_hello();
+    SecureHello b = make_secure_hello();
+    FrameCipher sealer(key, a, b, true);
+    FrameCipher opener(key, a, b, false);
+
+    std::string frames;
+    while (frames.size() < size) {
+        frames += make_event_frame(static_cast<int>(frames.size()));
+    }
+    std::string record;
+    std::string frame;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; i++) {
+        record = sealer.seal(frames.data(), frames.size());
+        if (!opener.open(record)) {
+            std::cerr << "Record failed to open\n";
+            return 0.0;
+        }
+        while (opener.next_frame(frame)) {}
+    }
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / n;
+}
+
+static int bench_secure(const BenchOptions& opt) {
+    PresharedKey key = derive_preshared_key("mouse-share-bench");
+
+    std::cout << opt.events << " events at " << opt.rate_hz << " Hz over loopback TCP\n";
+
+    LinkSetup secure;
+    secure.key = &key;
+    LinkResult plain = bench_link(opt, LinkSetup());
+    LinkResult sealed = bench_link(opt, secure);
+
+    auto latency = [](const HistogramSnapshot& s) {
+        return "latency us p50 " + std::to_string(s.percentile(50)) +
+               "  p99 " + std::to_string(s.percentile(99)) +
+               "  max " + std::to_string(s.max);
+    };
+    print_result("plaintext", plain.cpu_us, plain.bytes, plain.delivered, opt.events, latency(plain.latency));
+    print_result("aes-256-gcm", sealed.cpu_us, sealed.bytes, sealed.delivered, opt.events, latency(sealed.latency));
+    std::cout << "added p50 " << static_cast<int64_t>(sealed.latency.percentile(50)) - static_cast<int64_t>(plain.latency.percentile(50))
+              << " us, p99 " << static_cast<int64_t>(sealed.latency.percentile(99)) - static_cast<int64_t>(plain.latency.percentile(99))
+              << " us\n";
+
+    std::cout << "seal + open: one event " << bench_seal_open(key, 20, 100000) << " us, "
+              << "1 KB batch " << bench_seal_open(key, 1024, 100000) << " us, "
+              << "16 KB chunk " << bench_seal_open(key, 16 * 1024, 10000) << " us\n";
+    return 0;
+}
+
+// ============================================================================
+// compress: transfer compression on typical clipboard contents
+// ============================================================================
+
+struct Corpus {
+    std::string name;
+    std::string data;
+};
+
+// Stand-in random generator, the same on every run
+struct Lcg {
+    uint32_t state = 12345;
+    uint32_t next() {
+        state = state * 1103515245 + 12345;
+        return state >> 8;
+    }
+};
+
+// ASCII as CF_UNICODETEXT (UTF-16LE)
+static std::string to_utf16(const std::string& text) {
+    std::string wide;
+    wide.reserve(text.size() * 2);
+    for (char c : text) {
+        wide.push_back(c);
+        wide.push_back('\0');
+    }
+    return wide;
+}
+
+// Prose from a small vocabulary, in sentences and paragraphs
+static std::string make_text_corpus(size_t chars) {
+    static const char* const WORDS[] = {
+        "the", "of", "and", "to", "a", "in", "that", "is", "for", "it", "as", "was", "with",
+        "be", "by", "on", "not", "he", "this", "are", "or", "his", "from", "at", "which",
+        "meeting", "report", "quarterly", "numbers", "customer", "network", "schedule",
+        "please", "review", "attached", "before", "Friday", "update", "project", "team"
+    };
+    Lcg rng;
+    std::string text;
+    int in_sentence = 0;
+    while (text.size() < chars) {
+        std::string word = WORDS[rng.next() % (sizeof(WORDS) / sizeof(WORDS[0]))];
+        if (in_sentence == 0) word[0] = static_cast<char>(std::toupper(word[0]));
+        text += word;
+        if (++in_sentence > 6 + static_cast<int>(rng.next() % 12)) {
+            text += rng.next() % 5 == 0 ? ".\r\n\r\n" : ". ";
+            in_sentence = 0;
+        } else {
+            text += rng.next() % 9 == 0 ? ", " : " ";
+        }
+    }
+    return to_utf16(text);
+}
+
+// Indented source code with recurring identifiers
+static std::string make_code_corpus(size_t chars) {
+    static const char* const LINES[] = {
+        "if (!socket_.is_valid()) {", "return false;", "}", "std::lock_guard<std::mutex> lock(mutex_);",
+        "for (size_t i = 0; i < count; i++) {", "total += values[i];", "// Keep the window topped up",
+        "auto found = incoming_.find(channel);", "send_(serialize_packet(EventType::CHANNEL_CREDIT, credit));",
+        "uint64_t n = (std::min)(remaining, limit);", "case EventType::MOUSE_MOVE:", "break;"
+    };
+    Lcg rng;
+    std::string text;
+    int depth = 1;
+    while (text.size() < chars) {
+        text.append(depth * 4, ' ');
+        text += LINES[rng.next() % (sizeof(LINES) / sizeof(LINES[0]))];
+        text += "\r\n";
+        depth = 1 + static_cast<int>(rng.next() % 4);
+    }
+    return to_utf16(text);
+}
+
+// CF_DIB: BITMAPINFOHEADER followed by bottom-up pixel rows
+static std::string make_dib(int width, int height, int bits) {
+    std::string dib(40, '\0');
+    int32_t header[3] = {40, width, height};
+    uint16_t planes_bits[2] = {1, static_cast<uint16_t>(bits)};
+    std::memcpy(&dib[0], header, sizeof(header));
+    std::memcpy(&dib[12], planes_bits, sizeof(planes_bits));
+    return dib;
+}
+
+// 32-bit screenshot of an application: title bar gradient, flat panels,
+// lines of dark "text" strokes on white
+static std::string make_screenshot_corpus(int width, int height) {
+    std::string dib = make_dib(width, height, 32);
+    Lcg rng;
+    std::vector<uint32_t> row(width);
+    for (int y = height - 1; y >= 0; y--) {
+        for (int x = 0; x < width; x++) {
+            uint32_t pixel;
+            if (y < 32) {
+                pixel = 0xFF000000 | (0x20 + x * 0x60 / width) << 16 | 0x50 << 8 | 0xA0;  // title bar
+            } else if (x < 240) {
+                pixel = 0xFFF3F3F3;  // side panel
+            } else if ((y % 20) < 12 && (y % 20) > 2 && x > 260 && x < width - 40 && (x / 7 + y / 20) % 11 != 0) {
+                pixel = (rng.next() % 3) ? 0xFF202020 : 0xFFFFFFFF;  // text
+            } else {
+                pixel = 0xFFFFFFFF;
+            }
+            row[x] = pixel;
+        }
+        dib.append(reinterpret_cast<const char*>(row.data()), row.size() * 4);
+    }
+    return dib;
+}
+
+// 24-bit photo: smooth gradients under sensor noise
+static std::string make_photo_corpus(int width, int height) {
+    std::string dib = make_dib(width, height, 24);
+    Lcg rng;
+    size_t stride = (static_cast<size_t>(width) * 3 + 3) & ~size_t(3);
+    std::string row(stride, '\0');
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            double v = 0.5 + 0.25 * std::sin(x * 0.01) + 0.2 * std::cos(y * 0.013 + x * 0.004);
+            for (int c = 0; c < 3; c++) {
+                int noise = static_cast<int>(rng.next() % 9) - 4;
+                row[x * 3 + c] = static_cast<char>((std::max)(0, (std::min)(255, static_cast<int>(v * (180 + c * 30)) + noise)));
+            }
+        }
+        dib += row;
+    }
+    return dib;
+}
+
+// Stands in for content that is compressed already (PNG, ZIP, JPEG)
+static std::string make_random_corpus(size_t bytes) {
+    Lcg rng;
+    std::string data(bytes, '\0');
+    for (char& c : data) c = static_cast<char>(rng.next());
+    return data;
+}
+
+// Streams one corpus through the transfer compressor and back, chunk by
+// chunk as a ChannelMux would, keeping the best of a few passes
+static void bench_corpus(const Corpus& corpus) {
+    const std::string& data = corpus.data;
+    bool compress = should_compress(data.data(), data.size(), corpus.name);
+    double entropy = sample_entropy(data.data(), data.size());
+
+    uint64_t wire = 0;
+    double best_encode_s = 1e9;
+    double best_decode_s = 1e9;
+    bool ok = true;
+    for (int pass = 0; pass < 5; pass++) {
+        struct Chunk {
+            ChunkEncoding encoding;
+            std::string bytes;
+            size_t raw_size;
+        };
+        std::vector<Chunk> chunks;
+        ChunkCompressor compressor(data.data(), compress);
+        std::string encoded;
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t offset = 0; offset < data.size(); offset += CHANNEL_CHUNK_BYTES) {
+            size_t n = (std::min)(size_t(CHANNEL_CHUNK_BYTES), data.size() - offset);
+            ChunkEncoding encoding = compressor.encode(offset, n, encoded);
+            chunks.push_back({encoding, encoding == ChunkEncoding::LZ ? encoded : data.substr(offset, n), n});
+        }
+        auto encoded_at = std::chrono::steady_clock::now();
+
+        LzDecoder decoder;
+        std::string output;
+        output.reserve(data.size());
+        for (const auto& chunk : chunks) {
+            if (chunk.encoding == ChunkEncoding::LZ) {
+                ok = decoder.decode(chunk.bytes.data(), chunk.bytes.size(), chunk.raw_size) && ok;
+            } else {
+                decoder.append(chunk.bytes.data(), chunk.bytes.size());
+            }
+            output.append(decoder.data(), decoder.size());
+        }
+        auto decoded_at = std::chrono::steady_clock::now();
+        ok = ok && output == data;
+
+        wire = 0;
+        for (const auto& chunk : chunks) {
+            wire += sizeof(PacketHeader) + sizeof(ChannelDataHeader) + chunk.bytes.size();
+        }
+        best_encode_s = (std::min)(best_encode_s, std::chrono::duration<double>(encoded_at - start).count());
+        best_decode_s = (std::min)(best_decode_s, std::chrono::duration<double>(decoded_at - encoded_at).count());
+    }
+
+    double mb = data.size() / 1e6;
+    std::cout << std::left << std::setw(12) << corpus.name
+              << std::right << std::setw(8) << mb << " MB"
+              << std::setw(8) << entropy
+              << std::setw(7) << (compress ? "yes" : "no")
+              << std::setw(8) << static_cast<double>(data.size()) / wire << "x"
+              << std::setw(10) << mb / best_encode_s
+              << std::setw(10) << mb / best_decode_s
+              << (ok ? "" : "  ROUND TRIP FAILED") << "\n";
+}
+
+static int bench_compress(const BenchOptions& opt) {
+    std::vector<Corpus> corpora;
+    corpora.push_back({"text", make_text_corpus(2 * 1024 * 1024)});
+    corpora.push_back({"code", make_code_corpus(2 * 1024 * 1024)});
+    corpora.push_back({"screenshot", make_screenshot_corpus(1920, 1080)});
+    corpora.push_back({"photo", make_photo_corpus(1600, 1200)});
+    corpora.push_back({"random", make_random_corpus(4 * 1024 * 1024)});
+
+    if (!opt.file.empty()) {
+        MappedFile file;
+        if (!file.open_read(opt.file)) {
+            std::cerr << "Cannot read " << opt.file << "\n";
+            return 1;
+        }
+        corpora.push_back({opt.file, std::string(static_cast<const char*>(file.data()), file.size())});
+    }
+
+    std::cout << "corpus          size   entropy  tried   ratio  enc MB/s  dec MB/s\n"
+              << std::fixed << std::setprecision(2);
+    for (const auto& corpus : corpora) {
+        bench_corpus(corpus);
+    }
+    return 0;
+}
+
+// ============================================================================
+// reconnect: time to the first injected event, cold and resumed
+// ============================================================================
+
+// Passes frames between a client and the server, each after half the round
+// trip time. The TCP handshake itself is not delayed.
+class DelayedPipe {
+public:
+    DelayedPipe(Socket client, Socket server, uint64_t one_way_us)
+        : client_(std::move(client)), server_(std::move(server)), one_way_us_(one_way_us),
+          to_server_([this](const std::string& frame, uint64_t) { server_.send(frame); }),
+          to_client_([this](const std::string& frame, uint64_t) { client_.send(frame); }) {
+        to_server_.start();
+        to_client_.start();
+        up_ = std::thread(&DelayedPipe::forward, this, std::ref(client_), std::ref(to_server_));
+        down_ = std::thread(&DelayedPipe::forward, this, std::ref(server_), std::ref(to_client_));
+    }
+
+    ~DelayedPipe() {
+        client_.shutdown();
+        server_.shutdown();
+        up_.join();
+        down_.join();
+        to_server_.stop();
+        to_client_.stop();
+    }
+
+private:
+    void forward(Socket& from, DelayLine& line) {
+        std::string frame;
+        while (from.recv_frame(frame)) {
+            uint64_t now = get_timestamp_us();
+            line.push(std::move(frame), now, now + one_way_us_);
+        }
+        client_.shutdown();
+        server_.shutdown();
+    }
+
+    Socket client_;
+    Socket server_;
+    uint64_t one_way_us_;
+    DelayLine to_server_;
+    DelayLine to_client_;
+    std::thread up_;
+    std::thread down_;
+};
+
+// The server's side: a session log, input at 1 kHz whether or not the
+// client is there, and the accept path of mouse-share-server.exe
+class ReconnectServer {
+public:
+    explicit ReconnectServer(const PresharedKey& key) : key_(key) {
+        listener_.create();
+        listener_.bind(0);
+        listener_.listen(1);
+        running_ = true;
+        accept_thread_ = std::thread(&ReconnectServer::accept_loop, this);
+        input_thread_ = std::thread(&ReconnectServer::input_loop, this);
+    }
+
+    ~ReconnectServer() {
+        running_ = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            client_.shutdown();
+        }
+        accept_thread_.join();
+        input_thread_.join();
+    }
+
+    uint16_t port() {
+        sockaddr_in addr{};
+        int addr_len = sizeof(addr);
+        getsockname(listener_.handle(), reinterpret_cast<sockaddr*>(&addr), &addr_len);
+        return ntohs(addr.sin_port);
+    }
+
+private:
+    void accept_loop() {
+        while (running_) {
+            if (!listener_.wait_readable(100)) continue;
+            try {
+                Socket conn = listener_.accept();
+                if (key_.set) {
+                    conn.accept_encryption(key_);
+                }
+                SessionHelloEvent hello;
+                bool has_hello = recv_session_hello(conn, hello);
+
+                // Answered at once, taken over once the client proves the key
+                SessionHelloEvent resume_from = hello;
+                bool answered = has_hello && conn.is_encrypted();
+                if (answered) {
+                    SessionAcceptEvent offer;
+                    {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        offer = log_.offer(hello);
+                    }
+                    conn.send(serialize_packet(EventType::SESSION_ACCEPT, offer));
+                    resume_from = SessionLog::after_offer(hello, offer);
+                }
+
+                std::string frame;
+                if (conn.wait_confirmed()) {
+                    ScreenInfo info = {1920, 1080, 0, 0};
+                    std::vector<std::string> flight;
+                    {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        client_ = std::move(conn);
+                        log_.resume_flight(resume_from, has_hello, {serialize_packet(EventType::SCREEN_INFO, info)},
+                                           flight, answered);
+                        if (!flight.empty()) {
+                            client_.send_frames(flight);
+                        }
+                        connected_ = true;
+                    }
+                    while (client_.recv_frame(frame)) {}
+                }
+            } catch (const NetworkError& e) {
+                std::cerr << "Server: " << e.what() << "\n";
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            connected_ = false;
+            client_.close();
+            log_.detach();
+        }
+    }
+
+    // Like the server's send queue writer: recorded while the client is
+    // away, for replay when it comes back
+    void input_loop() {
+        auto next = std::chrono::steady_clock::now();
+        for (int i = 0; running_; i++) {
+            std::string frame = make_event_frame(i);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (connected_ || log_.is_resumable()) {
+                    log_.record(frame);
+                    if (connected_) {
+                        client_.send(frame);
+                    }
+                }
+            }
+            next += std::chrono::milliseconds(1);
+            std::this_thread::sleep_until(next);
+        }
+    }
+
+    PresharedKey key_;
+    Socket listener_;
+    std::mutex mutex_;
+    Socket client_;
+    SessionLog log_;
+    bool connected_ = false;
+    std::atomic<bool> running_{false};
+    std::thread accept_thread_;
+    std::thread input_thread_;
+};
+
+// Accepts connections and pipes each to the server through a DelayedPipe
+class DelayProxy {
+public:
+    DelayProxy(uint16_t server_port, int rtt_ms) : server_port_(server_port), one_way_us_(rtt_ms * 500) {
+        listener_.create();
+        listener_.bind(0);
+        listener_.listen(1);
+        running_ = true;
+        thread_ = std::thread(&DelayProxy::accept_loop, this);
+    }
+
+    ~DelayProxy() {
+        running_ = false;
+        thread_.join();
+    }
+
+    uint16_t port() {
+        sockaddr_in addr{};
+        int addr_len = sizeof(addr);
+        getsockname(listener_.handle(), reinterpret_cast<sockaddr*>(&addr), &addr_len);
+        return ntohs(addr.sin_port);
+    }
+
+private:
+    void accept_loop() {
+        while (running_) {
+            if (!listener_.wait_readable(100)) continue;
+            Socket client = listener_.accept();
+            Socket server;
+            server.create();
+            server.connect("127.0.0.1", server_port_);
+            pipe_.reset();  // the previous connection, closed by now
+            pipe_ = std::make_unique<DelayedPipe>(std::move(client), std::move(server), one_way_us_);
+        }
+        pipe_.reset();
+    }
+
+    uint16_t server_port_;
+    uint64_t one_way_us_;
+    Socket listener_;
+    std::unique_ptr<DelayedPipe> pipe_;
+    std::atomic<bool> running_{false};
+    std::thread thread_;
+};
+
+// Connect and wait for the first input event; milliseconds from the start
+// of the connect. ticket is updated as the client's would be.
+static double time_to_first_event(uint16_t port, const PresharedKey& key, SessionResume& ticket,
+                                  bool hello_in_first_flight) {
+    std::string hello = serialize_packet(EventType::SESSION_HELLO, ticket.hello());
+    auto start = std::chrono::steady_clock::now();
+
+    Socket sock;
+    sock.create();
+    sock.connect("127.0.0.1", port, hello_in_first_flight ? hello : std::string(), key);
+    if (!hello_in_first_flight) {
+        sock.send(hello);
+    }
+
+    std::string frame;
+    while (sock.wait_readable(SECURE_HANDSHAKE_TIMEOUT_MS) && sock.recv_frame(frame)) {
+        EventType type = frame_type(frame);
+        if (type == EventType::SESSION_ACCEPT) {
+            SessionAcceptEvent reply;
+            std::memcpy(&reply, frame.data() + sizeof(PacketHeader), sizeof(reply));
+            ticket.accepted(reply);
+            continue;
+        }
+        ticket.frame_received();
+        if (type == EventType::MOUSE_MOVE || type == EventType::KEY_PRESS || type == EventType::KEY_RELEASE) {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+    }
+    throw NetworkError("No input after connecting");
+}
+
+static int bench_reconnect(const BenchOptions& opt) {
+    constexpr int TRIALS = 20;
+    constexpr int OUTAGE_MS = 50;
+
+    std::cout << "Time to first input event over a " << opt.rtt_ms << " ms round trip, "
+              << TRIALS << " connects each\n"
+              << "(after the TCP handshake; TCP Fast Open saves that round trip too, where the OS allows)\n"
+              << std::fixed << std::setprecision(1);
+
+    PresharedKey none;
+    PresharedKey key = derive_preshared_key("mouse-share-bench");
+
+    struct Variant {
+        const char* name;
+        const PresharedKey* key;
+        bool resume;
+        bool first_flight;
+    };
+    const Variant variants[] = {
+        {"plain cold", &none, false, true},
+        {"plain resumed", &none, true, true},
+        {"secure cold", &key, false, true},
+        {"secure resumed", &key, true, true},
+        {"secure, hello after handshake", &key, true, false},
+    };
+
+    for (const Variant& v : variants) {
+        ReconnectServer server(*v.key);
+        DelayProxy proxy(server.port(), opt.rtt_ms);
+
+        // Resumed runs start from a ticket for a session the server holds
+        SessionResume ticket;
+        if (v.resume) {
+            time_to_first_event(proxy.port(), *v.key, ticket, true);
+        }
+
+        std::vector<double> ms;
+        for (int i = 0; i < TRIALS; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(OUTAGE_MS));
+            if (!v.resume) {
+                ticket = SessionResume();
+            }
+            ms.push_back(time_to_first_event(proxy.port(), *v.key, ticket, v.first_flight));
+        }
+        std::sort(ms.begin(), ms.end());
+        double p50 = ms[ms.size() / 2];
+        std::cout << std::left << std::setw(30) << v.name
+                  << " p50 " << std::setw(6) << p50 << " ms (" << p50 / opt.rtt_ms << " RTT)"
+                  << "  max " << ms.back() << " ms\n";
+    }
+    return 0;
+}
+
+// ============================================================================
+// shm, recv: the same events over different transports and receive paths
+// ============================================================================
+
+struct LinkRun {
+    const char* name;
+    const BenchOptions* options;
+    LinkSetup setup;
+};
+
+// Each run's result, with the system calls and wakeups it took
+static void bench_link_runs(const BenchOptions& opt, const LinkRun* runs, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const LinkRun& run = runs[i];
+        MetricsSnapshot before = g_metrics.snapshot();
+        LinkResult r = bench_link(*run.options, run.setup);
+        MetricsSnapshot after = g_metrics.snapshot();
+        auto delta = [&](Counter c) {
+            return after.counters[static_cast<int>(c)] - before.counters[static_cast<int>(c)];
+        };
+
+        std::ostringstream extra;
+        extra << "latency us p50 " << r.latency.percentile(50) << "  p99 " << r.latency.percentile(99)
+              << "  receiver cpu " << r.receiver_cpu_us / 1000.0 << " ms"
+              << "  send calls " << delta(Counter::SEND_CALLS)
+              << "  recv calls " << delta(Counter::RECV_CALLS)
+              << "  wakeups " << delta(Counter::SHM_WAKEUPS);
+        print_result(run.name, r.cpu_us, r.bytes, r.delivered, opt.events, extra.str());
+    }
+}
+
+static int bench_shm(const BenchOptions& opt) {
+    BenchOptions burst = opt;
+    burst.rate_hz = 1000000;  // as fast as the sender goes
+
+    LinkSetup tcp;
+    LinkSetup shm;
+    shm.shared_memory = true;
+
+    std::cout << opt.events << " events at " << opt.rate_hz << " Hz, then back to back, on this host\n";
+    const LinkRun runs[] = {
+        {"tcp", &opt, tcp},
+        {"shm", &opt, shm},
+        {"tcp burst", &burst, tcp},
+        {"shm burst", &burst, shm},
+    };
+    bench_link_runs(opt, runs, sizeof(runs) / sizeof(runs[0]));
+    return 0;
+}
+
+static int bench_recv(const BenchOptions& opt) {
+    BenchOptions burst = opt;
+    burst.rate_hz = 1000000;
+
+    LinkSetup per_frame;
+    per_frame.receive_batching = false;
+    LinkSetup batched;
+
+    std::cout << opt.events << " events at " << opt.rate_hz << " Hz, then back to back, over loopback TCP\n";
+    const LinkRun runs[] = {
+        {"per-frame", &opt, per_frame},
+        {"batched", &opt, batched},
+        {"per-frame burst", &burst, per_frame},
+        {"batched burst", &burst, batched},
+    };
+    bench_link_runs(opt, runs, sizeof(runs) / sizeof(runs[0]));
+    return 0;
+}
+
+// ============================================================================
+// latency: where an event's time goes, from app and kernel timestamps
+// ============================================================================
+
+// Events go the server's way (OutboundQueue, then Socket) over loopback
+// with tracing on, and each one's stamps are split into portions
+static int bench_latency(const BenchOptions& opt) {
+    g_tracer.enable();
+
+    Socket listener;
+    listener.create();
+    listener.bind(0);
+    listener.listen(1);
+
+    sockaddr_in addr{};
+    int addr_len = sizeof(addr);
+    getsockname(listener.handle(), reinterpret_cast<sockaddr*>(&addr), &addr_len);
+
+    Socket receiver;
+    receiver.create();
+    receiver.connect("127.0.0.1", ntohs(addr.sin_port));
+    Socket sender = listener.accept();
+    bool kernel = sender.enable_kernel_timestamps() && receiver.enable_kernel_timestamps();
+
+    // Trace ids of event i on each side; MOUSE_MOVE.x carries i across
+    std::vector<uint32_t> sent_ids(opt.events, 0);
+    std::vector<uint32_t> received_ids(opt.events, 0);
+    std::thread reader([&] {
+        std::string frame;
+        while (true) {
+            if (!receiver.wait_readable(100)) {
+                continue;
+            }
+            if (!receiver.recv_frame(frame)) {
+                break;
+            }
+            EventType type = frame_type(frame);
+            trace_begin(TraceStage::RECV, type);
+            trace_kernel_stamp(TraceStage::KERNEL_RX, trace_current(), receiver.kernel_rx_us());
+            MouseMoveEvent move;
+            std::memcpy(&move, frame.data() + sizeof(PacketHeader), sizeof(move));
+            trace_stage(TraceStage::DECODE, type);
+            if (move.x >= 0 && move.x < opt.events) {
+                received_ids[move.x] = trace_current();
+            }
+        }
+    });
+
+    OutboundQueue queue([&](const std::vector<std::string>& frames) {
+        return sender.send_frames(frames) > 0;
+    });
+    queue.start();
+    pace_events(opt, [&](int i) {
+        trace_begin(TraceStage::HOOK);
+        MouseMoveEvent move = {i, 0, 1, 0};
+        sent_ids[i] = trace_current();
+        queue.push(serialize_packet(EventType::MOUSE_MOVE, move));
+    });
+    queue.stop();
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    sender.poll_kernel_timestamps();
+    sender.close();
+    reader.join();
+
+    // Stage times by trace id
+    std::map<uint32_t, std::map<TraceStage, uint64_t>> stamps;
+    for (const TraceRecord& r : g_tracer.records()) {
+        stamps[r.id][r.stage] = r.ts_us;
+    }
+
+    struct Portion {
+        const char* name;
+        TraceStage from;
+        TraceStage to;
+        LatencyHistogram histogram;
+        uint64_t sum = 0;
+        bool sender_from;  // from is stamped on the sending side
+        bool sender_to;
+    };
+    std::vector<std::unique_ptr<Portion>> portions;
+    auto add = [&](const char* name, TraceStage from, bool sender_from, TraceStage to, bool sender_to) {
+        portions.push_back(std::make_unique<Portion>());
+        Portion& p = *portions.back();
+        p.name = name;
+        p.from = from;
+        p.to = to;
+        p.sender_from = sender_from;
+        p.sender_to = sender_to;
+    };
+    add("sender app", TraceStage::HOOK, true, TraceStage::SEND, true);
+    if (kernel) {
+        add("sender stack", TraceStage::SEND, true, TraceStage::KERNEL_TX, true);
+        add("wire", TraceStage::KERNEL_TX, true, TraceStage::KERNEL_RX, false);
+        add("receiver stack", TraceStage::KERNEL_RX, false, TraceStage::RECV, false);
+    } else {
+        add("network", TraceStage::SEND, true, TraceStage::RECV, false);
+    }
+    add("receiver app", TraceStage::RECV, false, TraceStage::DECODE, false);
+    add("total", TraceStage::HOOK, true, TraceStage::DECODE, false);
+
+    int complete = 0;
+    for (int i = 0; i < opt.events; i++) {
+        auto& sent = stamps[sent_ids[i]];
+        auto& received = stamps[received_ids[i]];
+        if (sent_ids[i] == 0 || received_ids[i] == 0) continue;
+
+        bool whole = true;
+        for (const auto& p : portions) {
+            whole = whole && (p->sender_from ? sent : received).count(p->from) &&
+                    (p->sender_to ? sent : received).count(p->to);
+        }
+        if (!whole) continue;
+        complete++;
+        for (auto& p : portions) {
+            uint64_t from = (p->sender_from ? sent : received)[p->from];
+            uint64_t to = (p->sender_to ? sent : received)[p->to];
+            uint64_t us = to > from ? to - from : 0;
+            p->histogram.record(us);
+            p->sum += us;
+        }
+    }
+
+    std::cout << opt.events << " events at " << opt.rate_hz << " Hz over loopback TCP, "
+              << complete << " with every stamp\n";
+    if (!kernel) {
+        std::cout << "No kernel timestamps on this system: the stack and the wire are reported together\n";
+    }
+    for (const auto& p : portions) {
+        HistogramSnapshot s = p->histogram.snapshot();
+        std::cout << std::left << std::setw(16) << p->name
+                  << " p50 " << std::setw(6) << s.percentile(50)
+                  << " p99 " << std::setw(6) << s.percentile(99)
+                  << " mean " << std::fixed << std::setprecision(1) << (complete ? double(p->sum) / complete : 0.0)
+                  << " us\n";
+    }
+    return 0;
+}
+
+// ============================================================================
+// backlog: a link slower than the input, with and without the send cap
+// ============================================================================
+
+// Motion through an OutboundQueue to a receiver that drains at half the
+// rate it is produced, like a slow link. Its receive buffer is small, so
+// the backlog builds on the sending side, in the kernel or in the queue.
+static void bench_backlog_run(const BenchOptions& opt, const char* name, bool limited) {
+    Socket listener;
+    listener.create();
+    listener.bind(0);
+    listener.listen(1);
+
+    sockaddr_in addr{};
+    int addr_len = sizeof(addr);
+    getsockname(listener.handle(), reinterpret_cast<sockaddr*>(&addr), &addr_len);
+
+    Socket receiver;
+    receiver.create();
+    int receive_buffer = 4096;
+    setsockopt(receiver.handle(), SOL_SOCKET, SO_RCVBUF, (char*)&receive_buffer, sizeof(receive_buffer));
+    receiver.set_receive_batching(false);
+    receiver.connect("127.0.0.1", ntohs(addr.sin_port));
+    Socket sender = listener.accept();
+    if (limited) {
+        sender.limit_send_backlog();
+    }
+
+    size_t frame_bytes = serialize_packet(EventType::MOUSE_MOVE, MouseMoveEvent{}).size();
+    double us_per_byte = 2e6 / (double((std::max)(1, opt.rate_hz)) * frame_bytes);
+
+    // MOUSE_MOVE.x carries the event index; a merged move, the newest one's
+    std::vector<std::atomic<uint64_t>> sent_us(opt.events);
+    LatencyHistogram latency;
+    int delivered = 0;
+    std::thread reader([&] {
+        std::string frame;
+        double link_free_us = double(get_timestamp_us());
+        while (true) {
+            if (!receiver.wait_readable(100)) {
+                continue;
+            }
+            if (!receiver.recv_frame(frame)) {
+                break;
+            }
+            uint64_t now = get_timestamp_us();
+            MouseMoveEvent move;
+            std::memcpy(&move, frame.data() + sizeof(PacketHeader), sizeof(move));
+            if (move.x >= 0 && move.x < opt.events) {
+                latency.record(now - sent_us[move.x].load(std::memory_order_relaxed));
+                delivered++;
+            }
+
+            link_free_us = (std::max)(link_free_us, double(now)) + frame.size() * us_per_byte;
+            while (double(get_timestamp_us()) < link_free_us) {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    OutboundQueue queue([&](const std::vector<std::string>& frames) {
+        return sender.send_frames(frames) > 0;
+    });
+    queue.start();
+    QueueDepth most_queued;
+    int most_unsent = -1;
+    pace_events(opt, [&](int i) {
+        MouseMoveEvent move = {i, 0, 1, 0};
+        sent_us[i].store(get_timestamp_us(), std::memory_order_relaxed);
+        queue.push(serialize_packet(EventType::MOUSE_MOVE, move));
+
+        QueueDepth depth = queue.depth();
+        most_queued.bytes = (std::max)(most_queued.bytes, depth.bytes);
+        most_queued.age_us = (std::max)(most_queued.age_us, depth.age_us);
+        most_unsent = (std::max)(most_unsent, sender.unsent_bytes());
+    });
+    queue.stop();
+    sender.close();
+    reader.join();
+
+    HistogramSnapshot h = latency.snapshot();
+    std::cout << std::left << std::setw(10) << name
+              << " latency us p50 " << std::setw(8) << h.percentile(50)
+              << " p99 " << std::setw(8) << h.percentile(99)
+              << " delivered " << delivered << "/" << opt.events
+              << "  queued max " << most_queued.bytes << " bytes, " << most_queued.age_us << " us";
+    if (most_unsent >= 0) {
+        std::cout << "  kernel unsent max " << most_unsent << " bytes";
+    }
+    std::cout << "\n";
+}
+
+static int bench_backlog(const BenchOptions& opt) {
+    std::cout << opt.events << " moves at " << opt.rate_hz << " Hz over a link half as fast (loopback TCP)\n";
+    bench_backlog_run(opt, "uncapped", false);
+    bench_backlog_run(opt, "capped", true);
+    return 0;
+}
+
+// ============================================================================
+// gather: send calls and latency at different gather windows
+// ============================================================================
+
+// Moves at the event rate through an OutboundQueue over loopback TCP, once
+// for each window send_batching.hpp can pick
+static int bench_gather(const BenchOptions& opt) {
+    Socket listener;
+    listener.create();
+    listener.bind(0);
+    listener.listen(1);
+
+    sockaddr_in addr{};
+    int addr_len = sizeof(addr);
+    getsockname(listener.handle(), reinterpret_cast<sockaddr*>(&addr), &addr_len);
+
+    Socket receiver;
+    receiver.create();
+    receiver.connect("127.0.0.1", ntohs(addr.sin_port));
+    Socket sender = listener.accept();
+
+    std::cout << opt.events << " moves at " << opt.rate_hz << " Hz over loopback TCP\n";
+    const uint64_t windows[] = {0, 250, 1000, MAX_GATHER_US};
+    for (uint64_t window : windows) {
+        std::vector<std::atomic<uint64_t>> sent_us(opt.events);
+        LatencyHistogram latency;
+        std::thread reader([&] {
+            std::string frame;
+            while (true) {
+                if (!receiver.wait_readable(100)) {
+                    continue;
+                }
+                if (!receiver.recv_frame(frame)) {
+                    break;
+                }
+                MouseMoveEvent move;
+                std::memcpy(&move, frame.data() + sizeof(PacketHeader), sizeof(move));
+                if (move.x >= 0 && move.x < opt.events) {
+                    latency.record(get_timestamp_us() - sent_us[move.x].load(std::memory_order_relaxed));
+                }
+                if (move.x == opt.events - 1) {
+                    break;
+                }
+            }
+        });
+
+        OutboundQueue queue([&](const std::vector<std::string>& frames) {
+            return sender.send_frames(frames) > 0;
+        });
+        queue.set_gather_window(window);
+        queue.start();
+        MetricsSnapshot before = g_metrics.snapshot();
+        pace_events(opt, [&](int i) {
+            MouseMoveEvent move = {i, 0, 1, 0};
+            sent_us[i].store(get_timestamp_us(), std::memory_order_relaxed);
+            queue.push(serialize_packet(EventType::MOUSE_MOVE, move));
+        });
+        reader.join();
+        MetricsSnapshot after = g_metrics.snapshot();
+        queue.stop();
+
+        HistogramSnapshot h = latency.snapshot();
+        HistogramSnapshot batches = queue.take_batch_sizes();
+        uint64_t send_calls = after.counters[static_cast<int>(Counter::SEND_CALLS)] -
+                              before.counters[static_cast<int>(Counter::SEND_CALLS)];
+        std::cout << "window " << std::left << std::setw(6) << window << " us"
+                  << "  send calls " << std::setw(6) << send_calls
+                  << "  frames per send p50 " << std::setw(4) << batches.percentile(50)
+                  << " max " << std::setw(4) << batches.max
+                  << "  latency us p50 " << std::setw(6) << h.percentile(50)
+                  << " p99 " << h.percentile(99) << "\n";
+    }
+    return 0;
+}
+
+// ============================================================================
+// predict: how far client-side pointer prediction strays from the real path
+// ============================================================================
+
+// The pointer as the server saw it: a move to (x, y), or a button
+struct PointerTrack {
+    uint64_t us;
+    double x;
+    double y;
+    int button;   // -1 a move, 0 a release, 1 a press
+};
+
+// MOUSE_MOVE and MOUSE_BUTTON records of a recording. While the client has
+// input, the server's own cursor is held still, so the path is the sum of
+// the deltas, as the client applies them.
+static bool load_recorded_track(const std::string& path, std::vector<PointerTrack>& track) {
+    SessionReplay replay;
+    if (!replay.open(path)) {
+        return false;
+    }
+    uint64_t us = 0;
+    double x = 0, y = 0;
+    for (size_t i = 0; i < replay.size(); i++) {
+        const InputRecord& record = replay[i];
+        us += record.delta_us;
+        if (record.type == EventType::MOUSE_MOVE) {
+            MouseMoveEvent move = SessionReplay::payload<MouseMoveEvent>(record);
+            x += move.dx;
+            y += move.dy;
+            track.push_back({us, x, y, -1});
+        } else if (record.type == EventType::MOUSE_BUTTON) {
+            MouseButtonEvent button = SessionReplay::payload<MouseButtonEvent>(record);
+            track.push_back({us, x, y, button.pressed ? 1 : 0});
+        }
+    }
+    return true;
+}
+
+// Synthetic strokes at the event rate: 300 ms to a random point up to 400
+// px away with a smooth (minimum jerk) speed profile, a click on every
+// other one, then 150 ms still
+static void make_synthetic_track(const BenchOptions& opt, std::vector<PointerTrack>& track) {
+    Lcg rng;
+    uint64_t interval = 1000000 / (std::max)(1, opt.rate_hz);
+    uint64_t us = 0;
+    double x = 0, y = 0;
+    for (int stroke = 0; static_cast<int>(track.size()) < opt.events; stroke++) {
+        double angle = (rng.next() % 6283) / 1000.0;
+        double distance = 50 + rng.next() % 350;
+        double from_x = x, from_y = y;
+        int steps = static_cast<int>(300000 / interval);
+        for (int i = 1; i <= steps; i++) {
+            double s = double(i) / steps;
+            double progress = s * s * s * (10 - 15 * s + 6 * s * s);
+            us += interval;
+            x = std::round(from_x + distance * progress * std::cos(angle));
+            y = std::round(from_y + distance * progress * std::sin(angle));
+            track.push_back({us, x, y, -1});
+        }
+        if (stroke % 2 == 1) {
+            track.push_back({us + 50000, x, y, 1});
+            track.push_back({us + 120000, x, y, 0});
+        }
+        us += 150000;
+    }
+}
+
+struct PredictionError {
+    std::vector<double> px;   // one sample per millisecond of motion
+};
+
+// Replay the track as a client a one-way latency away would receive it,
+// and compare the cursor it shows each millisecond with where the server's
+// cursor is at that moment
+static PredictionError evaluate_prediction(const std::vector<PointerTrack>& track, uint64_t latency_us,
+                                           uint64_t lead_us) {
+    PredictionError result;
+    PointerPredictor predictor(lead_us);
+    size_t arrived = 0;   // track entries the client has
+    size_t now_index = 0; // track entries that have happened
+    double truth_x = 0, truth_y = 0, shown_x = 0, shown_y = 0;
+    uint64_t last_move_us = 0;
+    bool any = false;
+
+    uint64_t end = track.back().us + latency_us + 200000;
+    for (uint64_t t = track.front().us; t <= end; t += 1000) {
+        while (now_index < track.size() && track[now_index].us <= t) {
+            truth_x = track[now_index].x;
+            truth_y = track[now_index].y;
+            if (track[now_index].button < 0) last_move_us = track[now_index].us;
+            now_index++;
+        }
+        while (arrived < track.size() && track[arrived].us + latency_us <= t) {
+            const PointerTrack& p = track[arrived++];
+            if (p.button < 0) {
+                predictor.on_move(t, p.x, p.y);
+                any = true;
+            } else {
+                predictor.on_button(t, p.button == 1);
+            }
+        }
+        if (!any) continue;
+
+        predictor.position(t, shown_x, shown_y);
+        // Motion and the settling after it; a still cursor says nothing
+        if (t - last_move_us <= latency_us + 100000) {
+            result.px.push_back(std::hypot(shown_x - truth_x, shown_y - truth_y));
+        }
+    }
+    std::sort(result.px.begin(), result.px.end());
+    return result;
+}
+
+static std::string describe_error(const PredictionError& e) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    if (e.px.empty()) {
+        out << "no samples";
+        return out.str();
+    }
+    double sum = 0;
+    for (double px : e.px) sum += px;
+    auto at = [&](double pct) { return e.px[static_cast<size_t>(pct / 100 * (e.px.size() - 1))]; };
+    out << "mean " << std::setw(6) << sum / e.px.size() << "  p50 " << std::setw(6) << at(50)
+        << "  p99 " << std::setw(6) << at(99) << "  max " << std::setw(6) << e.px.back();
+    return out.str();
+}
+
+static int bench_predict(const BenchOptions& opt) {
+    std::vector<PointerTrack> track;
+    if (!opt.file.empty()) {
+        if (!load_recorded_track(opt.file, track)) {
+            return 1;
+        }
+    } else {
+        make_synthetic_track(opt, track);
+    }
+    if (track.empty()) {
+        std::cerr << "No mouse motion to replay\n";
+        return 1;
+    }
+
+    std::cout << track.size() << " pointer events ("
+              << (opt.file.empty() ? "synthetic strokes at " + std::to_string(opt.rate_hz) + " Hz" : opt.file)
+              << "); distance in px from the server's cursor, each ms of motion\n";
+    const uint64_t latencies_ms[] = {5, 10, 20, 40};
+    for (uint64_t ms : latencies_ms) {
+        std::cout << "latency " << std::setw(3) << ms << " ms  as received  " << describe_error(evaluate_prediction(track, ms * 1000, 0)) << "\n"
+                  << "                predicted    " << describe_error(evaluate_prediction(track, ms * 1000, ms * 1000)) << "\n";
+    }
+    return 0;
+}
+
+// ============================================================================
+// Main
+// ============================================================================
+
+void print_usage(const char* program) {
+    std::cout << "Usage: " << program << " <benchmark> [options]\n"
+              << "Benchmarks:\n"
+              << "  multicast            Reliable multicast vs per-client TCP fan-out (loopback)\n"
+              << "  trace                Cost per trace call: off, flight recorder, tracing\n"
+              << "  replay               A recorded session over loopback TCP, with delivery latency\n"
+              << "  compress             Transfer compression ratio and speed on clipboard-like data\n"
+              << "  secure               Latency added by encryption at the event rate, and seal/open cost\n"
+              << "  reconnect            Time to the first input event after a cold and a resumed connect\n"
+              << "  shm                  Event latency and CPU: shared memory rings vs loopback TCP\n"
+              << "  recv                 Receive system calls and CPU: batched vs one recv per header and payload\n"
+              << "  latency              Event latency split into app, stack and wire time (kernel timestamps)\n"
+              << "  backlog              Motion latency over a link slower than the input, with and without the send cap\n"
+              << "  gather               Send calls and latency with each send batching window\n"
+              << "  predict              How far client pointer prediction strays from the real path (offline)\n"
+              << "Options:\n"
+              << "  -c, --clients N      Number of receivers (default: 8)\n"
+              << "  -n, --events N       Number of events to send (default: 5000)\n"
+              << "  -r, --rate HZ        Event rate (default: 1000)\n"
+              << "  -l, --loss PCT       Simulated datagram loss in percent (default: 0)\n"
+              << "  -f, --file FILE      Recording to replay, or a file to add to the compress corpora\n"
+              << "  -s, --speed X        Replay speed: 1 original timing, 0 no delays (default: 0)\n"
+              << "      --rtt MS         Round trip time the reconnect benchmark simulates (default: 20)\n"
+              << "  -h, --help           Show this help\n";
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    std::string benchmark = argv[1];
+    BenchOptions opt;
+
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "-h" || arg == "--help") {
+            print_usage(argv[0]);
+            return 0;
+        } else if ((arg == "-c" || arg == "--clients") && i + 1 < argc) {
+            opt.clients = std::stoi(argv[++i]);
+        } else if ((arg == "-n" || arg == "--events") && i + 1 < argc) {
+            opt.events = std::stoi(argv[++i]);
+        } else if ((arg == "-r" || arg == "--rate") && i + 1 < argc) {
+            opt.rate_hz = std::stoi(argv[++i]);
+        } else if ((arg == "-l" || arg == "--loss") && i + 1 < argc) {
+            opt.loss = std::stod(argv[++i]) / 100.0;
+        } else if ((arg == "-f" || arg == "--file") && i + 1 < argc) {
+            opt.file = argv[++i];
+        } else if ((arg == "-s" || arg == "--speed") && i + 1 < argc) {
+            opt.speed = std::stod(argv[++i]);
+        } else if (arg == "--rtt" && i + 1 < argc) {
+            opt.rtt_ms = (std::max)(1, std::stoi(argv[++i]));
+        }
+    }
+
+    // Initialize Winsock
+    if (!init_winsock()) {
+        std::cerr << "Failed to initialize Winsock\n";
+        return 1;
+    }
+
+    int result = 1;
+    try {
+        if (benchmark == "multicast") {
+            result = bench_multicast(opt);
+        } else if (benchmark == "trace") {
+            result = bench_trace(opt);
+        } else if (benchmark == "replay") {
+            result = bench_replay(opt);
+        } else if (benchmark == "compress") {
+            result = bench_compress(opt);
+        } else if (benchmark == "secure") {
+            result = bench_secure(opt);
+        } else if (benchmark == "reconnect") {
+            result = bench_reconnect(opt);
+        } else if (benchmark == "shm") {
+            result = bench_shm(opt);
+        } else if (benchmark == "recv") {
+            result = bench_recv(opt);
+        } else if (benchmark == "latency") {
+            result = bench_latency(opt);
+        } else if (benchmark == "backlog") {
+            result = bench_backlog(opt);
+        } else if (benchmark == "gather") {
+            result = bench_gather(opt);
+        } else if (benchmark == "predict") {
+            result = bench_predict(opt);
+        } else {
+            std::cerr << "Unknown benchmark: " << benchmark << "\n";
+            print_usage(argv[0]);
+        }
+    } catch (const NetworkError& e) {
+        std::cerr << "Benchmark failed: " << e.what() << "\n";
+    } catch (const CryptoError& e) {
+        std::cerr << "Benchmark failed: " << e.what() << "\n";
+    }
+
+    cleanup_winsock();
+    return result;
+}
@@ -52,10 +52,18 @@ if exist Release\mouse-share-gui.exe (
     echo   - Release\mouse-share-gui.exe [GUI - Recommended]
     echo   - Release\mouse-share-server.exe
     echo   - Release\mouse-share-client.exe
+    echo   - Release\mouse-share-relay.exe
+    echo   - Release\mouse-share-bench.exe
+    echo   - Release\mouse-share-flight.exe
+    echo   - Release\mouse-share-netem.exe
 ) else if exist mouse-share-gui.exe (
     echo   - mouse-share-gui.exe [GUI - Recommended]
     echo   - mouse-share-server.exe
     echo   - mouse-share-client.exe
+    echo   - mouse-share-relay.exe
+    echo   - mouse-share-bench.exe
+    echo   - mouse-share-flight.exe
+    echo   - mouse-share-netem.exe
 )
 echo.
 pause
@@ -0,0 +1,535 @@
+#pragma once
+
+#include "common.hpp"
+#include "compression.hpp"
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <iostream>
+
+namespace MouseShare {
+
+constexpr uint32_t CHANNEL_CHUNK_BYTES = 16384;          // content bytes per CHANNEL_DATA frame, before compression
+constexpr uint64_t CHANNEL_WINDOW_BYTES = 128 * 1024;    // credit granted ahead of what has arrived
+constexpr size_t CHANNEL_MAX_NAME = 255;
+constexpr size_t CHANNEL_MAX_OUTGOING = 64;
+// Undecoded transfer frames waiting for the receive thread. A peer that
+// keeps to its credit stays under a window per transfer it may have open.
+constexpr size_t CHANNEL_MAX_INBOX_BYTES = 2 * CHANNEL_MAX_OUTGOING * CHANNEL_WINDOW_BYTES;
+
+// Bytes to send. keep owns them (a string, a MappedFile) for as long as
+// the transfer may still need them.
+struct ChannelSource {
+    const char* data = nullptr;
+    uint64_t size = 0;
+    std::shared_ptr<const void> keep;
+};
+
+inline ChannelSource source_of(std::shared_ptr<const std::string> content) {
+    ChannelSource source;
+    source.data = content->data();
+    source.size = content->size();
+    source.keep = std::move(content);
+    return source;
+}
+
+// Where an incoming transfer goes; made by the acceptor for its kind.
+// Only ever used on the ChannelMux receive thread.
+class ChannelSink {
+public:
+    virtual ~ChannelSink() = default;
+
+    // Bytes already held from an interrupted attempt; the sender resumes there
+    virtual uint64_t resume_offset() { return 0; }
+
+    virtual bool write(const char* data, size_t size) = 0;
+
+    // Every byte arrived: check it against the hash and keep it
+    virtual bool finish() = 0;
+
+    // The connection went away first
+    virtual void abandon() {}
+};
+
+// Multiplexes bulk transfers (paste content, dropped files) over the
+// input connection. Each transfer is cut into CHANNEL_CHUNK_BYTES frames
+// and the receiver hands out credit, at most CHANNEL_WINDOW_BYTES beyond
+// what it has taken in. So however large the transfer, no more than one
+// window of it is ever queued or in flight ahead of the next keystroke,
+// and the outbound queue sends those frames only when no input waits.
+// A chunk past the credit fails its transfer, and so does one that finds
+// the receive queue full (CHANNEL_MAX_INBOX_BYTES).
+//
+// A sender thread interleaves chunks of all open transfers, compressing
+// them when that pays (see ChunkCompressor); a receive thread decodes them
+// and feeds the sinks. So neither the input hooks nor the thread reading
+// the connection ever spends time on compression or disk writes.
+//
+// Resumable transfers outlive the connection: after connected() they are
+// opened again and the receiver's first credit says where to pick up.
+//
+// handle_frame(), connected() and disconnected() must be called from the
+// thread that reads the connection.
+class ChannelMux {
+public:
+    // Sends one whole frame to the peer
+    using SendFn = std::function<bool(std::string frame)>;
+
+    // Decides on an incoming transfer: a sink, or nullptr to refuse it
+    using AcceptFn = std::function<std::unique_ptr<ChannelSink>(const ChannelOpen& open, const std::string& name)>;
+
+    explicit ChannelMux(SendFn send) : send_(std::move(send)) {}
+
+    ~ChannelMux() {
+        stop();
+    }
+
+    ChannelMux(const ChannelMux&) = delete;
+    ChannelMux& operator=(const ChannelMux&) = delete;
+
+    // Before start()
+    void set_acceptor(ChannelKind kind, AcceptFn accept) {
+        acceptors_[kind] = std::move(accept);
+    }
+
+    void start() {
+        if (running_) return;
+        running_ = true;
+        sender_thread_ = std::thread(&ChannelMux::sender_thread_func, this);
+        receive_thread_ = std::thread(&ChannelMux::receive_thread_func, this);
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::lock_guard<std::mutex> inbox_lock(inbox_mutex_);
+            running_ = false;
+        }
+        cv_.notify_all();
+        inbox_cv_.notify_all();
+        if (sender_thread_.joinable()) {
+            sender_thread_.join();
+        }
+        if (receive_thread_.joinable()) {
+            receive_thread_.join();
+        }
+    }
+
+    // Start sending source to the peer (any thread). A resumable transfer
+    // waits for a connection and survives reconnects until it is done.
+    bool send(ChannelKind kind, const ContentHash& hash, ChannelSource source,
+              const std::string& name = "", bool resumable = false) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!resumable && !connected_) return false;
+        if (outgoing_.size() >= CHANNEL_MAX_OUTGOING) {
+            std::cerr << "Too many transfers in progress\n";
+            return false;
+        }
+
+        // Channel numbers wrap; skip any still in use
+        uint16_t channel = next_channel_++;
+        while (outgoing_.count(channel)) {
+            channel = next_channel_++;
+        }
+
+        Outgoing& out = outgoing_[channel];
+        out.open.channel = channel;
+        out.open.kind = kind;
+        out.open.total = source.size;
+        out.open.hash = hash;
+        out.name = name.substr(0, CHANNEL_MAX_NAME);
+        out.compress = should_compress(source.data, static_cast<size_t>(source.size), name);
+        out.source = std::move(source);
+        out.resumable = resumable;
+        cv_.notify_all();
+        return true;
+    }
+
+    // Consume a transfer frame from the peer. Returns false for frames
+    // that aren't transfer traffic.
+    bool handle_frame(EventType type, const char* data, size_t size) {
+        switch (type) {
+            case EventType::CHANNEL_OPEN:
+            case EventType::CHANNEL_DATA:
+                // Decoded and written on the receive thread
+                if (size >= sizeof(uint16_t)) {
+                    uint16_t channel;
+                    std::memcpy(&channel, data, sizeof(channel));
+                    std::lock_guard<std::mutex> lock(inbox_mutex_);
+                    queue_inbound(type, channel, data, size);
+                }
+                inbox_cv_.notify_one();
+                return true;
+            case EventType::CHANNEL_CREDIT:
+                if (size >= sizeof(ChannelCredit)) {
+                    ChannelCredit credit;
+                    std::memcpy(&credit, data, sizeof(credit));
+                    receive_credit(credit);
+                }
+                return true;
+            case EventType::CHANNEL_CLOSE:
+                if (size >= sizeof(ChannelClose)) {
+                    ChannelClose close;
+                    std::memcpy(&close, data, sizeof(close));
+                    receive_close(close);
+                }
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // A peer is there: open (or reopen) every waiting transfer
+    void connected() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            connected_ = true;
+        }
+        cv_.notify_all();
+    }
+
+    // The peer is gone. Incoming transfers are abandoned; outgoing ones are
+    // dropped unless resumable, in which case they wait to be reopened.
+    void disconnected() {
+        {
+            // After whatever the old connection delivered
+            std::lock_guard<std::mutex> lock(inbox_mutex_);
+            inbox_.push_back({EventType::KEEPALIVE, std::string(), 0, true});
+        }
+        inbox_cv_.notify_one();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        connected_ = false;
+        for (auto it = outgoing_.begin(); it != outgoing_.end();) {
+            Outgoing& out = it->second;
+            if (!out.resumable) {
+                it = outgoing_.erase(it);
+                continue;
+            }
+            out.opened = false;
+            out.credited = false;
+            out.limit = 0;
+            out.compressor.reset();
+            ++it;
+        }
+    }
+
+    // Outgoing transfers not yet confirmed by the peer
+    size_t outgoing() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return outgoing_.size();
+    }
+
+private:
+    struct Outgoing {
+        ChannelOpen open = {};
+        std::string name;
+        ChannelSource source;
+        bool resumable = false;
+        bool compress = false;  // looked compressible when it was queued
+        bool opened = false;    // CHANNEL_OPEN sent on this connection
+        bool credited = false;  // first credit received: next is valid
+        uint64_t next = 0;
+        uint64_t limit = 0;
+        std::shared_ptr<ChunkCompressor> compressor;  // this connection's stream; sender thread only
+    };
+
+    struct Incoming {
+        std::unique_ptr<ChannelSink> sink;
+        uint64_t total = 0;
+        uint64_t next = 0;
+        uint64_t limit = 0;
+        LzDecoder decoder;
+    };
+
+    // A frame for the receive thread, the news that the connection is
+    // gone, or that a channel's frames no longer fit in the inbox
+    struct Inbound {
+        EventType type;
+        std::string payload;
+        uint16_t channel = 0;
+        bool disconnect = false;
+        bool overflow = false;
+    };
+
+    // One chunk (or open) picked under the lock, encoded and sent outside it
+    struct Pending {
+        std::string frame;                     // ready to go (CHANNEL_OPEN)
+        ChannelDataHeader chunk = {};
+        ChannelSource source;
+        std::shared_ptr<ChunkCompressor> compressor;
+    };
+
+    // ------------------------------------------------------------------
+    // Receiving side (receive thread)
+    // ------------------------------------------------------------------
+
+    // Under inbox_mutex_. A channel whose frame would take the inbox past
+    // CHANNEL_MAX_INBOX_BYTES has overrun its credit: its frames are dropped
+    // from then on and the receive thread fails it, in order.
+    void queue_inbound(EventType type, uint16_t channel, const char* data, size_t size) {
+        if (overflowed_.count(channel)) return;
+        if (inbox_bytes_ + size > CHANNEL_MAX_INBOX_BYTES) {
+            overflowed_.insert(channel);
+            inbox_.push_back({type, std::string(), channel, false, true});
+            return;
+        }
+        inbox_bytes_ += size;
+        inbox_.push_back({type, std::string(data, size), channel});
+    }
+
+    void receive_thread_func() {
+        std::unique_lock<std::mutex> lock(inbox_mutex_);
+        while (true) {
+            inbox_cv_.wait(lock, [this] { return !running_ || !inbox_.empty(); });
+            if (!running_) break;
+
+            Inbound item = std::move(inbox_.front());
+            inbox_.pop_front();
+            inbox_bytes_ -= item.payload.size();
+            if (item.overflow) overflowed_.erase(item.channel);
+            lock.unlock();
+
+            const char* data = item.payload.data();
+            size_t size = item.payload.size();
+            if (item.disconnect) {
+                abandon_incoming();
+            } else if (item.overflow) {
+                fail_incoming(item.channel);
+            } else if (item.type == EventType::CHANNEL_OPEN && size >= sizeof(ChannelOpen)) {
+                ChannelOpen open;
+                std::memcpy(&open, data, sizeof(open));
+                receive_open(open, std::string(data + sizeof(open), size - sizeof(open)));
+            } else if (item.type == EventType::CHANNEL_DATA && size >= sizeof(ChannelDataHeader)) {
+                ChannelDataHeader chunk;
+                std::memcpy(&chunk, data, sizeof(chunk));
+                receive_data(chunk, data + sizeof(chunk), size - sizeof(chunk));
+            }
+
+            lock.lock();
+        }
+        lock.unlock();
+        abandon_incoming();
+    }
+
+    void fail_incoming(uint16_t channel) {
+        auto found = incoming_.find(channel);
+        if (found != incoming_.end()) {
+            found->second.sink->abandon();
+            incoming_.erase(found);
+        }
+        close_incoming(channel, ChannelStatus::FAILED);
+    }
+
+    void abandon_incoming() {
+        for (auto& entry : incoming_) {
+            entry.second.sink->abandon();
+        }
+        incoming_.clear();
+    }
+
+    void receive_open(const ChannelOpen& open, const std::string& name) {
+        auto previous = incoming_.find(open.channel);
+        if (previous != incoming_.end()) {
+            previous->second.sink->abandon();
+            incoming_.erase(previous);
+        }
+
+        std::unique_ptr<ChannelSink> sink;
+        auto acceptor = acceptors_.find(open.kind);
+        if (acceptor != acceptors_.end()) {
+            sink = acceptor->second(open, name.substr(0, CHANNEL_MAX_NAME));
+        }
+        if (!sink) {
+            close_incoming(open.channel, ChannelStatus::REJECTED);
+            return;
+        }
+
+        uint64_t total = open.total;  // packed: no references to it
+        uint64_t start = (std::min)(sink->resume_offset(), total);
+        if (start == total) {
+            close_incoming(open.channel, sink->finish() ? ChannelStatus::DONE : ChannelStatus::FAILED);
+            return;
+        }
+
+        Incoming& in = incoming_[open.channel];
+        in.sink = std::move(sink);
+        in.total = total;
+        in.next = start;
+        in.limit = start + CHANNEL_WINDOW_BYTES;
+        send_(serialize_packet(EventType::CHANNEL_CREDIT, ChannelCredit{open.channel, in.next, in.limit}));
+    }
+
+    void receive_data(const ChannelDataHeader& chunk, const char* bytes, size_t size) {
+        auto found = incoming_.find(chunk.channel);
+        if (found == incoming_.end()) return;  // refused, or left over from a closed channel
+
+        Incoming& in = found->second;
+        size_t raw_size = chunk.size;
+        bool decoded = false;
+        // In order, within the transfer, and within the credit we granted
+        if (chunk.offset == in.next && raw_size <= in.total - in.next && raw_size <= in.limit - in.next) {
+            if (chunk.encoding == ChunkEncoding::LZ) {
+                decoded = in.decoder.decode(bytes, size, raw_size);
+            } else if (chunk.encoding == ChunkEncoding::RAW && size == raw_size) {
+                in.decoder.append(bytes, size);
+                decoded = true;
+            }
+        }
+        if (!decoded || !in.sink->write(in.decoder.data(), in.decoder.size())) {
+            fail_incoming(chunk.channel);
+            return;
+        }
+        in.next += raw_size;
+
+        if (in.next == in.total) {
+            bool ok = in.sink->finish();
+            incoming_.erase(found);
+            close_incoming(chunk.channel, ok ? ChannelStatus::DONE : ChannelStatus::FAILED);
+            return;
+        }
+
+        // Top the window up once half of it has been used
+        if (in.limit - in.next <= CHANNEL_WINDOW_BYTES / 2) {
+            in.limit = in.next + CHANNEL_WINDOW_BYTES;
+            send_(serialize_packet(EventType::CHANNEL_CREDIT, ChannelCredit{chunk.channel, in.next, in.limit}));
+        }
+    }
+
+    void close_incoming(uint16_t channel, ChannelStatus status) {
+        send_(serialize_packet(EventType::CHANNEL_CLOSE, ChannelClose{channel, status}));
+    }
+
+    // ------------------------------------------------------------------
+    // Sending side
+    // ------------------------------------------------------------------
+
+    void receive_credit(const ChannelCredit& credit) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto found = outgoing_.find(credit.channel);
+            if (found == outgoing_.end() || !found->second.opened) return;
+
+            Outgoing& out = found->second;
+            uint64_t offset = credit.offset;
+            uint64_t limit = credit.limit;
+            uint64_t total = out.open.total;
+            if (!out.credited) {
+                // A new stream starts here: compression can't refer back
+                // to anything the receiver didn't get on this connection
+                out.next = (std::min)(offset, total);
+                out.credited = true;
+                out.compressor = std::make_shared<ChunkCompressor>(out.source.data, out.compress);
+            }
+            out.limit = (std::max)(out.limit, limit);
+        }
+        cv_.notify_all();
+    }
+
+    void receive_close(const ChannelClose& close) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = outgoing_.find(close.channel);
+        if (found == outgoing_.end()) return;
+
+        if (close.status == ChannelStatus::FAILED) {
+            std::cerr << "Transfer" << (found->second.name.empty() ? "" : " of " + found->second.name)
+                      << " failed on the receiving side\n";
+        }
+        outgoing_.erase(found);
+    }
+
+    // Something to send right now, under mutex_
+    bool has_work() const {
+        if (!connected_) return false;
+        for (const auto& entry : outgoing_) {
+            const Outgoing& out = entry.second;
+            if (!out.opened) return true;
+            if (out.credited && out.next < out.limit && out.next < out.open.total) return true;
+        }
+        return false;
+    }
+
+    // Each pass opens whatever needs opening and sends at most one chunk
+    // per transfer, so concurrent transfers share the link evenly
+    void sender_thread_func() {
+        std::string encoded;
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            cv_.wait(lock, [this] { return !running_ || has_work(); });
+            if (!running_) break;
+
+            std::vector<Pending> pending;
+            for (auto& entry : outgoing_) {
+                Outgoing& out = entry.second;
+                if (!out.opened) {
+                    Pending open;
+                    open.frame = serialize_packet(EventType::CHANNEL_OPEN, out.open, out.name.data(), out.name.size());
+                    pending.push_back(std::move(open));
+                    out.opened = true;
+                    continue;
+                }
+                if (!out.credited || out.next >= out.limit || out.next >= out.open.total) continue;
+
+                uint64_t n = (std::min)({uint64_t(CHANNEL_CHUNK_BYTES), out.limit - out.next,
+                                         out.open.total - out.next});
+                Pending chunk;
+                chunk.chunk = {out.open.channel, out.next, static_cast<uint16_t>(n), ChunkEncoding::RAW};
+                chunk.source = out.source;
+                chunk.compressor = out.compressor;
+                pending.push_back(std::move(chunk));
+                out.next += n;
+            }
+
+            // Compressing takes time and sending may block on the socket;
+            // neither with the lock held
+            lock.unlock();
+            for (auto& item : pending) {
+                if (item.frame.empty()) {
+                    uint64_t offset = item.chunk.offset;
+                    size_t n = item.chunk.size;
+                    const char* raw = item.source.data + offset;
+                    item.chunk.encoding = item.compressor->encode(offset, n, encoded);
+                    item.frame = item.chunk.encoding == ChunkEncoding::LZ
+                        ? serialize_packet(EventType::CHANNEL_DATA, item.chunk, encoded.data(), encoded.size())
+                        : serialize_packet(EventType::CHANNEL_DATA, item.chunk, raw, n);
+                    g_metrics.count(Counter::TRANSFER_CONTENT_BYTES, n);
+                }
+                size_t bytes = item.frame.size();
+                if (!send_(std::move(item.frame))) break;
+                g_metrics.count(Counter::TRANSFER_BYTES, bytes);
+            }
+            pending.clear();
+            lock.lock();
+        }
+    }
+
+    SendFn send_;
+    std::map<ChannelKind, AcceptFn> acceptors_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::atomic<bool> running_{false};
+    bool connected_ = false;
+    std::map<uint16_t, Outgoing> outgoing_;
+    uint16_t next_channel_ = 1;
+    std::thread sender_thread_;
+
+    std::mutex inbox_mutex_;
+    std::condition_variable inbox_cv_;
+    std::deque<Inbound> inbox_;
+    size_t inbox_bytes_ = 0;
+    std::set<uint16_t> overflowed_;         // failing; their frames are dropped
+    std::map<uint16_t, Incoming> incoming_;  // receive thread only
+    std::thread receive_thread_;
+};
+
+} // namespace MouseShare
@@ -1,20 +1,41 @@
 #include "common.hpp"
 #include "network.hpp"
+#include "metrics_reporter.hpp"
 #include "input_simulator.hpp"
+#include "multicast.hpp"
+#include "session.hpp"
+#include "send_batching.hpp"
+#include "key_repeat.hpp"
+#include "pointer_prediction.hpp"
+#include "clipboard.hpp"
+#include "file_transfer.hpp"
 #include <iostream>
 #include <atomic>
 #include <thread>
 #include <chrono>
 #include <vector>
 #include <algorithm>
+#include <mutex>
 
 using namespace MouseShare;
 
 std::atomic<bool> g_running{true};
+std::string g_trace_path;
 
 BOOL WINAPI console_handler(DWORD signal) {
     if (signal == CTRL_C_EVENT || signal == CTRL_CLOSE_EVENT) {
         g_running = false;
+        
+        // The main thread may be blocked; write the trace from here. If main
+        // gets there first, this waits for it and writes nothing.
+        if (!g_trace_path.empty() && g_tracer.write_chrome_trace_once(g_trace_path)) {
+            std::cout << "Trace written to " << g_trace_path << "\n";
+        }
+        return TRUE;
+    }
+    if (signal == CTRL_BREAK_EVENT) {
+        // Ctrl+Break: save the flight recorder's last seconds
+        g_flight.trigger(true);
         return TRUE;
     }
     return FALSE;
@@ -23,7 +44,31 @@ BOOL WINAPI console_handler(DWORD signal) {
 class Client {
 public:
     Client(const std::string& server_host, uint16_t port)
-        : server_host_(server_host), port_(port), active_(false) {}
+        : server_host_(server_host), port_(port), active_(false),
+          repeater_(dispatch_mutex_, [this](const KeyEvent& key) {
+              simulator_.key_event(key.vkCode, key.scanCode, key.flags, true);
+          }),
+          predictor_(dispatch_mutex_, [this](int x, int y) { simulator_.move_mouse(x, y); }),
+          channels_([this](std::string frame) { return send_locked(frame); }),
+          files_(channels_),
+          clipboard_([this](std::string frame) { return send_locked(frame); }, channels_) {}
+    
+    void set_clipboard(bool enabled) { clipboard_enabled_ = enabled; }
+    
+    // Encrypt the connection with the key the server was given (--key)
+    void set_key(const PresharedKey& key) { key_ = key; }
+    
+    // Move to shared memory when the server turns out to be on this host (--shm)
+    void set_shared_memory(bool enabled) { socket_.offer_shared_memory(enabled); }
+    
+    // Where files from the server go; empty refuses them
+    void set_receive_directory(const std::string& directory) { files_.set_directory(directory); }
+    
+    // Send these files to the server once connected (--send)
+    void set_send_files(const std::vector<std::string>& paths) { send_paths_ = paths; }
+    
+    // Show the cursor this far ahead of the moves received; 0 is off (--predict)
+    void set_prediction(uint64_t lead_us) { prediction_us_ = lead_us; }
     
     bool run() {
         // Initialize input simulator
@@ -35,13 +80,45 @@ public:
         std::cout << "Screen size: " << simulator_.screen_width() << "x" 
                   << simulator_.screen_height() << "\n";
         
+        repeater_.start();
+        predictor_.start(prediction_us_);
+        channels_.start();
+        for (const auto& path : send_paths_) {
+            send_file(channels_, path);
+        }
+        if (clipboard_enabled_) {
+            clipboard_.start();
+        }
+        
+        ReconnectBackoff backoff;
+        uint64_t disconnected_us = 0;
+        
         while (g_running) {
             std::cout << "Connecting to " << server_host_ << ":" << port_ << "...\n";
             
             try {
+                // Our session ticket goes in the opening flight, so a server
+                // that still has the session answers with what we missed
+                // a single round trip after connecting
+                std::string hello;
+                {
+                    std::lock_guard<std::mutex> lock(dispatch_mutex_);
+                    session_ = &session_tickets_.get(server_host_, port_);
+                    hello = serialize_packet(EventType::SESSION_HELLO, session_->hello(display_refresh_hz()));
+                }
                 socket_.create();
-                socket_.connect(server_host_, port_);
-                connected_ = true;
+                socket_.connect(server_host_, port_, hello, key_);
+                if (g_tracer.enabled()) {
+                    socket_.enable_kernel_timestamps();
+                }
+                backoff.reset();
+                
+                {
+                    std::lock_guard<std::mutex> lock(send_mutex_);
+                    connected_ = true;
+                }
+                clipboard_.announce();
+                channels_.connected();
                 
                 std::cout << "Connected to server!\n";
                 
@@ -50,76 +127,152 @@ public:
                     process_events();
                 }
                 
-                socket_.close();
+                multicast_.close();
+                repeater_.cancel();
+                {
+                    std::lock_guard<std::mutex> lock(dispatch_mutex_);
+                    predictor_.reset();
+                }
+                clipboard_.disconnected();
+                channels_.disconnected();
+                {
+                    std::lock_guard<std::mutex> lock(send_mutex_);
+                    connected_ = false;
+                    socket_.close();
+                }
+                disconnected_us = get_timestamp_us();
                 std::cout << "Disconnected from server\n";
                 
             } catch (const NetworkError& e) {
                 std::cerr << "Connection failed: " << e.what() << "\n";
+                std::lock_guard<std::mutex> lock(send_mutex_);
                 socket_.close();
             }
             
             if (g_running) {
-                std::cout << "Reconnecting in 3 seconds...\n";
-                std::this_thread::sleep_for(std::chrono::seconds(3));
+                // Past the resume window the server can no longer tell us
+                // what was released meanwhile
+                if (disconnected_us != 0 &&
+                    get_timestamp_us() - disconnected_us >= SESSION_RESUME_WINDOW_US) {
+                    simulator_.release_all();
+                    disconnected_us = 0;
+                }
+                
+                int delay_ms = backoff.next_delay_ms();
+                std::cout << "Reconnecting in " << delay_ms << " ms...\n";
+                std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
             }
         }
         
+        clipboard_.stop();
+        channels_.stop();
+        repeater_.stop();
+        predictor_.stop();
+        simulator_.release_all();
         return true;
     }
     
 private:
+    // Clipboard and transfer frames, from their own threads
+    bool send_locked(const std::string& frame) {
+        std::lock_guard<std::mutex> lock(send_mutex_);
+        return connected_ && socket_.send(frame) > 0;
+    }
+    
     void process_events() {
-        PacketHeader header;
+        if (!socket_.wait_readable(100)) {
+            return;
+        }
         
-        if (!socket_.recv_exact(&header, sizeof(header), 100)) {
-            // Timeout or disconnect
-            int err = WSAGetLastError();
-            if (err != WSAEWOULDBLOCK && err != WSAETIMEDOUT) {
-                connected_ = false;
+        // A whole frame, opened first if the connection is encrypted. Fails
+        // on disconnect, a protocol version mismatch or a forged record.
+        if (!socket_.recv_frame(frame_)) {
+            connected_ = false;
+            return;
+        }
+        
+        EventType type = frame_type(frame_);
+        const char* payload = frame_.data() + sizeof(PacketHeader);
+        size_t size = frame_.size() - sizeof(PacketHeader);
+        trace_begin(TraceStage::RECV, type);
+        trace_kernel_stamp(TraceStage::KERNEL_RX, trace_current(), socket_.kernel_rx_us());
+        
+        // The server measuring its round trip: answer at once
+        if (type == EventType::KEEPALIVE) {
+            std::string reply;
+            if (answer_keepalive(payload, size, reply)) {
+                send_locked(reply);
             }
             return;
         }
         
-        // Verify protocol version
-        if (header.version != PROTOCOL_VERSION) {
-            std::cerr << "Protocol version mismatch\n";
-            connected_ = false;
+        // Clipboard and transfer traffic is neither input nor part of the session
+        if (clipboard_.handle_frame(type, payload, size) ||
+            channels_.handle_frame(type, payload, size)) {
             return;
         }
         
-        // Read payload
-        std::vector<char> payload(header.payload_size);
-        if (!socket_.recv_exact(payload.data(), header.payload_size)) {
-            connected_ = false;
+        std::lock_guard<std::mutex> lock(dispatch_mutex_);
+        if (type == EventType::SESSION_ACCEPT) {
+            if (size >= sizeof(SessionAcceptEvent)) {
+                handle_session_accept(payload);
+            }
             return;
         }
+        session_->frame_received();
+        dispatch(type, payload, size);
+    }
+    
+    // Process based on event type (TCP and multicast frames alike).
+    // A payload shorter than its event is dropped.
+    void dispatch(EventType type, const char* data, size_t size) {
+        ScopedTiming timing(Timing::DISPATCH);
+        g_metrics.count(Counter::EVENTS_DISPATCHED);
+        trace_stage(TraceStage::DECODE, type);
         
-        // Process based on event type
-        switch (header.type) {
+        switch (type) {
             case EventType::MOUSE_MOVE:
-                handle_mouse_move(payload.data());
+                if (size < sizeof(MouseMoveEvent)) break;
+                handle_mouse_move(data);
                 break;
             case EventType::MOUSE_BUTTON:
-                handle_mouse_button(payload.data());
+                if (size < sizeof(MouseButtonEvent)) break;
+                handle_mouse_button(data);
                 break;
             case EventType::MOUSE_SCROLL:
-                handle_mouse_scroll(payload.data());
+                if (size < sizeof(MouseScrollEvent)) break;
+                handle_mouse_scroll(data);
                 break;
             case EventType::KEY_PRESS:
             case EventType::KEY_RELEASE:
-                handle_key_event(payload.data(), header.type == EventType::KEY_PRESS);
+                if (size < sizeof(KeyEvent)) break;
+                handle_key_event(data, type == EventType::KEY_PRESS);
+                break;
+            case EventType::KEY_REPEAT:
+                if (size < sizeof(KeyRepeatEvent)) break;
+                handle_key_repeat(data);
                 break;
             case EventType::SCREEN_INFO:
-                handle_screen_info(payload.data());
+                if (size < sizeof(ScreenInfo)) break;
+                handle_screen_info(data);
                 break;
             case EventType::SWITCH_SCREEN:
-                handle_switch_screen(payload.data());
+                if (size < sizeof(SwitchScreenEvent)) break;
+                handle_switch_screen(data);
+                break;
+            case EventType::KEY_STATE:
+                if (size < sizeof(KeyStateEvent)) break;
+                handle_key_state(data);
+                break;
+            case EventType::MULTICAST_INFO:
+                if (size < sizeof(MulticastInfoEvent)) break;
+                handle_multicast_info(data);
                 break;
             case EventType::KEEPALIVE:
                 // Just ignore keepalive
                 break;
             default:
-                std::cerr << "Unknown event type: " << static_cast<int>(header.type) << "\n";
+                std::cerr << "Unknown event type: " << static_cast<int>(type) << "\n";
                 break;
         }
     }
@@ -137,7 +290,7 @@ private:
         cursor_x_ = (std::max)(0, (std::min)(cursor_x_, simulator_.screen_width() - 1));
         cursor_y_ = (std::max)(0, (std::min)(cursor_y_, simulator_.screen_height() - 1));
         
-        simulator_.move_mouse(cursor_x_, cursor_y_);
+        predictor_.move(cursor_x_, cursor_y_);
         
         // Check if we should switch back to server
         check_edge_switch();
@@ -147,6 +300,7 @@ private:
         if (!active_) return;
         
         auto* event = reinterpret_cast<const MouseButtonEvent*>(data);
+        predictor_.button(event->pressed, cursor_x_, cursor_y_);  // the click lands where the server's did
         simulator_.mouse_button(event->button, event->pressed);
     }
     
@@ -158,12 +312,23 @@ private:
     }
     
     void handle_key_event(const char* data, bool pressed) {
+        auto* event = reinterpret_cast<const KeyEvent*>(data);
+        repeater_.key(event->vkCode, pressed);
         if (!active_) return;
         
-        auto* event = reinterpret_cast<const KeyEvent*>(data);
         simulator_.key_event(event->vkCode, event->scanCode, event->flags, pressed);
     }
     
+    // From here on the key repeats locally, until its release
+    void handle_key_repeat(const char* data) {
+        if (!active_) return;
+        
+        auto* event = reinterpret_cast<const KeyRepeatEvent*>(data);
+        if (repeater_.repeat(*event)) {
+            simulator_.key_event(event->key.vkCode, event->key.scanCode, event->key.flags, true);
+        }
+    }
+    
     void handle_screen_info(const char* data) {
         auto* info = reinterpret_cast<const ScreenInfo*>(data);
         server_width_ = info->width;
@@ -202,10 +367,58 @@ private:
                 break;
         }
         
+        predictor_.reset();
         simulator_.move_mouse(cursor_x_, cursor_y_);
         std::cout << "Input active, entry edge: " << edge_name(entry_edge_) << "\n";
     }
     
+    void handle_key_state(const char* data) {
+        auto* state = reinterpret_cast<const KeyStateEvent*>(data);
+        
+        // Release keys the server no longer holds (frames were missed)
+        repeater_.cancel();
+        simulator_.sync_key_state(*state, active_);
+    }
+    
+    void handle_session_accept(const char* data) {
+        auto* reply = reinterpret_cast<const SessionAcceptEvent*>(data);
+        session_->accepted(*reply);
+        
+        switch (reply->mode) {
+            case SessionResumeMode::NEW:
+                // A different (or restarted) server: nothing of ours is held there
+                active_ = false;
+                simulator_.sync_key_state(reply->keys, false);
+                break;
+            case SessionResumeMode::REPLAY:
+                std::cout << "Session resumed\n";
+                break;
+            case SessionResumeMode::SNAPSHOT:
+                std::cout << "Session resumed, resyncing held keys\n";
+                simulator_.sync_key_state(reply->keys, active_);
+                break;
+        }
+    }
+    
+    void handle_multicast_info(const char* data) {
+        if (multicast_.is_open()) return;
+        
+        auto* info = reinterpret_cast<const MulticastInfoEvent*>(data);
+        try {
+            multicast_.open(*info, [this](const std::string& frame) {
+                if (frame.size() < sizeof(PacketHeader)) return;
+                PacketHeader header;
+                std::memcpy(&header, frame.data(), sizeof(header));
+                trace_begin(TraceStage::RECV, header.type);
+                std::lock_guard<std::mutex> lock(dispatch_mutex_);
+                dispatch(header.type, frame.data() + sizeof(header), frame.size() - sizeof(header));
+            });
+            std::cout << "Receiving input over multicast\n";
+        } catch (const NetworkError& e) {
+            std::cerr << "Failed to join multicast group: " << e.what() << "\n";
+        }
+    }
+    
     void check_edge_switch() {
         // If cursor moves back to entry edge, deactivate
         bool at_entry_edge = false;
@@ -229,6 +442,7 @@ private:
         
         if (at_entry_edge) {
             active_ = false;
+            predictor_.reset();
             std::cout << "Input returned to server\n";
         }
     }
@@ -251,10 +465,20 @@ private:
     uint16_t port_;
     
     InputSimulator simulator_;
+    PresharedKey key_;
     Socket socket_;
+    std::string frame_;          // Receive buffer, reused
+    MulticastReceiver multicast_;
+    SessionTickets session_tickets_;  // Per server, as in the GUI
+    SessionResume* session_ = nullptr;  // For the server we connect to, in session_tickets_
+    std::mutex dispatch_mutex_;  // TCP and multicast frames are dispatched from different threads
+    std::mutex send_mutex_;      // The clipboard and transfer threads send too
     
     std::atomic<bool> connected_{false};
     std::atomic<bool> active_;
+    KeyRepeater repeater_;       // Repeats a held key; injects under dispatch_mutex_
+    CursorPredictor predictor_;  // Moves the cursor; injects under dispatch_mutex_ too
+    uint64_t prediction_us_ = 0;
     
     int cursor_x_ = 0;
     int cursor_y_ = 0;
@@ -263,12 +487,29 @@ private:
     int server_height_ = 1080;
     
     ScreenEdge entry_edge_ = ScreenEdge::NONE;
+    
+    // Last: these send on socket_
+    ChannelMux channels_;
+    FileReceiver files_;
+    std::vector<std::string> send_paths_;
+    bool clipboard_enabled_ = true;
+    ClipboardSync clipboard_;
 };
 
 void print_usage(const char* program) {
     std::cout << "Usage: " << program << " <server-host> [options]\n"
               << "Options:\n"
               << "  -p, --port PORT      Port to connect to (default: 24800)\n"
+              << "  -s, --stats FILE     Write metrics to FILE every second\n"
+              << "  -t, --trace FILE     Trace every event; Chrome trace JSON is written on exit\n"
+              << "  -f, --flight FILE    Flight recorder ring file (default: %TEMP%\\mouse-share-client.flight)\n"
+              << "      --no-flight      Disable the flight recorder\n"
+              << "  -k, --key PASSPHRASE Encrypt the connection with the server's passphrase\n"
+              << "      --shm            Use shared memory instead of TCP if the server is on this host\n"
+              << "      --no-clipboard   Don't share the clipboard\n"
+              << "      --receive-dir DIR  Accept files sent by the server into DIR\n"
+              << "      --send FILE      Send FILE to the server once connected (repeatable)\n"
+              << "      --predict MS     Show the cursor MS ahead of remote motion to hide latency (default: 0, off)\n"
               << "  -h, --help           Show this help\n";
 }
 
@@ -280,6 +521,14 @@ int main(int argc, char* argv[]) {
     
     std::string server_host;
     uint16_t port = DEFAULT_PORT;
+    std::string stats_path;
+    std::string flight_path = FlightRecorder::default_path("client");
+    bool clipboard = true;
+    std::string receive_dir;
+    std::vector<std::string> send_paths;
+    std::string passphrase;
+    bool shared_memory = false;
+    int predict_ms = 0;
     
     for (int i = 1; i < argc; i++) {
         std::string arg = argv[i];
@@ -287,6 +536,27 @@ int main(int argc, char* argv[]) {
         if (arg == "-h" || arg == "--help") {
             print_usage(argv[0]);
             return 0;
+        } else if ((arg == "-s" || arg == "--stats") && i + 1 < argc) {
+            stats_path = argv[++i];
+        } else if ((arg == "-t" || arg == "--trace") && i + 1 < argc) {
+            g_trace_path = argv[++i];
+            g_tracer.enable();
+        } else if ((arg == "-f" || arg == "--flight") && i + 1 < argc) {
+            flight_path = argv[++i];
+        } else if (arg == "--no-flight") {
+            flight_path.clear();
+        } else if ((arg == "-k" || arg == "--key") && i + 1 < argc) {
+            passphrase = argv[++i];
+        } else if (arg == "--shm") {
+            shared_memory = true;
+        } else if (arg == "--no-clipboard") {
+            clipboard = false;
+        } else if (arg == "--receive-dir" && i + 1 < argc) {
+            receive_dir = argv[++i];
+        } else if (arg == "--send" && i + 1 < argc) {
+            send_paths.push_back(argv[++i]);
+        } else if (arg == "--predict" && i + 1 < argc) {
+            predict_ms = (std::max)(0, std::stoi(argv[++i]));
         } else if ((arg == "-p" || arg == "--port") && i + 1 < argc) {
             port = std::stoi(argv[++i]);
         } else if (server_host.empty() && arg[0] != '-') {
@@ -309,9 +579,35 @@ int main(int argc, char* argv[]) {
     // Set console handler
     SetConsoleCtrlHandler(console_handler, TRUE);
     
+    if (!flight_path.empty()) {
+        g_flight.open(flight_path);
+    }
+    
+    MetricsReporter metrics_reporter;
+    if (!stats_path.empty()) {
+        metrics_reporter.start(stats_path);
+    }
+    
     Client client(server_host, port);
+    if (!passphrase.empty()) {
+        try {
+            client.set_key(derive_preshared_key(passphrase));
+        } catch (const CryptoError& e) {
+            std::cerr << "Cannot use the key: " << e.what() << "\n";
+            return 1;
+        }
+    }
+    client.set_clipboard(clipboard);
+    client.set_shared_memory(shared_memory);
+    client.set_receive_directory(receive_dir);
+    client.set_send_files(send_paths);
+    client.set_prediction(static_cast<uint64_t>(predict_ms) * 1000);
     bool result = client.run();
     
+    if (!g_trace_path.empty()) {
+        g_tracer.write_chrome_trace_once(g_trace_path);
+    }
+    
     cleanup_winsock();
     return result ? 0 : 1;
 }
\ No newline at end of file
@@ -0,0 +1,456 @@
+#pragma once
+
+#include "common.hpp"
+#include "content_hash.hpp"
+#include "channel.hpp"
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <set>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <iostream>
+
+namespace MouseShare {
+
+constexpr uint32_t CLIPBOARD_MAX_BYTES = 128 * 1024 * 1024;   // larger formats are not shared
+constexpr size_t CLIPBOARD_CACHE_BYTES = 256 * 1024 * 1024;
+constexpr int CLIPBOARD_FETCH_TIMEOUT_MS = 10000;
+constexpr UINT WM_CLIPBOARD_REMOTE = WM_APP + 40;
+
+// Formats we share, in order of preference
+constexpr UINT CLIPBOARD_FORMATS[] = {CF_UNICODETEXT, CF_DIB};
+
+using ClipboardContent = std::shared_ptr<const std::string>;
+
+// Clipboard contents by hash, least recently used evicted first once the
+// byte budget is exceeded. Thread-safe.
+class ClipboardCache {
+public:
+    explicit ClipboardCache(size_t budget = CLIPBOARD_CACHE_BYTES) : budget_(budget) {}
+
+    void put(const ContentHash& hash, ClipboardContent content) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = index_.find(hash);
+        if (found != index_.end()) {
+            lru_.splice(lru_.begin(), lru_, found->second);
+            return;
+        }
+
+        bytes_ += content->size();
+        lru_.emplace_front(hash, std::move(content));
+        index_[hash] = lru_.begin();
+
+        // Never evict the entry just added
+        while (bytes_ > budget_ && lru_.size() > 1) {
+            bytes_ -= lru_.back().second->size();
+            index_.erase(lru_.back().first);
+            lru_.pop_back();
+        }
+    }
+
+    ClipboardContent get(const ContentHash& hash) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = index_.find(hash);
+        if (found == index_.end()) return nullptr;
+        lru_.splice(lru_.begin(), lru_, found->second);
+        return found->second->second;
+    }
+
+    size_t bytes() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return bytes_;
+    }
+
+private:
+    using Entry = std::pair<ContentHash, ClipboardContent>;
+
+    size_t budget_;
+    mutable std::mutex mutex_;
+    std::list<Entry> lru_;
+    std::map<ContentHash, std::list<Entry>::iterator> index_;
+    size_t bytes_ = 0;
+};
+
+// Lazy clipboard sharing with one peer. A local copy only sends a small
+// CLIPBOARD announcement (formats, sizes, hashes). The peer offers those
+// formats with delayed rendering, so the content is requested only when
+// something on that side actually pastes. Received and local content is
+// kept in a ClipboardCache, so content seen before is never sent twice.
+//
+// A message-only window thread watches and owns the clipboard. Content
+// travels as a ChannelMux transfer, chunked behind any waiting input.
+class ClipboardSync {
+public:
+    // Sends one whole frame to the peer; called from the clipboard thread
+    using SendFn = std::function<bool(std::string frame)>;
+
+    ClipboardSync(SendFn send, ChannelMux& channels) : send_(std::move(send)), channels_(channels) {
+        channels_.set_acceptor(ChannelKind::CLIPBOARD, [this](const ChannelOpen& open, const std::string&) {
+            return accept_transfer(open);
+        });
+    }
+
+    ~ClipboardSync() {
+        stop();
+    }
+
+    ClipboardSync(const ClipboardSync&) = delete;
+    ClipboardSync& operator=(const ClipboardSync&) = delete;
+
+    void start() {
+        if (running_) return;
+        running_ = true;
+        window_thread_ = std::thread(&ClipboardSync::window_thread_func, this);
+    }
+
+    void stop() {
+        if (!running_) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_ = false;
+            waiting_.clear();
+            if (hwnd_) {
+                PostMessage(hwnd_, WM_CLOSE, 0, 0);
+            }
+        }
+        cv_.notify_all();
+        if (window_thread_.joinable()) window_thread_.join();
+    }
+
+    // Consume a clipboard frame from the peer (any thread). Returns false
+    // for frames that aren't clipboard traffic; content itself arrives
+    // through the ChannelMux.
+    bool handle_frame(EventType type, const char* data, size_t size) {
+        switch (type) {
+            case EventType::CLIPBOARD:
+                if (size >= sizeof(ClipboardAnnounce)) {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    std::memcpy(&remote_, data, sizeof(remote_));
+                    remote_.count = (std::min)(remote_.count, uint8_t(CLIPBOARD_MAX_FORMATS));
+                    if (hwnd_) PostMessage(hwnd_, WM_CLIPBOARD_REMOTE, 0, 0);
+                }
+                return true;
+            case EventType::CLIPBOARD_REQUEST:
+                if (size >= sizeof(ClipboardRequest)) {
+                    ClipboardRequest request;
+                    std::memcpy(&request, data, sizeof(request));
+                    if (ClipboardContent content = cache_.get(request.hash)) {
+                        channels_.send(ChannelKind::CLIPBOARD, request.hash, source_of(std::move(content)));
+                    }
+                }
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Announce the current local clipboard again, e.g. to a peer that just
+    // (re)connected and may have missed the last announcement
+    void announce() {
+        std::string frame;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (local_.empty()) return;
+            frame = make_announcement();
+        }
+        send_(std::move(frame));
+    }
+
+    // The connection to the peer is gone: pastes waiting on it give up
+    void disconnected() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            waiting_.clear();
+        }
+        cv_.notify_all();
+    }
+
+private:
+    struct LocalFormat {
+        UINT format;
+        ContentHash hash;
+        ClipboardContent content;
+    };
+
+    // Content being received for a paste in progress
+    class ContentSink : public ChannelSink {
+    public:
+        ContentSink(ClipboardSync& owner, const ContentHash& hash, uint64_t total)
+            : owner_(owner), hash_(hash) {
+            data_.reserve(static_cast<size_t>(total));
+        }
+
+        bool write(const char* data, size_t size) override {
+            data_.append(data, size);
+            return true;
+        }
+
+        bool finish() override {
+            return owner_.received(hash_, std::move(data_));
+        }
+
+    private:
+        ClipboardSync& owner_;
+        ContentHash hash_;
+        std::string data_;
+    };
+
+    // ------------------------------------------------------------------
+    // Window thread
+    // ------------------------------------------------------------------
+
+    void window_thread_func() {
+        WNDCLASSEXA wc = {};
+        wc.cbSize = sizeof(wc);
+        wc.lpfnWndProc = window_proc;
+        wc.hInstance = GetModuleHandle(nullptr);
+        wc.lpszClassName = "MouseShareClipboard";
+        RegisterClassExA(&wc);
+
+        HWND hwnd = CreateWindowExA(0, wc.lpszClassName, "", 0, 0, 0, 0, 0,
+                                    HWND_MESSAGE, nullptr, wc.hInstance, this);
+        if (!hwnd) {
+            std::cerr << "Clipboard sharing disabled: cannot create window (" << GetLastError() << ")\n";
+            return;
+        }
+        AddClipboardFormatListener(hwnd);
+        {
+            // stop() may already have run and found no window to close
+            std::lock_guard<std::mutex> lock(mutex_);
+            hwnd_ = hwnd;
+            if (!running_) {
+                PostMessage(hwnd, WM_CLOSE, 0, 0);
+            }
+        }
+
+        MSG msg;
+        while (GetMessage(&msg, nullptr, 0, 0)) {
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        hwnd_ = nullptr;
+    }
+
+    static LRESULT CALLBACK window_proc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
+        if (msg == WM_NCCREATE) {
+            auto* create = reinterpret_cast<CREATESTRUCTA*>(lParam);
+            SetWindowLongPtr(hwnd, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(create->lpCreateParams));
+        }
+        auto* self = reinterpret_cast<ClipboardSync*>(GetWindowLongPtr(hwnd, GWLP_USERDATA));
+        if (!self) {
+            return DefWindowProc(hwnd, msg, wParam, lParam);
+        }
+
+        switch (msg) {
+            case WM_CLIPBOARDUPDATE:
+                self->on_local_change(hwnd);
+                return 0;
+            case WM_CLIPBOARD_REMOTE:
+                self->offer_remote(hwnd);
+                return 0;
+            case WM_RENDERFORMAT:
+                self->render(static_cast<UINT>(wParam), true);
+                return 0;
+            case WM_RENDERALLFORMATS:
+                // Exiting: hand over what we already have, without waiting on the peer
+                if (OpenClipboard(hwnd)) {
+                    if (GetClipboardOwner() == hwnd) {
+                        for (int i = 0; i < self->offered_.count; i++) {
+                            self->render(self->offered_.formats[i].format, false);
+                        }
+                    }
+                    CloseClipboard();
+                }
+                return 0;
+            case WM_DESTROY:
+                RemoveClipboardFormatListener(hwnd);
+                PostQuitMessage(0);
+                return 0;
+        }
+        return DefWindowProc(hwnd, msg, wParam, lParam);
+    }
+
+    static bool open_clipboard(HWND hwnd) {
+        // Another application may hold it for a moment
+        for (int attempt = 0; attempt < 10; attempt++) {
+            if (OpenClipboard(hwnd)) return true;
+            Sleep(10);
+        }
+        return false;
+    }
+
+    // Something on this machine copied: snapshot it and announce it
+    void on_local_change(HWND hwnd) {
+        if (GetClipboardOwner() == hwnd) return;  // our own offer of the peer's content
+        if (!open_clipboard(hwnd)) return;
+
+        std::vector<LocalFormat> formats;
+        for (UINT format : CLIPBOARD_FORMATS) {
+            if (!IsClipboardFormatAvailable(format)) continue;
+            HANDLE handle = GetClipboardData(format);
+            if (!handle) continue;
+
+            size_t size = GlobalSize(handle);
+            const void* bytes = GlobalLock(handle);
+            if (bytes && size <= CLIPBOARD_MAX_BYTES) {
+                auto content = std::make_shared<const std::string>(static_cast<const char*>(bytes), size);
+                formats.push_back({format, content_hash(*content), content});
+            }
+            GlobalUnlock(handle);
+        }
+        CloseClipboard();
+
+        if (formats.empty()) return;
+
+        std::string frame;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (same_formats(formats, local_)) return;  // copied the same thing again
+            local_ = std::move(formats);
+            for (const auto& f : local_) {
+                cache_.put(f.hash, f.content);
+            }
+            sequence_++;
+            frame = make_announcement();
+        }
+        send_(std::move(frame));
+    }
+
+    static bool same_formats(const std::vector<LocalFormat>& a, const std::vector<LocalFormat>& b) {
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); i++) {
+            if (a[i].format != b[i].format || a[i].hash != b[i].hash) return false;
+        }
+        return true;
+    }
+
+    std::string make_announcement() const {
+        ClipboardAnnounce announce = {};
+        announce.sequence = sequence_;
+        for (const auto& f : local_) {
+            if (announce.count == CLIPBOARD_MAX_FORMATS) break;
+            ClipboardFormatInfo& info = announce.formats[announce.count++];
+            info.format = f.format;
+            info.size = static_cast<uint32_t>(f.content->size());
+            info.hash = f.hash;
+        }
+        return serialize_packet(EventType::CLIPBOARD, announce);
+    }
+
+    // Take ownership of the clipboard with the peer's formats, content to follow
+    void offer_remote(HWND hwnd) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            offered_ = remote_;
+        }
+        if (!open_clipboard(hwnd)) return;
+        EmptyClipboard();
+        for (int i = 0; i < offered_.count; i++) {
+            SetClipboardData(offered_.formats[i].format, nullptr);
+        }
+        CloseClipboard();
+    }
+
+    // Supply one offered format. With fetch, a cache miss asks the peer and
+    // waits; the pasting application is blocked until then.
+    void render(UINT format, bool fetch) {
+        const ClipboardFormatInfo* info = nullptr;
+        for (int i = 0; i < offered_.count; i++) {
+            if (offered_.formats[i].format == format) info = &offered_.formats[i];
+        }
+        if (!info) return;
+
+        ClipboardContent content = cache_.get(info->hash);
+        if (content) {
+            g_metrics.count(Counter::CLIPBOARD_CACHE_HITS);
+        } else if (fetch) {
+            content = fetch_remote(info->hash);
+        }
+        if (!content) return;
+
+        HGLOBAL global = GlobalAlloc(GMEM_MOVEABLE, content->size());
+        if (!global) return;
+        std::memcpy(GlobalLock(global), content->data(), content->size());
+        GlobalUnlock(global);
+        if (!SetClipboardData(format, global)) {
+            GlobalFree(global);
+        }
+    }
+
+    ClipboardContent fetch_remote(const ContentHash& hash) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            waiting_.insert(hash);
+        }
+        g_metrics.count(Counter::CLIPBOARD_FETCHES);
+        if (!send_(serialize_packet(EventType::CLIPBOARD_REQUEST, ClipboardRequest{hash}))) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            waiting_.erase(hash);
+            return nullptr;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait_for(lock, std::chrono::milliseconds(CLIPBOARD_FETCH_TIMEOUT_MS),
+                     [&] { return waiting_.find(hash) == waiting_.end(); });
+        waiting_.erase(hash);
+        lock.unlock();
+
+        return cache_.get(hash);
+    }
+
+    // ------------------------------------------------------------------
+    // Receive side (the ChannelMux reader thread)
+    // ------------------------------------------------------------------
+
+    // Only content a paste is waiting for is taken
+    std::unique_ptr<ChannelSink> accept_transfer(const ChannelOpen& open) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!waiting_.count(open.hash) || open.total > CLIPBOARD_MAX_BYTES) return nullptr;
+        return std::make_unique<ContentSink>(*this, open.hash, open.total);
+    }
+
+    bool received(const ContentHash& hash, std::string data) {
+        auto content = std::make_shared<const std::string>(std::move(data));
+
+        // On a mismatch the paste comes up empty rather than pasting garbage
+        bool ok = content_hash(*content) == hash;
+        if (ok) {
+            cache_.put(hash, std::move(content));
+        } else {
+            std::cerr << "Clipboard content failed its hash check\n";
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            waiting_.erase(hash);
+        }
+        cv_.notify_all();
+        return ok;
+    }
+
+    SendFn send_;
+    ChannelMux& channels_;
+    ClipboardCache cache_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::atomic<bool> running_{false};
+    HWND hwnd_ = nullptr;
+
+    std::vector<LocalFormat> local_;        // what this machine last copied
+    uint32_t sequence_ = 0;
+    ClipboardAnnounce remote_ = {};         // the peer's latest announcement
+    ClipboardAnnounce offered_ = {};        // what our clipboard currently offers (window thread)
+    std::set<ContentHash> waiting_;         // pastes waiting on the peer
+
+    std::thread window_thread_;
+};
+
+} // namespace MouseShare
@@ -3,7 +3,9 @@
 #include <cstdint>
 #include <cstring>
 #include <string>
+#include <stdexcept>
 #include <chrono>
+#include "metrics.hpp"
 
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
@@ -15,8 +17,9 @@
 
 namespace MouseShare {
 
-// Protocol version
-constexpr uint16_t PROTOCOL_VERSION = 1;
+// Protocol version: 2 sends MOUSE_SCROLL in wheel units, 1 sent notches.
+// Frames of any other version are dropped, so mismatched peers never connect
+constexpr uint16_t PROTOCOL_VERSION = 2;
 constexpr uint16_t DEFAULT_PORT = 24800;
 
 // Event types
@@ -26,10 +29,24 @@ enum class EventType : uint8_t {
     MOUSE_SCROLL = 3,
     KEY_PRESS = 4,
     KEY_RELEASE = 5,
-    CLIPBOARD = 6,
+    CLIPBOARD = 6,            // clipboard changed: formats and content hashes only
     KEEPALIVE = 7,
     SCREEN_INFO = 8,
-    SWITCH_SCREEN = 9
+    SWITCH_SCREEN = 9,
+    KEY_STATE = 10,
+    MULTICAST_INFO = 11,
+    SESSION_HELLO = 12,
+    SESSION_ACCEPT = 13,
+    CLIPBOARD_REQUEST = 14,   // send the content with this hash
+    CHANNEL_OPEN = 15,        // a bulk transfer starts on its own channel
+    CHANNEL_DATA = 16,        // one chunk of a transfer
+    CHANNEL_CREDIT = 17,      // receiver lets the sender go further
+    CHANNEL_CLOSE = 18,       // receiver is done with a transfer
+    SECURE_HELLO = 19,        // encryption handshake (crypto.hpp)
+    SECURE_RECORD = 20,       // one or more frames, encrypted
+    SHM_OFFER = 21,           // client: move to shared memory if on the same host (shm_transport.hpp)
+    SHM_ANSWER = 22,
+    KEY_REPEAT = 23           // a held key repeats; the client generates the repeats (key_repeat.hpp)
 };
 
 // Mouse buttons
@@ -50,6 +67,37 @@ enum class ScreenEdge : uint8_t {
     BOTTOM = 4
 };
 
+// What a bulk transfer channel carries
+enum class ChannelKind : uint8_t {
+    CLIPBOARD = 0,  // content for a paste
+    FILE = 1        // a dropped file
+};
+
+// Why the receiver closed a channel
+enum class ChannelStatus : uint8_t {
+    DONE = 0,       // everything arrived and matched the hash
+    REJECTED = 1,   // not wanted (no paste waiting, file receiving off)
+    FAILED = 2      // bad offset, write error or hash mismatch
+};
+
+// How a CHANNEL_DATA chunk is encoded
+enum class ChunkEncoding : uint8_t {
+    RAW = 0,
+    LZ = 1          // compression.hpp; may refer back into earlier chunks
+};
+
+// AEAD used for SECURE_RECORD frames
+enum class CipherSuite : uint8_t {
+    AES_256_GCM = 1
+};
+
+// How the server brought a (re)connecting client up to date
+enum class SessionResumeMode : uint8_t {
+    NEW = 0,       // unknown or expired token: fresh session
+    REPLAY = 1,    // missed frames follow the accept
+    SNAPSHOT = 2   // too much was missed: key state only
+};
+
 #pragma pack(push, 1)
 
 // Base packet header
@@ -74,7 +122,8 @@ struct MouseButtonEvent {
     bool pressed;
 };
 
-// Mouse scroll event
+// Mouse scroll event, in wheel units as Windows reports them: one notch of
+// a detented wheel is 120 (WHEEL_DELTA), smooth scrolling sends less
 struct MouseScrollEvent {
     int32_t dx;
     int32_t dy;
@@ -87,6 +136,12 @@ struct KeyEvent {
     uint32_t flags;       // Key flags
 };
 
+// Autorepeat of a held key, at the sender's repeat rate
+struct KeyRepeatEvent {
+    KeyEvent key;
+    uint32_t interval_us;  // between repeats
+};
+
 // Screen information
 struct ScreenInfo {
     int32_t width;
@@ -101,6 +156,119 @@ struct SwitchScreenEvent {
     int32_t position;  // position along the edge
 };
 
+// Snapshot of held keys and mouse buttons (one bit per virtual key / MouseButton)
+struct KeyStateEvent {
+    uint8_t keys[32];
+    uint8_t buttons;
+};
+
+// Multicast channel to join for input events (sent over TCP)
+struct MulticastInfoEvent {
+    uint32_t group;    // IPv4 address, network byte order
+    uint16_t port;
+    uint32_t session;
+};
+
+// First frame a client sends on every connection
+struct SessionHelloEvent {
+    uint64_t token;       // 0 to start a new session
+    uint32_t last_seq;    // last frame received in that session
+    uint16_t refresh_hz;  // client's display refresh rate; 0 if unknown. Older clients stop before it.
+};
+
+// Server's reply to SESSION_HELLO. Every frame after it is numbered, starting at next_seq.
+struct SessionAcceptEvent {
+    uint64_t token;
+    uint32_t next_seq;
+    SessionResumeMode mode;
+    KeyStateEvent keys;  // held keys/buttons (NEW and SNAPSHOT only)
+};
+
+// 128-bit content hash (see content_hash.hpp)
+struct ContentHash {
+    uint64_t lo;
+    uint64_t hi;
+
+    bool operator==(const ContentHash& other) const { return lo == other.lo && hi == other.hi; }
+    bool operator!=(const ContentHash& other) const { return !(*this == other); }
+    bool operator<(const ContentHash& other) const { return hi != other.hi ? hi < other.hi : lo < other.lo; }
+};
+
+constexpr int CLIPBOARD_MAX_FORMATS = 4;
+
+struct ClipboardFormatInfo {
+    uint32_t format;     // Windows clipboard format (CF_UNICODETEXT, CF_DIB)
+    uint32_t size;
+    ContentHash hash;
+};
+
+// The sender's clipboard changed. Content follows only on CLIPBOARD_REQUEST.
+struct ClipboardAnnounce {
+    uint32_t sequence;
+    uint8_t count;
+    ClipboardFormatInfo formats[CLIPBOARD_MAX_FORMATS];
+};
+
+struct ClipboardRequest {
+    ContentHash hash;
+};
+
+// Opens a transfer. Channel numbers are chosen by the sender and only
+// name its own transfers. Followed by the file name (FILE only).
+struct ChannelOpen {
+    uint16_t channel;
+    ChannelKind kind;
+    uint64_t total;
+    ContentHash hash;
+};
+
+// Followed by the chunk's (encoded) bytes, up to the end of the payload.
+// offset and size count the transfer's bytes before encoding.
+struct ChannelDataHeader {
+    uint16_t channel;
+    uint64_t offset;
+    uint16_t size;
+    ChunkEncoding encoding;
+};
+
+// The receiver expects offset next (the first credit after an open says
+// where to start or resume) and takes bytes up to limit
+struct ChannelCredit {
+    uint16_t channel;
+    uint64_t offset;
+    uint64_t limit;
+};
+
+struct ChannelClose {
+    uint16_t channel;
+    ChannelStatus status;
+};
+
+// Sent in the clear by both ends of an encrypted connection, then once
+// more encrypted with the peer's nonce to prove the key
+struct SecureHello {
+    CipherSuite suite;
+    uint8_t nonce[32];
+    uint8_t early_records;  // client: records of early data right behind the hello
+};
+
+// A client's shared memory section, offered in its first frame; a server
+// that can open it is on the same host
+struct ShmOffer {
+    char name[64];         // NUL-terminated; its events are named after it
+    uint32_t ring_bytes;   // each direction
+};
+
+struct ShmAnswer {
+    uint8_t accepted;      // 0: stay on TCP
+};
+
+// Round trip probe (send_batching.hpp). Older versions send KEEPALIVE empty.
+struct KeepaliveEvent {
+    uint64_t sent_us;      // the pinging side's clock, echoed back unchanged
+    uint8_t reply;         // 0: ping, 1: answer
+};
+
 #pragma pack(pop)
 
 // Helper to get current timestamp in milliseconds
@@ -112,9 +280,19 @@ inline uint32_t get_timestamp() {
     return static_cast<uint32_t>(ms.count());
 }
 
+// Helper to get current monotonic timestamp in microseconds
+inline uint64_t get_timestamp_us() {
+    auto now = std::chrono::steady_clock::now();
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+        now.time_since_epoch()
+    );
+    return static_cast<uint64_t>(us.count());
+}
+
 // Serialize packet to buffer
 template<typename T>
 std::string serialize_packet(EventType type, const T& payload) {
+    static_assert(sizeof(T) <= UINT16_MAX, "payload too large for payload_size");
     std::string buffer;
     buffer.resize(sizeof(PacketHeader) + sizeof(T));
     
@@ -127,9 +305,45 @@ std::string serialize_packet(EventType type, const T& payload) {
     std::memcpy(buffer.data(), &header, sizeof(header));
     std::memcpy(buffer.data() + sizeof(header), &payload, sizeof(T));
     
+    g_metrics.count(Counter::FRAMES_SERIALIZED);
+    return buffer;
+}
+
+// Serialize a packet whose payload is a fixed header followed by raw bytes.
+// Throws std::length_error if that won't fit in payload_size: a truncated
+// size would desync the stream, so callers cut bulk data into chunks first.
+template<typename T>
+std::string serialize_packet(EventType type, const T& payload, const char* data, size_t size) {
+    if (size > UINT16_MAX - sizeof(T)) {
+        throw std::length_error("Packet payload of " + std::to_string(sizeof(T) + size) + " bytes is too large");
+    }
+    
+    std::string buffer;
+    buffer.resize(sizeof(PacketHeader) + sizeof(T) + size);
+    
+    PacketHeader header;
+    header.version = PROTOCOL_VERSION;
+    header.type = type;
+    header.timestamp = get_timestamp();
+    header.payload_size = static_cast<uint16_t>(sizeof(T) + size);
+    
+    std::memcpy(buffer.data(), &header, sizeof(header));
+    std::memcpy(buffer.data() + sizeof(header), &payload, sizeof(T));
+    if (size) {
+        std::memcpy(buffer.data() + sizeof(header) + sizeof(T), data, size);
+    }
+    
+    g_metrics.count(Counter::FRAMES_SERIALIZED);
     return buffer;
 }
 
+// Event type of a serialized frame
+inline EventType frame_type(const std::string& frame) {
+    PacketHeader header;
+    std::memcpy(&header, frame.data(), sizeof(header));
+    return header.type;
+}
+
 // Initialize Winsock
 inline bool init_winsock() {
 #ifdef _WIN32
@@ -0,0 +1,278 @@
+#pragma once
+
+#include "common.hpp"
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cctype>
+#include <algorithm>
+
+namespace MouseShare {
+
+// A small LZ77 codec in the LZ4 block layout: sequences of literals and a
+// match (2-byte offset, length >= 4). Fast enough to run at link speed
+// with no library, and compresses the text and bitmaps people copy well.
+constexpr size_t LZ_WINDOW = 65535;          // furthest a match may reach back
+constexpr int LZ_HASH_BITS = 14;
+constexpr size_t LZ_MIN_MATCH = 4;
+
+constexpr double COMPRESS_MAX_ENTROPY = 7.5;   // bits per byte; above this, data looks compressed already
+constexpr double COMPRESS_MIN_SAVING = 0.1;    // a chunk saving less than this didn't pay
+constexpr int COMPRESS_POOR_LIMIT = 4;         // that many poor chunks in a row...
+constexpr int COMPRESS_BACKOFF_CHUNKS = 64;    // ...and this many are sent raw before trying again
+
+// Shannon entropy of the byte values, in bits per byte, over up to 16
+// samples spread across the data
+inline double sample_entropy(const char* data, size_t size) {
+    constexpr size_t SAMPLES = 16;
+    constexpr size_t SAMPLE_BYTES = 512;
+
+    uint64_t counts[256] = {};
+    uint64_t total = 0;
+    auto count = [&](const char* p, size_t n) {
+        for (size_t i = 0; i < n; i++) counts[static_cast<uint8_t>(p[i])]++;
+        total += n;
+    };
+
+    if (size <= SAMPLES * SAMPLE_BYTES) {
+        count(data, size);
+    } else {
+        size_t step = size / SAMPLES;
+        for (size_t i = 0; i < SAMPLES; i++) {
+            count(data + i * step, SAMPLE_BYTES);
+        }
+    }
+    if (total == 0) return 0.0;
+
+    double entropy = 0.0;
+    for (uint64_t c : counts) {
+        if (c == 0) continue;
+        double p = static_cast<double>(c) / total;
+        entropy -= p * std::log2(p);
+    }
+    return entropy;
+}
+
+// File types that are compressed already (archives, images, media, Office)
+inline bool is_compressed_format(const std::string& name) {
+    static const char* const EXTENSIONS[] = {
+        "zip", "7z", "rar", "gz", "tgz", "bz2", "xz", "zst", "lz4", "cab", "jar", "apk",
+        "jpg", "jpeg", "png", "gif", "webp", "heic", "avif",
+        "mp3", "aac", "ogg", "flac", "m4a", "mp4", "m4v", "mkv", "webm", "avi", "mov",
+        "docx", "xlsx", "pptx", "odt", "pdf"
+    };
+    size_t dot = name.find_last_of('.');
+    if (dot == std::string::npos) return false;
+    std::string ext = name.substr(dot + 1);
+    for (char& c : ext) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    for (const char* known : EXTENSIONS) {
+        if (ext == known) return true;
+    }
+    return false;
+}
+
+// Compresses a buffer in consecutive pieces as one stream: a piece may
+// refer back into earlier pieces, which the decoder still holds. The
+// buffer must stay put (and unchanged) for the encoder's lifetime.
+class LzEncoder {
+public:
+    explicit LzEncoder(const char* base) : base_(reinterpret_cast<const uint8_t*>(base)), table_(size_t(1) << LZ_HASH_BITS, 0) {}
+
+    // Append the encoding of base[pos, pos + size) to out. Pieces must come
+    // in increasing order; gaps are fine (they are simply not matched).
+    void compress(uint64_t pos, size_t size, std::string& out) {
+        const uint8_t* p = base_;
+        uint64_t end = pos + size;
+        uint64_t anchor = pos;
+        uint64_t ip = pos;
+        uint32_t misses = 0;
+
+        while (ip + LZ_MIN_MATCH <= end) {
+            uint32_t value = read32(p + ip);
+            uint64_t& slot = table_[hash(value)];
+            uint64_t candidate = slot;  // position + 1, 0 if empty
+            slot = ip + 1;
+
+            if (candidate && ip - (candidate - 1) <= LZ_WINDOW && read32(p + candidate - 1) == value) {
+                uint64_t ref = candidate - 1;
+                uint64_t len = LZ_MIN_MATCH;
+                while (ip + len < end && p[ref + len] == p[ip + len]) len++;
+
+                emit(out, p + anchor, ip - anchor, ip - ref, len);
+                ip += len;
+                anchor = ip;
+                misses = 0;
+                continue;
+            }
+            // Step faster through data that keeps not matching
+            ip += 1 + (misses++ >> 5);
+        }
+        emit_literals(out, p + anchor, end - anchor);
+    }
+
+private:
+    static uint32_t read32(const uint8_t* p) {
+        uint32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static size_t hash(uint32_t v) {
+        return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+    }
+
+    static void put_length(std::string& out, uint64_t n) {
+        while (n >= 255) {
+            out.push_back(static_cast<char>(255));
+            n -= 255;
+        }
+        out.push_back(static_cast<char>(n));
+    }
+
+    static void emit(std::string& out, const uint8_t* literals, uint64_t literal_count,
+                     uint64_t offset, uint64_t match_len) {
+        uint64_t extra = match_len - LZ_MIN_MATCH;
+        uint8_t token = static_cast<uint8_t>(((std::min)(literal_count, uint64_t(15)) << 4) |
+                                             (std::min)(extra, uint64_t(15)));
+        out.push_back(static_cast<char>(token));
+        if (literal_count >= 15) put_length(out, literal_count - 15);
+        out.append(reinterpret_cast<const char*>(literals), static_cast<size_t>(literal_count));
+        out.push_back(static_cast<char>(offset & 0xFF));
+        out.push_back(static_cast<char>(offset >> 8));
+        if (extra >= 15) put_length(out, extra - 15);
+    }
+
+    // The last sequence: literals only, ended by the end of the input
+    static void emit_literals(std::string& out, const uint8_t* literals, uint64_t count) {
+        out.push_back(static_cast<char>((std::min)(count, uint64_t(15)) << 4));
+        if (count >= 15) put_length(out, count - 15);
+        out.append(reinterpret_cast<const char*>(literals), static_cast<size_t>(count));
+    }
+
+    const uint8_t* base_;
+    std::vector<uint64_t> table_;
+};
+
+// Decodes an LzEncoder stream piece by piece, keeping the last LZ_WINDOW
+// bytes of output for later pieces to refer back to. Raw pieces of the
+// same stream must be passed through append() to keep that history whole.
+class LzDecoder {
+public:
+    // Decode one piece that should expand to exactly raw_size bytes.
+    // False for corrupt input; the new bytes are at data(), size().
+    bool decode(const char* src, size_t size, size_t raw_size) {
+        trim();
+        start_ = window_.size();
+        size_t target = start_ + raw_size;
+        window_.resize(target);
+
+        const uint8_t* ip = reinterpret_cast<const uint8_t*>(src);
+        const uint8_t* end = ip + size;
+        char* w = &window_[0];
+        size_t op = start_;
+
+        auto get_length = [&](size_t& n) {
+            uint8_t b;
+            do {
+                if (ip == end) return false;
+                b = *ip++;
+                n += b;
+            } while (b == 255);
+            return true;
+        };
+
+        while (ip < end) {
+            uint8_t token = *ip++;
+            size_t literals = token >> 4;
+            if (literals == 15 && !get_length(literals)) return fail();
+            if (literals > static_cast<size_t>(end - ip) || literals > target - op) return fail();
+            std::memcpy(w + op, ip, literals);
+            op += literals;
+            ip += literals;
+            if (ip == end) break;
+
+            if (end - ip < 2) return fail();
+            size_t offset = ip[0] | (size_t(ip[1]) << 8);
+            ip += 2;
+            size_t len = (token & 15) + LZ_MIN_MATCH;
+            if ((token & 15) == 15 && !get_length(len)) return fail();
+            if (offset == 0 || offset > op || len > target - op) return fail();
+
+            const char* ref = w + op - offset;
+            if (offset >= len) {
+                std::memcpy(w + op, ref, len);
+            } else {
+                for (size_t i = 0; i < len; i++) w[op + i] = ref[i];  // overlapping: repeats a pattern
+            }
+            op += len;
+        }
+        return op == target || fail();
+    }
+
+    // A piece sent raw
+    void append(const char* data, size_t size) {
+        trim();
+        start_ = window_.size();
+        window_.append(data, size);
+    }
+
+    const char* data() const { return window_.data() + start_; }
+    size_t size() const { return window_.size() - start_; }
+
+private:
+    void trim() {
+        if (window_.size() > 4 * LZ_WINDOW) {
+            window_.erase(0, window_.size() - LZ_WINDOW);
+        }
+    }
+
+    bool fail() {
+        window_.resize(start_);
+        return false;
+    }
+
+    std::string window_;
+    size_t start_ = 0;
+};
+
+// Compresses one transfer chunk by chunk, backing off while the data
+// turns out not to compress
+class ChunkCompressor {
+public:
+    ChunkCompressor(const char* base, bool enabled) : encoder_(base), enabled_(enabled) {}
+
+    // LZ with the encoding in out, or RAW to send the bytes as they are
+    ChunkEncoding encode(uint64_t pos, size_t size, std::string& out) {
+        if (!enabled_) return ChunkEncoding::RAW;
+        if (backoff_ > 0) {
+            backoff_--;
+            return ChunkEncoding::RAW;
+        }
+
+        out.clear();
+        encoder_.compress(pos, size, out);
+        if (out.size() > size * (1.0 - COMPRESS_MIN_SAVING)) {
+            if (++poor_ >= COMPRESS_POOR_LIMIT) {
+                backoff_ = COMPRESS_BACKOFF_CHUNKS;
+                poor_ = 0;
+            }
+            return out.size() < size ? ChunkEncoding::LZ : ChunkEncoding::RAW;
+        }
+        poor_ = 0;
+        return ChunkEncoding::LZ;
+    }
+
+private:
+    LzEncoder encoder_;
+    bool enabled_;
+    int poor_ = 0;
+    int backoff_ = 0;
+};
+
+// Worth trying to compress at all? name is a file name, or empty
+inline bool should_compress(const char* data, size_t size, const std::string& name) {
+    if (size < 256 || is_compressed_format(name)) return false;
+    return sample_entropy(data, size) <= COMPRESS_MAX_ENTROPY;
+}
+
+} // namespace MouseShare
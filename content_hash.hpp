@@ -0,0 +1,81 @@
+#pragma once
+
+#include "common.hpp"
+
+namespace MouseShare {
+
+// MurmurHash3 x64/128 (Austin Appleby, public domain). Not cryptographic:
+// it only has to tell clipboard contents apart, at several GB/s.
+inline ContentHash content_hash(const void* data, size_t size, uint64_t seed = 0) {
+    auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    auto fmix = [](uint64_t k) {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdULL;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ULL;
+        k ^= k >> 33;
+        return k;
+    };
+
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    uint64_t h1 = seed;
+    uint64_t h2 = seed;
+
+    size_t blocks = size / 16;
+    for (size_t i = 0; i < blocks; i++) {
+        uint64_t k1, k2;
+        std::memcpy(&k1, bytes + i * 16, 8);
+        std::memcpy(&k2, bytes + i * 16 + 8, 8);
+
+        k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+        k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    const uint8_t* tail = bytes + blocks * 16;
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+    switch (size & 15) {
+        case 15: k2 ^= uint64_t(tail[14]) << 48; [[fallthrough]];
+        case 14: k2 ^= uint64_t(tail[13]) << 40; [[fallthrough]];
+        case 13: k2 ^= uint64_t(tail[12]) << 32; [[fallthrough]];
+        case 12: k2 ^= uint64_t(tail[11]) << 24; [[fallthrough]];
+        case 11: k2 ^= uint64_t(tail[10]) << 16; [[fallthrough]];
+        case 10: k2 ^= uint64_t(tail[9]) << 8; [[fallthrough]];
+        case 9:
+            k2 ^= uint64_t(tail[8]);
+            k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+            [[fallthrough]];
+        case 8: k1 ^= uint64_t(tail[7]) << 56; [[fallthrough]];
+        case 7: k1 ^= uint64_t(tail[6]) << 48; [[fallthrough]];
+        case 6: k1 ^= uint64_t(tail[5]) << 40; [[fallthrough]];
+        case 5: k1 ^= uint64_t(tail[4]) << 32; [[fallthrough]];
+        case 4: k1 ^= uint64_t(tail[3]) << 24; [[fallthrough]];
+        case 3: k1 ^= uint64_t(tail[2]) << 16; [[fallthrough]];
+        case 2: k1 ^= uint64_t(tail[1]) << 8; [[fallthrough]];
+        case 1:
+            k1 ^= uint64_t(tail[0]);
+            k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+            break;
+    }
+
+    h1 ^= size;
+    h2 ^= size;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix(h1);
+    h2 = fmix(h2);
+    h1 += h2;
+    h2 += h1;
+
+    return ContentHash{h1, h2};
+}
+
+inline ContentHash content_hash(const std::string& data) {
+    return content_hash(data.data(), data.size());
+}
+
+} // namespace MouseShare
@@ -0,0 +1,412 @@
+#pragma once
+
+#include "common.hpp"
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <initializer_list>
+
+#ifdef _WIN32
+#include <bcrypt.h>
+#pragma comment(lib, "bcrypt.lib")
+#endif
+
+namespace MouseShare {
+
+// Connection encryption: AES-256-GCM through Windows CNG, which uses
+// AES-NI and carry-less multiply where the CPU has them. Both ends share a
+// key (--key) and each connection gets its own pair of keys, one per
+// direction, from that key and a random nonce from each side. Frames are
+// sealed in batches: one SECURE_RECORD carries every frame a send() was
+// given, so a burst of motion costs one seal, not one per event.
+//
+// The client can't know the server's nonce before a round trip, so what it
+// must say first (the session hello) goes as early data: sealed under a
+// key from the shared key and its own nonce alone, right behind its hello.
+constexpr size_t SECURE_KEY_BYTES = 32;
+constexpr size_t SECURE_NONCE_BYTES = 12;
+constexpr size_t SECURE_TAG_BYTES = 16;
+constexpr size_t SECURE_MAX_PLAINTEXT = 65535 - SECURE_TAG_BYTES;  // payload_size is 16 bits
+constexpr uint32_t SECURE_PBKDF2_ITERATIONS = 200000;
+constexpr int SECURE_HANDSHAKE_TIMEOUT_MS = 2000;
+
+class CryptoError : public std::runtime_error {
+public:
+    explicit CryptoError(const std::string& msg) : std::runtime_error(msg) {}
+};
+
+// Algorithm providers, opened once per process (CNG handles are thread-safe)
+inline BCRYPT_ALG_HANDLE aes_gcm_provider() {
+    static BCRYPT_ALG_HANDLE provider = [] {
+        BCRYPT_ALG_HANDLE alg = nullptr;
+        if (!BCRYPT_SUCCESS(BCryptOpenAlgorithmProvider(&alg, BCRYPT_AES_ALGORITHM, nullptr, 0)) ||
+            !BCRYPT_SUCCESS(BCryptSetProperty(alg, BCRYPT_CHAINING_MODE, (PUCHAR)BCRYPT_CHAIN_MODE_GCM,
+                                              sizeof(BCRYPT_CHAIN_MODE_GCM), 0))) {
+            throw CryptoError("AES-GCM is not available");
+        }
+        return alg;
+    }();
+    return provider;
+}
+
+inline BCRYPT_ALG_HANDLE hmac_sha256_provider() {
+    static BCRYPT_ALG_HANDLE provider = [] {
+        BCRYPT_ALG_HANDLE alg = nullptr;
+        if (!BCRYPT_SUCCESS(BCryptOpenAlgorithmProvider(&alg, BCRYPT_SHA256_ALGORITHM, nullptr,
+                                                        BCRYPT_ALG_HANDLE_HMAC_FLAG))) {
+            throw CryptoError("HMAC-SHA256 is not available");
+        }
+        return alg;
+    }();
+    return provider;
+}
+
+inline void random_bytes(void* out, size_t size) {
+    if (!BCRYPT_SUCCESS(BCryptGenRandom(nullptr, static_cast<PUCHAR>(out), static_cast<ULONG>(size),
+                                        BCRYPT_USE_SYSTEM_PREFERRED_RNG))) {
+        throw CryptoError("No random numbers");
+    }
+}
+
+// HMAC-SHA256 of the concatenated parts
+inline void hmac_sha256(const uint8_t* key, size_t key_size,
+                        std::initializer_list<std::pair<const void*, size_t>> parts,
+                        uint8_t out[SECURE_KEY_BYTES]) {
+    BCRYPT_HASH_HANDLE hash = nullptr;
+    bool ok = BCRYPT_SUCCESS(BCryptCreateHash(hmac_sha256_provider(), &hash, nullptr, 0,
+                                              const_cast<PUCHAR>(key), static_cast<ULONG>(key_size), 0));
+    for (const auto& part : parts) {
+        ok = ok && BCRYPT_SUCCESS(BCryptHashData(hash, (PUCHAR)part.first, static_cast<ULONG>(part.second), 0));
+    }
+    ok = ok && BCRYPT_SUCCESS(BCryptFinishHash(hash, out, static_cast<ULONG>(SECURE_KEY_BYTES), 0));
+    if (hash) BCryptDestroyHash(hash);
+    if (!ok) throw CryptoError("HMAC failed");
+}
+
+// The shared key. PBKDF2 makes guessing a passphrase from a recorded
+// handshake slow; it runs once at startup, never per connection.
+struct PresharedKey {
+    uint8_t bytes[SECURE_KEY_BYTES] = {};
+    bool set = false;
+};
+
+inline PresharedKey derive_preshared_key(const std::string& passphrase) {
+    static const char SALT[] = "MouseShare preshared key v1";
+
+    PresharedKey key;
+    if (!BCRYPT_SUCCESS(BCryptDeriveKeyPBKDF2(hmac_sha256_provider(),
+                                              (PUCHAR)passphrase.data(), static_cast<ULONG>(passphrase.size()),
+                                              (PUCHAR)SALT, sizeof(SALT) - 1, SECURE_PBKDF2_ITERATIONS,
+                                              key.bytes, sizeof(key.bytes), 0))) {
+        throw CryptoError("Key derivation failed");
+    }
+    key.set = true;
+    return key;
+}
+
+// One AES-256-GCM key with its key object allocated up front, so sealing
+// and opening never allocate
+class AesGcmKey {
+public:
+    explicit AesGcmKey(const uint8_t key[SECURE_KEY_BYTES]) {
+        ULONG object_size = 0;
+        ULONG written = 0;
+        BCryptGetProperty(aes_gcm_provider(), BCRYPT_OBJECT_LENGTH, (PUCHAR)&object_size,
+                          sizeof(object_size), &written, 0);
+        object_.resize(object_size);
+        if (!BCRYPT_SUCCESS(BCryptGenerateSymmetricKey(aes_gcm_provider(), &key_, object_.data(),
+                                                       object_size, const_cast<PUCHAR>(key),
+                                                       static_cast<ULONG>(SECURE_KEY_BYTES), 0))) {
+            throw CryptoError("Cannot create an AES key");
+        }
+    }
+
+    ~AesGcmKey() {
+        if (key_) BCryptDestroyKey(key_);
+    }
+
+    AesGcmKey(const AesGcmKey&) = delete;
+    AesGcmKey& operator=(const AesGcmKey&) = delete;
+
+    // Encrypt size bytes into out, followed by the tag (size + SECURE_TAG_BYTES)
+    bool seal(uint64_t counter, const void* aad, size_t aad_size,
+              const char* in, size_t size, char* out) {
+        uint8_t nonce[SECURE_NONCE_BYTES];
+        BCRYPT_AUTHENTICATED_CIPHER_MODE_INFO info;
+        prepare(info, nonce, counter, aad, aad_size, reinterpret_cast<uint8_t*>(out) + size);
+
+        ULONG written = 0;
+        return BCRYPT_SUCCESS(BCryptEncrypt(key_, (PUCHAR)in, static_cast<ULONG>(size), &info, nullptr, 0,
+                                            (PUCHAR)out, static_cast<ULONG>(size), &written, 0));
+    }
+
+    // Decrypt and authenticate size bytes plus the tag that follows them
+    bool open(uint64_t counter, const void* aad, size_t aad_size,
+              const char* in, size_t size, char* out) {
+        uint8_t nonce[SECURE_NONCE_BYTES];
+        BCRYPT_AUTHENTICATED_CIPHER_MODE_INFO info;
+        prepare(info, nonce, counter, aad, aad_size, (uint8_t*)(in + size));
+
+        ULONG written = 0;
+        return BCRYPT_SUCCESS(BCryptDecrypt(key_, (PUCHAR)in, static_cast<ULONG>(size), &info, nullptr, 0,
+                                            (PUCHAR)out, static_cast<ULONG>(size), &written, 0));
+    }
+
+private:
+    // Each direction has its own key, so the record counter alone makes
+    // every nonce unique
+    static void prepare(BCRYPT_AUTHENTICATED_CIPHER_MODE_INFO& info, uint8_t* nonce, uint64_t counter,
+                        const void* aad, size_t aad_size, uint8_t* tag) {
+        std::memset(nonce, 0, SECURE_NONCE_BYTES);
+        std::memcpy(nonce + SECURE_NONCE_BYTES - sizeof(counter), &counter, sizeof(counter));
+
+        BCRYPT_INIT_AUTH_MODE_INFO(info);
+        info.pbNonce = nonce;
+        info.cbNonce = static_cast<ULONG>(SECURE_NONCE_BYTES);
+        info.pbAuthData = (PUCHAR)aad;
+        info.cbAuthData = static_cast<ULONG>(aad_size);
+        info.pbTag = tag;
+        info.cbTag = static_cast<ULONG>(SECURE_TAG_BYTES);
+    }
+
+    BCRYPT_KEY_HANDLE key_ = nullptr;
+    std::vector<uint8_t> object_;
+};
+
+inline SecureHello make_secure_hello() {
+    SecureHello hello = {};
+    hello.suite = CipherSuite::AES_256_GCM;
+    random_bytes(hello.nonce, sizeof(hello.nonce));
+    return hello;
+}
+
+// Sealing records under one key, numbered from counter on
+inline void seal_records(AesGcmKey& key, uint64_t& counter, const char* data, size_t size, std::string& out) {
+    do {
+        size_t n = (std::min)(size, SECURE_MAX_PLAINTEXT);
+
+        PacketHeader header;
+        header.version = PROTOCOL_VERSION;
+        header.type = EventType::SECURE_RECORD;
+        header.timestamp = get_timestamp();
+        header.payload_size = static_cast<uint16_t>(n + SECURE_TAG_BYTES);
+
+        size_t at = out.size();
+        out.resize(at + sizeof(header) + n + SECURE_TAG_BYTES);
+        std::memcpy(&out[at], &header, sizeof(header));
+        if (!key.seal(counter++, &header, sizeof(header), data, n, &out[at + sizeof(header)])) {
+            throw CryptoError("Encryption failed");
+        }
+        g_metrics.count(Counter::RECORDS_SEALED);
+
+        data += n;
+        size -= n;
+    } while (size > 0);
+}
+
+// HMAC(key, "MouseShare early" || initiator nonce)
+inline void early_data_key(const PresharedKey& key, const SecureHello& initiator, uint8_t out[SECURE_KEY_BYTES]) {
+    static const char EARLY[] = "MouseShare early";
+    hmac_sha256(key.bytes, sizeof(key.bytes), {
+        {EARLY, sizeof(EARLY) - 1},
+        {initiator.nonce, sizeof(initiator.nonce)}
+    }, out);
+}
+
+// Early data: whole frames the initiator sends right behind its hello,
+// which gets their record count. Anyone holding the key can open them as
+// soon as they arrive, and so could a replay of the same bytes: only send
+// what is harmless to receive twice.
+inline std::string seal_early_data(const PresharedKey& key, SecureHello& initiator, const std::string& frames) {
+    std::string records;
+    if (frames.empty()) {
+        initiator.early_records = 0;
+        return records;
+    }
+    if (frames.size() > 255 * SECURE_MAX_PLAINTEXT) {
+        throw CryptoError("Too much early data");
+    }
+
+    uint8_t bytes[SECURE_KEY_BYTES];
+    early_data_key(key, initiator, bytes);
+    AesGcmKey early(bytes);
+    uint64_t counter = 0;
+    seal_records(early, counter, frames.data(), frames.size(), records);
+    initiator.early_records = static_cast<uint8_t>(counter);
+    return records;
+}
+
+// Seals frames into SECURE_RECORD frames and opens them again for one
+// connection. Sending and receiving may run on different threads, but
+// each on one at a time. Records must arrive in the order they were
+// sealed (TCP), since the nonce is the record's number.
+class FrameCipher {
+public:
+    // initiator is the side that connected; both sides pass the same hellos
+    FrameCipher(const PresharedKey& key, const SecureHello& initiator, const SecureHello& responder,
+                bool is_initiator)
+        : send_key_(direction_key(key, initiator, responder, is_initiator).bytes),
+          recv_key_(direction_key(key, initiator, responder, !is_initiator).bytes) {
+        if (!is_initiator) {
+            uint8_t bytes[SECURE_KEY_BYTES];
+            early_data_key(key, initiator, bytes);
+            early_key_ = std::make_unique<AesGcmKey>(bytes);
+        }
+        sealed_.reserve(sizeof(PacketHeader) + SECURE_MAX_PLAINTEXT + SECURE_TAG_BYTES);
+        inbox_.reserve(2 * (sizeof(PacketHeader) + SECURE_MAX_PLAINTEXT));
+    }
+
+    // The peer's first record must start with our hello sent back, which
+    // proves it derived the same keys; open() checks and removes it
+    void expect_confirmation(const SecureHello& mine) {
+        confirm_ = mine;
+        confirmed_ = false;
+    }
+
+    bool confirmed() const { return confirmed_; }
+
+    // Encrypt size bytes of whole frames. The records (one, unless the
+    // frames don't fit in 64 KB) are valid until the next call.
+    const std::string& seal(const char* data, size_t size) {
+        sealed_.clear();
+        seal_records(send_key_, send_counter_, data, size, sealed_);
+        return sealed_;
+    }
+
+    // Authenticate and decrypt one SECURE_RECORD frame; what it carried
+    // comes out of next_frame(). False if it was forged, damaged, replayed
+    // or sealed with another key: the connection can't be trusted after that.
+    bool open(const std::string& record) {
+        size_t at = 0;
+        if (!open_with(recv_key_, recv_counter_, record, at)) {
+            return false;
+        }
+        if (confirmed_) {
+            return true;
+        }
+
+        constexpr size_t CONFIRM_SIZE = sizeof(PacketHeader) + sizeof(SecureHello);
+        bool ok = inbox_.size() - at >= CONFIRM_SIZE;
+        if (ok) {
+            PacketHeader header;
+            std::memcpy(&header, inbox_.data() + at, sizeof(header));
+            ok = header.type == EventType::SECURE_HELLO && header.payload_size == sizeof(SecureHello) &&
+                 std::memcmp(inbox_.data() + at + sizeof(header), &confirm_, sizeof(confirm_)) == 0;
+        }
+        if (!ok) {
+            inbox_.resize(at);
+            g_metrics.count(Counter::RECORDS_REJECTED);
+            return false;
+        }
+        inbox_.erase(at, CONFIRM_SIZE);
+        confirmed_ = true;
+        return true;
+    }
+
+    // One record of the initiator's early data (responder only). Opened
+    // frames come out of next_frame() ahead of everything after them.
+    bool open_early(const std::string& record) {
+        size_t at = 0;
+        return early_key_ && open_with(*early_key_, early_counter_, record, at);
+    }
+
+    // True once a whole frame has been opened
+    bool has_frame() const {
+        size_t available = inbox_.size() - inbox_pos_;
+        if (available < sizeof(PacketHeader)) return false;
+
+        PacketHeader header;
+        std::memcpy(&header, inbox_.data() + inbox_pos_, sizeof(header));
+        return available >= sizeof(header) + header.payload_size;
+    }
+
+    // The type of the next frame, without taking it; false if none yet
+    bool peek_type(EventType& type) const {
+        if (!has_frame()) return false;
+
+        PacketHeader header;
+        std::memcpy(&header, inbox_.data() + inbox_pos_, sizeof(header));
+        type = header.type;
+        return true;
+    }
+
+    // Take the next frame (check has_frame() first)
+    bool next_frame(std::string& frame) {
+        if (!has_frame()) return false;
+
+        PacketHeader header;
+        std::memcpy(&header, inbox_.data() + inbox_pos_, sizeof(header));
+        if (header.version != PROTOCOL_VERSION) return false;
+
+        size_t size = sizeof(header) + header.payload_size;
+        frame.assign(inbox_, inbox_pos_, size);
+        inbox_pos_ += size;
+        return true;
+    }
+
+private:
+    struct DirectionKey {
+        uint8_t bytes[SECURE_KEY_BYTES];
+    };
+
+    // HMAC(key, label || initiator nonce || responder nonce)
+    static DirectionKey direction_key(const PresharedKey& key, const SecureHello& initiator,
+                                      const SecureHello& responder, bool from_initiator) {
+        static const char INITIATOR[] = "MouseShare initiator";
+        static const char RESPONDER[] = "MouseShare responder";
+
+        DirectionKey out;
+        hmac_sha256(key.bytes, sizeof(key.bytes), {
+            {from_initiator ? INITIATOR : RESPONDER, sizeof(INITIATOR) - 1},
+            {initiator.nonce, sizeof(initiator.nonce)},
+            {responder.nonce, sizeof(responder.nonce)}
+        }, out.bytes);
+        return out;
+    }
+
+    // Open a record into the inbox, where its plaintext starts at at
+    bool open_with(AesGcmKey& key, uint64_t& counter, const std::string& record, size_t& at) {
+        if (record.size() < sizeof(PacketHeader) + SECURE_TAG_BYTES ||
+            frame_type(record) != EventType::SECURE_RECORD) {
+            return false;
+        }
+
+        // Drop what was handed out; usually everything
+        if (inbox_pos_ == inbox_.size()) {
+            inbox_.clear();
+            inbox_pos_ = 0;
+        } else if (inbox_pos_ > SECURE_MAX_PLAINTEXT) {
+            inbox_.erase(0, inbox_pos_);
+            inbox_pos_ = 0;
+        }
+
+        size_t n = record.size() - sizeof(PacketHeader) - SECURE_TAG_BYTES;
+        at = inbox_.size();
+        inbox_.resize(at + n);
+        if (!key.open(counter, record.data(), sizeof(PacketHeader),
+                      record.data() + sizeof(PacketHeader), n, &inbox_[at])) {
+            inbox_.resize(at);
+            g_metrics.count(Counter::RECORDS_REJECTED);
+            return false;
+        }
+        counter++;
+        return true;
+    }
+
+    AesGcmKey send_key_;
+    AesGcmKey recv_key_;
+    std::unique_ptr<AesGcmKey> early_key_;  // responder only
+    uint64_t send_counter_ = 0;
+    uint64_t recv_counter_ = 0;
+    uint64_t early_counter_ = 0;
+    SecureHello confirm_ = {};
+    bool confirmed_ = true;  // until expect_confirmation()
+    std::string sealed_;
+    std::string inbox_;      // opened bytes, from inbox_pos_ on not yet taken
+    size_t inbox_pos_ = 0;
+};
+
+} // namespace MouseShare
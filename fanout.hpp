@@ -0,0 +1,300 @@
+#pragma once
+
+#include "common.hpp"
+#include "network.hpp"
+#include <memory>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <iterator>
+
+namespace MouseShare {
+
+// Immutable wire frame (PacketHeader + payload). Shared between all peers
+// it is queued to, so fanning out never copies the bytes.
+using SharedFrame = std::shared_ptr<const std::string>;
+
+inline SharedFrame make_shared_frame(std::string frame) {
+    return std::make_shared<const std::string>(std::move(frame));
+}
+
+// Snapshot of a peer's send queue
+struct PeerStats {
+    size_t queued_frames = 0;
+    uint64_t lag_us = 0;           // age of the oldest queued frame
+    uint64_t sent_frames = 0;
+    uint64_t merged_frames = 0;    // queued moves folded into another on overflow
+    uint64_t avg_latency_us = 0;   // enqueue -> send completed
+    uint64_t max_latency_us = 0;
+};
+
+// One downstream connection with its own queue and writer thread, so a slow
+// peer only ever delays itself. A reader thread drains what the peer sends
+// (pong replies, clipboard offers), which nobody here uses, so its socket
+// buffers never fill, and notices the moment it disconnects.
+class FanoutPeer {
+public:
+    FanoutPeer(Socket sock, std::string name, size_t max_queue = 1024)
+        : sock_(std::move(sock)), name_(std::move(name)), max_queue_(max_queue) {}
+
+    ~FanoutPeer() {
+        stop();
+    }
+
+    FanoutPeer(const FanoutPeer&) = delete;
+    FanoutPeer& operator=(const FanoutPeer&) = delete;
+
+    void start() {
+        running_ = true;
+        writer_thread_ = std::thread(&FanoutPeer::writer_thread_func, this);
+        reader_thread_ = std::thread(&FanoutPeer::reader_thread_func, this);
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_ = false;
+        }
+        cv_.notify_all();
+        
+        // Unblock a writer stuck in send() on a stalled connection, and the reader
+        sock_.shutdown();
+        if (writer_thread_.joinable()) {
+            writer_thread_.join();
+        }
+        if (reader_thread_.joinable()) {
+            reader_thread_.join();
+        }
+        sock_.close();
+    }
+
+    // Queue a frame. When the queue is full, each run of queued motion is
+    // merged into one move (clients apply dx/dy, so none of it may be lost);
+    // a peer that is still full of key/button frames is disconnected rather
+    // than silently losing a release.
+    void enqueue(const SharedFrame& frame, uint64_t received_us) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!alive_) return;
+
+            if (queue_.size() >= max_queue_) {
+                merge_motion();
+
+                if (queue_.size() >= max_queue_) {
+                    alive_ = false;
+                    queue_.clear();
+                    cv_.notify_all();
+                    return;
+                }
+            }
+
+            queue_.push_back({frame, received_us});
+        }
+        cv_.notify_one();
+    }
+
+    bool is_alive() const { return alive_; }
+    const std::string& name() const { return name_; }
+
+    PeerStats stats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        PeerStats s;
+        s.queued_frames = queue_.size();
+        s.lag_us = queue_.empty() ? 0 : get_timestamp_us() - queue_.front().received_us;
+        s.sent_frames = sent_frames_;
+        s.merged_frames = merged_frames_;
+        s.avg_latency_us = sent_frames_ ? total_latency_us_ / sent_frames_ : 0;
+        s.max_latency_us = max_latency_us_;
+        return s;
+    }
+
+    // Reset the max latency window (used for periodic reporting)
+    void reset_max_latency() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        max_latency_us_ = 0;
+    }
+
+private:
+    struct Pending {
+        SharedFrame frame;
+        uint64_t received_us;
+    };
+
+    // Replace each run of consecutive MOUSE_MOVE frames with one move that
+    // sums dx/dy and keeps the last x/y. Runs stay where they were, so no
+    // click moves to the other side of the motion before it. The merged
+    // move keeps the run's oldest receive time, which is what it waited.
+    void merge_motion() {
+        std::deque<Pending> merged;
+        auto it = queue_.begin();
+        while (it != queue_.end()) {
+            if (frame_type(*it->frame) != EventType::MOUSE_MOVE) {
+                merged.push_back(std::move(*it++));
+                continue;
+            }
+
+            auto run_end = std::find_if(it, queue_.end(),
+                [](const Pending& p) { return frame_type(*p.frame) != EventType::MOUSE_MOVE; });
+            if (std::distance(it, run_end) == 1) {
+                merged.push_back(std::move(*it++));
+                continue;
+            }
+
+            MouseMoveEvent move = {};
+            for (auto run = it; run != run_end; ++run) {
+                MouseMoveEvent event;
+                std::memcpy(&event, run->frame->data() + sizeof(PacketHeader), sizeof(event));
+                move.x = event.x;
+                move.y = event.y;
+                move.dx += event.dx;
+                move.dy += event.dy;
+            }
+
+            merged_frames_ += std::distance(it, run_end) - 1;
+            merged.push_back({make_shared_frame(serialize_packet(EventType::MOUSE_MOVE, move)), it->received_us});
+            it = run_end;
+        }
+        queue_.swap(merged);
+    }
+
+    void writer_thread_func() {
+        while (true) {
+            Pending item;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return !running_ || !alive_ || !queue_.empty(); });
+                if (!running_ || !alive_) break;
+                item = std::move(queue_.front());
+                queue_.pop_front();
+            }
+
+            int sent = sock_.send(*item.frame);
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (sent <= 0) {
+                alive_ = false;
+                queue_.clear();
+                break;
+            }
+
+            uint64_t latency = get_timestamp_us() - item.received_us;
+            sent_frames_++;
+            total_latency_us_ += latency;
+            max_latency_us_ = (std::max)(max_latency_us_, latency);
+        }
+    }
+
+    void reader_thread_func() {
+        std::string frame;
+        while (sock_.recv_frame(frame)) {
+            // Nothing a downstream peer sends is forwarded
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        alive_ = false;
+        queue_.clear();
+        cv_.notify_all();
+    }
+
+    Socket sock_;
+    std::string name_;
+    size_t max_queue_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Pending> queue_;
+    std::thread writer_thread_;
+    std::thread reader_thread_;
+    bool running_ = false;
+    std::atomic<bool> alive_{true};
+
+    uint64_t sent_frames_ = 0;
+    uint64_t merged_frames_ = 0;
+    uint64_t total_latency_us_ = 0;
+    uint64_t max_latency_us_ = 0;
+};
+
+// A set of peers that all receive the same frames
+class FanoutGroup {
+public:
+    // first is queued to the new peer ahead of anything broadcast later
+    void add(Socket sock, const std::string& name, const std::vector<SharedFrame>& first = {}) {
+        auto peer = std::make_unique<FanoutPeer>(std::move(sock), name);
+        for (const auto& frame : first) {
+            peer->enqueue(frame, get_timestamp_us());
+        }
+        peer->start();
+        std::lock_guard<std::mutex> lock(mutex_);
+        peers_.push_back(std::move(peer));
+    }
+
+    // Queue one frame to every live peer; returns the number of peers reached
+    size_t broadcast(const SharedFrame& frame, uint64_t received_us = get_timestamp_us()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t count = 0;
+        for (auto& peer : peers_) {
+            if (peer->is_alive()) {
+                peer->enqueue(frame, received_us);
+                count++;
+            }
+        }
+        return count;
+    }
+
+    // Remove disconnected peers, returning their names
+    std::vector<std::string> prune() {
+        std::vector<std::unique_ptr<FanoutPeer>> dead;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = std::partition(peers_.begin(), peers_.end(),
+                [](const std::unique_ptr<FanoutPeer>& p) { return p->is_alive(); });
+            std::move(it, peers_.end(), std::back_inserter(dead));
+            peers_.erase(it, peers_.end());
+        }
+
+        // Join writer threads outside the group lock
+        std::vector<std::string> names;
+        for (auto& peer : dead) {
+            names.push_back(peer->name());
+            peer->stop();
+        }
+        return names;
+    }
+
+    void clear() {
+        std::vector<std::unique_ptr<FanoutPeer>> peers;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            peers.swap(peers_);
+        }
+        for (auto& peer : peers) {
+            peer->stop();
+        }
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return peers_.size();
+    }
+
+    // Per-peer stats; resets each peer's max latency window
+    std::vector<std::pair<std::string, PeerStats>> collect_stats() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<std::pair<std::string, PeerStats>> result;
+        for (auto& peer : peers_) {
+            result.emplace_back(peer->name(), peer->stats());
+            peer->reset_max_latency();
+        }
+        return result;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<FanoutPeer>> peers_;
+};
+
+} // namespace MouseShare
@@ -0,0 +1,179 @@
+#pragma once
+
+#include "common.hpp"
+#include "channel.hpp"
+#include "content_hash.hpp"
+#include "mapped_file.hpp"
+#include <string>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+namespace MouseShare {
+
+// Name of a received file with anything that could leave the target
+// directory (or that Windows rejects) replaced
+inline std::string safe_file_name(const std::string& name) {
+    std::string base = name.substr(name.find_last_of("/\\:") + 1);
+    for (char& c : base) {
+        if (static_cast<unsigned char>(c) < 32 || std::strchr("<>\"|?*", c)) c = '_';
+    }
+    if (base.empty() || base == "." || base == "..") base = "file";
+    return base;
+}
+
+inline bool file_exists(const std::string& path) {
+    return std::ifstream(path, std::ios::binary).good();
+}
+
+inline uint64_t file_size(const std::string& path) {
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    return in ? static_cast<uint64_t>(in.tellg()) : 0;
+}
+
+// Send a file to the peer. It is mapped rather than read, so chunks are
+// copied straight from the page cache into frames. The transfer resumes
+// by itself after a reconnect. Hashes the whole file first: call it off
+// any thread that must stay responsive.
+inline bool send_file(ChannelMux& channels, const std::string& path) {
+    auto file = std::make_shared<MappedFile>();
+    if (!file->open_read(path)) {
+        std::cerr << "Cannot send " << path << " (missing, empty or a folder)\n";
+        return false;
+    }
+
+    ChannelSource source;
+    source.data = static_cast<const char*>(file->data());
+    source.size = file->size();
+    ContentHash hash = content_hash(source.data, file->size());
+    source.keep = std::move(file);
+    return channels.send(ChannelKind::FILE, hash, std::move(source), safe_file_name(path), true);
+}
+
+// Accepts files from the peer into a directory (or refuses them all when
+// there is none). A file arrives as <name>.<hash>.part and is renamed once
+// its hash checks out; a part left by an interrupted transfer of the same
+// content is where the next attempt resumes.
+class FileReceiver {
+public:
+    explicit FileReceiver(ChannelMux& channels) {
+        channels.set_acceptor(ChannelKind::FILE, [this](const ChannelOpen& open, const std::string& name) {
+            return accept(open, name);
+        });
+    }
+
+    // Empty refuses incoming files
+    void set_directory(const std::string& directory) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        directory_ = directory;
+    }
+
+    std::string directory() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return directory_;
+    }
+
+private:
+    class FileSink : public ChannelSink {
+    public:
+        FileSink(const std::string& part_path, const std::string& final_path,
+                 const ContentHash& hash, uint64_t total)
+            : part_path_(part_path), final_path_(final_path), hash_(hash) {
+            resume_ = file_size(part_path);
+            if (resume_ > total) resume_ = 0;  // not ours after all: start over
+            out_.open(part_path, std::ios::binary | (resume_ ? std::ios::app : std::ios::trunc));
+        }
+
+        bool is_open() const { return out_.is_open(); }
+
+        uint64_t resume_offset() override { return resume_; }
+
+        bool write(const char* data, size_t size) override {
+            out_.write(data, static_cast<std::streamsize>(size));
+            return out_.good();
+        }
+
+        bool finish() override {
+            out_.close();
+
+            // Check what actually landed on disk, not what we meant to write
+            MappedFile written;
+            ContentHash hash = written.open_read(part_path_)
+                ? content_hash(written.data(), written.size())
+                : content_hash(nullptr, 0);
+            written.close();
+            if (hash != hash_) {
+                std::cerr << "Received " << final_path_ << " failed its hash check\n";
+                std::remove(part_path_.c_str());
+                return false;
+            }
+
+            std::string path = unused_path(final_path_);
+            if (std::rename(part_path_.c_str(), path.c_str()) != 0) {
+                std::cerr << "Cannot rename " << part_path_ << " to " << path << "\n";
+                return false;
+            }
+            g_metrics.count(Counter::FILES_RECEIVED);
+            std::cout << "Received " << path << "\n";
+            return true;
+        }
+
+        // Keep the part: the sender reopens the transfer on reconnect
+        void abandon() override {
+            out_.close();
+        }
+
+    private:
+        // "name.ext", then "name (1).ext", "name (2).ext", ...
+        static std::string unused_path(const std::string& path) {
+            size_t slash = path.find_last_of("/\\");
+            size_t dot = path.find_last_of('.');
+            if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) dot = path.size();
+
+            std::string candidate = path;
+            for (int i = 1; file_exists(candidate); i++) {
+                candidate = path.substr(0, dot) + " (" + std::to_string(i) + ")" + path.substr(dot);
+            }
+            return candidate;
+        }
+
+        std::string part_path_;
+        std::string final_path_;
+        ContentHash hash_;
+        uint64_t resume_ = 0;
+        std::ofstream out_;
+    };
+
+    std::unique_ptr<ChannelSink> accept(const ChannelOpen& open, const std::string& name) {
+        std::string directory = this->directory();
+        if (directory.empty()) return nullptr;
+
+        char tag[40];
+        std::snprintf(tag, sizeof(tag), ".%016llx%016llx.part",
+                      static_cast<unsigned long long>(open.hash.hi),
+                      static_cast<unsigned long long>(open.hash.lo));
+        std::string final_path = directory + "\\" + safe_file_name(name);
+
+        uint64_t total = open.total;
+        auto sink = std::make_unique<FileSink>(final_path + tag, final_path, open.hash, total);
+        if (!sink->is_open()) {
+            std::cerr << "Cannot write to " << directory << "\n";
+            return nullptr;
+        }
+        return sink;
+    }
+
+    mutable std::mutex mutex_;
+    std::string directory_;
+};
+
+// Where files go unless told otherwise: the user's Downloads folder
+inline std::string default_receive_directory() {
+    const char* profile = std::getenv("USERPROFILE");
+    return profile ? std::string(profile) + "\\Downloads" : std::string();
+}
+
+} // namespace MouseShare
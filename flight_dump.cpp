@@ -0,0 +1,182 @@
+#include "common.hpp"
+#include "trace.hpp"
+#include "flight_recorder.hpp"
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <ctime>
+
+using namespace MouseShare;
+
+// Plain copy of a FlightRecord, as read from the file
+struct Entry {
+    uint64_t ts_us;
+    uint32_t seq;
+    uint8_t stage;
+    uint8_t type;
+    uint16_t queue_depth;
+    uint32_t latency_us;
+};
+
+static bool read_flight_file(const std::string& path, FlightHeader& header, std::vector<Entry>& entries) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::cerr << "Cannot open " << path << "\n";
+        return false;
+    }
+
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!in || header.magic != FLIGHT_MAGIC) {
+        std::cerr << path << " is not a flight recorder file\n";
+        return false;
+    }
+    if (header.version != FLIGHT_VERSION || header.record_size != sizeof(FlightRecord)) {
+        std::cerr << path << " was written by an incompatible version\n";
+        return false;
+    }
+
+    std::vector<FlightRecord> records(header.capacity);
+    in.read(reinterpret_cast<char*>(records.data()), records.size() * sizeof(FlightRecord));
+    if (!in) {
+        std::cerr << path << " is truncated\n";
+        return false;
+    }
+
+    // A live ring may have wrapped; skip slots that were being rewritten
+    uint64_t head = header.head.load(std::memory_order_relaxed);
+    uint64_t first = head > header.capacity ? head - header.capacity : 0;
+    for (uint64_t slot = first; slot < head; slot++) {
+        const FlightRecord& r = records[slot % header.capacity];
+        if (r.commit.load(std::memory_order_relaxed) != static_cast<uint32_t>(slot + 1)) continue;
+        entries.push_back({r.ts_us, r.seq, r.stage, r.type, r.queue_depth, r.latency_us});
+    }
+
+    // Threads claim slots slightly out of time order
+    std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.ts_us < b.ts_us;
+    });
+    return true;
+}
+
+// hh:mm:ss.uuuuuu local time
+static std::string format_time(int64_t wall_us) {
+    std::time_t seconds = static_cast<std::time_t>(wall_us / 1000000);
+    std::tm local = {};
+#ifdef _WIN32
+    localtime_s(&local, &seconds);
+#else
+    localtime_r(&seconds, &local);
+#endif
+    char buf[32];
+    std::strftime(buf, sizeof(buf), "%H:%M:%S", &local);
+
+    char out[48];
+    std::snprintf(out, sizeof(out), "%s.%06d", buf, static_cast<int>(wall_us % 1000000));
+    return out;
+}
+
+static const char* stage_name(uint8_t stage) {
+    if (stage == FLIGHT_STAGE_SPIKE) return "SPIKE";
+    return trace_stage_name(static_cast<TraceStage>(stage));
+}
+
+void print_usage(const char* program) {
+    std::cout << "Usage: " << program << " <file.flight> [options]\n"
+              << "Prints the timeline in a flight recorder ring or dump.\n"
+              << "Options:\n"
+              << "  -s, --seconds N      Only the last N seconds\n"
+              << "  -e, --event SEQ      Only the stages of one event\n"
+              << "  -h, --help           Show this help\n";
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    std::string path;
+    double seconds = 0;
+    int64_t only_event = -1;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "-h" || arg == "--help") {
+            print_usage(argv[0]);
+            return 0;
+        } else if ((arg == "-s" || arg == "--seconds") && i + 1 < argc) {
+            seconds = std::stod(argv[++i]);
+        } else if ((arg == "-e" || arg == "--event") && i + 1 < argc) {
+            only_event = std::stoll(argv[++i]);
+        } else if (path.empty() && arg[0] != '-') {
+            path = arg;
+        }
+    }
+
+    FlightHeader header;
+    std::vector<Entry> entries;
+    if (path.empty() || !read_flight_file(path, header, entries)) {
+        return 1;
+    }
+
+    std::cout << path << ": pid " << header.pid << ", " << entries.size() << " records";
+    if (entries.empty()) {
+        std::cout << "\n";
+        return 0;
+    }
+
+    uint64_t newest = entries.back().ts_us;
+    uint64_t cutoff = seconds > 0 ? newest - static_cast<uint64_t>(seconds * 1e6) : 0;
+    std::cout << ", " << format_time(header.wall_offset_us + entries.front().ts_us)
+              << " - " << format_time(header.wall_offset_us + newest) << "\n\n";
+
+    // First stamp of each event, to show how far along it is, and its type
+    // (the hook and send stages don't know it)
+    std::map<uint32_t, uint64_t> event_start;
+    std::map<uint32_t, uint8_t> event_type;
+    for (const auto& e : entries) {
+        if (e.stage == FLIGHT_STAGE_SPIKE) continue;
+        event_start.emplace(e.seq, e.ts_us);
+        if (e.type) event_type[e.seq] = e.type;
+    }
+
+    std::cout << std::left << std::setw(17) << "time" << std::right << std::setw(10) << "gap_us"
+              << std::setw(10) << "event" << "  " << std::left << std::setw(9) << "stage"
+              << std::setw(16) << "type" << std::right << std::setw(10) << "since_us"
+              << std::setw(7) << "queue" << "\n";
+
+    uint64_t previous = 0;
+    int spikes = 0;
+    for (const auto& e : entries) {
+        if (e.ts_us < cutoff) continue;
+        bool spike = e.stage == FLIGHT_STAGE_SPIKE;
+        if (only_event >= 0 && e.seq != only_event) continue;
+
+        uint64_t gap = previous ? e.ts_us - previous : 0;
+        previous = e.ts_us;
+
+        std::cout << std::left << std::setw(17) << format_time(header.wall_offset_us + e.ts_us)
+                  << std::right << std::setw(10) << gap;
+        if (spike) spikes++;
+
+        std::cout << std::setw(10) << e.seq << "  " << std::left << std::setw(9) << stage_name(e.stage)
+                  << std::setw(16) << (event_type.count(e.seq) ? event_type_name(static_cast<EventType>(event_type[e.seq])) : "-")
+                  << std::right << std::setw(10) << (spike ? e.latency_us : e.ts_us - event_start[e.seq])
+                  << std::setw(7);
+        if (e.queue_depth) {
+            std::cout << e.queue_depth;
+        } else {
+            std::cout << "";
+        }
+        std::cout << "\n";
+    }
+
+    if (spikes > 0) {
+        std::cout << "\n" << spikes << " latency spike(s) over " << FLIGHT_SPIKE_US / 1000 << " ms\n";
+    }
+    return 0;
+}
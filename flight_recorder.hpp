@@ -0,0 +1,316 @@
+#pragma once
+
+#include "common.hpp"
+#include "mapped_file.hpp"
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <ctime>
+
+namespace MouseShare {
+
+constexpr uint64_t FLIGHT_MAGIC = 0x544847494c46534dULL;   // "MSFLIGHT"
+constexpr uint32_t FLIGHT_VERSION = 1;
+constexpr uint32_t FLIGHT_RING_RECORDS = 65536;           // ~20 s at 1000 Hz motion
+constexpr uint32_t FLIGHT_SPIKE_US = 30000;               // in-process latency that trips a dump
+constexpr uint32_t FLIGHT_DUMP_WINDOW_S = 10;             // seconds frozen into a dump
+constexpr uint32_t FLIGHT_DUMP_DELAY_MS = 500;            // keep recording the aftermath first
+constexpr uint64_t FLIGHT_MIN_DUMP_INTERVAL_US = 10000000;
+constexpr uint32_t FLIGHT_BEGIN_SLOTS = 4096;             // events in flight at once
+
+// One bit per consumer of trace stamps, so the trace helpers skip
+// everything with a single load while nothing is listening
+enum : uint32_t {
+    TRACE_SINK_TRACER = 1,
+    TRACE_SINK_FLIGHT = 2
+};
+
+inline std::atomic<uint32_t> g_trace_sinks{0};
+
+// Stage value of the marker written when the spike detector trips;
+// ordinary records use TraceStage values
+constexpr uint8_t FLIGHT_STAGE_SPIKE = 0xff;
+
+// Layout shared by the live ring and frozen dumps. A dump is the same
+// header followed by its records oldest first, with head == capacity.
+struct FlightHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t capacity;
+    uint32_t pid;
+    int64_t wall_offset_us;     // add to ts_us for microseconds since the Unix epoch
+    std::atomic<uint64_t> head; // records ever written
+};
+
+struct FlightRecord {
+    uint64_t ts_us;
+    uint32_t seq;               // event id (trace id)
+    std::atomic<uint32_t> commit; // low 32 bits of slot index + 1 once the record is complete
+    uint8_t stage;
+    uint8_t type;
+    uint16_t queue_depth;
+    uint32_t latency_us;        // spike markers: the event's latency so far
+};
+
+// Always-on black box. Every traced stage of every event goes into a
+// fixed-size ring in a memory-mapped file, so the ring survives a crash and
+// can be read while the process runs. Writers claim a slot with one atomic
+// add and never block. When an event takes longer than FLIGHT_SPIKE_US from
+// its first to its last stage in this process (or on demand) a background
+// thread freezes the last FLIGHT_DUMP_WINDOW_S seconds into a dump file next
+// to the ring.
+class FlightRecorder {
+public:
+    ~FlightRecorder() {
+        close();
+    }
+
+    bool open(const std::string& path) {
+        close();
+
+        size_t size = sizeof(FlightHeader) + sizeof(FlightRecord) * FLIGHT_RING_RECORDS;
+        if (!file_.create(path, size)) {
+            std::cerr << "Flight recorder disabled: cannot map " << path << "\n";
+            return false;
+        }
+
+        path_ = path;
+        header_ = new (file_.data()) FlightHeader();
+        records_ = reinterpret_cast<FlightRecord*>(static_cast<char*>(file_.data()) + sizeof(FlightHeader));
+        for (uint32_t i = 0; i < FLIGHT_RING_RECORDS; i++) {
+            new (&records_[i]) FlightRecord();
+        }
+
+        header_->magic = FLIGHT_MAGIC;
+        header_->version = FLIGHT_VERSION;
+        header_->record_size = sizeof(FlightRecord);
+        header_->capacity = FLIGHT_RING_RECORDS;
+#ifdef _WIN32
+        header_->pid = GetCurrentProcessId();
+#else
+        header_->pid = static_cast<uint32_t>(getpid());
+#endif
+        header_->wall_offset_us = wall_clock_us() - static_cast<int64_t>(get_timestamp_us());
+
+        running_ = true;
+        dump_thread_ = std::thread(&FlightRecorder::dump_thread_func, this);
+        g_trace_sinks.fetch_or(TRACE_SINK_FLIGHT, std::memory_order_release);
+        return true;
+    }
+
+    void close() {
+        g_trace_sinks.fetch_and(~TRACE_SINK_FLIGHT, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_ = false;
+        }
+        cv_.notify_all();
+        if (dump_thread_.joinable()) {
+            dump_thread_.join();
+        }
+        file_.close();
+        header_ = nullptr;
+        records_ = nullptr;
+    }
+
+    bool enabled() const {
+        return (g_trace_sinks.load(std::memory_order_relaxed) & TRACE_SINK_FLIGHT) != 0;
+    }
+
+    void record(uint8_t stage, uint8_t type, uint32_t seq, uint16_t queue_depth = 0) {
+        if (!enabled()) return;
+        uint64_t now = get_timestamp_us();
+        append(now, stage, type, seq, queue_depth);
+    }
+
+    // First stage of an event in this process; remembered for the spike check
+    void begin(uint8_t stage, uint8_t type, uint32_t seq) {
+        if (!enabled()) return;
+        uint64_t now = get_timestamp_us();
+        begin_us_[seq % FLIGHT_BEGIN_SLOTS].store(now, std::memory_order_relaxed);
+        append(now, stage, type, seq, 0);
+    }
+
+    // Last stage of an event in this process. Trips the spike detector if
+    // the event took too long since begin(); only the first finish of an
+    // event is checked, so stale ids reused by later sends can't trip it.
+    void finish(uint8_t stage, uint8_t type, uint32_t seq) {
+        if (!enabled()) return;
+        uint64_t now = get_timestamp_us();
+        append(now, stage, type, seq, 0);
+
+        uint64_t started = begin_us_[seq % FLIGHT_BEGIN_SLOTS].exchange(0, std::memory_order_relaxed);
+        if (started == 0 || now < started) return;
+        uint64_t latency = now - started;
+        if (latency >= FLIGHT_SPIKE_US) {
+            append(now, FLIGHT_STAGE_SPIKE, type, seq, 0, static_cast<uint32_t>(latency));
+            trigger();
+        }
+    }
+
+    // Freeze the recent past into a dump file. Spike dumps are rate limited;
+    // on-demand ones are not. Lock-free, so it can be called from a hook
+    // procedure or a console handler.
+    void trigger(bool on_demand = false) {
+        if (!enabled()) return;
+        if (on_demand) on_demand_.store(true, std::memory_order_relaxed);
+        dump_requested_.store(true, std::memory_order_release);
+        cv_.notify_one();
+    }
+
+    const std::string& path() const { return path_; }
+
+    // <temp dir>/mouse-share-<role>.flight
+    static std::string default_path(const std::string& role) {
+#ifdef _WIN32
+        char temp[MAX_PATH];
+        DWORD length = GetTempPathA(MAX_PATH, temp);
+        std::string dir = (length > 0 && length < MAX_PATH) ? std::string(temp, length) : std::string(".\\");
+#else
+        std::string dir = "/tmp/";
+#endif
+        return dir + "mouse-share-" + role + ".flight";
+    }
+
+private:
+    void append(uint64_t ts_us, uint8_t stage, uint8_t type, uint32_t seq, uint16_t queue_depth,
+                uint32_t latency_us = 0) {
+        if (!enabled()) return;
+        uint64_t slot = header_->head.fetch_add(1, std::memory_order_relaxed);
+        FlightRecord& r = records_[slot % FLIGHT_RING_RECORDS];
+        r.commit.store(0, std::memory_order_relaxed);
+        r.ts_us = ts_us;
+        r.seq = seq;
+        r.stage = stage;
+        r.type = type;
+        r.queue_depth = queue_depth;
+        r.latency_us = latency_us;
+        r.commit.store(static_cast<uint32_t>(slot + 1), std::memory_order_release);
+    }
+
+    void dump_thread_func() {
+        uint64_t last_dump_us = 0;
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (running_) {
+            // trigger() doesn't take the mutex, so don't rely on the notify alone
+            cv_.wait_for(lock, std::chrono::seconds(1), [this] {
+                return !running_ || dump_requested_.load(std::memory_order_acquire);
+            });
+            if (!running_) break;
+            if (!dump_requested_.exchange(false, std::memory_order_acq_rel)) continue;
+
+            bool on_demand = on_demand_.exchange(false, std::memory_order_relaxed);
+            uint64_t now = get_timestamp_us();
+            if (!on_demand) {
+                if (last_dump_us != 0 && now - last_dump_us < FLIGHT_MIN_DUMP_INTERVAL_US) continue;
+                last_dump_us = now;
+                cv_.wait_for(lock, std::chrono::milliseconds(FLIGHT_DUMP_DELAY_MS), [this] { return !running_; });
+            }
+
+            lock.unlock();
+            std::string dump_path = write_dump();
+            if (!dump_path.empty()) {
+                std::cerr << "Flight recorder: " << (on_demand ? "" : "latency spike, ")
+                          << "saved " << dump_path << "\n";
+            }
+            lock.lock();
+        }
+    }
+
+    // Copy every complete record of the last FLIGHT_DUMP_WINDOW_S seconds
+    std::string write_dump() {
+        uint64_t head = header_->head.load(std::memory_order_acquire);
+        uint64_t first = head > FLIGHT_RING_RECORDS ? head - FLIGHT_RING_RECORDS : 0;
+        uint64_t cutoff = get_timestamp_us() - uint64_t(FLIGHT_DUMP_WINDOW_S) * 1000000;
+
+        std::unique_ptr<FlightRecord[]> kept(new FlightRecord[FLIGHT_RING_RECORDS]);
+        uint32_t count = 0;
+        for (uint64_t slot = first; slot < head; slot++) {
+            const FlightRecord& r = records_[slot % FLIGHT_RING_RECORDS];
+            uint32_t commit = static_cast<uint32_t>(slot + 1);
+            if (r.commit.load(std::memory_order_acquire) != commit) continue;
+
+            FlightRecord& copy = kept[count];
+            copy.ts_us = r.ts_us;
+            copy.seq = r.seq;
+            copy.stage = r.stage;
+            copy.type = r.type;
+            copy.queue_depth = r.queue_depth;
+            copy.latency_us = r.latency_us;
+
+            // Overwritten by a writer while copying
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (r.commit.load(std::memory_order_relaxed) != commit) continue;
+            if (copy.ts_us < cutoff) continue;
+            copy.commit.store(++count, std::memory_order_relaxed);
+        }
+
+        std::string dump_path = dump_path_for(wall_clock_us());
+        std::ofstream out(dump_path, std::ios::binary | std::ios::trunc);
+        if (!out) return "";
+
+        FlightHeader header;
+        header.magic = FLIGHT_MAGIC;
+        header.version = FLIGHT_VERSION;
+        header.record_size = sizeof(FlightRecord);
+        header.capacity = count;
+        header.pid = header_->pid;
+        header.wall_offset_us = header_->wall_offset_us;
+        header.head.store(count, std::memory_order_relaxed);
+
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(kept.get()), count * sizeof(FlightRecord));
+        return out ? dump_path : "";
+    }
+
+    // mouse-share-server.flight -> mouse-share-server-20240131-142501.flight
+    std::string dump_path_for(int64_t wall_us) const {
+        std::time_t seconds = static_cast<std::time_t>(wall_us / 1000000);
+        std::tm local = {};
+#ifdef _WIN32
+        localtime_s(&local, &seconds);
+#else
+        localtime_r(&seconds, &local);
+#endif
+        char stamp[32];
+        std::strftime(stamp, sizeof(stamp), "-%Y%m%d-%H%M%S", &local);
+
+        std::string base = path_;
+        size_t dot = base.rfind(".flight");
+        if (dot != std::string::npos && dot + 7 == base.size()) {
+            base.resize(dot);
+        }
+        return base + stamp + ".flight";
+    }
+
+    static int64_t wall_clock_us() {
+        auto now = std::chrono::system_clock::now().time_since_epoch();
+        return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+    }
+
+    MappedFile file_;
+    FlightHeader* header_ = nullptr;
+    FlightRecord* records_ = nullptr;
+    std::string path_;
+
+    std::atomic<uint64_t> begin_us_[FLIGHT_BEGIN_SLOTS] = {};
+    std::atomic<bool> dump_requested_{false};
+    std::atomic<bool> on_demand_{false};
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool running_ = false;
+    std::thread dump_thread_;
+};
+
+inline FlightRecorder g_flight;
+
+} // namespace MouseShare
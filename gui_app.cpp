@@ -21,6 +21,7 @@
 
 #pragma comment(lib, "ws2_32.lib")
 #pragma comment(lib, "comctl32.lib")
+#pragma comment(lib, "shell32.lib")
 #pragma comment(linker,"\"/manifestdependency:type='win32' name='Microsoft.Windows.Common-Controls' version='6.0.0.0' processorArchitecture='*' publicKeyToken='6595b64144ccf1df' language='*'\"")
 
 // Include our existing headers
@@ -28,6 +29,16 @@
 #include "network.hpp"
 #include "input_capture.hpp"
 #include "input_simulator.hpp"
+#include "fanout.hpp"
+#include "multicast.hpp"
+#include "session.hpp"
+#include "outbound_queue.hpp"
+#include "send_batching.hpp"
+#include "key_repeat.hpp"
+#include "pointer_prediction.hpp"
+#include "clipboard.hpp"
+#include "file_transfer.hpp"
+#include "metrics_reporter.hpp"
 
 using namespace MouseShare;
 
@@ -48,6 +59,8 @@ constexpr int ID_EDIT_NAME = 106;
 constexpr int ID_EDIT_PORT = 107;
 constexpr int ID_STATUS_BAR = 108;
 constexpr int ID_TRAY_ICON = 109;
+constexpr int ID_CHECK_BROADCAST = 110;
+constexpr int ID_CHECK_MULTICAST = 111;
 
 // Menu IDs
 constexpr int ID_TRAY_SHOW = 1001;
@@ -96,6 +109,11 @@ struct ScreenLayout {
 // Global State
 // ============================================================================
 
+bool send_to_active_client(const std::vector<std::string>& frames);
+bool send_bulk_frame(std::string frame);
+void inject_key_repeat(const KeyEvent& key);
+void inject_predicted_move(int x, int y);
+
 class AppState {
 public:
     // Window handles
@@ -107,10 +125,13 @@ public:
     // Computer info
     std::string computer_name;
     uint16_t port = DEFAULT_PORT;
+    PresharedKey key;  // --key: every connection is encrypted and needs the same one
+    bool shared_memory = false;  // --shm: offer shared memory to servers on this host
     
     // Network state
     std::atomic<bool> server_running{false};
     std::atomic<bool> client_connected{false};
+    std::atomic<bool> client_running{false};       // The client thread reconnects until Disconnect
     std::atomic<bool> client_is_receiving{false};  // Track if client is actively receiving input
     std::string connected_to;
     
@@ -131,10 +152,38 @@ public:
     Socket server_socket;
     Socket client_socket;
     Socket active_client;
-    std::mutex active_client_mutex;  // Protect active_client from race conditions
+    std::mutex active_client_send_mutex;  // Writes to active_client; taken before active_client_mutex when both are
+    std::mutex active_client_mutex;  // The session and which connection active_client is; never held across I/O
+    SessionLog session;              // Frames sent to active_client, for resume (under active_client_mutex)
+    std::atomic<bool> active_connected{false};
+    uint64_t active_connection = 0;  // Which connection active_client is; changes under both mutexes
+    std::atomic<uint64_t> resumable_until_us{0};  // For has_remote_client(): UINT64_MAX while connected
+    OutboundQueue outbound{send_to_active_client};  // Priority lanes towards active_client
+    SendBatching batching;           // Round trip to active_client, and when outbound may gather
+    SessionTickets session_tickets;  // Client side, per server: a quick reconnect picks up where we left off
+    std::mutex client_send_mutex;    // client_socket is written by the clipboard and transfer threads too
+
+    // With the server or active client, not in broadcast mode
+    ChannelMux channels{send_bulk_frame};
+    FileReceiver files{channels};
+    ClipboardSync clipboard{send_bulk_frame, channels};
     std::atomic<bool> active_on_remote{false};
     std::atomic<bool> manual_mode{false};  // Track if we're in manual toggle mode (vs automatic edge mode)
 
+    // Broadcast mode: every accepted client joins the group and receives all input
+    std::atomic<bool> broadcast_mode{false};
+    FanoutGroup broadcast_group;
+
+    // Optional multicast transport for broadcast mode (TCP still carries control)
+    std::atomic<bool> multicast_mode{false};
+    MulticastSender multicast_sender;
+    MulticastReceiver multicast_receiver;
+    std::mutex client_dispatch_mutex;  // Serializes TCP and multicast event dispatch
+    KeyRepeater key_repeater{client_dispatch_mutex, inject_key_repeat};  // Client: repeats a held key here
+    CursorPredictor cursor_predictor{client_dispatch_mutex, inject_predicted_move};  // Client: moves the cursor
+    uint64_t prediction_us = 0;        // --predict MS: show the cursor this far ahead; 0 is off
+    KeyRepeatDetector key_repeats;     // Server side, hook thread only
+
     // Virtual cursor for server when controlling remote
     int virtual_cursor_x = 0;
     int virtual_cursor_y = 0;
@@ -329,6 +378,110 @@ void discovery_thread_func() {
 // Server/Client Logic
 // ============================================================================
 
+// True if there is somewhere to send input (the active client, or any broadcast member).
+// A client that dropped still counts while it can resume: what it misses is
+// recorded and replayed, so a key released meanwhile doesn't stay down.
+bool has_remote_client() {
+    if (g_app.broadcast_mode) {
+        return g_app.broadcast_group.size() > 0;
+    }
+    return g_app.active_connected || get_timestamp_us() < g_app.resumable_until_us;
+}
+
+// Writer side of g_app.outbound: frames reach the active client in lane order
+bool send_to_active_client(const std::vector<std::string>& frames) {
+    uint64_t connection;
+    {
+        std::lock_guard<std::mutex> lock(g_app.active_client_mutex);
+        bool connected = g_app.active_connected;
+        if (!connected && get_timestamp_us() >= g_app.resumable_until_us) {
+            return false;
+        }
+
+        // While the client is away its input is only recorded, for the resume
+        for (const auto& frame : frames) {
+            if (is_session_frame(frame_type(frame))) {
+                g_app.session.record(frame);
+            }
+        }
+        if (!connected) return true;
+        connection = g_app.active_connection;
+    }
+
+    // Not under active_client_mutex: a stalled client may block here, and
+    // the hooks and the UI only ever need that one. After a failed send the
+    // server thread sees the connection drop and detaches the session; the
+    // frames are in it already.
+    std::lock_guard<std::mutex> send_lock(g_app.active_client_send_mutex);
+    if (!g_app.active_connected || connection != g_app.active_connection) {
+        return true;  // the resume flight replayed them
+    }
+    if (g_app.active_client.send_frames(frames) <= 0) {
+        g_app.active_connected = false;
+    }
+    return true;
+}
+
+// Send a serialized event to the active client, or to every broadcast member.
+// Returns false only if there is no unicast client to send to.
+bool send_to_remote(std::string data) {
+    if (g_app.broadcast_mode) {
+        if (g_app.multicast_sender.is_open()) {
+            // One datagram reaches every member
+            g_app.multicast_sender.send_frame(data);
+            return true;
+        }
+
+        // Encoded once; each member's queue holds a reference to the same buffer
+        g_app.broadcast_group.broadcast(make_shared_frame(std::move(data)));
+        return true;
+    }
+
+    // Keys and buttons go ahead of merged motion, never past it; see OutboundQueue
+    if (!has_remote_client()) {
+        return false;
+    }
+    g_app.batching.on_input(get_timestamp_us());
+    g_app.outbound.push(std::move(data));
+    return true;
+}
+
+// Clipboard and transfer traffic goes to the server we're connected to, or to the active client
+bool send_bulk_frame(std::string frame) {
+    if (g_app.client_connected) {
+        std::lock_guard<std::mutex> lock(g_app.client_send_mutex);
+        return g_app.client_socket.send(frame) > 0;
+    }
+    // Not recorded for resume, so only while the client is actually there
+    if (g_app.server_running && !g_app.broadcast_mode && g_app.active_connected) {
+        g_app.outbound.push(std::move(frame));
+        return true;
+    }
+    return false;
+}
+
+// Drop broadcast members whose connection failed or fell too far behind
+void prune_broadcast_members() {
+    auto gone = g_app.broadcast_group.prune();
+    if (gone.empty()) return;
+
+    {
+        std::lock_guard<std::mutex> layout_lock(g_app.layout_mutex);
+        for (auto& comp : g_app.layout.computers) {
+            if (std::find(gone.begin(), gone.end(), comp.ip) != gone.end()) {
+                comp.is_connected = false;
+            }
+        }
+    }
+
+    if (g_app.broadcast_group.size() == 0 && g_app.active_on_remote) {
+        g_app.active_on_remote = false;
+        g_app.input_capture.capture_input(false);
+    }
+
+    PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)"Broadcast member disconnected");
+}
+
 void server_thread_func() {
     if (!g_app.input_capture.init()) {
         PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)"Failed to init input capture");
@@ -340,8 +493,7 @@ void server_thread_func() {
         // Mouse move
         [](int x, int y, int dx, int dy) {
             // Check if we have a client connection (quick check without full lock)
-            bool has_client = g_app.active_client.is_valid();
-            if (!has_client) return;
+            if (!has_remote_client()) return;
 
             if (g_app.active_on_remote) {
                 // Update virtual cursor position with the deltas we received
@@ -360,17 +512,12 @@ void server_thread_func() {
                 event.dy = dy;
                 auto data = serialize_packet(EventType::MOUSE_MOVE, event);
 
-                // Lock only for the send operation
-                {
-                    std::lock_guard<std::mutex> lock(g_app.active_client_mutex);
-                    if (g_app.active_client.is_valid()) {
-                        int sent = g_app.active_client.send(data);
-                        if (sent <= 0) {
-                            // Send failed - disconnect
-                            g_app.active_on_remote = false;
-                            g_app.input_capture.capture_input(false);
-                        }
-                    }
+                if (!send_to_remote(std::move(data))) {
+                    // The client is gone for good - give input back to this machine
+                    g_app.active_on_remote = false;
+                    g_app.input_capture.capture_input(false);
+                    PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)"Connection lost - switched to LOCAL control");
+                    return;
                 }
 
                 // In manual mode, don't process edge detection - just stay active
@@ -499,18 +646,11 @@ void server_thread_func() {
 
                 auto data = serialize_packet(EventType::SWITCH_SCREEN, event);
 
-                // Lock only for the send operation
-                {
-                    std::lock_guard<std::mutex> lock(g_app.active_client_mutex);
-                    if (g_app.active_client.is_valid()) {
-                        int sent = g_app.active_client.send(data);
-                        if (sent <= 0) {
-                            // Send failed - disconnect
-                            g_app.active_on_remote = false;
-                            g_app.input_capture.capture_input(false);
-                            return;
-                        }
-                    }
+                if (!send_to_remote(std::move(data))) {
+                    // Send failed - disconnect
+                    g_app.active_on_remote = false;
+                    g_app.input_capture.capture_input(false);
+                    return;
                 }
 
                 PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)"Edge detected - now controlling remote (cursor captured)");
@@ -519,30 +659,22 @@ void server_thread_func() {
         // Mouse button
         [](MouseButton button, bool pressed) {
             if (!g_app.active_on_remote) return;
-            std::lock_guard<std::mutex> lock(g_app.active_client_mutex);
-            if (!g_app.active_client.is_valid()) return;
 
             MouseButtonEvent event;
             event.button = button;
             event.pressed = pressed;
-            auto data = serialize_packet(EventType::MOUSE_BUTTON, event);
-            int sent = g_app.active_client.send(data);
-            if (sent <= 0) {
+            if (!send_to_remote(serialize_packet(EventType::MOUSE_BUTTON, event))) {
                 g_app.active_on_remote = false;
             }
         },
         // Mouse scroll
         [](int dx, int dy) {
             if (!g_app.active_on_remote) return;
-            std::lock_guard<std::mutex> lock(g_app.active_client_mutex);
-            if (!g_app.active_client.is_valid()) return;
 
             MouseScrollEvent event;
             event.dx = dx;
             event.dy = dy;
-            auto data = serialize_packet(EventType::MOUSE_SCROLL, event);
-            int sent = g_app.active_client.send(data);
-            if (sent <= 0) {
+            if (!send_to_remote(serialize_packet(EventType::MOUSE_SCROLL, event))) {
                 g_app.active_on_remote = false;
             }
         },
@@ -551,8 +683,7 @@ void server_thread_func() {
             // F8 to manually toggle input control (for testing)
             if (vk == VK_F8 && pressed) {
                 // Check if client exists first (without holding lock)
-                bool has_client = g_app.active_client.is_valid();
-                if (has_client) {
+                if (has_remote_client()) {
                     // Toggle state
                     g_app.active_on_remote = !g_app.active_on_remote;
                     bool new_state = g_app.active_on_remote;
@@ -599,16 +730,12 @@ void server_thread_func() {
                         event.position = GetSystemMetrics(SM_CYSCREEN) / 2;
                         auto data = serialize_packet(EventType::SWITCH_SCREEN, event);
 
-                        std::lock_guard<std::mutex> lock(g_app.active_client_mutex);
-                        if (g_app.active_client.is_valid()) {
-                            int sent = g_app.active_client.send(data);
-                            if (sent <= 0) {
-                                PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)"F8: Failed to send SWITCH_SCREEN to client!");
-                                g_app.input_capture.capture_input(false);
-                                g_app.active_on_remote = false;
-                            } else {
-                                PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)"F8: Input captured! Move mouse to send to client.");
-                            }
+                        if (!send_to_remote(std::move(data))) {
+                            PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)"F8: Failed to send SWITCH_SCREEN to client!");
+                            g_app.input_capture.capture_input(false);
+                            g_app.active_on_remote = false;
+                        } else {
+                            PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)"F8: Input captured! Move mouse to send to client.");
                         }
                     }
                 }
@@ -626,29 +753,53 @@ void server_thread_func() {
                 return;
             }
 
-            if (!g_app.active_on_remote) return;
+            // Seen even while input is local, so it knows which keys are down
+            KeyDown down = KeyDown::PRESS;
+            uint32_t interval_us = 0;
+            bool was_repeating = false;
+            if (pressed) {
+                down = g_app.key_repeats.on_press(vk, get_timestamp_us(), interval_us);
+            } else {
+                was_repeating = g_app.key_repeats.on_release(vk);
+            }
+
+            // A repeating remote key stops only when told
+            if (!g_app.active_on_remote && !was_repeating) return;
+            if (down == KeyDown::SUPPRESS) return;
 
             KeyEvent event;
             event.vkCode = vk;
             event.scanCode = scan;
             event.flags = flags;
-            auto data = serialize_packet(pressed ? EventType::KEY_PRESS : EventType::KEY_RELEASE, event);
+            std::string data;
+            if (down == KeyDown::REPEAT) {
+                KeyRepeatEvent repeat;
+                repeat.key = event;
+                repeat.interval_us = interval_us;
+                data = serialize_packet(EventType::KEY_REPEAT, repeat);
+            } else {
+                data = serialize_packet(pressed ? EventType::KEY_PRESS : EventType::KEY_RELEASE, event);
+            }
 
-            // Lock only for sending
-            {
-                std::lock_guard<std::mutex> lock(g_app.active_client_mutex);
-                if (g_app.active_client.is_valid()) {
-                    int sent = g_app.active_client.send(data);
-                    if (sent <= 0) {
-                        g_app.active_on_remote = false;
-                        PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)"Connection lost - switched to LOCAL control");
-                    }
-                }
+            if (!send_to_remote(std::move(data)) && g_app.active_on_remote) {
+                g_app.active_on_remote = false;
+                PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)"Connection lost - switched to LOCAL control");
             }
         }
     );
     
     g_app.input_capture.start();
+    g_app.outbound.start();
+    
+    if (g_app.broadcast_mode && g_app.multicast_mode && g_app.key.set) {
+        PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)"Multicast is not encrypted - broadcasting over TCP");
+    } else if (g_app.broadcast_mode && g_app.multicast_mode) {
+        try {
+            g_app.multicast_sender.open(DEFAULT_MULTICAST_GROUP, g_app.port + 2);
+        } catch (const NetworkError&) {
+            PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)"Multicast unavailable - broadcasting over TCP");
+        }
+    }
     
     try {
         g_app.server_socket.create();
@@ -660,6 +811,10 @@ void server_thread_func() {
         PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)start_msg);
         
         while (g_app.server_running) {
+            if (g_app.broadcast_mode) {
+                prune_broadcast_members();
+            }
+
             // Accept with timeout
             fd_set readSet;
             FD_ZERO(&readSet);
@@ -668,6 +823,21 @@ void server_thread_func() {
             timeval tv = {1, 0};
             if (select(0, &readSet, nullptr, nullptr, &tv) > 0) {
                 Socket new_client = g_app.server_socket.accept();
+                try {
+                    if (g_app.key.set) {
+                        new_client.accept_encryption(g_app.key);
+                    }
+                    new_client.accept_shared_memory();
+                } catch (const NetworkError& e) {
+                    static char key_msg[256];
+                    snprintf(key_msg, sizeof(key_msg), "Connection refused: %s", e.what());
+                    PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)key_msg);
+                    continue;
+                }
+                new_client.limit_send_backlog();  // the backlog waits in our queue instead
+                if (g_tracer.enabled()) {
+                    new_client.enable_kernel_timestamps();
+                }
 
                 // Get client address to find which computer connected
                 sockaddr_in client_addr{};
@@ -707,31 +877,117 @@ void server_thread_func() {
                     PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)diag_msg);
                 }
 
+                if (g_app.broadcast_mode) {
+                    // Send screen info before the member starts receiving shared frames
+                    ScreenInfo info;
+                    info.width = g_app.local_info.screen_width;
+                    info.height = g_app.local_info.screen_height;
+                    new_client.send(serialize_packet(EventType::SCREEN_INFO, info));
+
+                    if (g_app.multicast_sender.is_open()) {
+                        new_client.send(serialize_packet(EventType::MULTICAST_INFO, g_app.multicast_sender.info()));
+                    }
+                    if (!new_client.wait_confirmed()) {
+                        PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0,
+                                    (LPARAM)"Connection refused: the client did not prove the key");
+                        continue;
+                    }
+
+                    g_app.broadcast_group.add(std::move(new_client), client_ip);
+
+                    static char member_msg[256];
+                    snprintf(member_msg, sizeof(member_msg), "BROADCAST MEMBER JOINED from %s (%d total)",
+                             client_ip, (int)g_app.broadcast_group.size());
+                    PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)member_msg);
+                    continue;
+                }
+
+                // Read before taking the lock the input hooks send under. It came
+                // in the client's opening flight, so this doesn't wait.
+                SessionHelloEvent hello;
+                bool has_hello = recv_session_hello(new_client, hello);
+                SessionResumeMode resume_mode;
+
+                // An encrypted opening flight may be a replay until the client
+                // proves the key: answer the hello at once, but only take the
+                // session over once it is confirmed
+                SessionHelloEvent resume_from = hello;
+                bool answered = has_hello && new_client.is_encrypted();
+                if (answered) {
+                    SessionAcceptEvent offer;
+                    {
+                        std::lock_guard<std::mutex> lock(g_app.active_client_mutex);
+                        offer = g_app.session.offer(hello);
+                    }
+                    new_client.send(serialize_packet(EventType::SESSION_ACCEPT, offer));
+                    resume_from = SessionLog::after_offer(hello, offer);
+                }
+                if (!new_client.wait_confirmed()) {
+                    PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0,
+                                (LPARAM)"Connection refused: the client did not prove the key");
+                    continue;
+                }
+
+                // Motion resampled to what the client's display can show
+                g_app.outbound.set_motion_rate(has_hello ? hello.refresh_hz * MOTION_REFRESH_MULTIPLE : 0);
+
                 {
-                    std::lock_guard<std::mutex> lock(g_app.active_client_mutex);
+                    // The reply, what the client missed and our screen info in
+                    // one send. The writer records meanwhile but sends after it.
+                    std::lock_guard<std::mutex> send_lock(g_app.active_client_send_mutex);
                     g_app.active_client = std::move(new_client);
-
-                    // Send screen info
                     ScreenInfo info;
                     info.width = g_app.local_info.screen_width;
                     info.height = g_app.local_info.screen_height;
-                    auto data = serialize_packet(EventType::SCREEN_INFO, info);
-                    g_app.active_client.send(data);
+                    std::vector<std::string> flight;
+                    {
+                        std::lock_guard<std::mutex> lock(g_app.active_client_mutex);
+                        resume_mode = g_app.session.resume_flight(resume_from, has_hello,
+                                                                  {serialize_packet(EventType::SCREEN_INFO, info)}, flight,
+                                                                  answered);
+                        g_app.active_connection++;
+                        g_app.active_connected = true;
+                        g_app.resumable_until_us = UINT64_MAX;
+                    }
+                    if (!flight.empty()) {
+                        g_app.active_client.send_frames(flight);
+                    }
                 }
 
                 static char conn_msg[256];
-                snprintf(conn_msg, sizeof(conn_msg), "CLIENT CONNECTED from %s! Press F8 to toggle control", client_ip);
+                snprintf(conn_msg, sizeof(conn_msg), "CLIENT %s from %s! Press F8 to toggle control",
+                         resume_mode == SessionResumeMode::NEW ? "CONNECTED" : "RECONNECTED (session resumed)",
+                         client_ip);
                 PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)conn_msg);
-
-                // Keep connection alive and monitor for disconnect
-                while (g_app.server_running) {
-                    {
-                        std::lock_guard<std::mutex> lock(g_app.active_client_mutex);
-                        if (!g_app.active_client.is_valid() || !g_app.active_client.is_connected()) {
-                            break;
-                        }
+                g_app.clipboard.announce();
+                g_app.channels.connected();
+
+                // Read the client's clipboard and transfer traffic, and its
+                // answers to our pings, until it disconnects (or Stop Server
+                // closes the socket under us)
+                g_app.batching.reset();
+                while (g_app.server_running && g_app.active_connected) {
+                    std::string ping;
+                    if (g_app.batching.ping_due(get_timestamp_us(), ping)) {
+                        g_app.outbound.push(std::move(ping));
+                    }
+                    g_app.outbound.set_gather_window(g_app.batching.window_us());
+                    
+                    if (!g_app.active_client.wait_readable(100)) {
+                        continue;
+                    }
+                    std::string frame;
+                    if (!g_app.active_client.recv_frame(frame)) {
+                        break;
+                    }
+                    EventType type = frame_type(frame);
+                    const char* payload = frame.data() + sizeof(PacketHeader);
+                    size_t size = frame.size() - sizeof(PacketHeader);
+                    if (type == EventType::KEEPALIVE) {
+                        g_app.batching.on_keepalive(payload, size, get_timestamp_us());
+                    } else if (!g_app.clipboard.handle_frame(type, payload, size)) {
+                        g_app.channels.handle_frame(type, payload, size);
                     }
-                    Sleep(100);
                 }
 
                 // Mark client as disconnected
@@ -745,11 +1001,22 @@ void server_thread_func() {
                     }
                 }
 
+                // A send stalled on the gone client fails now instead of
+                // holding the send lock
+                g_app.active_client.shutdown();
                 {
+                    std::lock_guard<std::mutex> send_lock(g_app.active_client_send_mutex);
                     std::lock_guard<std::mutex> lock(g_app.active_client_mutex);
                     g_app.active_client.close();
+                    g_app.active_connected = false;
+                    g_app.session.detach();
+                    g_app.resumable_until_us = get_timestamp_us() + SESSION_RESUME_WINDOW_US;
                 }
-                g_app.active_on_remote = false;
+                g_app.clipboard.disconnected();
+                g_app.channels.disconnected();
+
+                // active_on_remote stays: input goes on being recorded while the
+                // client can resume, and the first move after that gives it back
 
                 PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)"Client disconnected - waiting for new connection...");
             }
@@ -759,171 +1026,353 @@ void server_thread_func() {
     }
     
     g_app.input_capture.stop();
+    g_app.outbound.stop();
+    g_app.outbound.clear();
+    g_app.multicast_sender.close();
+    g_app.broadcast_group.clear();
     g_app.server_socket.close();
 }
 
+// Receiver-side state for the session with the server
+struct ClientSession {
+    int cursor_x = 0;
+    int cursor_y = 0;
+    bool active = false;
+    bool manual_mode = false;  // Track if client is in manual mode
+    ScreenEdge entry_edge = ScreenEdge::LEFT;
+    SessionResume* ticket = nullptr;  // For the server we connect to, in session_tickets
+};
+
+// One autorepeat of a held key, from key_repeater's thread under client_dispatch_mutex
+void inject_key_repeat(const KeyEvent& key) {
+    g_app.input_simulator.key_event(key.vkCode, key.scanCode, key.flags, true);
+}
+
+// A cursor position from cursor_predictor, under client_dispatch_mutex
+void inject_predicted_move(int x, int y) {
+    g_app.input_simulator.move_mouse(x, y);
+}
+
+// Apply one event from the server. Called from the TCP receive loop and the
+// multicast receive thread, always under client_dispatch_mutex.
+void handle_server_event(ClientSession& session, EventType type, const char* data, size_t size) {
+    ScopedTiming timing(Timing::DISPATCH);
+    g_metrics.count(Counter::EVENTS_DISPATCHED);
+    trace_stage(TraceStage::DECODE, type);
+
+    switch (type) {
+        case EventType::MOUSE_MOVE: {
+            if (!session.active) break;
+            if (size < sizeof(MouseMoveEvent)) break;
+
+            auto* e = (const MouseMoveEvent*)data;
+            session.cursor_x += e->dx;
+            session.cursor_y += e->dy;
+            session.cursor_x = (std::max)(0, (std::min)(session.cursor_x, g_app.local_info.screen_width - 1));
+            session.cursor_y = (std::max)(0, (std::min)(session.cursor_y, g_app.local_info.screen_height - 1));
+            g_app.cursor_predictor.move(session.cursor_x, session.cursor_y);
+
+            // Only check for return to server in automatic mode, not manual mode
+            if (!session.manual_mode) {
+                // Check for return to server based on entry edge
+                bool should_return = false;
+                switch (session.entry_edge) {
+                    case ScreenEdge::LEFT:
+                        should_return = (session.cursor_x <= 0);
+                        break;
+                    case ScreenEdge::RIGHT:
+                        should_return = (session.cursor_x >= g_app.local_info.screen_width - 1);
+                        break;
+                    case ScreenEdge::TOP:
+                        should_return = (session.cursor_y <= 0);
+                        break;
+                    case ScreenEdge::BOTTOM:
+                        should_return = (session.cursor_y >= g_app.local_info.screen_height - 1);
+                        break;
+                    default:
+                        break;
+                }
+
+                if (should_return) {
+                    session.active = false;
+                    g_app.client_is_receiving = false;  // Update global state
+                    // Move cursor to center to prevent re-trigger
+                    session.cursor_x = g_app.local_info.screen_width / 2;
+                    session.cursor_y = g_app.local_info.screen_height / 2;
+                    g_app.cursor_predictor.reset();
+                    g_app.input_simulator.move_mouse(session.cursor_x, session.cursor_y);
+                    PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)"Client returned control to server");
+                }
+            }
+            break;
+        }
+        case EventType::MOUSE_BUTTON: {
+            if (!session.active) break;
+            if (size < sizeof(MouseButtonEvent)) break;
+
+            auto* e = (const MouseButtonEvent*)data;
+            g_app.cursor_predictor.button(e->pressed, session.cursor_x, session.cursor_y);  // click where the server did
+            g_app.input_simulator.mouse_button(e->button, e->pressed);
+            break;
+        }
+        case EventType::MOUSE_SCROLL: {
+            if (!session.active) break;
+            if (size < sizeof(MouseScrollEvent)) break;
+
+            auto* e = (const MouseScrollEvent*)data;
+            g_app.input_simulator.mouse_scroll(e->dx, e->dy);
+            break;
+        }
+        case EventType::KEY_PRESS:
+        case EventType::KEY_RELEASE: {
+            if (size < sizeof(KeyEvent)) break;
+
+            auto* e = (const KeyEvent*)data;
+            g_app.key_repeater.key(e->vkCode, type == EventType::KEY_PRESS);
+            if (!session.active) break;
+            g_app.input_simulator.key_event(e->vkCode, e->scanCode, e->flags,
+                                            type == EventType::KEY_PRESS);
+            break;
+        }
+        case EventType::KEY_REPEAT: {
+            if (!session.active) break;
+            if (size < sizeof(KeyRepeatEvent)) break;
+
+            // From here on the key repeats on this side, until its release
+            auto* e = (const KeyRepeatEvent*)data;
+            if (g_app.key_repeater.repeat(*e)) {
+                g_app.input_simulator.key_event(e->key.vkCode, e->key.scanCode, e->key.flags, true);
+            }
+            break;
+        }
+        case EventType::SWITCH_SCREEN: {
+            if (size < sizeof(SwitchScreenEvent)) break;
+
+            auto* e = (const SwitchScreenEvent*)data;
+            session.active = true;
+            g_app.client_is_receiving = true;  // Update global state for GUI
+            session.entry_edge = e->edge;
+
+            // Detect manual mode: server sends LEFT edge with center Y position
+            int center_y = GetSystemMetrics(SM_CYSCREEN) / 2;
+            session.manual_mode = (e->edge == ScreenEdge::LEFT && e->position == center_y);
+
+            // Position cursor based on entry edge
+            switch (session.entry_edge) {
+                case ScreenEdge::LEFT:
+                    session.cursor_x = 0;
+                    session.cursor_y = e->position;
+                    break;
+                case ScreenEdge::RIGHT:
+                    session.cursor_x = g_app.local_info.screen_width - 1;
+                    session.cursor_y = e->position;
+                    break;
+                case ScreenEdge::TOP:
+                    session.cursor_x = e->position;
+                    session.cursor_y = 0;
+                    break;
+                case ScreenEdge::BOTTOM:
+                    session.cursor_x = e->position;
+                    session.cursor_y = g_app.local_info.screen_height - 1;
+                    break;
+                default:
+                    session.cursor_x = 0;
+                    session.cursor_y = e->position;
+                    break;
+            }
+
+            // Clamp to screen bounds
+            session.cursor_x = (std::max)(0, (std::min)(session.cursor_x, g_app.local_info.screen_width - 1));
+            session.cursor_y = (std::max)(0, (std::min)(session.cursor_y, g_app.local_info.screen_height - 1));
+            g_app.cursor_predictor.reset();
+            g_app.input_simulator.move_mouse(session.cursor_x, session.cursor_y);
+
+            PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)"Client now RECEIVING input from server");
+            break;
+        }
+        case EventType::KEY_STATE: {
+            if (size < sizeof(KeyStateEvent)) break;
+
+            // Resync after missed frames: release anything the server no longer holds
+            auto* e = (const KeyStateEvent*)data;
+            g_app.key_repeater.cancel();
+            g_app.input_simulator.sync_key_state(*e, session.active);
+            break;
+        }
+        case EventType::SESSION_ACCEPT: {
+            if (size < sizeof(SessionAcceptEvent)) break;
+
+            auto* e = (const SessionAcceptEvent*)data;
+            session.ticket->accepted(*e);
+            if (e->mode == SessionResumeMode::NEW) {
+                // A different (or restarted) server: nothing of ours is held there
+                session.active = false;
+                g_app.client_is_receiving = false;
+                g_app.input_simulator.sync_key_state(e->keys, false);
+            } else if (e->mode == SessionResumeMode::SNAPSHOT) {
+                g_app.input_simulator.sync_key_state(e->keys, session.active);
+            }
+            break;
+        }
+        case EventType::MULTICAST_INFO: {
+            if (size < sizeof(MulticastInfoEvent)) break;
+            if (g_app.multicast_receiver.is_open()) break;
+
+            // Input events now arrive over multicast; dispatch them like TCP frames
+            auto* e = (const MulticastInfoEvent*)data;
+            try {
+                g_app.multicast_receiver.open(*e, [&session](const std::string& frame) {
+                    if (frame.size() < sizeof(PacketHeader)) return;
+                    PacketHeader mc_header;
+                    std::memcpy(&mc_header, frame.data(), sizeof(mc_header));
+                    trace_begin(TraceStage::RECV, mc_header.type);
+                    std::lock_guard<std::mutex> lock(g_app.client_dispatch_mutex);
+                    handle_server_event(session, mc_header.type, frame.data() + sizeof(mc_header),
+                                        frame.size() - sizeof(mc_header));
+                });
+                PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)"Receiving input over multicast");
+            } catch (const NetworkError&) {
+                PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)"Failed to join multicast group");
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
 void client_thread_func(std::string host, uint16_t port) {
     if (!g_app.input_simulator.init()) {
         PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)"Failed to init input simulator");
         return;
     }
     
-    try {
-        g_app.client_socket.create();
-        g_app.client_socket.connect(host, port);
-        g_app.client_connected = true;
-        g_app.connected_to = host;
-        
-        PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)"CONNECTED TO SERVER! Press F8 to toggle control, or move mouse to screen edge");
-        
-        int cursor_x = 0, cursor_y = 0;
-        bool active = false;
-        bool client_manual_mode = false;  // Track if client is in manual mode
-        ScreenEdge entry_edge = ScreenEdge::LEFT;
-
-        while (g_app.client_connected) {
-            PacketHeader header;
-            if (!g_app.client_socket.recv_exact(&header, sizeof(header), 100)) {
-                continue;
+    // Outlives the multicast receiver, which dispatches into it
+    ClientSession session;
+    session.ticket = &g_app.session_tickets.get(host, port);
+
+    ReconnectBackoff backoff;
+    uint64_t disconnected_us = 0;
+    g_app.key_repeater.start();
+    g_app.cursor_predictor.start(g_app.prediction_us);
+
+    while (g_app.client_running) {
+        try {
+            // Our ticket goes in the opening flight, so a server that still has
+            // the session answers with what we missed one round trip later
+            std::string hello;
+            {
+                std::lock_guard<std::mutex> lock(g_app.client_dispatch_mutex);
+                hello = serialize_packet(EventType::SESSION_HELLO, session.ticket->hello(display_refresh_hz()));
             }
-
-            // Validate packet size (prevent crashes from malformed packets)
-            if (header.payload_size > 65535) {
-                PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)"Invalid packet size received");
-                break;
+            g_app.client_socket.create();
+            g_app.client_socket.offer_shared_memory(g_app.shared_memory);
+            g_app.client_socket.connect(host, port, hello, g_app.key);
+            if (g_tracer.enabled()) {
+                g_app.client_socket.enable_kernel_timestamps();
             }
+            g_app.connected_to = host;
+            backoff.reset();
 
-            std::vector<char> payload(header.payload_size);
-            if (header.payload_size > 0 && !g_app.client_socket.recv_exact(payload.data(), header.payload_size)) {
-                break;
+            {
+                std::lock_guard<std::mutex> lock(g_app.client_send_mutex);
+                g_app.client_connected = true;
             }
+            g_app.clipboard.announce();
+            g_app.channels.connected();
+            
+            PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)"CONNECTED TO SERVER! Press F8 to toggle control, or move mouse to screen edge");
 
-            switch (header.type) {
-                case EventType::MOUSE_MOVE: {
-                    if (!active) break;
-                    if (payload.size() < sizeof(MouseMoveEvent)) break;
-
-                    auto* e = (MouseMoveEvent*)payload.data();
-                    cursor_x += e->dx;
-                    cursor_y += e->dy;
-                    cursor_x = (std::max)(0, (std::min)(cursor_x, g_app.local_info.screen_width - 1));
-                    cursor_y = (std::max)(0, (std::min)(cursor_y, g_app.local_info.screen_height - 1));
-                    g_app.input_simulator.move_mouse(cursor_x, cursor_y);
-
-                    // Only check for return to server in automatic mode, not manual mode
-                    if (!client_manual_mode) {
-                        // Check for return to server based on entry edge
-                        bool should_return = false;
-                        switch (entry_edge) {
-                            case ScreenEdge::LEFT:
-                                should_return = (cursor_x <= 0);
-                                break;
-                            case ScreenEdge::RIGHT:
-                                should_return = (cursor_x >= g_app.local_info.screen_width - 1);
-                                break;
-                            case ScreenEdge::TOP:
-                                should_return = (cursor_y <= 0);
-                                break;
-                            case ScreenEdge::BOTTOM:
-                                should_return = (cursor_y >= g_app.local_info.screen_height - 1);
-                                break;
-                            default:
-                                break;
-                        }
-
-                        if (should_return) {
-                            active = false;
-                            g_app.client_is_receiving = false;  // Update global state
-                            // Move cursor to center to prevent re-trigger
-                            cursor_x = g_app.local_info.screen_width / 2;
-                            cursor_y = g_app.local_info.screen_height / 2;
-                            g_app.input_simulator.move_mouse(cursor_x, cursor_y);
-                            PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)"Client returned control to server");
-                        }
-                    }
-                    break;
-                }
-                case EventType::MOUSE_BUTTON: {
-                    if (!active) break;
-                    if (payload.size() < sizeof(MouseButtonEvent)) break;
-
-                    auto* e = (MouseButtonEvent*)payload.data();
-                    g_app.input_simulator.mouse_button(e->button, e->pressed);
-                    break;
+            std::string frame;
+            while (g_app.client_connected) {
+                if (!g_app.client_socket.wait_readable(100)) {
+                    continue;
                 }
-                case EventType::MOUSE_SCROLL: {
-                    if (!active) break;
-                    if (payload.size() < sizeof(MouseScrollEvent)) break;
-
-                    auto* e = (MouseScrollEvent*)payload.data();
-                    g_app.input_simulator.mouse_scroll(e->dx, e->dy);
+                // Opened first on an encrypted connection; a forged record ends it
+                if (!g_app.client_socket.recv_frame(frame)) {
                     break;
                 }
-                case EventType::KEY_PRESS:
-                case EventType::KEY_RELEASE: {
-                    if (!active) break;
-                    if (payload.size() < sizeof(KeyEvent)) break;
-
-                    auto* e = (KeyEvent*)payload.data();
-                    g_app.input_simulator.key_event(e->vkCode, e->scanCode, e->flags,
-                                                    header.type == EventType::KEY_PRESS);
-                    break;
-                }
-                case EventType::SWITCH_SCREEN: {
-                    if (payload.size() < sizeof(SwitchScreenEvent)) break;
-
-                    auto* e = (SwitchScreenEvent*)payload.data();
-                    active = true;
-                    g_app.client_is_receiving = true;  // Update global state for GUI
-                    entry_edge = e->edge;
-
-                    // Detect manual mode: server sends LEFT edge with center Y position
-                    int center_y = GetSystemMetrics(SM_CYSCREEN) / 2;
-                    client_manual_mode = (e->edge == ScreenEdge::LEFT && e->position == center_y);
-
-                    // Position cursor based on entry edge
-                    switch (entry_edge) {
-                        case ScreenEdge::LEFT:
-                            cursor_x = 0;
-                            cursor_y = e->position;
-                            break;
-                        case ScreenEdge::RIGHT:
-                            cursor_x = g_app.local_info.screen_width - 1;
-                            cursor_y = e->position;
-                            break;
-                        case ScreenEdge::TOP:
-                            cursor_x = e->position;
-                            cursor_y = 0;
-                            break;
-                        case ScreenEdge::BOTTOM:
-                            cursor_x = e->position;
-                            cursor_y = g_app.local_info.screen_height - 1;
-                            break;
-                        default:
-                            cursor_x = 0;
-                            cursor_y = e->position;
-                            break;
+                EventType type = frame_type(frame);
+                const char* payload = frame.data() + sizeof(PacketHeader);
+                size_t size = frame.size() - sizeof(PacketHeader);
+                trace_begin(TraceStage::RECV, type);
+                trace_kernel_stamp(TraceStage::KERNEL_RX, trace_current(), g_app.client_socket.kernel_rx_us());
+
+                // The server measuring its round trip: answer at once
+                if (type == EventType::KEEPALIVE) {
+                    std::string reply;
+                    if (answer_keepalive(payload, size, reply)) {
+                        std::lock_guard<std::mutex> lock(g_app.client_send_mutex);
+                        g_app.client_socket.send(reply);
                     }
+                    continue;
+                }
 
-                    // Clamp to screen bounds
-                    cursor_x = (std::max)(0, (std::min)(cursor_x, g_app.local_info.screen_width - 1));
-                    cursor_y = (std::max)(0, (std::min)(cursor_y, g_app.local_info.screen_height - 1));
-                    g_app.input_simulator.move_mouse(cursor_x, cursor_y);
+                // Clipboard and transfer traffic is neither input nor part of the session
+                if (g_app.clipboard.handle_frame(type, payload, size) ||
+                    g_app.channels.handle_frame(type, payload, size)) {
+                    continue;
+                }
 
-                    PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)"Client now RECEIVING input from server");
-                    break;
+                {
+                    std::lock_guard<std::mutex> lock(g_app.client_dispatch_mutex);
+                    if (is_session_frame(type)) {
+                        session.ticket->frame_received();
+                    }
+                    handle_server_event(session, type, payload, size);
                 }
-                default:
-                    break;
             }
+            disconnected_us = get_timestamp_us();
+            if (g_app.client_running) {
+                PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)"Connection lost - reconnecting...");
+            }
+        } catch (const NetworkError& e) {
+            static char error_msg[256];
+            snprintf(error_msg, sizeof(error_msg), "Connection failed: %s - retrying", e.what());
+            PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)error_msg);
+        }
+
+        g_app.multicast_receiver.close();
+        g_app.key_repeater.cancel();
+        {
+            std::lock_guard<std::mutex> lock(g_app.client_dispatch_mutex);
+            g_app.cursor_predictor.reset();
+        }
+        g_app.clipboard.disconnected();
+        g_app.channels.disconnected();
+        {
+            std::lock_guard<std::mutex> lock(g_app.client_send_mutex);
+            g_app.client_connected = false;
+            g_app.client_socket.close();
+        }
+        g_app.client_is_receiving = false;  // Reset receiving state
+
+        if (!g_app.client_running) {
+            break;
+        }
+
+        // Past the resume window the server can no longer tell us what was
+        // released meanwhile
+        if (disconnected_us != 0 && get_timestamp_us() - disconnected_us >= SESSION_RESUME_WINDOW_US) {
+            std::lock_guard<std::mutex> lock(g_app.client_dispatch_mutex);
+            g_app.input_simulator.release_all();
+            disconnected_us = 0;
+        }
+
+        // Sleep in slices so Disconnect doesn't wait out the backoff
+        auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(backoff.next_delay_ms());
+        while (g_app.client_running && std::chrono::steady_clock::now() < until) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
         }
-    } catch (const NetworkError& e) {
-        PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)e.what());
     }
 
-    g_app.client_socket.close();
-    g_app.client_connected = false;
-    g_app.client_is_receiving = false;  // Reset receiving state
+    // Leaving for good: nothing would ever release these
+    g_app.key_repeater.stop();
+    g_app.cursor_predictor.stop();
+    {
+        std::lock_guard<std::mutex> lock(g_app.client_dispatch_mutex);
+        g_app.input_simulator.release_all();
+    }
     PostMessage(g_app.hwnd_main, WM_UPDATE_STATUS, 0, (LPARAM)"Disconnected");
 }
 
@@ -1020,12 +1469,12 @@ void draw_layout(HDC hdc, RECT& rect) {
         instructions += "Press F8 to manually toggle control. ";
     }
     if (g_app.server_running) {
-        bool has_client = false;
-        {
-            std::lock_guard<std::mutex> lock(g_app.active_client_mutex);
-            has_client = g_app.active_client.is_valid();
+        bool has_client = has_remote_client();
+        if (g_app.broadcast_mode) {
+            instructions += "Broadcasting to " + std::to_string(g_app.broadcast_group.size()) + " client(s)";
+        } else {
+            instructions += has_client ? "Client is CONNECTED" : "Waiting for client...";
         }
-        instructions += has_client ? "Client is CONNECTED" : "Waiting for client...";
     } else if (g_app.client_connected) {
         instructions += g_app.active_on_remote ? "Controlling REMOTE" : "Controlling LOCAL";
     }
@@ -1227,6 +1676,16 @@ LRESULT CALLBACK main_wnd_proc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam
                 700, 260, 170, 30,
                 hwnd, (HMENU)(INT_PTR)ID_BTN_DISCONNECT, GetModuleHandle(nullptr), nullptr);
             
+            CreateWindowA("BUTTON", "Broadcast input to all connected clients",
+                WS_CHILD | WS_VISIBLE | BS_AUTOCHECKBOX,
+                520, 296, 350, 20,
+                hwnd, (HMENU)(INT_PTR)ID_CHECK_BROADCAST, GetModuleHandle(nullptr), nullptr);
+            
+            CreateWindowA("BUTTON", "Use multicast for broadcast input",
+                WS_CHILD | WS_VISIBLE | BS_AUTOCHECKBOX,
+                520, 320, 350, 20,
+                hwnd, (HMENU)(INT_PTR)ID_CHECK_MULTICAST, GetModuleHandle(nullptr), nullptr);
+            
             // Labels and edit controls
             CreateWindowA("STATIC", "Computer Name:",
                 WS_CHILD | WS_VISIBLE,
@@ -1262,6 +1721,9 @@ LRESULT CALLBACK main_wnd_proc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam
             g_app.discovery_running = true;
             g_app.discovery_thread = std::thread(discovery_thread_func);
             
+            // Files dropped on the window are sent to the other computer
+            DragAcceptFiles(hwnd, TRUE);
+            
             // Set update timer
             SetTimer(hwnd, TIMER_UPDATE, 1000, nullptr);
             
@@ -1283,6 +1745,19 @@ LRESULT CALLBACK main_wnd_proc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam
                     selected_name = name;
                 }
 
+                // Per-member send lag in broadcast mode, keyed by IP
+                std::map<std::string, PeerStats> member_stats;
+                if (g_app.broadcast_mode) {
+                    for (const auto& entry : g_app.broadcast_group.collect_stats()) {
+                        member_stats[entry.first] = entry.second;
+                    }
+                }
+
+                // Queueing delay towards the unicast client over the last second
+                HistogramSnapshot control_latency = g_app.outbound.take_latency(Lane::CONTROL);
+                HistogramSnapshot motion_latency = g_app.outbound.take_latency(Lane::MOTION);
+                g_app.outbound.take_latency(Lane::SCROLL);
+
                 // Update computer list
                 std::lock_guard<std::mutex> lock(g_app.layout_mutex);
 
@@ -1310,13 +1785,8 @@ LRESULT CALLBACK main_wnd_proc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam
                     std::string status;
                     if (comp.name == g_app.computer_name) {
                         if (g_app.server_running) {
-                            bool has_client = false;
-                            bool controlling_remote = false;
-                            {
-                                std::lock_guard<std::mutex> client_lock(g_app.active_client_mutex);
-                                has_client = g_app.active_client.is_valid();
-                                controlling_remote = g_app.active_on_remote;
-                            }
+                            bool has_client = has_remote_client();
+                            bool controlling_remote = g_app.active_on_remote;
                             if (has_client) {
                                 status = controlling_remote ? "Server [SENDING]" : "Server [READY]";
                             } else {
@@ -1328,7 +1798,15 @@ LRESULT CALLBACK main_wnd_proc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam
                             status = "This PC";
                         }
                     } else {
-                        if (comp.is_connected) {
+                        auto member = member_stats.find(comp.ip);
+                        if (member != member_stats.end()) {
+                            const PeerStats& ps = member->second;
+                            status = "Member (lag " + std::to_string(ps.lag_us / 1000) + " ms, " +
+                                     std::to_string(ps.queued_frames) + " queued)";
+                        } else if (comp.is_connected && g_app.server_running && !g_app.broadcast_mode) {
+                            status = "Connected (p99 keys " + std::to_string(control_latency.percentile(99)) +
+                                     " us, motion " + std::to_string(motion_latency.percentile(99)) + " us)";
+                        } else if (comp.is_connected) {
                             status = "Connected";
                         } else if (comp.is_server) {
                             status = "Server (Available)";
@@ -1362,6 +1840,12 @@ LRESULT CALLBACK main_wnd_proc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam
                     GetWindowTextA(GetDlgItem(hwnd, ID_EDIT_PORT), port_str, sizeof(port_str));
                     g_app.port = (uint16_t)atoi(port_str);
                     
+                    // Mode is fixed for the lifetime of the server
+                    g_app.broadcast_mode = IsDlgButtonChecked(hwnd, ID_CHECK_BROADCAST) == BST_CHECKED;
+                    g_app.multicast_mode = IsDlgButtonChecked(hwnd, ID_CHECK_MULTICAST) == BST_CHECKED;
+                    EnableWindow(GetDlgItem(hwnd, ID_CHECK_BROADCAST), FALSE);
+                    EnableWindow(GetDlgItem(hwnd, ID_CHECK_MULTICAST), FALSE);
+                    
                     g_app.server_running = true;
                     g_app.server_thread = std::make_unique<std::thread>(server_thread_func);
                     
@@ -1380,10 +1864,16 @@ LRESULT CALLBACK main_wnd_proc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam
                     }
                     g_app.server_socket.close();
 
+                    g_app.active_client.shutdown();
                     {
+                        std::lock_guard<std::mutex> send_lock(g_app.active_client_send_mutex);
                         std::lock_guard<std::mutex> lock(g_app.active_client_mutex);
                         g_app.active_client.close();
+                        g_app.active_connected = false;
+                        g_app.resumable_until_us = 0;
                     }
+                    g_app.broadcast_group.clear();
+                    g_app.active_on_remote = false;
 
                     // Mark all computers as disconnected
                     {
@@ -1395,6 +1885,8 @@ LRESULT CALLBACK main_wnd_proc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam
 
                     EnableWindow(GetDlgItem(hwnd, ID_BTN_START_SERVER), TRUE);
                     EnableWindow(GetDlgItem(hwnd, ID_BTN_STOP_SERVER), FALSE);
+                    EnableWindow(GetDlgItem(hwnd, ID_CHECK_BROADCAST), TRUE);
+                    EnableWindow(GetDlgItem(hwnd, ID_CHECK_MULTICAST), TRUE);
                     // Re-enable client controls
                     EnableWindow(GetDlgItem(hwnd, ID_BTN_CONNECT), TRUE);
 
@@ -1443,6 +1935,7 @@ LRESULT CALLBACK main_wnd_proc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam
                     std::string status_msg = "Connecting to " + std::string(ip) + ":" + std::to_string(port) + "...";
                     SendMessageA(g_app.hwnd_status, SB_SETTEXTA, 0, (LPARAM)status_msg.c_str());
 
+                    g_app.client_running = true;
                     g_app.client_thread = std::make_unique<std::thread>(
                         client_thread_func, std::string(ip), port);
 
@@ -1455,6 +1948,7 @@ LRESULT CALLBACK main_wnd_proc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam
                 }
                 
                 case ID_BTN_DISCONNECT: {
+                    g_app.client_running = false;
                     g_app.client_connected = false;
                     if (g_app.client_thread && g_app.client_thread->joinable()) {
                         g_app.client_thread->join();
@@ -1489,6 +1983,33 @@ LRESULT CALLBACK main_wnd_proc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam
             return 0;
         }
         
+        case WM_DROPFILES: {
+            HDROP drop = reinterpret_cast<HDROP>(wParam);
+            std::vector<std::string> paths;
+            UINT count = DragQueryFileA(drop, 0xFFFFFFFF, nullptr, 0);
+            for (UINT i = 0; i < count; i++) {
+                char path[MAX_PATH];
+                if (DragQueryFileA(drop, i, path, sizeof(path))) {
+                    paths.push_back(path);
+                }
+            }
+            DragFinish(drop);
+
+            if (!g_app.client_connected && !(g_app.server_running && !g_app.broadcast_mode && has_remote_client())) {
+                SendMessageA(g_app.hwnd_status, SB_SETTEXTA, 0, (LPARAM)"Connect to another computer to send files");
+                return 0;
+            }
+
+            // Hashing a large file takes a while; keep the window responsive
+            std::thread([paths] {
+                for (const auto& path : paths) {
+                    send_file(g_app.channels, path);
+                }
+            }).detach();
+            SendMessageA(g_app.hwnd_status, SB_SETTEXTA, 0, (LPARAM)"Sending dropped files...");
+            return 0;
+        }
+        
         case WM_UPDATE_STATUS: {
             if (lParam) {
                 SendMessageA(g_app.hwnd_status, SB_SETTEXTA, 0, lParam);
@@ -1548,18 +2069,20 @@ LRESULT CALLBACK main_wnd_proc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam
             // Cleanup - stop all threads and close all sockets
             g_app.discovery_running = false;
             g_app.server_running = false;
+            g_app.client_running = false;
             g_app.client_connected = false;
 
-            // Stop input capture
+            // Stop input capture, clipboard sharing and file transfers
             g_app.input_capture.stop();
+            g_app.clipboard.stop();
+            g_app.channels.stop();
 
-            // Close all sockets to unblock threads
+            // Close all sockets to unblock threads. The server thread closes
+            // active_client itself on its way out.
             g_app.server_socket.close();
             g_app.client_socket.close();
-            {
-                std::lock_guard<std::mutex> lock(g_app.active_client_mutex);
-                g_app.active_client.close();
-            }
+            g_app.active_client.shutdown();
+            g_app.broadcast_group.clear();
             g_app.discovery_socket.close();
 
             // Wait for threads with timeout
@@ -1608,6 +2131,56 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int nCmdShow) {
     // Initialize app state
     g_app.init();
     
+    // Diagnostics: --stats FILE writes metrics every second, --trace FILE
+    // writes a Chrome trace of every event on exit, --flight FILE moves the
+    // flight recorder ring, --no-flight turns it off, --no-clipboard
+    // stops clipboard sharing, --receive-dir says where received files
+    // go (Downloads by default), --key PASSPHRASE encrypts connections,
+    // --shm talks to a server on this machine through shared memory and
+    // --predict MS shows a remote-controlled cursor MS ahead
+    MetricsReporter metrics_reporter;
+    std::string trace_path;
+    std::string flight_path = FlightRecorder::default_path("gui");
+    bool clipboard = true;
+    std::string receive_dir = default_receive_directory();
+    for (int i = 1; i < __argc; i++) {
+        std::string arg = __argv[i];
+        bool has_value = i + 1 < __argc;
+        if (arg == "--stats" && has_value) {
+            metrics_reporter.start(__argv[++i]);
+        } else if (arg == "--trace" && has_value) {
+            trace_path = __argv[++i];
+            g_tracer.enable();
+        } else if (arg == "--flight" && has_value) {
+            flight_path = __argv[++i];
+        } else if (arg == "--no-flight") {
+            flight_path.clear();
+        } else if (arg == "--no-clipboard") {
+            clipboard = false;
+        } else if (arg == "--shm") {
+            g_app.shared_memory = true;
+        } else if (arg == "--receive-dir" && has_value) {
+            receive_dir = __argv[++i];
+        } else if (arg == "--predict" && has_value) {
+            g_app.prediction_us = static_cast<uint64_t>((std::max)(0, atoi(__argv[++i]))) * 1000;
+        } else if (arg == "--key" && has_value) {
+            try {
+                g_app.key = derive_preshared_key(__argv[++i]);
+            } catch (const CryptoError& e) {
+                MessageBoxA(nullptr, e.what(), "Cannot use the key", MB_OK | MB_ICONERROR);
+                return 1;
+            }
+        }
+    }
+    if (!flight_path.empty()) {
+        g_flight.open(flight_path);
+    }
+    g_app.files.set_directory(receive_dir);
+    g_app.channels.start();
+    if (clipboard) {
+        g_app.clipboard.start();
+    }
+    
     // Register window class
     WNDCLASSA wc = {};
     wc.lpfnWndProc = main_wnd_proc;
@@ -1654,6 +2227,10 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int nCmdShow) {
         DispatchMessage(&msg);
     }
     
+    if (!trace_path.empty()) {
+        g_tracer.write_chrome_trace(trace_path);
+    }
+    
     cleanup_winsock();
     return (int)msg.wParam;
 }
\ No newline at end of file
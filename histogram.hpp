@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <array>
+
+namespace MouseShare {
+
+// Plain copy of a histogram, for reporting
+struct HistogramSnapshot {
+    static constexpr int SUB_BUCKETS = 8;
+    static constexpr int MAGNITUDES = 40;
+    static constexpr int BUCKETS = SUB_BUCKETS * MAGNITUDES;
+
+    std::array<uint64_t, BUCKETS> counts{};
+    uint64_t total = 0;
+    uint64_t max = 0;
+
+    // Upper bound of the bucket holding value
+    static uint64_t bucket_limit(int bucket) {
+        int magnitude = bucket / SUB_BUCKETS;
+        int sub = bucket % SUB_BUCKETS;
+        if (magnitude == 0) {
+            return static_cast<uint64_t>(sub);
+        }
+        uint64_t base = uint64_t(1) << (magnitude + 2);
+        return base + ((base / SUB_BUCKETS) * (sub + 1)) - 1;
+    }
+
+    // Value at percentile p (0-100), accurate to the bucket width (~12%)
+    uint64_t percentile(double p) const {
+        if (total == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(p / 100.0 * total + 0.5);
+        if (rank == 0) rank = 1;
+
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            seen += counts[i];
+            if (seen >= rank) {
+                uint64_t limit = bucket_limit(i);
+                return limit < max ? limit : max;
+            }
+        }
+        return max;
+    }
+
+    void merge(const HistogramSnapshot& other) {
+        for (int i = 0; i < BUCKETS; i++) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        if (other.max > max) max = other.max;
+    }
+};
+
+// Log-linear (HDR-style) histogram: 8 linear sub-buckets per power of two,
+// so every recorded value is kept to within ~12%. Recording is a couple of
+// relaxed atomic adds and never blocks.
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BUCKETS = HistogramSnapshot::SUB_BUCKETS;
+    static constexpr int BUCKETS = HistogramSnapshot::BUCKETS;
+
+    void record(uint64_t value) {
+        counts_[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+        total_.fetch_add(1, std::memory_order_relaxed);
+
+        uint64_t seen = max_.load(std::memory_order_relaxed);
+        while (value > seen && !max_.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    HistogramSnapshot snapshot() const {
+        HistogramSnapshot s;
+        for (int i = 0; i < BUCKETS; i++) {
+            s.counts[i] = counts_[i].load(std::memory_order_relaxed);
+            s.total += s.counts[i];
+        }
+        s.max = max_.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    // Snapshot and start a new window
+    HistogramSnapshot take() {
+        HistogramSnapshot s;
+        for (int i = 0; i < BUCKETS; i++) {
+            s.counts[i] = counts_[i].exchange(0, std::memory_order_relaxed);
+            s.total += s.counts[i];
+        }
+        total_.store(0, std::memory_order_relaxed);
+        s.max = max_.exchange(0, std::memory_order_relaxed);
+        return s;
+    }
+
+    uint64_t count() const { return total_.load(std::memory_order_relaxed); }
+
+    static int bucket_of(uint64_t value) {
+        if (value < SUB_BUCKETS) {
+            return static_cast<int>(value);
+        }
+
+        // Values in [2^(m+2), 2^(m+3)) land in magnitude m
+        int bits = 0;
+        for (uint64_t v = value; v > 1; v >>= 1) bits++;
+        int magnitude = bits - 2;
+        int sub = static_cast<int>((value >> (bits - 3)) & (SUB_BUCKETS - 1));
+        int bucket = magnitude * SUB_BUCKETS + sub;
+        return bucket < BUCKETS ? bucket : BUCKETS - 1;
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKETS> counts_{};
+    std::atomic<uint64_t> total_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+} // namespace MouseShare
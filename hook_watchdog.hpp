@@ -0,0 +1,128 @@
+#pragma once
+
+#include "metrics.hpp"
+#include <cstdint>
+
+namespace MouseShare {
+
+constexpr uint64_t HOOK_BUDGET_US = 5000;            // a hook proc slower than this is worth a warning
+constexpr uint64_t HOOK_SYSTEM_TIMEOUT_US = 300000;  // Windows' default LowLevelHooksTimeout
+constexpr uint64_t HOOK_MISS_WINDOW_US = 1000000;    // system input this long after our last callback
+constexpr int HOOK_CHECK_INTERVAL_MS = 1000;
+
+enum class HookKind : uint8_t {
+    MOUSE = 0,
+    KEYBOARD = 1
+};
+
+inline const char* hook_kind_name(HookKind kind) {
+    return kind == HookKind::MOUSE ? "mouse" : "keyboard";
+}
+
+// Result of one HookWatchdog::check()
+struct HookCheck {
+    uint64_t over_budget = 0;   // procs over budget since the last check
+    uint64_t worst_us = 0;      // slowest of those
+    HookKind worst_kind = HookKind::MOUSE;
+    bool reinstall = false;     // the hooks are probably gone
+    const char* reason = "";
+};
+
+// Times every hook procedure and decides when the hooks need reinstalling.
+// Windows silently unhooks a low-level hook whose proc runs longer than
+// LowLevelHooksTimeout; after that the procs are simply never called again.
+// We notice either by having seen a proc run that long, or by the system
+// reporting input (GetLastInputInfo) that none of our procs saw.
+//
+// Everything runs on the hook thread. The clock is injectable so the logic
+// can be driven by a fake one.
+class HookWatchdog {
+public:
+    using Clock = uint64_t (*)();
+
+    explicit HookWatchdog(Clock clock = &MetricsRegistry::now_us,
+                          uint64_t budget_us = HOOK_BUDGET_US,
+                          uint64_t miss_window_us = HOOK_MISS_WINDOW_US)
+        : clock_(clock), budget_us_(budget_us), miss_window_us_(miss_window_us),
+          last_callback_us_(clock()) {}
+
+    uint64_t now() const { return clock_(); }
+
+    // End of a hook procedure that started at start_us
+    void proc_finished(HookKind kind, uint64_t start_us) {
+        uint64_t end_us = clock_();
+        uint64_t took = end_us - start_us;
+        g_metrics.record(Timing::HOOK_PROC, took);
+        last_callback_us_ = end_us;
+
+        if (took > budget_us_) {
+            g_metrics.count(Counter::HOOK_OVER_BUDGET);
+            over_budget_++;
+            if (took > worst_us_) {
+                worst_us_ = took;
+                worst_kind_ = kind;
+            }
+        }
+        if (took > HOOK_SYSTEM_TIMEOUT_US) {
+            timed_out_ = true;
+        }
+    }
+
+    // last_input_us: the system's most recent input, on our clock
+    HookCheck check(uint64_t last_input_us) {
+        HookCheck result;
+        result.over_budget = over_budget_;
+        result.worst_us = worst_us_;
+        result.worst_kind = worst_kind_;
+        over_budget_ = 0;
+        worst_us_ = 0;
+
+        if (timed_out_) {
+            result.reinstall = true;
+            result.reason = "a hook procedure exceeded LowLevelHooksTimeout";
+        } else if (last_input_us > last_callback_us_ + miss_window_us_) {
+            result.reinstall = true;
+            result.reason = "input arrived that the hooks never saw";
+        }
+        return result;
+    }
+
+    // Hooks were installed again; start watching afresh
+    void reinstalled() {
+        g_metrics.count(Counter::HOOK_REINSTALLS);
+        timed_out_ = false;
+        last_callback_us_ = clock_();
+    }
+
+private:
+    Clock clock_;
+    uint64_t budget_us_;
+    uint64_t miss_window_us_;
+
+    uint64_t last_callback_us_;
+    uint64_t over_budget_ = 0;
+    uint64_t worst_us_ = 0;
+    HookKind worst_kind_ = HookKind::MOUSE;
+    bool timed_out_ = false;
+};
+
+// Times a hook procedure for the watchdog (when there is one)
+class HookTiming {
+public:
+    HookTiming(HookWatchdog* watchdog, HookKind kind)
+        : watchdog_(watchdog), kind_(kind), start_us_(watchdog ? watchdog->now() : 0) {}
+
+    ~HookTiming() {
+        if (watchdog_) watchdog_->proc_finished(kind_, start_us_);
+    }
+
+    HookTiming(const HookTiming&) = delete;
+    HookTiming& operator=(const HookTiming&) = delete;
+
+private:
+    HookWatchdog* watchdog_;
+    HookKind kind_;
+    uint64_t start_us_;
+};
+
+} // namespace MouseShare
@@ -0,0 +1,102 @@
+#include "hook_watchdog.hpp"
+#include <iostream>
+
+using namespace MouseShare;
+
+// HookWatchdog decisions on a fake clock: hook procs take exactly as long
+// as the test says, and checks run at whatever time it picks.
+
+static int g_failures = 0;
+static uint64_t g_now_us = 0;
+
+static uint64_t fake_clock() {
+    return g_now_us;
+}
+
+static void expect(const char* name, bool condition) {
+    if (condition) {
+        std::cout << "ok      " << name << "\n";
+        return;
+    }
+    g_failures++;
+    std::cout << "FAILED  " << name << "\n";
+}
+
+// One hook procedure that runs for took_us
+static void run_proc(HookWatchdog& watchdog, HookKind kind, uint64_t took_us) {
+    HookTiming timing(&watchdog, kind);
+    g_now_us += took_us;
+}
+
+int main() {
+    {
+        g_now_us = 1000000;
+        HookWatchdog watchdog(&fake_clock);
+        run_proc(watchdog, HookKind::MOUSE, HOOK_BUDGET_US / 2);
+        run_proc(watchdog, HookKind::MOUSE, HOOK_BUDGET_US);
+        HookCheck check = watchdog.check(g_now_us);
+        expect("within budget", check.over_budget == 0 && !check.reinstall);
+    }
+    {
+        g_now_us = 1000000;
+        HookWatchdog watchdog(&fake_clock);
+        run_proc(watchdog, HookKind::MOUSE, HOOK_BUDGET_US + 1000);
+        run_proc(watchdog, HookKind::KEYBOARD, HOOK_BUDGET_US + 4000);
+        run_proc(watchdog, HookKind::MOUSE, 100);
+        HookCheck check = watchdog.check(g_now_us);
+        expect("over budget counted", check.over_budget == 2);
+        expect("over budget worst", check.worst_us == HOOK_BUDGET_US + 4000 &&
+                                    check.worst_kind == HookKind::KEYBOARD);
+        expect("over budget keeps hooks", !check.reinstall);
+
+        // The count is per check
+        check = watchdog.check(g_now_us);
+        expect("over budget reset", check.over_budget == 0 && check.worst_us == 0);
+    }
+    {
+        g_now_us = 1000000;
+        HookWatchdog watchdog(&fake_clock);
+        run_proc(watchdog, HookKind::KEYBOARD, HOOK_SYSTEM_TIMEOUT_US + 1);
+        HookCheck check = watchdog.check(g_now_us);
+        expect("timed out proc reinstalls", check.reinstall && check.over_budget == 1);
+
+        // Still gone until the hooks are actually reinstalled
+        check = watchdog.check(g_now_us);
+        expect("timed out until reinstalled", check.reinstall);
+        watchdog.reinstalled();
+        check = watchdog.check(g_now_us);
+        expect("reinstalled clears timeout", !check.reinstall);
+    }
+    {
+        g_now_us = 1000000;
+        HookWatchdog watchdog(&fake_clock);
+        run_proc(watchdog, HookKind::MOUSE, 100);
+        uint64_t last_callback_us = g_now_us;
+
+        // Idle user: no input anywhere is not a stall
+        g_now_us += 10 * HOOK_MISS_WINDOW_US;
+        HookCheck check = watchdog.check(last_callback_us);
+        expect("idle is not stalled", !check.reinstall);
+
+        // Input the hooks saw recently enough
+        check = watchdog.check(last_callback_us + HOOK_MISS_WINDOW_US);
+        expect("input within window", !check.reinstall);
+
+        // Input well after the last hook callback: the hooks are gone
+        check = watchdog.check(last_callback_us + HOOK_MISS_WINDOW_US + 1);
+        expect("stalled hooks reinstall", check.reinstall);
+
+        // A fresh install starts the window from now
+        watchdog.reinstalled();
+        check = watchdog.check(g_now_us);
+        expect("reinstalled restarts window", !check.reinstall);
+
+        // And callbacks keep it open
+        g_now_us += 2 * HOOK_MISS_WINDOW_US;
+        run_proc(watchdog, HookKind::KEYBOARD, 100);
+        check = watchdog.check(g_now_us);
+        expect("callbacks keep window open", !check.reinstall);
+    }
+
+    return g_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,293 @@
+#pragma once
+
+#include "common.hpp"
+#include <string>
+#include <sstream>
+#include <vector>
+#include <queue>
+#include <random>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+
+namespace MouseShare {
+
+constexpr double TCP_RETRANSMIT_MS = 200.0;  // minimum RTO: what a lost segment costs on a stream
+constexpr double PARETO_ALPHA = 3.0;         // tail shape of the pareto jitter
+
+enum class DelayDistribution : uint8_t {
+    UNIFORM = 0,   // delay +- jitter
+    NORMAL = 1,    // jitter is the standard deviation
+    PARETO = 2     // only ever adds delay; long tail, like a busy Wi-Fi channel
+};
+
+inline const char* delay_distribution_name(DelayDistribution distribution) {
+    switch (distribution) {
+        case DelayDistribution::UNIFORM: return "uniform";
+        case DelayDistribution::NORMAL: return "normal";
+        case DelayDistribution::PARETO: return "pareto";
+    }
+    return "?";
+}
+
+// How badly a link behaves. Applied per frame on TCP and per datagram on UDP.
+struct ImpairmentProfile {
+    double delay_ms = 0;
+    double jitter_ms = 0;
+    DelayDistribution distribution = DelayDistribution::NORMAL;
+    double loss = 0;        // fraction of packets lost
+    double reorder = 0;     // fraction of datagrams held back behind later ones
+    double rate_kbps = 0;   // bandwidth cap, 0 for none
+    double flap_s = 0;      // mean seconds between connection drops, 0 for none
+};
+
+// Parse "delay=40 jitter=10 dist=pareto loss=1 reorder=0.5 rate=2000 flap=30".
+// loss and reorder are percentages. Unknown keys are an error.
+inline bool parse_impairment(const std::string& spec, ImpairmentProfile& profile, std::string& error) {
+    std::istringstream in(spec);
+    std::string token;
+    while (in >> token) {
+        size_t eq = token.find('=');
+        if (eq == std::string::npos) {
+            error = "expected key=value: " + token;
+            return false;
+        }
+        std::string key = token.substr(0, eq);
+        std::string value = token.substr(eq + 1);
+
+        try {
+            if (key == "dist") {
+                if (value == "uniform") profile.distribution = DelayDistribution::UNIFORM;
+                else if (value == "normal") profile.distribution = DelayDistribution::NORMAL;
+                else if (value == "pareto") profile.distribution = DelayDistribution::PARETO;
+                else {
+                    error = "unknown distribution: " + value;
+                    return false;
+                }
+            } else if (key == "delay") {
+                profile.delay_ms = std::stod(value);
+            } else if (key == "jitter") {
+                profile.jitter_ms = std::stod(value);
+            } else if (key == "loss") {
+                profile.loss = std::stod(value) / 100.0;
+            } else if (key == "reorder") {
+                profile.reorder = std::stod(value) / 100.0;
+            } else if (key == "rate") {
+                profile.rate_kbps = std::stod(value);
+            } else if (key == "flap") {
+                profile.flap_s = std::stod(value);
+            } else {
+                error = "unknown setting: " + key;
+                return false;
+            }
+        } catch (const std::exception&) {
+            error = "bad value: " + token;
+            return false;
+        }
+    }
+    return true;
+}
+
+inline std::string describe_impairment(const ImpairmentProfile& p) {
+    std::ostringstream out;
+    out << "delay " << p.delay_ms << " ms, jitter " << p.jitter_ms << " ms ("
+        << delay_distribution_name(p.distribution) << "), loss " << p.loss * 100
+        << "%, reorder " << p.reorder * 100 << "%";
+    out << ", rate " << (p.rate_kbps > 0 ? std::to_string(static_cast<int>(p.rate_kbps)) + " kbit/s" : "unlimited");
+    if (p.flap_s > 0) {
+        out << ", drop every ~" << p.flap_s << " s";
+    }
+    return out.str();
+}
+
+struct ImpairmentStats {
+    uint64_t packets = 0;
+    uint64_t lost = 0;          // datagrams dropped
+    uint64_t retransmits = 0;   // stream frames delayed by a simulated retransmission
+    uint64_t reordered = 0;
+};
+
+// Decides when each packet crossing one direction of a link is delivered.
+// A stream link (TCP) never drops or reorders: a lost frame costs a
+// retransmission timeout and everything behind it waits (head-of-line
+// blocking). A datagram link drops lost packets and lets held-back ones
+// arrive after later ones.
+class LinkImpairment {
+public:
+    explicit LinkImpairment(bool stream) : stream_(stream), rng_(std::random_device{}()) {}
+
+    void set_profile(const ImpairmentProfile& profile) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        profile_ = profile;
+    }
+
+    // Delivery time for a packet of bytes arriving at now_us, or 0 if it is lost
+    uint64_t schedule(size_t bytes, uint64_t now_us) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.packets++;
+
+        // Serialisation on a capped link queues packets behind each other
+        uint64_t start_us = now_us;
+        if (profile_.rate_kbps > 0) {
+            start_us = (std::max)(now_us, link_free_us_);
+            link_free_us_ = start_us + static_cast<uint64_t>(bytes * 8 * 1000.0 / profile_.rate_kbps);
+            start_us = link_free_us_;
+        }
+
+        double delay_ms = (std::max)(0.0, profile_.delay_ms + sample_jitter());
+
+        if (chance(profile_.loss)) {
+            if (!stream_) {
+                stats_.lost++;
+                return 0;
+            }
+            stats_.retransmits++;
+            delay_ms += (std::max)(TCP_RETRANSMIT_MS, 2 * profile_.delay_ms);
+        }
+
+        uint64_t deliver_us = start_us + static_cast<uint64_t>(delay_ms * 1000.0);
+
+        if (!stream_ && chance(profile_.reorder)) {
+            // Held back by one more base delay; later packets overtake it
+            stats_.reordered++;
+            return deliver_us + static_cast<uint64_t>((std::max)(1.0, profile_.delay_ms) * 1000.0);
+        }
+
+        // Jitter alone never reorders, as on a single path
+        deliver_us = (std::max)(deliver_us, last_deliver_us_);
+        last_deliver_us_ = deliver_us;
+        return deliver_us;
+    }
+
+    // Stats since the last call
+    ImpairmentStats take_stats() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ImpairmentStats stats = stats_;
+        stats_ = ImpairmentStats();
+        return stats;
+    }
+
+private:
+    double sample_jitter() {
+        double jitter = profile_.jitter_ms;
+        if (jitter <= 0) return 0;
+
+        switch (profile_.distribution) {
+            case DelayDistribution::UNIFORM:
+                return std::uniform_real_distribution<double>(-jitter, jitter)(rng_);
+            case DelayDistribution::NORMAL:
+                return std::normal_distribution<double>(0, jitter)(rng_);
+            case DelayDistribution::PARETO: {
+                // Scaled so the mean extra delay is jitter
+                double u = std::uniform_real_distribution<double>(1e-9, 1.0)(rng_);
+                return jitter * (PARETO_ALPHA - 1) * (std::pow(u, -1.0 / PARETO_ALPHA) - 1);
+            }
+        }
+        return 0;
+    }
+
+    bool chance(double p) {
+        return p > 0 && std::uniform_real_distribution<double>(0, 1)(rng_) < p;
+    }
+
+    bool stream_;
+    std::mt19937 rng_;
+    std::mutex mutex_;
+    ImpairmentProfile profile_;
+    ImpairmentStats stats_;
+    uint64_t link_free_us_ = 0;
+    uint64_t last_deliver_us_ = 0;
+};
+
+// Holds packets until their delivery time, then hands them to a sink on its
+// own thread. Packets due at the same time leave in arrival order.
+class DelayLine {
+public:
+    // arrived_us is when the packet entered the line
+    using SinkFn = std::function<void(const std::string& data, uint64_t arrived_us)>;
+
+    explicit DelayLine(SinkFn sink) : sink_(std::move(sink)) {}
+
+    ~DelayLine() {
+        stop();
+    }
+
+    void start() {
+        running_ = true;
+        thread_ = std::thread(&DelayLine::thread_func, this);
+    }
+
+    // Stop without delivering what is still queued
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_ = false;
+        }
+        cv_.notify_all();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    void push(std::string data, uint64_t arrived_us, uint64_t deliver_us) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push(Entry{deliver_us, next_order_++, arrived_us, std::move(data)});
+        }
+        cv_.notify_one();
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return queue_.size();
+    }
+
+private:
+    struct Entry {
+        uint64_t deliver_us;
+        uint64_t order;
+        uint64_t arrived_us;
+        std::string data;
+
+        bool operator>(const Entry& other) const {
+            return deliver_us != other.deliver_us ? deliver_us > other.deliver_us : order > other.order;
+        }
+    };
+
+    void thread_func() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (running_) {
+            if (queue_.empty()) {
+                cv_.wait(lock);
+                continue;
+            }
+
+            // get_timestamp_us counts steady_clock microseconds
+            auto due = std::chrono::steady_clock::time_point(std::chrono::microseconds(queue_.top().deliver_us));
+            if (std::chrono::steady_clock::now() < due) {
+                cv_.wait_until(lock, due);
+                continue;
+            }
+
+            Entry entry = queue_.top();
+            queue_.pop();
+            lock.unlock();
+            sink_(entry.data, entry.arrived_us);
+            lock.lock();
+        }
+    }
+
+    SinkFn sink_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue_;
+    uint64_t next_order_ = 0;
+    bool running_ = false;
+    std::thread thread_;
+};
+
+} // namespace MouseShare
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "common.hpp"
+#include "trace.hpp"
+#include "hook_watchdog.hpp"
 #include <functional>
 #include <atomic>
 #include <thread>
@@ -13,7 +15,7 @@ class InputCapture {
 public:
     using MouseMoveCallback = std::function<void(int x, int y, int dx, int dy)>;
     using MouseButtonCallback = std::function<void(MouseButton button, bool pressed)>;
-    using MouseScrollCallback = std::function<void(int dx, int dy)>;
+    using MouseScrollCallback = std::function<void(int dx, int dy)>;  // wheel units, WHEEL_DELTA a notch
     using KeyCallback = std::function<void(uint32_t vkCode, uint32_t scanCode, uint32_t flags, bool pressed)>;
     
     InputCapture() : running_(false), captured_(false) {
@@ -92,27 +94,74 @@ public:
     int screen_height() const { return screen_height_; }
     
 private:
-    void hook_thread_func() {
-        hook_thread_id_ = GetCurrentThreadId();
-        
-        // Install low-level mouse hook
+    bool install_hooks() {
         mouse_hook_ = SetWindowsHookEx(WH_MOUSE_LL, mouse_hook_proc, nullptr, 0);
         if (!mouse_hook_) {
             std::cerr << "Failed to install mouse hook: " << GetLastError() << "\n";
-            return;
+            return false;
         }
         
-        // Install low-level keyboard hook
         keyboard_hook_ = SetWindowsHookEx(WH_KEYBOARD_LL, keyboard_hook_proc, nullptr, 0);
         if (!keyboard_hook_) {
             std::cerr << "Failed to install keyboard hook: " << GetLastError() << "\n";
             UnhookWindowsHookEx(mouse_hook_);
+            mouse_hook_ = nullptr;
+            return false;
+        }
+        return true;
+    }
+    
+    void remove_hooks() {
+        // Fails harmlessly for a hook Windows already removed
+        if (mouse_hook_) UnhookWindowsHookEx(mouse_hook_);
+        if (keyboard_hook_) UnhookWindowsHookEx(keyboard_hook_);
+        mouse_hook_ = nullptr;
+        keyboard_hook_ = nullptr;
+    }
+    
+    // Periodic, on the hook thread: warn about slow procs and put back
+    // hooks that Windows removed
+    void check_hooks() {
+        LASTINPUTINFO info = {sizeof(info)};
+        uint64_t now = watchdog_.now();
+        uint64_t last_input_us = 0;
+        if (GetLastInputInfo(&info)) {
+            uint64_t ago_us = static_cast<uint64_t>(GetTickCount() - info.dwTime) * 1000;
+            last_input_us = ago_us < now ? now - ago_us : 0;
+        }
+        
+        HookCheck check = watchdog_.check(last_input_us);
+        if (check.over_budget) {
+            std::cerr << "Warning: " << check.over_budget << " hook procedure(s) over the "
+                      << HOOK_BUDGET_US / 1000 << " ms budget, slowest " << check.worst_us / 1000
+                      << " ms (" << hook_kind_name(check.worst_kind) << ")\n";
+        }
+        if (check.reinstall) {
+            std::cerr << "Reinstalling input hooks: " << check.reason << "\n";
+            remove_hooks();
+            if (install_hooks()) {
+                watchdog_.reinstalled();
+            }
+        }
+    }
+    
+    void hook_thread_func() {
+        hook_thread_id_ = GetCurrentThreadId();
+        
+        if (!install_hooks()) {
             return;
         }
+        watchdog_.reinstalled();
+        
+        // Wakes the loop for the hook checks even when no input arrives
+        UINT_PTR timer = SetTimer(nullptr, 0, HOOK_CHECK_INTERVAL_MS, nullptr);
         
         // Message loop for hooks
         MSG msg;
         while (running_ && GetMessage(&msg, nullptr, 0, 0)) {
+            if (msg.message == WM_TIMER && msg.hwnd == nullptr) {
+                check_hooks();
+            }
             TranslateMessage(&msg);
             DispatchMessage(&msg);
             
@@ -122,13 +171,14 @@ private:
                 if ((now - instance_->last_activity_) > 30000) {
                     std::cerr << "Safety timeout: releasing input capture\n";
                     instance_->captured_ = false;
+                    g_metrics.count(Counter::SAFETY_TIMEOUTS);
                 }
             }
         }
         
         // Cleanup hooks
-        UnhookWindowsHookEx(mouse_hook_);
-        UnhookWindowsHookEx(keyboard_hook_);
+        KillTimer(nullptr, timer);
+        remove_hooks();
     }
     
     static bool is_emergency_key(DWORD vkCode, bool ctrl_down, bool alt_down) {
@@ -164,6 +214,10 @@ private:
     }
     
     static LRESULT CALLBACK mouse_hook_proc(int nCode, WPARAM wParam, LPARAM lParam) {
+        trace_begin(TraceStage::HOOK);
+        HookTiming timing(instance_ ? &instance_->watchdog_ : nullptr, HookKind::MOUSE);
+        g_metrics.count(Counter::HOOK_EVENTS);
+        
         if (nCode >= 0 && instance_) {
             auto* ms = reinterpret_cast<MSLLHOOKSTRUCT*>(lParam);
             
@@ -235,14 +289,14 @@ private:
                 case WM_MOUSEWHEEL:
                     if (instance_->scroll_callback_) {
                         int delta = GET_WHEEL_DELTA_WPARAM(ms->mouseData);
-                        instance_->scroll_callback_(0, delta / WHEEL_DELTA);
+                        instance_->scroll_callback_(0, delta);
                     }
                     break;
                     
                 case WM_MOUSEHWHEEL:
                     if (instance_->scroll_callback_) {
                         int delta = GET_WHEEL_DELTA_WPARAM(ms->mouseData);
-                        instance_->scroll_callback_(delta / WHEEL_DELTA, 0);
+                        instance_->scroll_callback_(delta, 0);
                     }
                     break;
             }
@@ -257,6 +311,10 @@ private:
     }
     
     static LRESULT CALLBACK keyboard_hook_proc(int nCode, WPARAM wParam, LPARAM lParam) {
+        trace_begin(TraceStage::HOOK);
+        HookTiming timing(instance_ ? &instance_->watchdog_ : nullptr, HookKind::KEYBOARD);
+        g_metrics.count(Counter::HOOK_EVENTS);
+        
         if (nCode >= 0 && instance_) {
             auto* kb = reinterpret_cast<KBDLLHOOKSTRUCT*>(lParam);
             bool pressed = (wParam == WM_KEYDOWN || wParam == WM_SYSKEYDOWN);
@@ -320,6 +378,7 @@ private:
     
     HHOOK mouse_hook_ = nullptr;
     HHOOK keyboard_hook_ = nullptr;
+    HookWatchdog watchdog_;
     
     MouseMoveCallback move_callback_;
     MouseButtonCallback button_callback_;
@@ -1,11 +1,24 @@
 #pragma once
 
 #include "common.hpp"
+#include "key_state.hpp"
+#include "trace.hpp"
 #include <iostream>
 #include <algorithm>
 
 namespace MouseShare {
 
+// Refresh rate of the primary display, for the session hello; 0 if Windows
+// only knows the hardware default
+inline uint16_t display_refresh_hz() {
+    DEVMODE mode = {};
+    mode.dmSize = sizeof(mode);
+    if (!EnumDisplaySettings(nullptr, ENUM_CURRENT_SETTINGS, &mode) || mode.dmDisplayFrequency <= 1) {
+        return 0;
+    }
+    return static_cast<uint16_t>((std::min)(mode.dmDisplayFrequency, DWORD(UINT16_MAX)));
+}
+
 class InputSimulator {
 public:
     InputSimulator() {}
@@ -42,6 +55,7 @@ public:
         input.mi.dwFlags = MOUSEEVENTF_ABSOLUTE | MOUSEEVENTF_MOVE;
         
         SendInput(1, &input, sizeof(INPUT));
+        trace_stage(TraceStage::INJECT);
         
         current_x_ = x;
         current_y_ = y;
@@ -55,6 +69,7 @@ public:
         input.mi.dwFlags = MOUSEEVENTF_MOVE;
         
         SendInput(1, &input, sizeof(INPUT));
+        trace_stage(TraceStage::INJECT);
         
         current_x_ += dx;
         current_y_ += dy;
@@ -85,15 +100,19 @@ public:
         }
         
         SendInput(1, &input, sizeof(INPUT));
+        trace_stage(TraceStage::INJECT);
+        held_.set_button(button, pressed);
     }
     
+    // Wheel units (MouseScrollEvent): passed through unrounded, so
+    // applications that scroll smoothly get the fractions of a notch too
     void mouse_scroll(int dx, int dy) {
         // Vertical scroll
         if (dy != 0) {
             INPUT input = {};
             input.type = INPUT_MOUSE;
             input.mi.dwFlags = MOUSEEVENTF_WHEEL;
-            input.mi.mouseData = dy * WHEEL_DELTA;
+            input.mi.mouseData = static_cast<DWORD>(dy);
             SendInput(1, &input, sizeof(INPUT));
         }
         
@@ -102,9 +121,10 @@ public:
             INPUT input = {};
             input.type = INPUT_MOUSE;
             input.mi.dwFlags = MOUSEEVENTF_HWHEEL;
-            input.mi.mouseData = dx * WHEEL_DELTA;
+            input.mi.mouseData = static_cast<DWORD>(dx);
             SendInput(1, &input, sizeof(INPUT));
         }
+        trace_stage(TraceStage::INJECT);
     }
     
     void key_event(uint32_t vkCode, uint32_t scanCode, uint32_t flags, bool pressed) {
@@ -125,6 +145,43 @@ public:
         }
         
         SendInput(1, &input, sizeof(INPUT));
+        trace_stage(TraceStage::INJECT);
+        held_.set_key(vkCode, pressed);
+    }
+    
+    // Bring injected key/button state in line with the sender's snapshot.
+    // Keys we hold that the sender doesn't are released; keys the sender
+    // holds are only pressed if allow_press is set.
+    void sync_key_state(const KeyStateEvent& target, bool allow_press) {
+        KeyStateTracker wanted;
+        wanted.load(target);
+        
+        for (uint32_t vk = 1; vk < 256; vk++) {
+            bool have = held_.key_down(vk);
+            bool want = wanted.key_down(vk);
+            if (have && !want) {
+                key_event(vk, 0, 0, false);
+            } else if (!have && want && allow_press) {
+                key_event(vk, 0, 0, true);
+            }
+        }
+        
+        for (uint8_t b = static_cast<uint8_t>(MouseButton::LEFT); b <= static_cast<uint8_t>(MouseButton::BUTTON5); b++) {
+            MouseButton button = static_cast<MouseButton>(b);
+            bool have = held_.button_down(button);
+            bool want = wanted.button_down(button);
+            if (have && !want) {
+                mouse_button(button, false);
+            } else if (!have && want && allow_press) {
+                mouse_button(button, true);
+            }
+        }
+    }
+    
+    // Release everything we injected a press for (e.g. after losing the server)
+    void release_all() {
+        KeyStateEvent none = {};
+        sync_key_state(none, false);
     }
     
     void get_cursor_position(int& x, int& y) {
@@ -142,6 +199,8 @@ private:
     int screen_height_ = 0;
     int current_x_ = 0;
     int current_y_ = 0;
+    
+    KeyStateTracker held_;  // keys/buttons we injected a press for
 };
 
 } // namespace MouseShare
\ No newline at end of file
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "common.hpp"
+#include <vector>
+
+#ifdef __linux__
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <sys/socket.h>
+#include <ctime>
+#endif
+
+namespace MouseShare {
+
+// Kernel software timestamps on a TCP connection: when the stack received
+// each batch of bytes, and when it handed each send to the device. Linux
+// has them (SO_TIMESTAMPING); Winsock only stamps UDP (SIO_TIMESTAMPING),
+// so on Windows enabling fails and callers keep their own stamps only.
+// Stamps come back on the get_timestamp_us() clock.
+
+// One send, stamped when the stack passed it to the device. last_byte is
+// the stream offset of the send's last byte, counted (mod 2^32) from when
+// stamping was enabled.
+struct KernelTxStamp {
+    uint32_t last_byte;
+    uint64_t sent_us;
+};
+
+#ifdef __linux__
+// Software stamps are CLOCK_REALTIME; get_timestamp_us() is steady_clock
+inline uint64_t kernel_stamp_to_steady_us(const timespec& stamp) {
+    timespec realtime;
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    int64_t now_real_us = int64_t(realtime.tv_sec) * 1000000 + realtime.tv_nsec / 1000;
+    int64_t stamp_us = int64_t(stamp.tv_sec) * 1000000 + stamp.tv_nsec / 1000;
+    return static_cast<uint64_t>(int64_t(get_timestamp_us()) - (now_real_us - stamp_us));
+}
+#endif
+
+inline bool enable_kernel_timestamps(SOCKET sock) {
+#ifdef __linux__
+    int flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE |
+                SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    return setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0;
+#else
+    (void)sock;
+    return false;
+#endif
+}
+
+// recv() that also says when the kernel received the bytes (0 if unknown)
+inline int recv_stamped(SOCKET sock, char* buffer, int len, uint64_t& kernel_us) {
+    kernel_us = 0;
+#ifdef __linux__
+    iovec iov = {buffer, static_cast<size_t>(len)};
+    alignas(cmsghdr) char control[256];
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    int n = static_cast<int>(recvmsg(sock, &msg, 0));
+    for (cmsghdr* c = CMSG_FIRSTHDR(&msg); n > 0 && c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPING) {
+            const scm_timestamping* stamps = reinterpret_cast<const scm_timestamping*>(CMSG_DATA(c));
+            if (stamps->ts[0].tv_sec || stamps->ts[0].tv_nsec) {
+                kernel_us = kernel_stamp_to_steady_us(stamps->ts[0]);
+            }
+        }
+    }
+    return n;
+#else
+    return ::recv(sock, buffer, len, 0);
+#endif
+}
+
+// Collect the send stamps that have come back so far, without blocking
+inline void read_tx_stamps(SOCKET sock, std::vector<KernelTxStamp>& out) {
+#ifdef __linux__
+    while (true) {
+        char data[1];
+        iovec iov = {data, sizeof(data)};
+        alignas(cmsghdr) char control[256];
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            return;
+        }
+
+        uint64_t sent_us = 0;
+        const sock_extended_err* err = nullptr;
+        for (cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPING) {
+                sent_us = kernel_stamp_to_steady_us(reinterpret_cast<const scm_timestamping*>(CMSG_DATA(c))->ts[0]);
+            } else if ((c->cmsg_level == IPPROTO_IP && c->cmsg_type == IP_RECVERR) ||
+                       (c->cmsg_level == IPPROTO_IPV6 && c->cmsg_type == IPV6_RECVERR)) {
+                err = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(c));
+            }
+        }
+        if (sent_us && err && err->ee_origin == SO_EE_ORIGIN_TIMESTAMPING && err->ee_info == SCM_TSTAMP_SND) {
+            out.push_back({err->ee_data, sent_us});
+        }
+    }
+#else
+    (void)sock;
+    (void)out;
+#endif
+}
+
+} // namespace MouseShare
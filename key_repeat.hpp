@@ -0,0 +1,210 @@
+#pragma once
+
+#include "common.hpp"
+#include "key_state.hpp"
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+namespace MouseShare {
+
+// Keyboard autorepeat, sent once instead of as a KEY_PRESS per repeat.
+// Windows repeats a held key as further key downs with no up in between.
+// The first of them goes out as a KEY_REPEAT carrying the repeat interval,
+// the rest are dropped, and the client repeats the key itself on its own
+// clock until the KEY_RELEASE, another key's press, or the connection ends.
+constexpr uint32_t KEY_REPEAT_MIN_INTERVAL_US = 10000;    // 100 a second
+constexpr uint32_t KEY_REPEAT_MAX_INTERVAL_US = 1000000;
+constexpr uint32_t KEY_REPEAT_DRIFT_PERCENT = 25;  // measured this far off the announced interval: announce again
+
+// Interval between repeats as set in the keyboard control panel
+// (SPI_GETKEYBOARDSPEED: 0 is about 2.5 a second, 31 about 30)
+inline uint32_t system_key_repeat_interval_us() {
+    DWORD speed = 31;
+#ifdef _WIN32
+    SystemParametersInfo(SPI_GETKEYBOARDSPEED, 0, &speed, 0);
+#endif
+    double per_second = 2.5 + (std::min)(speed, DWORD(31)) * (27.5 / 31);
+    return static_cast<uint32_t>(1e6 / per_second);
+}
+
+inline uint32_t clamp_repeat_interval(uint64_t us) {
+    return static_cast<uint32_t>((std::max)(uint64_t(KEY_REPEAT_MIN_INTERVAL_US),
+                                            (std::min)(us, uint64_t(KEY_REPEAT_MAX_INTERVAL_US))));
+}
+
+// What to send for a key down
+enum class KeyDown : uint8_t {
+    PRESS,         // a new press: KEY_PRESS
+    REPEAT,        // autorepeat started, or its interval changed: KEY_REPEAT
+    SUPPRESS       // autorepeat the client is already producing
+};
+
+// Server side: tells presses from autorepeat. Feed it every key event, sent
+// or not, so it always knows which keys are down.
+class KeyRepeatDetector {
+public:
+    explicit KeyRepeatDetector(uint32_t interval_us = system_key_repeat_interval_us())
+        : default_interval_us_(interval_us) {}
+
+    // A key down; for REPEAT, interval_us is the one to announce
+    KeyDown on_press(uint32_t vk, uint64_t now_us, uint32_t& interval_us) {
+        if (!down_.key_down(vk)) {
+            down_.set_key(vk, true);
+            repeating_vk_ = 0;  // like Windows: a new press ends the other key's repeat
+            return KeyDown::PRESS;
+        }
+
+        if (repeating_vk_ != vk) {
+            repeating_vk_ = vk;
+            announced_us_ = measured_us_ = default_interval_us_;
+            last_us_ = now_us;
+            interval_us = announced_us_;
+            return KeyDown::REPEAT;
+        }
+
+        // Smoothed like an RTT, so one late hook callback doesn't count
+        uint64_t gap = now_us - last_us_;
+        last_us_ = now_us;
+        measured_us_ = clamp_repeat_interval(measured_us_ - measured_us_ / 4 + gap / 4);
+        uint32_t drift = measured_us_ > announced_us_ ? measured_us_ - announced_us_ : announced_us_ - measured_us_;
+        if (drift * 100 > announced_us_ * KEY_REPEAT_DRIFT_PERCENT) {
+            announced_us_ = measured_us_;
+            interval_us = announced_us_;
+            return KeyDown::REPEAT;
+        }
+        return KeyDown::SUPPRESS;
+    }
+
+    // A key up; true if the key was repeating, so the client must hear of
+    // it even if the release happened while input was local
+    bool on_release(uint32_t vk) {
+        down_.set_key(vk, false);
+        if (repeating_vk_ != vk) return false;
+        repeating_vk_ = 0;
+        return true;
+    }
+
+private:
+    uint32_t default_interval_us_;
+    KeyStateTracker down_;
+    uint32_t repeating_vk_ = 0;
+    uint32_t announced_us_ = 0;
+    uint32_t measured_us_ = 0;
+    uint64_t last_us_ = 0;
+};
+
+// Client side: injects the repeats of one key on a thread of its own.
+// The caller's dispatch mutex orders them with the frames it applies, so
+// a repeat never lands after the release that ended it. Call repeat() and
+// key() with that mutex held; cancel() either way.
+class KeyRepeater {
+public:
+    using InjectFn = std::function<void(const KeyEvent& key)>;  // one key down
+
+    KeyRepeater(std::mutex& dispatch_mutex, InjectFn inject)
+        : dispatch_mutex_(dispatch_mutex), inject_(std::move(inject)) {}
+
+    ~KeyRepeater() {
+        stop();
+    }
+
+    KeyRepeater(const KeyRepeater&) = delete;
+    KeyRepeater& operator=(const KeyRepeater&) = delete;
+
+    void start() {
+        running_ = true;
+        thread_ = std::thread(&KeyRepeater::thread_func, this);
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_ = false;
+        }
+        cv_.notify_all();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    // A KEY_REPEAT. True if this starts a repeat: the caller injects the
+    // first one itself. Otherwise only the interval changes.
+    bool repeat(const KeyRepeatEvent& event) {
+        bool started;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            started = !repeating_ || key_.vkCode != event.key.vkCode;
+            if (started) {
+                key_ = event.key;
+                last_ = std::chrono::steady_clock::now();
+            }
+            repeating_ = true;
+            interval_ = std::chrono::microseconds(clamp_repeat_interval(event.interval_us));
+            next_ = last_ + interval_;
+        }
+        cv_.notify_all();
+        return started;
+    }
+
+    // A KEY_PRESS or KEY_RELEASE from the server
+    void key(uint32_t vk, bool pressed) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (repeating_ && (pressed || key_.vkCode == vk)) {
+            repeating_ = false;
+        }
+    }
+
+    // No more repeats, e.g. when the connection drops
+    void cancel() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        repeating_ = false;
+    }
+
+private:
+    void thread_func() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (running_) {
+            if (!repeating_) {
+                cv_.wait(lock, [this] { return !running_ || repeating_; });
+                continue;
+            }
+            auto due = next_;
+            if (cv_.wait_until(lock, due, [this, due] { return !running_ || !repeating_ || next_ != due; })) {
+                continue;
+            }
+
+            // Dispatch mutex first, as every caller holds it
+            lock.unlock();
+            {
+                std::lock_guard<std::mutex> dispatch(dispatch_mutex_);
+                std::lock_guard<std::mutex> relock(mutex_);
+                if (running_ && repeating_ && next_ == due) {
+                    inject_(key_);
+                    last_ = due;
+                    // After a stall, carry on from now rather than catch up in a burst
+                    next_ = (std::max)(due + interval_, std::chrono::steady_clock::now());
+                }
+            }
+            lock.lock();
+        }
+    }
+
+    std::mutex& dispatch_mutex_;
+    InjectFn inject_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::thread thread_;
+    bool running_ = false;
+    bool repeating_ = false;
+    KeyEvent key_ = {};
+    std::chrono::microseconds interval_{0};
+    std::chrono::steady_clock::time_point last_;   // last repeat injected
+    std::chrono::steady_clock::time_point next_;
+};
+
+} // namespace MouseShare
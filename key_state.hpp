@@ -0,0 +1,108 @@
+#pragma once
+
+#include "common.hpp"
+
+namespace MouseShare {
+
+// Tracks which keys and mouse buttons are held, as seen by the frames that
+// crossed the wire. Used to resynchronise a receiver that missed releases.
+class KeyStateTracker {
+public:
+    KeyStateTracker() {
+        reset();
+    }
+
+    void reset() {
+        std::memset(&state_, 0, sizeof(state_));
+    }
+
+    void load(const KeyStateEvent& state) {
+        state_ = state;
+    }
+
+    void set_key(uint32_t vkCode, bool pressed) {
+        if (vkCode >= 256) return;
+        uint8_t bit = static_cast<uint8_t>(1u << (vkCode & 7));
+        if (pressed) {
+            state_.keys[vkCode >> 3] |= bit;
+        } else {
+            state_.keys[vkCode >> 3] &= static_cast<uint8_t>(~bit);
+        }
+    }
+
+    void set_button(MouseButton button, bool pressed) {
+        uint8_t bit = static_cast<uint8_t>(1u << static_cast<uint8_t>(button));
+        if (pressed) {
+            state_.buttons |= bit;
+        } else {
+            state_.buttons &= static_cast<uint8_t>(~bit);
+        }
+    }
+
+    bool key_down(uint32_t vkCode) const {
+        return vkCode < 256 && (state_.keys[vkCode >> 3] & (1u << (vkCode & 7))) != 0;
+    }
+
+    bool button_down(MouseButton button) const {
+        return (state_.buttons & (1u << static_cast<uint8_t>(button))) != 0;
+    }
+
+    bool any_down() const {
+        if (state_.buttons) return true;
+        for (uint8_t byte : state_.keys) {
+            if (byte) return true;
+        }
+        return false;
+    }
+
+    // Update from a serialized frame; non-key frames are ignored
+    void apply_frame(const std::string& frame) {
+        if (frame.size() < sizeof(PacketHeader)) return;
+
+        PacketHeader header;
+        std::memcpy(&header, frame.data(), sizeof(header));
+        const char* payload = frame.data() + sizeof(header);
+        size_t size = frame.size() - sizeof(header);
+
+        switch (header.type) {
+            case EventType::KEY_PRESS:
+            case EventType::KEY_RELEASE:
+                if (size >= sizeof(KeyEvent)) {
+                    KeyEvent event;
+                    std::memcpy(&event, payload, sizeof(event));
+                    set_key(event.vkCode, header.type == EventType::KEY_PRESS);
+                }
+                break;
+            case EventType::KEY_REPEAT:
+                if (size >= sizeof(KeyRepeatEvent)) {
+                    KeyRepeatEvent event;
+                    std::memcpy(&event, payload, sizeof(event));
+                    set_key(event.key.vkCode, true);
+                }
+                break;
+            case EventType::MOUSE_BUTTON:
+                if (size >= sizeof(MouseButtonEvent)) {
+                    MouseButtonEvent event;
+                    std::memcpy(&event, payload, sizeof(event));
+                    set_button(event.button, event.pressed);
+                }
+                break;
+            case EventType::KEY_STATE:
+                if (size >= sizeof(KeyStateEvent)) {
+                    KeyStateEvent event;
+                    std::memcpy(&event, payload, sizeof(event));
+                    load(event);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    const KeyStateEvent& snapshot() const { return state_; }
+
+private:
+    KeyStateEvent state_;
+};
+
+} // namespace MouseShare
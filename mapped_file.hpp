@@ -0,0 +1,125 @@
+#pragma once
+
+#include "common.hpp"
+#include <string>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace MouseShare {
+
+// A file mapped into memory, either created read-write at a fixed size or
+// opened read-only at its current size. Unmapped on close/destruction.
+class MappedFile {
+public:
+    MappedFile() = default;
+
+    ~MappedFile() {
+        close();
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Create (or truncate) path and map size bytes of it, zero-filled
+    bool create(const std::string& path, size_t size) {
+        close();
+#ifdef _WIN32
+        file_ = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                            CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE) {
+            file_ = nullptr;
+            return false;
+        }
+        mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READWRITE, 0, static_cast<DWORD>(size), nullptr);
+        if (mapping_) {
+            view_ = MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, size);
+        }
+#else
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd_ >= 0 && ftruncate(fd_, static_cast<off_t>(size)) == 0) {
+            void* view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+            view_ = view == MAP_FAILED ? nullptr : view;
+        }
+#endif
+        if (!view_) {
+            close();
+            return false;
+        }
+        size_ = size;
+        return true;
+    }
+
+    // Map an existing file read-only
+    bool open_read(const std::string& path) {
+        close();
+#ifdef _WIN32
+        file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE) {
+            file_ = nullptr;
+            return false;
+        }
+        LARGE_INTEGER file_size;
+        if (GetFileSizeEx(file_, &file_size) && file_size.QuadPart > 0) {
+            mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping_) {
+                view_ = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+                size_ = static_cast<size_t>(file_size.QuadPart);
+            }
+        }
+#else
+        fd_ = ::open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd_ >= 0 && fstat(fd_, &st) == 0 && st.st_size > 0) {
+            void* view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd_, 0);
+            if (view != MAP_FAILED) {
+                view_ = view;
+                size_ = static_cast<size_t>(st.st_size);
+            }
+        }
+#endif
+        if (!view_) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (view_) UnmapViewOfFile(view_);
+        if (mapping_) CloseHandle(mapping_);
+        if (file_) CloseHandle(file_);
+        mapping_ = nullptr;
+        file_ = nullptr;
+#else
+        if (view_) munmap(view_, size_);
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+#endif
+        view_ = nullptr;
+        size_ = 0;
+    }
+
+    bool is_open() const { return view_ != nullptr; }
+    void* data() const { return view_; }
+    size_t size() const { return size_; }
+
+private:
+#ifdef _WIN32
+    HANDLE file_ = nullptr;
+    HANDLE mapping_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+    void* view_ = nullptr;
+    size_t size_ = 0;
+};
+
+} // namespace MouseShare
@@ -0,0 +1,186 @@
+#pragma once
+
+#include "histogram.hpp"
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+
+namespace MouseShare {
+
+// Event counters. Add new ones before COUNT and name them in counter_name().
+enum class Counter : uint8_t {
+    HOOK_EVENTS,          // low-level hook callbacks
+    SAFETY_TIMEOUTS,      // capture released by the 30 s inactivity timeout
+    FRAMES_SERIALIZED,
+    SEND_CALLS,
+    BYTES_SENT,
+    SEND_FAILURES,        // Socket::send returned <= 0
+    EVENTS_DISPATCHED,    // frames applied by a client
+    HOOK_OVER_BUDGET,     // hook procedures slower than HOOK_BUDGET_US
+    HOOK_REINSTALLS,      // hooks reinstalled after Windows dropped them
+    CLIPBOARD_FETCHES,    // pastes that had to pull content from the peer
+    CLIPBOARD_CACHE_HITS, // pastes served from the content cache
+    TRANSFER_BYTES,       // bytes of clipboard and file transfer frames sent
+    TRANSFER_CONTENT_BYTES, // what those frames carried before compression
+    FILES_RECEIVED,       // dropped files received and verified
+    RECORDS_SEALED,       // encrypted records sent
+    RECORDS_REJECTED,     // received records that failed authentication
+    SHM_WAKEUPS,          // shared memory rings: sleeping peers woken by a system call
+    RECV_CALLS,           // recv system calls on TCP connections
+    SCROLL_MERGED,        // scroll frames added into one already queued
+    COUNT
+};
+
+// Distributions: latencies in microseconds, and sizes
+enum class Timing : uint8_t {
+    HOOK_PROC,            // time spent inside a hook procedure
+    DISPATCH,             // client: applying one received frame
+    SEND_BATCH,           // frames per send from the outbound queue
+    COUNT
+};
+
+// Current values, overwritten rather than accumulated
+enum class Gauge : uint8_t {
+    SEND_QUEUED_BYTES,    // bytes waiting in the connection's outbound queue
+    SEND_QUEUED_US,       // how long the oldest of them has waited
+    SEND_RTT_US,          // smoothed round trip time to the peer, from keepalive pings
+    GATHER_WINDOW_US,     // how long the queue waits to batch input (send_batching.hpp)
+    MOTION_RATE_HZ,       // most MOUSE_MOVE frames the queue sends a second; 0 unlimited
+    COUNT
+};
+
+constexpr int COUNTER_COUNT = static_cast<int>(Counter::COUNT);
+constexpr int TIMING_COUNT = static_cast<int>(Timing::COUNT);
+constexpr int GAUGE_COUNT = static_cast<int>(Gauge::COUNT);
+constexpr int METRICS_MAX_THREADS = 32;
+
+inline const char* counter_name(Counter counter) {
+    switch (counter) {
+        case Counter::HOOK_EVENTS: return "hook_events";
+        case Counter::SAFETY_TIMEOUTS: return "safety_timeouts";
+        case Counter::FRAMES_SERIALIZED: return "frames_serialized";
+        case Counter::SEND_CALLS: return "send_calls";
+        case Counter::BYTES_SENT: return "bytes_sent";
+        case Counter::SEND_FAILURES: return "send_failures";
+        case Counter::EVENTS_DISPATCHED: return "events_dispatched";
+        case Counter::HOOK_OVER_BUDGET: return "hook_over_budget";
+        case Counter::HOOK_REINSTALLS: return "hook_reinstalls";
+        case Counter::CLIPBOARD_FETCHES: return "clipboard_fetches";
+        case Counter::CLIPBOARD_CACHE_HITS: return "clipboard_cache_hits";
+        case Counter::TRANSFER_BYTES: return "transfer_bytes";
+        case Counter::TRANSFER_CONTENT_BYTES: return "transfer_content_bytes";
+        case Counter::FILES_RECEIVED: return "files_received";
+        case Counter::RECORDS_SEALED: return "records_sealed";
+        case Counter::RECORDS_REJECTED: return "records_rejected";
+        case Counter::SHM_WAKEUPS: return "shm_wakeups";
+        case Counter::RECV_CALLS: return "recv_calls";
+        case Counter::SCROLL_MERGED: return "scroll_merged";
+        default: return "unknown";
+    }
+}
+
+inline const char* timing_name(Timing timing) {
+    switch (timing) {
+        case Timing::HOOK_PROC: return "hook_proc_us";
+        case Timing::DISPATCH: return "dispatch_us";
+        case Timing::SEND_BATCH: return "send_batch_frames";
+        default: return "unknown";
+    }
+}
+
+inline const char* gauge_name(Gauge gauge) {
+    switch (gauge) {
+        case Gauge::SEND_QUEUED_BYTES: return "send_queued_bytes";
+        case Gauge::SEND_QUEUED_US: return "send_queued_us";
+        case Gauge::SEND_RTT_US: return "send_rtt_us";
+        case Gauge::GATHER_WINDOW_US: return "gather_window_us";
+        case Gauge::MOTION_RATE_HZ: return "motion_rate_hz";
+        default: return "unknown";
+    }
+}
+
+struct MetricsSnapshot {
+    uint64_t taken_us = 0;
+    uint64_t counters[COUNTER_COUNT] = {};
+    HistogramSnapshot timings[TIMING_COUNT];
+    uint64_t gauges[GAUGE_COUNT] = {};
+};
+
+// Process-wide metrics. Each thread increments counters in its own
+// cache-line-sized block, so the hook thread never shares a line with the
+// network threads; timings go to lock-free histograms. Nothing here takes
+// a lock, so it is safe to call from hook procedures.
+class MetricsRegistry {
+public:
+    void count(Counter counter, uint64_t n = 1) {
+        blocks_[thread_slot()].values[static_cast<int>(counter)].fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void record(Timing timing, uint64_t us) {
+        timings_[static_cast<int>(timing)].record(us);
+    }
+
+    void set(Gauge gauge, uint64_t value) {
+        gauges_[static_cast<int>(gauge)].store(value, std::memory_order_relaxed);
+    }
+
+    // Sum of all thread blocks; cheap enough to call once a second
+    MetricsSnapshot snapshot() const {
+        MetricsSnapshot s;
+        s.taken_us = now_us();
+        for (const auto& block : blocks_) {
+            for (int i = 0; i < COUNTER_COUNT; i++) {
+                s.counters[i] += block.values[i].load(std::memory_order_relaxed);
+            }
+        }
+        for (int i = 0; i < TIMING_COUNT; i++) {
+            s.timings[i] = timings_[i].snapshot();
+        }
+        for (int i = 0; i < GAUGE_COUNT; i++) {
+            s.gauges[i] = gauges_[i].load(std::memory_order_relaxed);
+        }
+        return s;
+    }
+
+    static uint64_t now_us() {
+        auto now = std::chrono::steady_clock::now().time_since_epoch();
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(now).count());
+    }
+
+private:
+    struct alignas(64) CounterBlock {
+        std::atomic<uint64_t> values[COUNTER_COUNT] = {};
+    };
+
+    int thread_slot() {
+        // Threads beyond METRICS_MAX_THREADS share blocks; still correct, just slower
+        thread_local int slot = next_slot_.fetch_add(1, std::memory_order_relaxed) % METRICS_MAX_THREADS;
+        return slot;
+    }
+
+    CounterBlock blocks_[METRICS_MAX_THREADS];
+    LatencyHistogram timings_[TIMING_COUNT];
+    std::atomic<uint64_t> gauges_[GAUGE_COUNT] = {};
+    std::atomic<int> next_slot_{0};
+};
+
+inline MetricsRegistry g_metrics;
+
+// Records the lifetime of a scope into a Timing
+class ScopedTiming {
+public:
+    explicit ScopedTiming(Timing timing) : timing_(timing), start_us_(MetricsRegistry::now_us()) {}
+
+    ~ScopedTiming() {
+        g_metrics.record(timing_, MetricsRegistry::now_us() - start_us_);
+    }
+
+    ScopedTiming(const ScopedTiming&) = delete;
+    ScopedTiming& operator=(const ScopedTiming&) = delete;
+
+private:
+    Timing timing_;
+    uint64_t start_us_;
+};
+
+} // namespace MouseShare
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "common.hpp"
+#include <string>
+#include <fstream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+
+namespace MouseShare {
+
+// Periodically writes a g_metrics snapshot to a text file, e.g. for
+// `type` / `Get-Content -Wait`. The file is written beside the target and
+// renamed over it, so readers never see a partial snapshot.
+class MetricsReporter {
+public:
+    ~MetricsReporter() {
+        stop();
+    }
+
+    void start(const std::string& path, int interval_ms = 1000) {
+        stop();
+        path_ = path;
+        interval_ms_ = interval_ms;
+        start_ = g_metrics.snapshot();
+        running_ = true;
+        thread_ = std::thread(&MetricsReporter::thread_func, this);
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_ = false;
+        }
+        cv_.notify_all();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+private:
+    void thread_func() {
+        MetricsSnapshot previous = start_;
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (running_) {
+            cv_.wait_for(lock, std::chrono::milliseconds(interval_ms_), [this] { return !running_; });
+
+            MetricsSnapshot current = g_metrics.snapshot();
+            write_file(previous, current);
+            previous = current;
+        }
+    }
+
+    void write_file(const MetricsSnapshot& previous, const MetricsSnapshot& current) {
+        std::string temp_path = path_ + ".tmp";
+        {
+            std::ofstream out(temp_path, std::ios::trunc);
+            if (!out) return;
+
+            double elapsed_s = (current.taken_us - previous.taken_us) / 1e6;
+            out << std::fixed << std::setprecision(1);
+            out << "# uptime_s " << (current.taken_us - start_.taken_us) / 1e6 << "\n";
+
+            // Totals, and the rate over the last interval
+            for (int i = 0; i < COUNTER_COUNT; i++) {
+                uint64_t delta = current.counters[i] - previous.counters[i];
+                out << counter_name(static_cast<Counter>(i)) << " " << current.counters[i]
+                    << " " << (elapsed_s > 0 ? delta / elapsed_s : 0.0) << "/s\n";
+            }
+
+            for (int i = 0; i < TIMING_COUNT; i++) {
+                const HistogramSnapshot& h = current.timings[i];
+                out << timing_name(static_cast<Timing>(i))
+                    << " count " << h.total
+                    << " p50 " << h.percentile(50)
+                    << " p99 " << h.percentile(99)
+                    << " p999 " << h.percentile(99.9)
+                    << " max " << h.max << "\n";
+            }
+
+            for (int i = 0; i < GAUGE_COUNT; i++) {
+                out << gauge_name(static_cast<Gauge>(i)) << " " << current.gauges[i] << "\n";
+            }
+        }
+
+#ifdef _WIN32
+        MoveFileExA(temp_path.c_str(), path_.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+        std::rename(temp_path.c_str(), path_.c_str());
+#endif
+    }
+
+    std::string path_;
+    int interval_ms_ = 1000;
+    MetricsSnapshot start_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool running_ = false;
+    std::thread thread_;
+};
+
+} // namespace MouseShare
@@ -0,0 +1,560 @@
+#pragma once
+
+#include "common.hpp"
+#include "network.hpp"
+#include "key_state.hpp"
+#include <functional>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <algorithm>
+
+namespace MouseShare {
+
+constexpr const char* DEFAULT_MULTICAST_GROUP = "239.255.77.77";
+constexpr uint32_t MULTICAST_RING_SIZE = 4096;       // frames kept for repair
+constexpr int MULTICAST_HEARTBEAT_MS = 200;
+constexpr uint64_t MULTICAST_NACK_INTERVAL_US = 30000;
+constexpr uint64_t MULTICAST_GAP_TIMEOUT_US = 1000000;
+constexpr int MULTICAST_MAX_NACKS = 16;               // holes requested per round
+
+enum class MulticastKind : uint8_t {
+    DATA = 1,       // sender -> group: sequenced frame
+    REPAIR = 2,     // sender -> receiver: retransmitted frame
+    RESYNC = 3,     // sender -> receiver: KEY_STATE frame valid at seq
+    HEARTBEAT = 4,  // sender -> group: seq is the next sequence number
+    NACK = 5,       // receiver -> sender: seq/count frames missing
+    JOIN = 6        // receiver -> sender: request a RESYNC
+};
+
+#pragma pack(push, 1)
+
+struct MulticastHeader {
+    char magic[4];  // "MSMC"
+    MulticastKind kind;
+    uint32_t session;
+    uint32_t seq;
+    uint16_t count;
+};
+
+#pragma pack(pop)
+
+// Drops outgoing datagrams with a fixed probability, for testing repair
+// paths on loopback where nothing is ever lost
+class PacketLossShim {
+public:
+    explicit PacketLossShim(double loss = 0.0)
+        : loss_(loss), rng_(std::random_device{}()) {}
+
+    void set_loss(double loss) { loss_ = loss; }
+
+    bool should_drop() {
+        if (loss_ <= 0.0) return false;
+        std::lock_guard<std::mutex> lock(mutex_);
+        return std::uniform_real_distribution<double>(0.0, 1.0)(rng_) < loss_;
+    }
+
+private:
+    double loss_;
+    std::mutex mutex_;
+    std::mt19937 rng_;
+};
+
+struct MulticastStats {
+    uint64_t frames = 0;       // DATA frames sent / delivered
+    uint64_t bytes = 0;        // datagram bytes sent (including repairs and control)
+    uint64_t repairs = 0;      // REPAIR frames sent / received
+    uint64_t resyncs = 0;      // RESYNC snapshots sent / applied
+    uint64_t nacks = 0;        // NACKs received / sent
+};
+
+inline std::string make_multicast_datagram(MulticastKind kind, uint32_t session, uint32_t seq,
+                                           uint16_t count, const std::string& frame = std::string()) {
+    MulticastHeader header;
+    std::memcpy(header.magic, "MSMC", 4);
+    header.kind = kind;
+    header.session = session;
+    header.seq = seq;
+    header.count = count;
+
+    std::string datagram(sizeof(header) + frame.size(), '\0');
+    std::memcpy(&datagram[0], &header, sizeof(header));
+    if (!frame.empty()) {
+        std::memcpy(&datagram[sizeof(header)], frame.data(), frame.size());
+    }
+    return datagram;
+}
+
+inline SOCKET create_udp_socket() {
+    SOCKET sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock == INVALID_SOCKET) {
+        throw NetworkError("Failed to create UDP socket: " + std::to_string(WSAGetLastError()));
+    }
+    return sock;
+}
+
+// Sends identical input frames to every member of a multicast group. Frames
+// are sequenced and kept in a ring so receivers can NACK for repairs; a
+// receiver that joins late or falls out of the ring gets a key-state
+// snapshot instead.
+class MulticastSender {
+public:
+    MulticastSender() : ring_(MULTICAST_RING_SIZE) {}
+
+    ~MulticastSender() {
+        close();
+    }
+
+    void open(const std::string& group, uint16_t port, uint8_t ttl = 1) {
+        close();
+
+        socket_ = Socket(create_udp_socket());
+
+        int ttl_value = ttl;
+        setsockopt(socket_.handle(), IPPROTO_IP, IP_MULTICAST_TTL, (char*)&ttl_value, sizeof(ttl_value));
+        int loop = 1;  // receivers on this host (and loopback testing) see our frames too
+        setsockopt(socket_.handle(), IPPROTO_IP, IP_MULTICAST_LOOP, (char*)&loop, sizeof(loop));
+
+        // Bind to an ephemeral port so receivers can NACK us directly
+        sockaddr_in local{};
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = INADDR_ANY;
+        local.sin_port = 0;
+        if (::bind(socket_.handle(), reinterpret_cast<sockaddr*>(&local), sizeof(local)) == SOCKET_ERROR) {
+            throw NetworkError("Failed to bind multicast sender: " + std::to_string(WSAGetLastError()));
+        }
+
+        group_addr_ = {};
+        group_addr_.sin_family = AF_INET;
+        group_addr_.sin_port = htons(port);
+        if (inet_pton(AF_INET, group.c_str(), &group_addr_.sin_addr) != 1) {
+            throw NetworkError("Invalid multicast group: " + group);
+        }
+
+        session_ = std::random_device{}();
+        next_seq_ = 1;
+        tracker_.reset();
+        stats_ = MulticastStats();
+
+        running_ = true;
+        control_thread_ = std::thread(&MulticastSender::control_thread_func, this);
+    }
+
+    void close() {
+        running_ = false;
+        socket_.shutdown();
+        if (control_thread_.joinable()) {
+            control_thread_.join();
+        }
+        socket_.close();
+    }
+
+    bool is_open() const { return running_; }
+
+    // Announcement for receivers, to be sent to each member over TCP
+    MulticastInfoEvent info() const {
+        MulticastInfoEvent event;
+        event.group = group_addr_.sin_addr.s_addr;
+        event.port = ntohs(group_addr_.sin_port);
+        event.session = session_;
+        return event;
+    }
+
+    void send_frame(const std::string& frame) {
+        std::string datagram;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            uint32_t seq = next_seq_++;
+
+            RingEntry& entry = ring_[seq % MULTICAST_RING_SIZE];
+            entry.seq = seq;
+            entry.frame = frame;
+
+            tracker_.apply_frame(frame);
+            stats_.frames++;
+
+            datagram = make_multicast_datagram(MulticastKind::DATA, session_, seq, 0, frame);
+        }
+        send_datagram(datagram, group_addr_);
+    }
+
+    MulticastStats stats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+    void set_loss(double loss) { loss_.set_loss(loss); }
+
+private:
+    struct RingEntry {
+        uint32_t seq = 0;
+        std::string frame;
+    };
+
+    void send_datagram(const std::string& datagram, const sockaddr_in& to) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_.bytes += datagram.size();
+        }
+        if (loss_.should_drop()) return;
+        sendto(socket_.handle(), datagram.data(), (int)datagram.size(), 0,
+               reinterpret_cast<const sockaddr*>(&to), sizeof(to));
+    }
+
+    void send_resync(const sockaddr_in& to) {
+        std::string datagram;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            // Snapshot and sequence number are taken together so the receiver
+            // knows exactly which frames the snapshot already covers
+            auto frame = serialize_packet(EventType::KEY_STATE, tracker_.snapshot());
+            datagram = make_multicast_datagram(MulticastKind::RESYNC, session_, next_seq_, 0, frame);
+            stats_.resyncs++;
+        }
+        send_datagram(datagram, to);
+    }
+
+    void handle_nack(uint32_t first, uint16_t count, const sockaddr_in& from) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_.nacks++;
+        }
+
+        for (uint32_t seq = first; seq != first + count; seq++) {
+            std::string datagram;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                const RingEntry& entry = ring_[seq % MULTICAST_RING_SIZE];
+                if (entry.seq == seq && seq < next_seq_) {
+                    datagram = make_multicast_datagram(MulticastKind::REPAIR, session_, seq, 0, entry.frame);
+                    stats_.repairs++;
+                }
+            }
+
+            if (datagram.empty()) {
+                // Already overwritten: the receiver can only catch up via snapshot
+                send_resync(from);
+                return;
+            }
+            send_datagram(datagram, from);
+        }
+    }
+
+    void control_thread_func() {
+        auto last_heartbeat = std::chrono::steady_clock::now();
+
+        while (running_) {
+            if (socket_.wait_readable(50)) {
+                char buffer[256];
+                sockaddr_in from{};
+                int from_len = sizeof(from);
+                int n = recvfrom(socket_.handle(), buffer, sizeof(buffer), 0,
+                                 reinterpret_cast<sockaddr*>(&from), &from_len);
+                if (n >= (int)sizeof(MulticastHeader)) {
+                    MulticastHeader header;
+                    std::memcpy(&header, buffer, sizeof(header));
+                    if (std::memcmp(header.magic, "MSMC", 4) == 0 && header.session == session_) {
+                        if (header.kind == MulticastKind::NACK) {
+                            handle_nack(header.seq, header.count, from);
+                        } else if (header.kind == MulticastKind::JOIN) {
+                            send_resync(from);
+                        }
+                    }
+                }
+            }
+
+            // Heartbeats let receivers detect loss of the most recent frames
+            auto now = std::chrono::steady_clock::now();
+            if (now - last_heartbeat >= std::chrono::milliseconds(MULTICAST_HEARTBEAT_MS)) {
+                uint32_t next;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    next = next_seq_;
+                }
+                send_datagram(make_multicast_datagram(MulticastKind::HEARTBEAT, session_, next, 0), group_addr_);
+                last_heartbeat = now;
+            }
+        }
+    }
+
+    Socket socket_;
+    sockaddr_in group_addr_{};
+    uint32_t session_ = 0;
+
+    mutable std::mutex mutex_;
+    uint32_t next_seq_ = 1;
+    std::vector<RingEntry> ring_;
+    KeyStateTracker tracker_;
+    MulticastStats stats_;
+
+    PacketLossShim loss_;
+    std::atomic<bool> running_{false};
+    std::thread control_thread_;
+};
+
+// Joins a sender's group and delivers its frames exactly once, in order.
+// Gaps are NACKed; until the first RESYNC arrives frames are held back so a
+// late joiner starts from a consistent key state.
+class MulticastReceiver {
+public:
+    using FrameCallback = std::function<void(const std::string& frame)>;
+
+    ~MulticastReceiver() {
+        close();
+    }
+
+    void open(const MulticastInfoEvent& info, FrameCallback callback) {
+        close();
+
+        group_socket_ = Socket(create_udp_socket());
+
+        // Several receivers may share a host (and a port) when testing on loopback
+        BOOL reuse = TRUE;
+        setsockopt(group_socket_.handle(), SOL_SOCKET, SO_REUSEADDR, (char*)&reuse, sizeof(reuse));
+
+        sockaddr_in local{};
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = INADDR_ANY;
+        local.sin_port = htons(info.port);
+        if (::bind(group_socket_.handle(), reinterpret_cast<sockaddr*>(&local), sizeof(local)) == SOCKET_ERROR) {
+            throw NetworkError("Failed to bind multicast receiver: " + std::to_string(WSAGetLastError()));
+        }
+
+        ip_mreq membership{};
+        membership.imr_multiaddr.s_addr = info.group;
+        membership.imr_interface.s_addr = INADDR_ANY;
+        if (setsockopt(group_socket_.handle(), IPPROTO_IP, IP_ADD_MEMBERSHIP,
+                       (char*)&membership, sizeof(membership)) == SOCKET_ERROR) {
+            throw NetworkError("Failed to join multicast group: " + std::to_string(WSAGetLastError()));
+        }
+
+        // NACKs/JOINs go out from a private port: unicast repairs sent back to
+        // the shared group port would reach only one receiver on this host
+        control_socket_ = Socket(create_udp_socket());
+        local.sin_port = 0;
+        if (::bind(control_socket_.handle(), reinterpret_cast<sockaddr*>(&local), sizeof(local)) == SOCKET_ERROR) {
+            throw NetworkError("Failed to bind multicast control socket: " + std::to_string(WSAGetLastError()));
+        }
+
+        session_ = info.session;
+        callback_ = std::move(callback);
+        have_sender_ = false;
+        synced_ = false;
+        expected_ = 0;
+        sender_next_ = 0;
+        pending_.clear();
+        gap_since_us_ = 0;
+        last_request_us_ = 0;
+        stats_ = MulticastStats();
+
+        running_ = true;
+        receive_thread_ = std::thread(&MulticastReceiver::receive_thread_func, this);
+    }
+
+    void close() {
+        running_ = false;
+        if (receive_thread_.joinable()) {
+            receive_thread_.join();
+        }
+        group_socket_.close();
+        control_socket_.close();
+    }
+
+    bool is_open() const { return running_; }
+
+    MulticastStats stats() const {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        return stats_;
+    }
+
+    void set_loss(double loss) { loss_.set_loss(loss); }
+
+private:
+    void send_control(MulticastKind kind, uint32_t seq, uint16_t count) {
+        if (!have_sender_) return;
+        auto datagram = make_multicast_datagram(kind, session_, seq, count);
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            stats_.bytes += datagram.size();
+            if (kind == MulticastKind::NACK) stats_.nacks++;
+        }
+        if (loss_.should_drop()) return;
+        sendto(control_socket_.handle(), datagram.data(), (int)datagram.size(), 0,
+               reinterpret_cast<const sockaddr*>(&sender_addr_), sizeof(sender_addr_));
+    }
+
+    void deliver_in_order() {
+        uint32_t start = expected_;
+        auto it = pending_.find(expected_);
+        while (it != pending_.end()) {
+            callback_(it->second);
+            {
+                std::lock_guard<std::mutex> lock(stats_mutex_);
+                stats_.frames++;
+            }
+            pending_.erase(it);
+            expected_++;
+            it = pending_.find(expected_);
+        }
+        // The gap timeout measures how long delivery has been stuck, not how
+        // long some frame has been missing
+        if (expected_ != start || (pending_.empty() && sender_next_ <= expected_)) {
+            gap_since_us_ = 0;
+        }
+    }
+
+    void handle_datagram(const char* data, int size, const sockaddr_in& from) {
+        MulticastHeader header;
+        std::memcpy(&header, data, sizeof(header));
+        if (std::memcmp(header.magic, "MSMC", 4) != 0 || header.session != session_) {
+            return;
+        }
+
+        if (!have_sender_) {
+            sender_addr_ = from;
+            have_sender_ = true;
+        }
+
+        std::string frame(data + sizeof(header), size - sizeof(header));
+
+        switch (header.kind) {
+            case MulticastKind::DATA:
+            case MulticastKind::REPAIR:
+                if (header.kind == MulticastKind::REPAIR) {
+                    std::lock_guard<std::mutex> lock(stats_mutex_);
+                    stats_.repairs++;
+                }
+                if (synced_ && header.seq < expected_) break;  // duplicate
+                if (header.seq + 1 > sender_next_) sender_next_ = header.seq + 1;
+                pending_[header.seq] = std::move(frame);
+                if (pending_.size() > MULTICAST_RING_SIZE) {
+                    pending_.erase(pending_.begin());
+                }
+                if (synced_) deliver_in_order();
+                break;
+
+            case MulticastKind::RESYNC:
+                if (synced_ && header.seq <= expected_) break;  // stale snapshot
+                callback_(frame);
+                {
+                    std::lock_guard<std::mutex> lock(stats_mutex_);
+                    stats_.resyncs++;
+                }
+                synced_ = true;
+                expected_ = header.seq;
+                pending_.erase(pending_.begin(), pending_.lower_bound(expected_));
+                gap_since_us_ = 0;
+                deliver_in_order();
+                break;
+
+            case MulticastKind::HEARTBEAT:
+                if (header.seq > sender_next_) sender_next_ = header.seq;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    // Ask for whatever is missing, or for a snapshot if we can't catch up
+    void request_missing() {
+        uint64_t now = get_timestamp_us();
+
+        if (!synced_) {
+            if (have_sender_ && now - last_request_us_ >= MULTICAST_NACK_INTERVAL_US * 5) {
+                send_control(MulticastKind::JOIN, 0, 0);
+                last_request_us_ = now;
+            }
+            return;
+        }
+
+        uint32_t gap_end = pending_.empty() ? sender_next_ : pending_.begin()->first;
+        if (gap_end <= expected_) return;
+
+        if (gap_since_us_ == 0) {
+            gap_since_us_ = now;
+        }
+        if (now - last_request_us_ < MULTICAST_NACK_INTERVAL_US) return;
+        last_request_us_ = now;
+
+        if (now - gap_since_us_ > MULTICAST_GAP_TIMEOUT_US ||
+            sender_next_ - expected_ >= MULTICAST_RING_SIZE) {
+            send_control(MulticastKind::JOIN, 0, 0);
+            return;
+        }
+
+        // One NACK per hole, so a burst of losses is repaired in one round trip
+        uint32_t seq = expected_;
+        auto it = pending_.begin();
+        int nacks = 0;
+        while (seq < sender_next_ && nacks < MULTICAST_MAX_NACKS) {
+            uint32_t hole_end = it == pending_.end() ? sender_next_ : it->first;
+            if (hole_end > seq) {
+                uint32_t count = (std::min)(hole_end - seq, (uint32_t)UINT16_MAX);
+                send_control(MulticastKind::NACK, seq, static_cast<uint16_t>(count));
+                nacks++;
+            }
+            if (it == pending_.end()) break;
+            seq = it->first + 1;
+            ++it;
+        }
+    }
+
+    void receive_from(Socket& sock) {
+        char buffer[2048];
+        sockaddr_in from{};
+        int from_len = sizeof(from);
+        int n = recvfrom(sock.handle(), buffer, sizeof(buffer), 0,
+                         reinterpret_cast<sockaddr*>(&from), &from_len);
+        if (n >= (int)sizeof(MulticastHeader)) {
+            handle_datagram(buffer, n, from);
+        }
+    }
+
+    void receive_thread_func() {
+        SOCKET group = group_socket_.handle();
+        SOCKET control = control_socket_.handle();
+
+        while (running_) {
+            fd_set readSet;
+            FD_ZERO(&readSet);
+            FD_SET(group, &readSet);
+            FD_SET(control, &readSet);
+
+            timeval tv = {0, 10000};
+            if (select((int)(std::max)(group, control) + 1, &readSet, nullptr, nullptr, &tv) > 0) {
+                if (FD_ISSET(group, &readSet)) receive_from(group_socket_);
+                if (FD_ISSET(control, &readSet)) receive_from(control_socket_);
+            }
+            request_missing();
+        }
+    }
+
+    Socket group_socket_;
+    Socket control_socket_;
+    uint32_t session_ = 0;
+    FrameCallback callback_;
+
+    sockaddr_in sender_addr_{};
+    bool have_sender_ = false;
+
+    // Only touched by the receive thread
+    bool synced_ = false;
+    uint32_t expected_ = 0;
+    uint32_t sender_next_ = 0;
+    std::map<uint32_t, std::string> pending_;
+    uint64_t gap_since_us_ = 0;
+    uint64_t last_request_us_ = 0;
+
+    mutable std::mutex stats_mutex_;
+    MulticastStats stats_;
+
+    PacketLossShim loss_;
+    std::atomic<bool> running_{false};
+    std::thread receive_thread_;
+};
+
+} // namespace MouseShare
@@ -0,0 +1,700 @@
+#include "common.hpp"
+#include "network.hpp"
+#include "multicast.hpp"
+#include "impairment.hpp"
+#include "histogram.hpp"
+#include "key_state.hpp"
+#include "session.hpp"
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <random>
+
+using namespace MouseShare;
+
+constexpr uint16_t DEFAULT_NETEM_PORT = DEFAULT_PORT + 1;
+constexpr uint64_t STUCK_KEY_US = 1000000;  // beyond the link's own delay
+
+std::atomic<bool> g_running{true};
+
+BOOL WINAPI console_handler(DWORD signal) {
+    if (signal == CTRL_C_EVENT || signal == CTRL_CLOSE_EVENT) {
+        g_running = false;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+// One step of a scripted run
+struct Scenario {
+    std::string name;
+    int seconds = 0;
+    ImpairmentProfile profile;
+};
+
+// Lines of "<name> <seconds> [key=value ...]"; # starts a comment
+static bool load_scenarios(const std::string& path, std::vector<Scenario>& scenarios) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Cannot read scenarios " << path << "\n";
+        return false;
+    }
+
+    std::string line;
+    int line_no = 0;
+    while (std::getline(in, line)) {
+        line_no++;
+        line = line.substr(0, line.find('#'));
+
+        std::istringstream fields(line);
+        Scenario scenario;
+        if (!(fields >> scenario.name)) continue;
+
+        std::string rest, error;
+        if (!(fields >> scenario.seconds) || scenario.seconds <= 0) {
+            std::cerr << path << ":" << line_no << ": expected <name> <seconds> [key=value ...]\n";
+            return false;
+        }
+        std::getline(fields, rest);
+        if (!parse_impairment(rest, scenario.profile, error)) {
+            std::cerr << path << ":" << line_no << ": " << error << "\n";
+            return false;
+        }
+        scenarios.push_back(scenario);
+    }
+
+    if (scenarios.empty()) {
+        std::cerr << path << " has no scenarios\n";
+        return false;
+    }
+    return true;
+}
+
+// What the input stream looked like on both sides of the proxy: how long
+// events were held up, and keys the client was left holding after the
+// server had released them.
+class InputObserver {
+public:
+    // A frame from the server entered the proxy
+    void frame_entered(const std::string& frame) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sent_.apply_frame(frame);
+    }
+
+    // A frame reached the client
+    void frame_delivered(const std::string& frame, uint64_t arrived_us) {
+        uint64_t latency = get_timestamp_us() - arrived_us;
+        switch (frame_type(frame)) {
+            case EventType::MOUSE_MOVE:
+                cursor_.record(latency);
+                break;
+            case EventType::MOUSE_BUTTON:
+            case EventType::KEY_PRESS:
+            case EventType::KEY_RELEASE:
+                keys_.record(latency);
+                break;
+            default:
+                break;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        delivered_.apply_frame(frame);
+    }
+
+    void client_connected() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        disconnected_us_ = 0;
+    }
+
+    void client_disconnected() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        disconnected_us_ = get_timestamp_us();
+    }
+
+    // Look for keys held on the client but not on the server. slack_us is
+    // how long the link itself may legitimately keep them apart.
+    void check(uint64_t slack_us) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t now = get_timestamp_us();
+
+        // The client lets go of everything once it can't resume (see Client::run)
+        if (disconnected_us_ && now - disconnected_us_ >= SESSION_RESUME_WINDOW_US) {
+            delivered_.reset();
+        }
+
+        for (uint32_t vk = 0; vk < 256; vk++) {
+            track(vk, delivered_.key_down(vk) && !sent_.key_down(vk), now, slack_us);
+        }
+        for (uint8_t b = 1; b <= 5; b++) {
+            auto button = static_cast<MouseButton>(b);
+            track(256 + b, delivered_.button_down(button) && !sent_.button_down(button), now, slack_us);
+        }
+    }
+
+    HistogramSnapshot take_cursor() { return cursor_.take(); }
+    HistogramSnapshot take_keys() { return keys_.take(); }
+
+    uint64_t take_stuck() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t stuck = stuck_;
+        stuck_ = 0;
+        return stuck;
+    }
+
+private:
+    void track(uint32_t slot, bool diverged, uint64_t now, uint64_t slack_us) {
+        if (!diverged) {
+            diverged_since_[slot] = 0;
+            counted_[slot] = false;
+        } else if (diverged_since_[slot] == 0) {
+            diverged_since_[slot] = now;
+        } else if (!counted_[slot] && now - diverged_since_[slot] > STUCK_KEY_US + slack_us) {
+            counted_[slot] = true;
+            stuck_++;
+        }
+    }
+
+    LatencyHistogram cursor_;
+    LatencyHistogram keys_;
+
+    std::mutex mutex_;
+    KeyStateTracker sent_;
+    KeyStateTracker delivered_;
+    uint64_t disconnected_us_ = 0;
+    uint64_t diverged_since_[262] = {};
+    bool counted_[262] = {};
+    uint64_t stuck_ = 0;
+};
+
+// One client connection and its connection to the server. Frames in each
+// direction go through their own impaired link.
+class ProxyConnection {
+public:
+    ProxyConnection(Socket client, Socket server, InputObserver& observer, const ImpairmentProfile& profile)
+        : client_(std::move(client)), server_(std::move(server)), observer_(observer),
+          down_link_(true), up_link_(true),
+          down_line_([this](const std::string& frame, uint64_t arrived_us) {
+              client_.send(frame);
+              observer_.frame_delivered(frame, arrived_us);
+          }),
+          up_line_([this](const std::string& frame, uint64_t) {
+              server_.send(frame);
+          }) {
+        set_profile(profile);
+    }
+
+    ~ProxyConnection() {
+        drop();
+        if (down_thread_.joinable()) down_thread_.join();
+        if (up_thread_.joinable()) up_thread_.join();
+        down_line_.stop();
+        up_line_.stop();
+    }
+
+    void start() {
+        down_line_.start();
+        up_line_.start();
+        down_thread_ = std::thread(&ProxyConnection::forward, this, std::ref(server_),
+                                   std::ref(down_link_), std::ref(down_line_), true);
+        up_thread_ = std::thread(&ProxyConnection::forward, this, std::ref(client_),
+                                 std::ref(up_link_), std::ref(up_line_), false);
+    }
+
+    void set_profile(const ImpairmentProfile& profile) {
+        down_link_.set_profile(profile);
+        up_link_.set_profile(profile);
+    }
+
+    // Cut both sides, as a lost link would
+    void drop() {
+        client_.shutdown();
+        server_.shutdown();
+    }
+
+    bool closed() const { return closed_; }
+
+    void add_stats(ImpairmentStats& total) {
+        for (LinkImpairment* link : {&down_link_, &up_link_}) {
+            ImpairmentStats s = link->take_stats();
+            total.packets += s.packets;
+            total.lost += s.lost;
+            total.retransmits += s.retransmits;
+            total.reordered += s.reordered;
+        }
+    }
+
+private:
+    void forward(Socket& from, LinkImpairment& link, DelayLine& line, bool downstream) {
+        std::string frame;
+        while (from.recv_frame(frame)) {
+            uint64_t now = get_timestamp_us();
+            if (downstream) {
+                observer_.frame_entered(frame);
+            }
+            uint64_t deliver_us = link.schedule(frame.size(), now);
+            line.push(std::move(frame), now, deliver_us);
+        }
+
+        // Either side closing ends the whole connection
+        drop();
+        closed_ = true;
+    }
+
+    Socket client_;
+    Socket server_;
+    InputObserver& observer_;
+
+    LinkImpairment down_link_;
+    LinkImpairment up_link_;
+    DelayLine down_line_;
+    DelayLine up_line_;
+
+    std::thread down_thread_;
+    std::thread up_thread_;
+    std::atomic<bool> closed_{false};
+};
+
+// Forwards unicast UDP between whoever last sent to the local port and a
+// fixed target, impaired in both directions
+class UdpForward {
+public:
+    UdpForward()
+        : to_target_(false), to_peer_(false),
+          target_line_([this](const std::string& data, uint64_t) {
+              sendto(socket_.handle(), data.data(), (int)data.size(), 0,
+                     reinterpret_cast<const sockaddr*>(&target_), sizeof(target_));
+          }),
+          peer_line_([this](const std::string& data, uint64_t) {
+              sockaddr_in peer;
+              {
+                  std::lock_guard<std::mutex> lock(peer_mutex_);
+                  peer = peer_;
+              }
+              sendto(socket_.handle(), data.data(), (int)data.size(), 0,
+                     reinterpret_cast<const sockaddr*>(&peer), sizeof(peer));
+          }) {}
+
+    ~UdpForward() {
+        close();
+    }
+
+    void open(uint16_t local_port, const std::string& host, uint16_t port, const ImpairmentProfile& profile) {
+        addrinfo hints{};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        addrinfo* result;
+        if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0) {
+            throw NetworkError("Failed to resolve UDP target " + host);
+        }
+        std::memcpy(&target_, result->ai_addr, sizeof(target_));
+        freeaddrinfo(result);
+
+        socket_ = Socket(create_udp_socket());
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = INADDR_ANY;
+        addr.sin_port = htons(local_port);
+        if (::bind(socket_.handle(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == SOCKET_ERROR) {
+            throw NetworkError("Failed to bind UDP port: " + std::to_string(WSAGetLastError()));
+        }
+
+        set_profile(profile);
+        target_line_.start();
+        peer_line_.start();
+        running_ = true;
+        thread_ = std::thread(&UdpForward::thread_func, this);
+    }
+
+    void close() {
+        running_ = false;
+        if (thread_.joinable()) thread_.join();
+        target_line_.stop();
+        peer_line_.stop();
+        socket_.close();
+    }
+
+    void set_profile(const ImpairmentProfile& profile) {
+        to_target_.set_profile(profile);
+        to_peer_.set_profile(profile);
+    }
+
+    void add_stats(ImpairmentStats& total) {
+        for (LinkImpairment* link : {&to_target_, &to_peer_}) {
+            ImpairmentStats s = link->take_stats();
+            total.packets += s.packets;
+            total.lost += s.lost;
+            total.retransmits += s.retransmits;
+            total.reordered += s.reordered;
+        }
+    }
+
+private:
+    void thread_func() {
+        char buffer[65536];
+        while (running_) {
+            if (!socket_.wait_readable(100)) continue;
+
+            sockaddr_in from{};
+            int from_len = sizeof(from);
+            int n = recvfrom(socket_.handle(), buffer, sizeof(buffer), 0,
+                             reinterpret_cast<sockaddr*>(&from), &from_len);
+            if (n <= 0) continue;
+
+            uint64_t now = get_timestamp_us();
+            bool from_target = from.sin_addr.s_addr == target_.sin_addr.s_addr &&
+                               from.sin_port == target_.sin_port;
+            LinkImpairment& link = from_target ? to_peer_ : to_target_;
+            DelayLine& line = from_target ? peer_line_ : target_line_;
+            if (!from_target) {
+                std::lock_guard<std::mutex> lock(peer_mutex_);
+                peer_ = from;
+            }
+
+            uint64_t deliver_us = link.schedule(n, now);
+            if (deliver_us) {
+                line.push(std::string(buffer, n), now, deliver_us);
+            }
+        }
+    }
+
+    Socket socket_;
+    sockaddr_in target_{};
+    std::mutex peer_mutex_;
+    sockaddr_in peer_{};
+
+    LinkImpairment to_target_;
+    LinkImpairment to_peer_;
+    DelayLine target_line_;
+    DelayLine peer_line_;
+
+    std::atomic<bool> running_{false};
+    std::thread thread_;
+};
+
+// Sits between a client and the server on the loopback (or any) interface
+// and makes the link between them behave badly on purpose.
+class NetemProxy {
+public:
+    NetemProxy(const std::string& server_host, uint16_t server_port, uint16_t listen_port,
+               int report_interval_s)
+        : server_host_(server_host), server_port_(server_port), listen_port_(listen_port),
+          report_interval_s_(report_interval_s), rng_(std::random_device{}()) {}
+
+    void set_profile(const ImpairmentProfile& profile) { profile_ = profile; }
+    void set_scenarios(const std::vector<Scenario>& scenarios) { scenarios_ = scenarios; }
+
+    void set_udp(uint16_t local_port, const std::string& host, uint16_t port) {
+        udp_local_port_ = local_port;
+        udp_host_ = host;
+        udp_port_ = port;
+    }
+
+    bool run() {
+        listen_socket_.create();
+        listen_socket_.bind(listen_port_);
+        listen_socket_.listen();
+        std::cout << "Proxy listening on port " << listen_port_ << " for " << server_host_
+                  << ":" << server_port_ << "\n";
+
+        if (!udp_host_.empty()) {
+            udp_.open(udp_local_port_, udp_host_, udp_port_, profile_);
+            std::cout << "Forwarding UDP port " << udp_local_port_ << " to " << udp_host_
+                      << ":" << udp_port_ << "\n";
+        }
+
+        size_t scenario = 0;
+        if (!scenarios_.empty()) {
+            begin_scenario(0);
+        } else {
+            std::cout << "Impairment: " << describe_impairment(profile_) << "\n";
+        }
+
+        auto period_start = std::chrono::steady_clock::now();
+        schedule_flap();
+
+        while (g_running) {
+            if (listen_socket_.wait_readable(100)) {
+                try {
+                    accept_client();
+                } catch (const NetworkError& e) {
+                    std::cerr << "Connection failed: " << e.what() << "\n";
+                }
+            }
+
+            prune();
+            observer_.check(slack_us());
+
+            if (flap_at_us_ && get_timestamp_us() >= flap_at_us_) {
+                drop_connections();
+                schedule_flap();
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            if (!scenarios_.empty()) {
+                if (now - period_start >= std::chrono::seconds(scenarios_[scenario].seconds)) {
+                    report(scenarios_[scenario].name);
+                    if (++scenario == scenarios_.size()) break;
+                    begin_scenario(scenario);
+                    period_start = now;
+                }
+            } else if (report_interval_s_ > 0 && now - period_start >= std::chrono::seconds(report_interval_s_)) {
+                report("last " + std::to_string(report_interval_s_) + " s");
+                period_start = now;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(connections_mutex_);
+            connections_.clear();
+        }
+        udp_.close();
+        listen_socket_.close();
+        return true;
+    }
+
+private:
+    void accept_client() {
+        Socket client = listen_socket_.accept();
+
+        Socket server;
+        server.create();
+        server.connect(server_host_, server_port_);
+
+        auto connection = std::make_unique<ProxyConnection>(std::move(client), std::move(server),
+                                                            observer_, profile_);
+        connection->start();
+        observer_.client_connected();
+
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        connections_.push_back(std::move(connection));
+        std::cout << "Client connected\n";
+    }
+
+    void prune() {
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        for (auto it = connections_.begin(); it != connections_.end();) {
+            if ((*it)->closed()) {
+                (*it)->add_stats(closed_stats_);
+                it = connections_.erase(it);
+                observer_.client_disconnected();
+                std::cout << "Client disconnected\n";
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void drop_connections() {
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        if (connections_.empty()) return;
+        for (auto& connection : connections_) {
+            connection->drop();
+        }
+        drops_++;
+        std::cout << "Dropping connection (flap)\n";
+    }
+
+    // Exponentially distributed gaps, like random roaming events
+    void schedule_flap() {
+        if (profile_.flap_s <= 0) {
+            flap_at_us_ = 0;
+            return;
+        }
+        double gap_s = std::exponential_distribution<double>(1.0 / profile_.flap_s)(rng_);
+        flap_at_us_ = get_timestamp_us() + static_cast<uint64_t>(gap_s * 1000000);
+    }
+
+    void begin_scenario(size_t index) {
+        const Scenario& s = scenarios_[index];
+        std::cout << "Scenario " << s.name << " (" << s.seconds << " s): "
+                  << describe_impairment(s.profile) << "\n";
+        profile_ = s.profile;
+
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        for (auto& connection : connections_) {
+            connection->set_profile(profile_);
+        }
+        udp_.set_profile(profile_);
+        schedule_flap();
+    }
+
+    // How long the link alone may keep a release from the client
+    uint64_t slack_us() const {
+        double ms = profile_.delay_ms + 4 * profile_.jitter_ms;
+        if (profile_.loss > 0) ms += (std::max)(TCP_RETRANSMIT_MS, 2 * profile_.delay_ms);
+        return static_cast<uint64_t>(ms * 1000);
+    }
+
+    static std::string format_latency(const HistogramSnapshot& s) {
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(1)
+            << "p50 " << s.percentile(50) / 1000.0 << " ms  p99 " << s.percentile(99) / 1000.0
+            << " ms  max " << s.max / 1000.0 << " ms  (" << s.total << ")";
+        return out.str();
+    }
+
+    void report(const std::string& title) {
+        ImpairmentStats stats = closed_stats_;
+        closed_stats_ = ImpairmentStats();
+        {
+            std::lock_guard<std::mutex> lock(connections_mutex_);
+            for (auto& connection : connections_) {
+                connection->add_stats(stats);
+            }
+        }
+        udp_.add_stats(stats);
+
+        std::cout << "Results for " << title << ":\n"
+                  << "  cursor  " << format_latency(observer_.take_cursor()) << "\n"
+                  << "  keys    " << format_latency(observer_.take_keys()) << "\n"
+                  << "  stuck keys " << observer_.take_stuck()
+                  << ", drops " << drops_
+                  << ", packets " << stats.packets
+                  << ", retransmits " << stats.retransmits
+                  << ", lost " << stats.lost
+                  << ", reordered " << stats.reordered << "\n";
+        drops_ = 0;
+    }
+
+    std::string server_host_;
+    uint16_t server_port_;
+    uint16_t listen_port_;
+    int report_interval_s_;
+
+    ImpairmentProfile profile_;
+    std::vector<Scenario> scenarios_;
+
+    uint16_t udp_local_port_ = 0;
+    std::string udp_host_;
+    uint16_t udp_port_ = 0;
+    UdpForward udp_;
+
+    Socket listen_socket_;
+    std::mutex connections_mutex_;
+    std::vector<std::unique_ptr<ProxyConnection>> connections_;
+    InputObserver observer_;
+    ImpairmentStats closed_stats_;
+
+    std::mt19937 rng_;
+    uint64_t flap_at_us_ = 0;
+    uint64_t drops_ = 0;
+};
+
+void print_usage(const char* program) {
+    std::cout << "Usage: " << program << " <server-host> [options]\n"
+              << "Options:\n"
+              << "  -p, --port PORT      Server port (default: 24800)\n"
+              << "  -l, --listen PORT    Port the client connects to (default: 24801)\n"
+              << "  -i, --impair SPEC    Impairment, e.g. \"delay=40 jitter=10 dist=pareto loss=1\"\n"
+              << "  -c, --scenario FILE  Run the scenarios in FILE one after another, then exit\n"
+              << "  -u, --udp L:HOST:P   Also forward UDP from local port L to HOST:P\n"
+              << "  -r, --report SECS    Report interval without scenarios, 0 to disable (default: 10)\n"
+              << "  -h, --help           Show this help\n"
+              << "Impairment settings:\n"
+              << "  delay=MS             Base one-way delay\n"
+              << "  jitter=MS            Delay variation\n"
+              << "  dist=NAME            Jitter distribution: uniform, normal or pareto (default: normal)\n"
+              << "  loss=PCT             Packet loss; on TCP a loss costs a retransmission timeout\n"
+              << "  reorder=PCT          Datagrams held back behind later ones (UDP only)\n"
+              << "  rate=KBIT            Bandwidth cap\n"
+              << "  flap=SECS            Mean time between dropped connections\n";
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    std::string server_host;
+    uint16_t port = DEFAULT_PORT;
+    uint16_t listen_port = DEFAULT_NETEM_PORT;
+    int report_interval = 10;
+    std::string impair_spec;
+    std::string scenario_path;
+    std::string udp_spec;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "-h" || arg == "--help") {
+            print_usage(argv[0]);
+            return 0;
+        } else if ((arg == "-p" || arg == "--port") && i + 1 < argc) {
+            port = std::stoi(argv[++i]);
+        } else if ((arg == "-l" || arg == "--listen") && i + 1 < argc) {
+            listen_port = std::stoi(argv[++i]);
+        } else if ((arg == "-i" || arg == "--impair") && i + 1 < argc) {
+            impair_spec = argv[++i];
+        } else if ((arg == "-c" || arg == "--scenario") && i + 1 < argc) {
+            scenario_path = argv[++i];
+        } else if ((arg == "-u" || arg == "--udp") && i + 1 < argc) {
+            udp_spec = argv[++i];
+        } else if ((arg == "-r" || arg == "--report") && i + 1 < argc) {
+            report_interval = std::stoi(argv[++i]);
+        } else if (server_host.empty() && arg[0] != '-') {
+            server_host = arg;
+        }
+    }
+
+    if (server_host.empty()) {
+        std::cerr << "Server host is required\n";
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    NetemProxy proxy(server_host, port, listen_port, report_interval);
+
+    ImpairmentProfile profile;
+    std::string error;
+    if (!parse_impairment(impair_spec, profile, error)) {
+        std::cerr << "Bad --impair: " << error << "\n";
+        return 1;
+    }
+    proxy.set_profile(profile);
+
+    if (!scenario_path.empty()) {
+        std::vector<Scenario> scenarios;
+        if (!load_scenarios(scenario_path, scenarios)) {
+            return 1;
+        }
+        proxy.set_scenarios(scenarios);
+    }
+
+    if (!udp_spec.empty()) {
+        size_t first = udp_spec.find(':');
+        size_t last = udp_spec.rfind(':');
+        if (first == std::string::npos || first == last) {
+            std::cerr << "--udp expects LOCALPORT:HOST:PORT\n";
+            return 1;
+        }
+        proxy.set_udp(static_cast<uint16_t>(std::stoi(udp_spec.substr(0, first))),
+                      udp_spec.substr(first + 1, last - first - 1),
+                      static_cast<uint16_t>(std::stoi(udp_spec.substr(last + 1))));
+    }
+
+    // Initialize Winsock
+    if (!init_winsock()) {
+        std::cerr << "Failed to initialize Winsock\n";
+        return 1;
+    }
+
+    SetConsoleCtrlHandler(console_handler, TRUE);
+
+    bool result = false;
+    try {
+        result = proxy.run();
+    } catch (const NetworkError& e) {
+        std::cerr << "Proxy failed: " << e.what() << "\n";
+    }
+
+    cleanup_winsock();
+    return result ? 0 : 1;
+}
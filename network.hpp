@@ -1,11 +1,44 @@
 #pragma once
 
 #include "common.hpp"
+#include "trace.hpp"
+#include "crypto.hpp"
+#include "shm_transport.hpp"
+#include "kernel_timestamps.hpp"
 #include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <chrono>
 #include <stdexcept>
+#include <algorithm>
+#include <thread>
+
+#ifdef _WIN32
+#include <mswsock.h>  // ConnectEx, for TCP Fast Open
+#elif defined(__linux__)
+#include <sys/ioctl.h>
+#include <linux/sockios.h>  // SIOCOUTQNSD
+#endif
+
+#ifndef TCP_FASTOPEN
+#define TCP_FASTOPEN 15  // Windows 10 1607 and later; older SDKs lack the name
+#endif
 
 namespace MouseShare {
 
+#if defined(_WIN32) && !defined(SIO_IDEAL_SEND_BACKLOG_QUERY)
+#define SIO_IDEAL_SEND_BACKLOG_QUERY _IOR('t', 123, ULONG)
+#endif
+
+// Received bytes are read this much at a time and frames cut from there
+constexpr int RECV_BUFFER_BYTES = 64 * 1024;
+
+// Unsent bytes the kernel may hold once limit_send_backlog() is on: enough
+// to keep a fast link busy between sends, a few hundred input frames
+constexpr int SEND_BACKLOG_BYTES = 4 * 1024;
+constexpr uint64_t SEND_BACKLOG_QUERY_US = 1000000;  // Windows: re-ask the ideal backlog this often
+
 class NetworkError : public std::runtime_error {
 public:
     explicit NetworkError(const std::string& msg) : std::runtime_error(msg) {}
@@ -22,15 +55,44 @@ public:
     }
     
     // Move-only
-    Socket(Socket&& other) noexcept : sock_(other.sock_) {
+    Socket(Socket&& other) noexcept
+        : sock_(other.sock_), cipher_(std::move(other.cipher_)), batch_(std::move(other.batch_)),
+          shm_(std::move(other.shm_)), offer_shm_(other.offer_shm_),
+          recv_buffer_(std::move(other.recv_buffer_)), recv_pos_(other.recv_pos_), recv_end_(other.recv_end_),
+          batch_receive_(other.batch_receive_), send_backlog_(other.send_backlog_), send_buffer_(other.send_buffer_),
+          backlog_query_us_(other.backlog_query_us_), kernel_stamps_(other.kernel_stamps_),
+          tx_bytes_(other.tx_bytes_), tx_pending_(std::move(other.tx_pending_)),
+          tx_stamps_(std::move(other.tx_stamps_)), recv_kernel_us_(other.recv_kernel_us_),
+          frame_kernel_us_(other.frame_kernel_us_) {
         other.sock_ = INVALID_SOCKET;
+        other.recv_pos_ = other.recv_end_ = 0;
+        other.clear_kernel_stamps();
     }
     
     Socket& operator=(Socket&& other) noexcept {
         if (this != &other) {
             close();
             sock_ = other.sock_;
+            cipher_ = std::move(other.cipher_);
+            batch_ = std::move(other.batch_);
+            shm_ = std::move(other.shm_);
+            offer_shm_ = other.offer_shm_;
+            recv_buffer_ = std::move(other.recv_buffer_);
+            recv_pos_ = other.recv_pos_;
+            recv_end_ = other.recv_end_;
+            batch_receive_ = other.batch_receive_;
+            send_backlog_ = other.send_backlog_;
+            send_buffer_ = other.send_buffer_;
+            backlog_query_us_ = other.backlog_query_us_;
+            kernel_stamps_ = other.kernel_stamps_;
+            tx_bytes_ = other.tx_bytes_;
+            tx_pending_ = std::move(other.tx_pending_);
+            tx_stamps_ = std::move(other.tx_stamps_);
+            recv_kernel_us_ = other.recv_kernel_us_;
+            frame_kernel_us_ = other.frame_kernel_us_;
             other.sock_ = INVALID_SOCKET;
+            other.recv_pos_ = other.recv_end_ = 0;
+            other.clear_kernel_stamps();
         }
         return *this;
     }
@@ -64,6 +126,10 @@ public:
     }
     
     void listen(int backlog = 5) {
+        // Take data in the SYN from clients that connect with TCP Fast Open
+        DWORD fast_open = 1;
+        setsockopt(sock_, IPPROTO_TCP, TCP_FASTOPEN, (char*)&fast_open, sizeof(fast_open));
+        
         if (::listen(sock_, backlog) == SOCKET_ERROR) {
             throw NetworkError("Failed to listen: " + std::to_string(WSAGetLastError()));
         }
@@ -85,7 +151,20 @@ public:
         return Socket(client_sock);
     }
     
-    void connect(const std::string& host, uint16_t port) {
+    // Client, before connect(): offer the server a shared memory section
+    // (shm_transport.hpp). One that can open it is on the same host, and the
+    // connection moves there before anything else is sent; any other server
+    // refuses and it stays on TCP. With a key, the offer goes in the early
+    // data and the move waits until the server has our proof of the key.
+    void offer_shared_memory(bool enabled) { offer_shm_ = enabled; }
+    
+    // Connect and send first (whole frames) in the opening flight: in the
+    // SYN where TCP Fast Open works, right behind the handshake where it
+    // doesn't. With a key the connection is encrypted (crypto.hpp) and first
+    // goes as early data, so it still costs no round trip of its own. Throws
+    // if the server can't be reached or, encrypted, has no key or another one.
+    void connect(const std::string& host, uint16_t port, const std::string& first = std::string(),
+                 const PresharedKey& key = PresharedKey()) {
         addrinfo hints{};
         hints.ai_family = AF_INET;
         hints.ai_socktype = SOCK_STREAM;
@@ -96,12 +175,53 @@ public:
             throw NetworkError("Failed to resolve host: " + std::to_string(ret));
         }
         
-        if (::connect(sock_, result->ai_addr, (int)result->ai_addrlen) == SOCKET_ERROR) {
+        SecureHello mine = {};
+        std::string flight;
+        bool plain_shm = offer_shm_ && !key.set;    // offered ahead of everything
+        std::shared_ptr<SharedMemoryLink> sealed_shm;  // offered in the early data
+        try {
+            if (key.set) {
+                std::string early = first;
+                ShmOffer offer = {};
+                if (offer_shm_ && (sealed_shm = SharedMemoryLink::create(sock_, offer))) {
+                    early = serialize_packet(EventType::SHM_OFFER, offer) + first;
+                }
+                mine = make_secure_hello();
+                // Sealing sets mine.early_records, which the hello carries
+                std::string records = seal_early_data(key, mine, early);
+                flight = serialize_packet(EventType::SECURE_HELLO, mine) + records;
+            } else {
+                flight = first;
+            }
+        } catch (const CryptoError& e) {
             freeaddrinfo(result);
-            throw NetworkError("Failed to connect: " + std::to_string(WSAGetLastError()));
+            throw NetworkError(e.what());
         }
         
+        bool sent = !offer_shm_ && !flight.empty() && connect_fast_open(result->ai_addr, (int)result->ai_addrlen, flight);
+        if (!sent && ::connect(sock_, result->ai_addr, (int)result->ai_addrlen) == SOCKET_ERROR) {
+            freeaddrinfo(result);
+            throw NetworkError("Failed to connect: " + std::to_string(WSAGetLastError()));
+        }
         freeaddrinfo(result);
+        
+        if (plain_shm) {
+            request_shared_memory();
+        }
+        if (!sent && !flight.empty() && send_raw(flight) != (int)flight.size()) {
+            throw NetworkError("Failed to send: " + std::to_string(WSAGetLastError()));
+        }
+        if (key.set) {
+            try {
+                finish_handshake(key, mine);
+            } catch (const CryptoError& e) {
+                cipher_.reset();
+                throw NetworkError(e.what());
+            }
+            if (sealed_shm) {
+                take_shm_answer(sealed_shm);
+            }
+        }
     }
     
     void set_nonblocking(bool nonblocking) {
@@ -109,23 +229,204 @@ public:
         ioctlsocket(sock_, FIONBIO, &mode);
     }
     
+    // Send whole frames; sealed first on an encrypted connection
     int send(const void* data, int len) {
-        return ::send(sock_, (const char*)data, len, 0);
+        trace_stage(TraceStage::SEND);
+        if (!cipher_) {
+            return send_raw(data, len);
+        }
+        
+        try {
+            const std::string& sealed = cipher_->seal(static_cast<const char*>(data), len);
+            return send_raw(sealed.data(), (int)sealed.size()) == (int)sealed.size() ? len : -1;
+        } catch (const CryptoError&) {
+            g_metrics.count(Counter::SEND_FAILURES);
+            return -1;
+        }
     }
     
     int send(const std::string& data) {
         return send(data.data(), (int)data.size());
     }
     
+    // Several frames with one send() call, and one record when encrypted
+    int send_frames(const std::vector<std::string>& frames) {
+        if (frames.size() == 1) {
+            return send(frames[0]);
+        }
+        batch_.clear();
+        for (const auto& frame : frames) {
+            batch_ += frame;
+        }
+        return send(batch_);
+    }
+    
+    // Server, right after accept() and accept_encryption(): move to shared
+    // memory if the client offers a section we can open. Clients that offer
+    // nothing carry on over TCP. Unencrypted, the offer is the client's first
+    // frame, and one that sends nothing at first costs a short wait.
+    // Encrypted, it is the first frame of the early data, which anyone could
+    // replay, so the section is only opened once the client has proved the
+    // key (wait_confirmed); throws if it doesn't.
+    void accept_shared_memory() {
+        if (cipher_) {
+            accept_sealed_shared_memory();
+            return;
+        }
+        
+        PacketHeader header;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(SHM_OFFER_WAIT_MS);
+        while (true) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            if (left.count() <= 0 || !wait_socket((int)left.count())) {
+                return;
+            }
+            int n = ::recv(sock_, (char*)&header, sizeof(header), MSG_PEEK);
+            if (n <= 0) {
+                return;
+            }
+            if (n == (int)sizeof(header)) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));  // rest of the header is on its way
+        }
+        if (header.version != PROTOCOL_VERSION || header.type != EventType::SHM_OFFER) {
+            return;
+        }
+        
+        std::string frame;
+        if (!recv_raw_frame(frame)) {
+            return;
+        }
+        std::shared_ptr<SharedMemoryLink> link = open_shm_offer(frame);
+        ShmAnswer answer = {};
+        answer.accepted = link ? 1 : 0;
+        if (send_raw(serialize_packet(EventType::SHM_ANSWER, answer)) > 0 && link) {
+            std::atomic_store(&shm_, link);
+        }
+    }
+    
+    bool is_shared_memory() const { return std::atomic_load(&shm_) != nullptr; }
+    
+    // Server end of encryption, right after accept(): read the client's
+    // hello and early data, and answer with our hello and proof of the key
+    // in one flight. The early frames come out of recv_frame() first. Throws
+    // if the client offers no encryption or holds another key.
+    void accept_encryption(const PresharedKey& key) {
+        try {
+            answer_handshake(key);
+        } catch (const CryptoError& e) {
+            cipher_.reset();
+            throw NetworkError(e.what());
+        }
+    }
+    
+    // The client proves it holds the key a round trip after our answer;
+    // until then it may be a replay of someone else's opening flight. Call
+    // after sending the first reply. True at once when not encrypted.
+    bool wait_confirmed(int timeout_ms = SECURE_HANDSHAKE_TIMEOUT_MS) {
+        std::string record;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while (cipher_ && !cipher_->confirmed()) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            if (left.count() <= 0 || !wait_socket((int)left.count()) ||
+                !recv_raw_frame(record) || !cipher_->open(record)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    bool is_encrypted() const { return cipher_ != nullptr; }
+    
+    // Let the kernel hold only about `bytes` that haven't gone out yet.
+    // When the link can't keep up, send() then blocks early and the backlog
+    // waits in the caller's queue (OutboundQueue), where stale motion is
+    // merged, instead of in a socket buffer that only grows the delay.
+    // Linux caps unsent bytes exactly (TCP_NOTSENT_LOWAT). Windows has no
+    // such option: the send buffer is sized to the ideal send backlog the
+    // stack estimates for the path (SIO_IDEAL_SEND_BACKLOG_QUERY), but no
+    // smaller than `bytes`, and re-sized as that estimate changes.
+    bool limit_send_backlog(int bytes = SEND_BACKLOG_BYTES) {
+        if (is_shared_memory()) return false;
+        send_backlog_ = bytes;
+#ifdef _WIN32
+        return resize_send_buffer();
+#else
+        return setsockopt(sock_, IPPROTO_TCP, TCP_NOTSENT_LOWAT, (char*)&bytes, sizeof(bytes)) == 0;
+#endif
+    }
+    
+    // Bytes written but not yet sent by the kernel; -1 where it won't say
+    int unsent_bytes() const {
+#ifdef __linux__
+        int n = 0;
+        return !is_shared_memory() && ioctl(sock_, SIOCOUTQNSD, &n) == 0 ? n : -1;
+#else
+        return -1;
+#endif
+    }
+    
+    // On by default: each recv call takes whatever the socket holds, up to
+    // RECV_BUFFER_BYTES, so a burst of frames costs one call instead of two
+    // per frame, and wait_readable() doesn't ask the socket while frames
+    // are left over. Off reads every header and payload on its own.
+    void set_receive_batching(bool enabled) { batch_receive_ = enabled; }
+    
     int recv(void* buffer, int len) {
+        g_metrics.count(Counter::RECV_CALLS);
+        if (kernel_stamps_) {
+            return recv_stamped(sock_, (char*)buffer, len, recv_kernel_us_);
+        }
         return ::recv(sock_, (char*)buffer, len, 0);
     }
     
+    // Kernel timestamps on this connection, for tracing: sends get a
+    // KERNEL_TX stamp and kernel_rx_us() says when a frame arrived (see
+    // kernel_timestamps.hpp). False where the OS can't stamp TCP.
+    bool enable_kernel_timestamps() {
+        kernel_stamps_ = shm_ == nullptr && MouseShare::enable_kernel_timestamps(sock_);
+        tx_bytes_ = 0;
+        tx_pending_.clear();
+        return kernel_stamps_;
+    }
+    
+    // When the kernel received the start of the last frame recv_frame()
+    // returned, on the get_timestamp_us() clock; 0 if unknown
+    uint64_t kernel_rx_us() const { return frame_kernel_us_; }
+    
+    // Stamp traced sends the kernel has passed on since the last call.
+    // Every send does this too; call it after the last one.
+    void poll_kernel_timestamps() {
+        if (!kernel_stamps_) return;
+        tx_stamps_.clear();
+        read_tx_stamps(sock_, tx_stamps_);
+        for (const auto& stamp : tx_stamps_) {
+            // Offsets are 32 bits and wrap
+            while (!tx_pending_.empty() && static_cast<int32_t>(tx_pending_.front().last_byte - stamp.last_byte) <= 0) {
+                trace_kernel_stamp(TraceStage::KERNEL_TX, tx_pending_.front().id, stamp.sent_us);
+                tx_pending_.pop_front();
+            }
+        }
+    }
+    
     bool recv_exact(void* buffer, int len, int timeout_ms = -1) {
+        if (auto shm = std::atomic_load(&shm_)) {
+            return shm->read(buffer, len, timeout_ms);
+        }
+        
         int received = 0;
         char* buf = static_cast<char*>(buffer);
         
         while (received < len) {
+            if (recv_pos_ < recv_end_) {
+                int take = (std::min)(recv_end_ - recv_pos_, len - received);
+                std::memcpy(buf + received, recv_buffer_.data() + recv_pos_, take);
+                recv_pos_ += take;
+                received += take;
+                continue;
+            }
+            
             if (timeout_ms >= 0) {
                 fd_set readSet;
                 FD_ZERO(&readSet);
@@ -141,21 +442,74 @@ public:
                 }
             }
             
-            int n = recv(buf + received, len - received);
+            // Large payloads (transfer chunks) go straight to the caller
+            if (!batch_receive_ || len - received >= RECV_BUFFER_BYTES) {
+                int n = recv(buf + received, len - received);
+                if (n <= 0) {
+                    return false;
+                }
+                received += n;
+                continue;
+            }
+            
+            recv_buffer_.resize(RECV_BUFFER_BYTES);
+            int n = recv(&recv_buffer_[0], RECV_BUFFER_BYTES);
             if (n <= 0) {
                 return false;
             }
-            received += n;
+            recv_pos_ = 0;
+            recv_end_ = n;
         }
         
         return true;
     }
     
+    // Wait until data is available to read (false on timeout or error)
+    bool wait_readable(int timeout_ms) {
+        if (cipher_ && cipher_->has_frame()) {
+            return true;  // opened already, along with an earlier frame
+        }
+        return wait_socket(timeout_ms);
+    }
+    
+    // Receive one complete frame (PacketHeader + payload) into a single
+    // buffer. On an encrypted connection, records are opened until one
+    // completes a frame; a record that fails to open ends the connection.
+    bool recv_frame(std::string& frame) {
+        if (!cipher_) {
+            return recv_raw_frame(frame);
+        }
+        while (!cipher_->has_frame()) {
+            if (!recv_raw_frame(frame) || !cipher_->open(frame)) {
+                return false;
+            }
+        }
+        return cipher_->next_frame(frame);
+    }
+    
+    // Abort pending send/recv calls on other threads without releasing the handle
+    void shutdown() {
+        if (auto shm = std::atomic_load(&shm_)) {
+            shm->close();
+        }
+        if (sock_ != INVALID_SOCKET) {
+            ::shutdown(sock_, SD_BOTH);
+        }
+    }
+    
     void close() {
+        // Threads still inside the link hold it until they see it closed
+        if (auto shm = std::atomic_exchange(&shm_, std::shared_ptr<SharedMemoryLink>())) {
+            shm->close();
+        }
         if (sock_ != INVALID_SOCKET) {
             closesocket(sock_);
             sock_ = INVALID_SOCKET;
         }
+        cipher_.reset();
+        recv_pos_ = recv_end_ = 0;
+        send_backlog_ = send_buffer_ = 0;
+        clear_kernel_stamps();
     }
     
     bool is_valid() const { return sock_ != INVALID_SOCKET; }
@@ -187,7 +541,304 @@ public:
     }
 
 private:
+    int send_raw(const void* data, int len) {
+        if (auto shm = std::atomic_load(&shm_)) {
+            int written = shm->write(data, len);
+            if (written > 0) {
+                g_metrics.count(Counter::BYTES_SENT, written);
+            } else {
+                g_metrics.count(Counter::SEND_FAILURES);
+            }
+            return written;
+        }
+        
+#ifdef _WIN32
+        if (send_backlog_ && get_timestamp_us() >= backlog_query_us_) {
+            resize_send_buffer();
+        }
+#endif
+        int sent = ::send(sock_, (const char*)data, len, 0);
+        
+        g_metrics.count(Counter::SEND_CALLS);
+        if (sent > 0) {
+            g_metrics.count(Counter::BYTES_SENT, sent);
+            if (kernel_stamps_) {
+                track_send(sent);
+            }
+        } else {
+            g_metrics.count(Counter::SEND_FAILURES);
+        }
+        return sent;
+    }
+    
+    int send_raw(const std::string& data) {
+        return send_raw(data.data(), (int)data.size());
+    }
+    
+#ifdef _WIN32
+    bool resize_send_buffer() {
+        ULONG ideal = 0;
+        DWORD returned = 0;
+        WSAIoctl(sock_, SIO_IDEAL_SEND_BACKLOG_QUERY, nullptr, 0, &ideal, sizeof(ideal), &returned, nullptr, nullptr);
+        backlog_query_us_ = get_timestamp_us() + SEND_BACKLOG_QUERY_US;
+        
+        int size = (std::max)(send_backlog_, (int)ideal);
+        if (size == send_buffer_) return true;
+        send_buffer_ = size;
+        return setsockopt(sock_, SOL_SOCKET, SO_SNDBUF, (char*)&size, sizeof(size)) == 0;
+    }
+#endif
+    
+    // ConnectEx with TCP_FASTOPEN (Windows 10 1607 and later). The data
+    // rides in the SYN once an earlier connection got us the server's
+    // cookie; until then it follows the handshake, like a send(). False if
+    // this didn't work, leaving a fresh socket for a plain connect.
+    bool connect_fast_open(const sockaddr* addr, int addr_len, const std::string& data) {
+        LPFN_CONNECTEX connect_ex = nullptr;
+        GUID guid = WSAID_CONNECTEX;
+        DWORD bytes = 0;
+        DWORD fast_open = 1;
+        if (WSAIoctl(sock_, SIO_GET_EXTENSION_FUNCTION_POINTER, &guid, sizeof(guid),
+                     &connect_ex, sizeof(connect_ex), &bytes, nullptr, nullptr) == SOCKET_ERROR ||
+            setsockopt(sock_, IPPROTO_TCP, TCP_FASTOPEN, (char*)&fast_open, sizeof(fast_open)) == SOCKET_ERROR) {
+            return false;
+        }
+        
+        // ConnectEx wants a bound socket and completes overlapped
+        sockaddr_in local{};
+        local.sin_family = AF_INET;
+        OVERLAPPED overlapped{};
+        overlapped.hEvent = WSACreateEvent();
+        bytes = 0;
+        bool ok = ::bind(sock_, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != SOCKET_ERROR;
+        if (ok && !connect_ex(sock_, addr, addr_len, (PVOID)data.data(), (DWORD)data.size(), &bytes, &overlapped)) {
+            DWORD flags = 0;
+            ok = WSAGetLastError() == ERROR_IO_PENDING &&
+                 WSAGetOverlappedResult(sock_, &overlapped, &bytes, TRUE, &flags);
+        }
+        WSACloseEvent(overlapped.hEvent);
+        
+        if (!ok) {
+            // Refused, or no fast open after all: the plain connect tells which
+            close();
+            create();
+            return false;
+        }
+        setsockopt(sock_, SOL_SOCKET, SO_UPDATE_CONNECT_CONTEXT, nullptr, 0);
+        
+        g_metrics.count(Counter::SEND_CALLS);
+        g_metrics.count(Counter::BYTES_SENT, bytes);
+        return bytes == data.size() ||
+               send_raw(data.data() + bytes, (int)(data.size() - bytes)) == (int)(data.size() - bytes);
+    }
+    
+    static SecureHello parse_hello(const std::string& frame, const char* not_encrypted) {
+        if (frame_type(frame) != EventType::SECURE_HELLO || frame.size() != sizeof(PacketHeader) + sizeof(SecureHello)) {
+            throw NetworkError(not_encrypted);
+        }
+        SecureHello hello;
+        std::memcpy(&hello, frame.data() + sizeof(PacketHeader), sizeof(hello));
+        if (hello.suite != CipherSuite::AES_256_GCM) {
+            throw NetworkError("Unsupported cipher suite");
+        }
+        return hello;
+    }
+    
+    // Client, after its hello and early data went out with connect: the
+    // server's hello and its proof of the key come back in one flight
+    void finish_handshake(const PresharedKey& key, const SecureHello& mine) {
+        std::string frame;
+        if (!wait_socket(SECURE_HANDSHAKE_TIMEOUT_MS) || !recv_raw_frame(frame)) {
+            throw NetworkError("No reply to the encryption handshake");
+        }
+        SecureHello theirs = parse_hello(frame, "The server does not use encryption (--key)");
+        
+        cipher_ = std::make_unique<FrameCipher>(key, mine, theirs, true);
+        cipher_->expect_confirmation(mine);
+        if (!wait_socket(SECURE_HANDSHAKE_TIMEOUT_MS) || !recv_raw_frame(frame) || !cipher_->open(frame)) {
+            cipher_.reset();
+            throw NetworkError("Encryption handshake failed: the other side has a different key");
+        }
+        
+        // Our proof: the server's nonce, sent back encrypted
+        send(serialize_packet(EventType::SECURE_HELLO, theirs));
+    }
+    
+    void answer_handshake(const PresharedKey& key) {
+        std::string frame;
+        if (!wait_socket(SECURE_HANDSHAKE_TIMEOUT_MS) || !recv_raw_frame(frame)) {
+            throw NetworkError("No encryption handshake from the client");
+        }
+        SecureHello theirs = parse_hello(frame, "The client did not offer encryption (--key)");
+        SecureHello mine = make_secure_hello();
+        
+        cipher_ = std::make_unique<FrameCipher>(key, theirs, mine, false);
+        cipher_->expect_confirmation(mine);
+        
+        // Answer first, so a client with another key learns why it failed
+        std::string flight = serialize_packet(EventType::SECURE_HELLO, mine);
+        std::string proof = serialize_packet(EventType::SECURE_HELLO, theirs);
+        flight += cipher_->seal(proof.data(), proof.size());
+        send_raw(flight);
+        
+        for (int i = 0; i < theirs.early_records; i++) {
+            if (!wait_socket(SECURE_HANDSHAKE_TIMEOUT_MS) || !recv_raw_frame(frame) || !cipher_->open_early(frame)) {
+                cipher_.reset();
+                throw NetworkError("Encryption handshake failed: the other side has a different key");
+            }
+        }
+    }
+    
+    // Remember which traced event the bytes just sent belong to, for the
+    // stamp the kernel reports once it has passed them on
+    void track_send(int sent) {
+        tx_bytes_ += static_cast<uint32_t>(sent);
+        if (uint32_t id = trace_take_sent_id()) {
+            tx_pending_.push_back({tx_bytes_ - 1, id});
+            if (tx_pending_.size() > KERNEL_TX_PENDING_MAX) {
+                tx_pending_.pop_front();  // the kernel stopped stamping
+            }
+        }
+        poll_kernel_timestamps();
+    }
+    
+    // Client side of accept_shared_memory(), unencrypted. The server
+    // answers over TCP either way; from then on everything goes through the
+    // rings if it could open them.
+    void request_shared_memory() {
+        ShmOffer offer = {};
+        std::shared_ptr<SharedMemoryLink> link = SharedMemoryLink::create(sock_, offer);
+        if (!link) {
+            return;  // no shared memory here: plain TCP
+        }
+        if (send_raw(serialize_packet(EventType::SHM_OFFER, offer)) <= 0) {
+            throw NetworkError("The server did not answer the shared memory offer (--shm)");
+        }
+        take_shm_answer(link);
+    }
+    
+    // Client: the server's answer to our offer, over TCP (sealed when
+    // encrypted). The section is ours until it said yes.
+    void take_shm_answer(const std::shared_ptr<SharedMemoryLink>& link) {
+        std::string frame;
+        if (!wait_readable(SHM_ANSWER_TIMEOUT_MS) || !recv_frame(frame) ||
+            frame_type(frame) != EventType::SHM_ANSWER ||
+            frame.size() != sizeof(PacketHeader) + sizeof(ShmAnswer)) {
+            throw NetworkError("The server did not answer the shared memory offer (--shm)");
+        }
+        link->unlink_name();
+        
+        ShmAnswer answer;
+        std::memcpy(&answer, frame.data() + sizeof(PacketHeader), sizeof(answer));
+        if (answer.accepted) {
+            std::atomic_store(&shm_, link);
+        }
+    }
+    
+    // Server, encrypted: the offer left in the early data. Answered only
+    // after the client's proof, and sealed like everything after it.
+    void accept_sealed_shared_memory() {
+        EventType type;
+        if (!cipher_->peek_type(type) || type != EventType::SHM_OFFER) {
+            return;
+        }
+        std::string frame;
+        cipher_->next_frame(frame);
+        if (!wait_confirmed()) {
+            throw NetworkError("Encryption handshake failed: the client did not prove the key");
+        }
+        
+        std::shared_ptr<SharedMemoryLink> link = open_shm_offer(frame);
+        ShmAnswer answer = {};
+        answer.accepted = link ? 1 : 0;
+        if (send(serialize_packet(EventType::SHM_ANSWER, answer)) > 0 && link) {
+            std::atomic_store(&shm_, link);
+        }
+    }
+    
+    // The section an SHM_OFFER names, if this host has it
+    std::shared_ptr<SharedMemoryLink> open_shm_offer(const std::string& frame) const {
+        if (frame.size() != sizeof(PacketHeader) + sizeof(ShmOffer)) {
+            return nullptr;
+        }
+        ShmOffer offer;
+        std::memcpy(&offer, frame.data() + sizeof(PacketHeader), sizeof(offer));
+        return SharedMemoryLink::open(sock_, offer);
+    }
+    
+    // Data (or a disconnect) waiting on the socket itself, or on the
+    // shared memory ring once the connection has moved there
+    bool wait_socket(int timeout_ms) {
+        if (auto shm = std::atomic_load(&shm_)) {
+            return shm->wait_readable(timeout_ms);
+        }
+        if (recv_pos_ < recv_end_) {
+            return true;  // left over from the last recv
+        }
+        
+        fd_set readSet;
+        FD_ZERO(&readSet);
+        FD_SET(sock_, &readSet);
+        
+        timeval tv;
+        tv.tv_sec = timeout_ms / 1000;
+        tv.tv_usec = (timeout_ms % 1000) * 1000;
+        
+        return select(0, &readSet, nullptr, nullptr, &tv) > 0;
+    }
+    
+    // Off, with nothing pending, until enable_kernel_timestamps()
+    void clear_kernel_stamps() {
+        kernel_stamps_ = false;
+        tx_bytes_ = 0;
+        tx_pending_.clear();
+        tx_stamps_.clear();
+        recv_kernel_us_ = frame_kernel_us_ = 0;
+    }
+    
+    bool recv_raw_frame(std::string& frame) {
+        frame.resize(sizeof(PacketHeader));
+        if (!recv_exact(&frame[0], sizeof(PacketHeader))) {
+            return false;
+        }
+        frame_kernel_us_ = recv_kernel_us_;  // the recv that brought the header
+        
+        PacketHeader header;
+        std::memcpy(&header, frame.data(), sizeof(header));
+        if (header.version != PROTOCOL_VERSION) {
+            return false;
+        }
+        
+        frame.resize(sizeof(PacketHeader) + header.payload_size);
+        return header.payload_size == 0 ||
+               recv_exact(&frame[sizeof(PacketHeader)], header.payload_size);
+    }
+    
     SOCKET sock_;
+    std::unique_ptr<FrameCipher> cipher_;  // set by the handshake
+    std::string batch_;                    // send_frames, reused
+    std::shared_ptr<SharedMemoryLink> shm_;  // same-host transport; only touched through atomic_load/store
+    bool offer_shm_ = false;
+    std::string recv_buffer_;              // recv_exact reads ahead into this
+    int recv_pos_ = 0;                     // unread bytes are [recv_pos_, recv_end_)
+    int recv_end_ = 0;
+    bool batch_receive_ = true;
+    int send_backlog_ = 0;                 // limit_send_backlog(), 0 if off
+    int send_buffer_ = 0;                  // Windows: SO_SNDBUF as last set
+    uint64_t backlog_query_us_ = 0;        // Windows: when to re-ask the ideal backlog
+    
+    // Kernel timestamps (tracing only)
+    struct PendingTx {
+        uint32_t last_byte;                // stream offset, as the kernel counts it
+        uint32_t id;                       // traced event
+    };
+    static constexpr size_t KERNEL_TX_PENDING_MAX = 4096;
+    bool kernel_stamps_ = false;
+    uint32_t tx_bytes_ = 0;
+    std::deque<PendingTx> tx_pending_;
+    std::vector<KernelTxStamp> tx_stamps_; // poll_kernel_timestamps, reused
+    uint64_t recv_kernel_us_ = 0;          // the last recv call's
+    uint64_t frame_kernel_us_ = 0;         // the last frame's
 };
 
 } // namespace MouseShare
@@ -0,0 +1,418 @@
+#pragma once
+
+#include "common.hpp"
+#include "histogram.hpp"
+#include "trace.hpp"
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+namespace MouseShare {
+
+// Outbound priority classes, highest first
+enum class Lane : uint8_t {
+    CONTROL = 0,  // keys, buttons, screen switches, handshakes
+    SCROLL = 1,
+    MOTION = 2,
+    BULK = 3      // clipboard and file transfers: only when no input is waiting
+};
+
+constexpr int LANE_COUNT = 4;
+constexpr size_t MAX_QUEUED_MOTION = 256;  // beyond this, queued motion is merged
+constexpr size_t MAX_BATCH_BYTES = 16 * 1024;  // frames handed to one send
+constexpr uint64_t MOTION_STALE_US = 4000;  // motion queued this long is merged before sending
+constexpr uint32_t MOTION_REFRESH_MULTIPLE = 2;  // default motion rate, in client display refreshes
+
+inline Lane lane_of(EventType type) {
+    switch (type) {
+        case EventType::MOUSE_MOVE: return Lane::MOTION;
+        case EventType::MOUSE_SCROLL: return Lane::SCROLL;
+        case EventType::CLIPBOARD:
+        case EventType::CLIPBOARD_REQUEST:
+        case EventType::CHANNEL_OPEN:
+        case EventType::CHANNEL_DATA:
+        case EventType::CHANNEL_CREDIT:
+        case EventType::CHANNEL_CLOSE:
+            return Lane::BULK;
+        default: return Lane::CONTROL;
+    }
+}
+
+inline const char* lane_name(Lane lane) {
+    switch (lane) {
+        case Lane::CONTROL: return "control";
+        case Lane::SCROLL: return "scroll";
+        case Lane::MOTION: return "motion";
+        case Lane::BULK: return "bulk";
+        default: return "unknown";
+    }
+}
+
+// Snapshot of what is waiting to be sent
+struct QueueDepth {
+    size_t frames = 0;
+    size_t bytes = 0;
+    uint64_t age_us = 0;  // how long the oldest frame has waited
+};
+
+// Single-connection send queue with one FIFO per Lane. A writer thread
+// always drains the highest non-empty lane, so a click never waits behind
+// buffered motion. Only keepalives may overtake anything; every other
+// control or scroll frame first pulls the scroll and motion queued before
+// it into its own lane (motion merged into one MOUSE_MOVE), so it still
+// lands at the cursor position it happened at and a modifier key stays
+// around the wheel or drag it modifies.
+//
+// Whatever is queued when the writer wakes goes out as one batch (in lane
+// order, and ending after a bulk frame), so a burst costs one send() and,
+// on an encrypted connection, one sealed record. With a gather window set
+// (send_batching.hpp), a batch of motion and scroll waits until its oldest
+// frame is that old, so input arriving meanwhile joins it; a control frame
+// ends the wait.
+//
+// With a motion rate set (from the client's display refresh), motion is
+// resampled to it: MOUSE_MOVE frames wait for the next tick and leave merged
+// into one, their deltas summed, so an 8 kHz mouse costs a few hundred
+// frames a second and no motion is lost. Whatever pulls motion into its
+// own lane (a button, a scroll) sends it right away.
+//
+// Scroll frames queued back to back, with no motion between them, are
+// added together per axis: a fast spin of a high resolution wheel sends one
+// MOUSE_SCROLL per batch instead of one per wheel report.
+//
+// On a link slower than the input, send() blocks (see
+// Socket::limit_send_backlog) and motion piles up here rather than in the
+// kernel. Once the oldest of it is MOTION_STALE_US old it goes out merged
+// into one move: the cursor jumps to where it is now instead of replaying
+// the path late.
+class OutboundQueue {
+public:
+    // Called on the writer thread with one or more frames in their final
+    // order; return false if the connection failed
+    using SendFn = std::function<bool(const std::vector<std::string>& frames)>;
+
+    explicit OutboundQueue(SendFn send) : send_(std::move(send)) {}
+
+    ~OutboundQueue() {
+        stop();
+    }
+
+    OutboundQueue(const OutboundQueue&) = delete;
+    OutboundQueue& operator=(const OutboundQueue&) = delete;
+
+    void start() {
+        running_ = true;
+        writer_thread_ = std::thread(&OutboundQueue::writer_thread_func, this);
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_ = false;
+        }
+        cv_.notify_all();
+        if (writer_thread_.joinable()) {
+            writer_thread_.join();
+        }
+    }
+
+    void push(std::string frame) {
+        uint64_t now = get_timestamp_us();
+        EventType type = frame_type(frame);
+        Lane lane = lane_of(type);
+        uint32_t trace_id = trace_current();
+        size_t depth = 0;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queued_bytes_ += frame.size();
+            auto& motion = lanes_[(int)Lane::MOTION];
+            auto& scroll = lanes_[(int)Lane::SCROLL];
+
+            if (lane == Lane::BULK) {
+                lanes_[(int)Lane::BULK].push_back({std::move(frame), now, trace_id});
+            } else if (lane == Lane::MOTION) {
+                motion.push_back({std::move(frame), now, trace_id});
+                if (motion.size() > MAX_QUEUED_MOTION) {
+                    merge_motion_into(motion);
+                }
+            } else if (lane == Lane::SCROLL) {
+                merge_motion_into(scroll);
+                if (!merge_scroll_into(scroll, frame, trace_id)) {
+                    scroll.push_back({std::move(frame), now, trace_id});
+                }
+            } else {
+                auto& control = lanes_[(int)Lane::CONTROL];
+                if (type != EventType::KEEPALIVE) {
+                    // Scroll frames already carry the motion that preceded them
+                    for (auto& pending : scroll) {
+                        control.push_back(std::move(pending));
+                    }
+                    scroll.clear();
+                    merge_motion_into(control);
+                }
+                control.push_back({std::move(frame), now, trace_id});
+            }
+            for (const auto& l : lanes_) {
+                depth += l.size();
+            }
+            publish_gauges(now);
+        }
+        trace_stage(TraceStage::ENQUEUE, type, static_cast<uint16_t>((std::min)(depth, size_t(UINT16_MAX))));
+        cv_.notify_one();
+    }
+
+    // Drop everything not yet sent (e.g. after the connection was lost)
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& lane : lanes_) {
+            lane.clear();
+        }
+        queued_bytes_ = 0;
+        publish_gauges(get_timestamp_us());
+    }
+
+    size_t queued(Lane lane) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return lanes_[(int)lane].size();
+    }
+
+    QueueDepth depth() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        QueueDepth d;
+        for (const auto& l : lanes_) {
+            d.frames += l.size();
+        }
+        d.bytes = queued_bytes_;
+        d.age_us = oldest_age_us(get_timestamp_us());
+        return d;
+    }
+
+    // Time frames spent queued per lane, since the last call
+    HistogramSnapshot take_latency(Lane lane) {
+        return latency_[(int)lane].take();
+    }
+
+    // Frames per send, since the last call
+    HistogramSnapshot take_batch_sizes() {
+        return batch_frames_.take();
+    }
+
+    // How long to let input gather before sending it; 0 sends at once
+    void set_gather_window(uint64_t us) {
+        gather_us_.store(us, std::memory_order_relaxed);
+        g_metrics.set(Gauge::GATHER_WINDOW_US, us);
+    }
+
+    // Most MOUSE_MOVE frames to send a second; 0 sends motion as it comes
+    void set_motion_rate(uint32_t per_second) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            motion_interval_us_ = per_second ? 1000000 / per_second : 0;
+            next_motion_us_ = 0;
+        }
+        g_metrics.set(Gauge::MOTION_RATE_HZ, per_second);
+        cv_.notify_one();
+    }
+
+private:
+    struct Pending {
+        std::string frame;
+        uint64_t enqueued_us;
+        uint32_t trace_id = 0;  // traced as the newest event merged into it
+    };
+
+    // Replace all queued motion with one frame at the end of target. The
+    // merged move keeps the oldest enqueue time, which is what it waited.
+    void merge_motion_into(std::deque<Pending>& target) {
+        auto& motion = lanes_[(int)Lane::MOTION];
+        if (motion.empty()) return;
+
+        if (motion.size() == 1 && &target != &motion) {
+            target.push_back(std::move(motion.front()));
+            motion.clear();
+            return;
+        }
+
+        MouseMoveEvent merged = {};
+        for (const auto& pending : motion) {
+            queued_bytes_ -= pending.frame.size();
+            MouseMoveEvent event;
+            std::memcpy(&event, pending.frame.data() + sizeof(PacketHeader), sizeof(event));
+            merged.x = event.x;
+            merged.y = event.y;
+            merged.dx += event.dx;
+            merged.dy += event.dy;
+        }
+
+        Pending combined;
+        combined.frame = serialize_packet(EventType::MOUSE_MOVE, merged);
+        combined.enqueued_us = motion.front().enqueued_us;
+        combined.trace_id = motion.back().trace_id;
+        queued_bytes_ += combined.frame.size();
+
+        motion.clear();
+        target.push_back(std::move(combined));
+    }
+
+    // Add a scroll frame's deltas to the scroll frame queued last, if that is
+    // the newest frame in the lane. It keeps its enqueue time, like merged motion.
+    bool merge_scroll_into(std::deque<Pending>& scroll, const std::string& frame, uint32_t trace_id) {
+        if (scroll.empty() || frame_type(scroll.back().frame) != EventType::MOUSE_SCROLL ||
+            frame.size() < sizeof(PacketHeader) + sizeof(MouseScrollEvent)) {
+            return false;
+        }
+
+        Pending& last = scroll.back();
+        MouseScrollEvent merged, event;
+        std::memcpy(&merged, last.frame.data() + sizeof(PacketHeader), sizeof(merged));
+        std::memcpy(&event, frame.data() + sizeof(PacketHeader), sizeof(event));
+        merged.dx += event.dx;
+        merged.dy += event.dy;
+        std::memcpy(&last.frame[sizeof(PacketHeader)], &merged, sizeof(merged));
+        last.trace_id = trace_id;
+        queued_bytes_ -= frame.size();
+        g_metrics.count(Counter::SCROLL_MERGED);
+        return true;
+    }
+
+    // Move queued frames into batch, highest lane first. Motion waiting for
+    // its tick stays queued.
+    void take_batch(std::vector<std::string>& batch, std::vector<uint32_t>& trace_ids) {
+        size_t bytes = 0;
+        uint64_t now = get_timestamp_us();
+        auto& motion = lanes_[(int)Lane::MOTION];
+        bool hold_motion = motion_interval_us_ && now < next_motion_us_;
+        if (!hold_motion && !motion.empty() && motion_interval_us_) {
+            if (motion.size() > 1) merge_motion_into(motion);
+            // The next tick follows this one; after a pause, it starts from now
+            next_motion_us_ = now - next_motion_us_ < motion_interval_us_ ? next_motion_us_ + motion_interval_us_
+                                                                           : now + motion_interval_us_;
+        } else if (motion.size() > 1 && now - motion.front().enqueued_us >= MOTION_STALE_US) {
+            merge_motion_into(motion);
+        }
+        while (bytes < MAX_BATCH_BYTES) {
+            int i = 0;
+            while (i < LANE_COUNT && (lanes_[i].empty() || (hold_motion && i == (int)Lane::MOTION))) i++;
+            if (i == LANE_COUNT) break;
+
+            Pending& item = lanes_[i].front();
+            latency_[i].record(now - item.enqueued_us);
+            bytes += item.frame.size();
+            batch.push_back(std::move(item.frame));
+            trace_ids.push_back(item.trace_id);
+            lanes_[i].pop_front();
+            queued_bytes_ -= batch.back().size();
+
+            // One transfer chunk at most: input arriving meanwhile
+            // shouldn't wait behind a second
+            if (i == (int)Lane::BULK) break;
+        }
+        publish_gauges(now);
+    }
+
+    // Lanes are in enqueue order, so the oldest frame is at a front
+    uint64_t oldest_age_us(uint64_t now) const {
+        uint64_t oldest = now;
+        for (const auto& l : lanes_) {
+            if (!l.empty()) oldest = (std::min)(oldest, l.front().enqueued_us);
+        }
+        return now - oldest;
+    }
+
+    // Only input is held back, and only up to one batch of it
+    bool gathering() const {
+        return lanes_[(int)Lane::CONTROL].empty() && lanes_[(int)Lane::BULK].empty() &&
+               queued_bytes_ < MAX_BATCH_BYTES;
+    }
+
+    // Nothing to send but motion, and its tick hasn't come
+    bool motion_held(uint64_t now) const {
+        return motion_interval_us_ && now < next_motion_us_ && !lanes_[(int)Lane::MOTION].empty() &&
+               lanes_[(int)Lane::CONTROL].empty() && lanes_[(int)Lane::SCROLL].empty() &&
+               lanes_[(int)Lane::BULK].empty();
+    }
+
+    // As of the last push or batch; the stats file reports these
+    void publish_gauges(uint64_t now) {
+        g_metrics.set(Gauge::SEND_QUEUED_BYTES, queued_bytes_);
+        g_metrics.set(Gauge::SEND_QUEUED_US, oldest_age_us(now));
+    }
+
+    void writer_thread_func() {
+        std::vector<std::string> batch;
+        std::vector<uint32_t> trace_ids;
+        while (true) {
+            batch.clear();
+            trace_ids.clear();
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] {
+                    if (!running_) return true;
+                    for (const auto& l : lanes_) {
+                        if (!l.empty()) return true;
+                    }
+                    return false;
+                });
+                if (!running_) break;
+
+                uint64_t window = gather_us_.load(std::memory_order_relaxed);
+                uint64_t age = oldest_age_us(get_timestamp_us());
+                if (window > age && gathering()) {
+                    cv_.wait_for(lock, std::chrono::microseconds(window - age), [this] {
+                        return !running_ || !gathering();
+                    });
+                    if (!running_) break;
+                }
+
+                uint64_t now = get_timestamp_us();
+                while (running_ && motion_held(now)) {
+                    cv_.wait_for(lock, std::chrono::microseconds(next_motion_us_ - now), [this] {
+                        return !running_ || !motion_held(get_timestamp_us());
+                    });
+                    now = get_timestamp_us();
+                }
+                if (!running_) break;
+
+                take_batch(batch, trace_ids);
+                if (batch.empty()) continue;  // cleared meanwhile
+            }
+            g_metrics.record(Timing::SEND_BATCH, batch.size());
+            batch_frames_.record(batch.size());
+
+            // Stamped here: the socket only knows the batch
+            for (uint32_t id : trace_ids) {
+                trace_resume(id);
+                trace_stage(TraceStage::SEND);
+            }
+            trace_resume(0);
+
+            if (!send_(batch)) {
+                clear();
+            }
+        }
+    }
+
+    SendFn send_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Pending> lanes_[LANE_COUNT];
+    size_t queued_bytes_ = 0;
+    bool running_ = false;
+    std::thread writer_thread_;
+
+    std::atomic<uint64_t> gather_us_{0};
+    uint64_t motion_interval_us_ = 0;  // 0: no motion rate
+    uint64_t next_motion_us_ = 0;      // when held motion may go
+
+    LatencyHistogram latency_[LANE_COUNT];
+    LatencyHistogram batch_frames_;
+};
+
+} // namespace MouseShare
@@ -0,0 +1,94 @@
+#include "common.hpp"
+#include "outbound_queue.hpp"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <chrono>
+
+using namespace MouseShare;
+
+// Frame order out of an OutboundQueue. Everything is queued before the
+// writer starts, as when a gather window or a slow link holds a batch.
+
+static int g_failures = 0;
+
+static void expect_order(const char* name, const std::vector<EventType>& got, const std::vector<EventType>& want) {
+    if (got == want) {
+        std::cout << "ok      " << name << "\n";
+        return;
+    }
+    g_failures++;
+    std::cout << "FAILED  " << name << ": got";
+    for (EventType type : got) std::cout << " " << event_type_name(type);
+    std::cout << ", want";
+    for (EventType type : want) std::cout << " " << event_type_name(type);
+    std::cout << "\n";
+}
+
+// Queue the frames, then start the writer and collect what it sends
+static std::vector<EventType> send_through_queue(const std::vector<std::string>& frames) {
+    std::mutex mutex;
+    std::vector<EventType> sent;
+    OutboundQueue queue([&](const std::vector<std::string>& batch) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& frame : batch) {
+            sent.push_back(frame_type(frame));
+        }
+        return true;
+    });
+    for (const auto& frame : frames) {
+        queue.push(frame);
+    }
+    queue.start();
+    while (queue.depth().frames > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    queue.stop();
+    return sent;
+}
+
+static std::string key(EventType type) {
+    KeyEvent event = {0x11, 0x1d, 0};  // VK_CONTROL
+    return serialize_packet(type, event);
+}
+
+static std::string scroll() {
+    MouseScrollEvent event = {0, 120};
+    return serialize_packet(EventType::MOUSE_SCROLL, event);
+}
+
+static std::string move() {
+    MouseMoveEvent event = {10, 10, 1, 0};
+    return serialize_packet(EventType::MOUSE_MOVE, event);
+}
+
+static std::string keepalive() {
+    KeepaliveEvent event = {1, 0};
+    return serialize_packet(EventType::KEEPALIVE, event);
+}
+
+int main() {
+    // Ctrl+wheel: the wheel must stay between the key's press and release
+    expect_order("key scroll key",
+                 send_through_queue({key(EventType::KEY_PRESS), scroll(), key(EventType::KEY_RELEASE)}),
+                 {EventType::KEY_PRESS, EventType::MOUSE_SCROLL, EventType::KEY_RELEASE});
+
+    // Shift+drag: motion queued before a release goes out before it
+    expect_order("key move key",
+                 send_through_queue({key(EventType::KEY_PRESS), move(), move(), key(EventType::KEY_RELEASE)}),
+                 {EventType::KEY_PRESS, EventType::MOUSE_MOVE, EventType::KEY_RELEASE});
+
+    // An autorepeat announcement keeps its place too
+    expect_order("scroll repeat",
+                 send_through_queue({scroll(), key(EventType::KEY_REPEAT)}),
+                 {EventType::MOUSE_SCROLL, EventType::KEY_REPEAT});
+
+    // Keepalives are not input: they still overtake it
+    expect_order("keepalive overtakes",
+                 send_through_queue({move(), scroll(), keepalive()}),
+                 {EventType::KEEPALIVE, EventType::MOUSE_MOVE, EventType::MOUSE_SCROLL});
+
+    return g_failures == 0 ? 0 : 1;
+}
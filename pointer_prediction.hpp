@@ -0,0 +1,308 @@
+#pragma once
+
+#include "common.hpp"
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+namespace MouseShare {
+
+// Client-side pointer prediction (--predict). Remote motion shows up a
+// network delay late; the predictor shows the cursor where it will be that
+// much later, extrapolating its velocity over the last moves received. When
+// the next real move says otherwise, the difference fades out instead of
+// jumping. Nothing is predicted while a button is down, or shortly after
+// one changed, so clicks and drags land exactly where the server put them.
+constexpr uint64_t PREDICTION_MAX_LEAD_US = 50000;       // never look further ahead
+constexpr uint64_t PREDICTION_VELOCITY_US = 15000;       // velocity over the moves this recent
+constexpr uint64_t PREDICTION_MIN_SPAN_US = 2000;        // too short a span to measure velocity
+constexpr uint64_t PREDICTION_FADE_US = 50000;           // after motion stops, prediction fades over this
+constexpr uint64_t PREDICTION_BLEND_US = 8000;           // time constant of a correction fading out
+constexpr uint64_t PREDICTION_BUTTON_HOLD_US = 150000;   // no prediction this long after a button changes
+constexpr uint64_t PREDICTION_TICK_US = 4000;            // between moves, the cursor is updated this often
+constexpr double PREDICTION_SNAP_PX = 200;               // a correction larger than this jumps instead
+
+// The model alone, on the caller's clock, so it can be evaluated offline
+// (bench predict). Not thread-safe.
+class PointerPredictor {
+public:
+    explicit PointerPredictor(uint64_t lead_us = 0) {
+        set_lead(lead_us);
+    }
+
+    // How far ahead to show the cursor; 0 shows it where it is
+    void set_lead(uint64_t lead_us) {
+        lead_us_ = (std::min)(lead_us, PREDICTION_MAX_LEAD_US);
+    }
+
+    uint64_t lead_us() const { return lead_us_; }
+
+    // The cursor jumped (a screen switch): forget its motion
+    void reset() {
+        count_ = 0;
+        vx_ = vy_ = 0;
+        corr_x_ = corr_y_ = 0;
+    }
+
+    // A MOUSE_MOVE arrived; (x, y) is where it put the cursor
+    void on_move(uint64_t now_us, double x, double y) {
+        double shown_x = x, shown_y = y;
+        bool had_motion = count_ > 0 && now_us - last_us() < PREDICTION_VELOCITY_US + PREDICTION_FADE_US;
+        if (had_motion) {
+            position(now_us, shown_x, shown_y);
+        } else {
+            count_ = 0;
+            vx_ = vy_ = 0;
+        }
+
+        samples_[(first_ + count_) % SAMPLES] = {now_us, x, y};
+        if (count_ < SAMPLES) {
+            count_++;
+        } else {
+            first_ = (first_ + 1) % SAMPLES;
+        }
+        update_velocity(now_us);
+
+        // Carry on from where the cursor is shown, and let the error fade
+        corr_x_ = corr_y_ = 0;
+        corr_us_ = now_us;
+        if (had_motion && predicting(now_us)) {
+            double px, py;
+            position(now_us, px, py);
+            double ex = shown_x - px, ey = shown_y - py;
+            if (std::hypot(ex, ey) < PREDICTION_SNAP_PX) {
+                corr_x_ = ex;
+                corr_y_ = ey;
+            }
+        }
+    }
+
+    // A button went down or up: show the real position until it has been
+    // up for PREDICTION_BUTTON_HOLD_US
+    void on_button(uint64_t now_us, bool pressed) {
+        buttons_ = pressed ? buttons_ + 1 : (std::max)(0, buttons_ - 1);
+        hold_until_us_ = now_us + PREDICTION_BUTTON_HOLD_US;
+        corr_x_ = corr_y_ = 0;
+    }
+
+    // A button release the server will never send (key state resync)
+    void release_buttons() {
+        buttons_ = 0;
+    }
+
+    // Where to show the cursor at now_us
+    void position(uint64_t now_us, double& x, double& y) const {
+        if (count_ == 0) {
+            x = y = 0;
+            return;
+        }
+        const Sample& last = samples_[(first_ + count_ - 1) % SAMPLES];
+        x = last.x;
+        y = last.y;
+        if (!predicting(now_us)) return;
+
+        // Extrapolated past the last move as well, so the cursor keeps
+        // moving between moves; after motion stops it settles back
+        uint64_t gap = now_us - last.us;
+        uint64_t stop_after = stop_after_us();
+        double fade = gap <= stop_after ? 1.0 : 1.0 - double(gap - stop_after) / PREDICTION_FADE_US;
+        if (fade <= 0) return;
+
+        double ahead = double((std::min)(gap, stop_after) + lead_us_) * fade;
+        double blend = std::exp(-double(now_us - corr_us_) / PREDICTION_BLEND_US);
+        x += vx_ * ahead + corr_x_ * blend;
+        y += vy_ * ahead + corr_y_ * blend;
+    }
+
+    // True once the cursor shows the real position and will stay there
+    // until the next move
+    bool settled(uint64_t now_us) const {
+        return count_ == 0 || !predicting(now_us) ||
+               now_us - last_us() >= stop_after_us() + PREDICTION_FADE_US;
+    }
+
+private:
+    struct Sample {
+        uint64_t us;
+        double x;
+        double y;
+    };
+
+    static constexpr int SAMPLES = 16;
+
+    bool predicting(uint64_t now_us) const {
+        return lead_us_ > 0 && buttons_ == 0 && now_us >= hold_until_us_;
+    }
+
+    uint64_t last_us() const {
+        return samples_[(first_ + count_ - 1) % SAMPLES].us;
+    }
+
+    // Moves come about this far apart; missing two in a row means the
+    // pointer stopped
+    uint64_t stop_after_us() const {
+        if (count_ < 2) return PREDICTION_MIN_SPAN_US;
+        uint64_t span = last_us() - samples_[first_].us;
+        return (std::max)(PREDICTION_MIN_SPAN_US, 2 * span / (count_ - 1));
+    }
+
+    // Over a span rather than from the last two moves: moves that arrive
+    // in one batch are microseconds apart
+    void update_velocity(uint64_t now_us) {
+        const Sample& last = samples_[(first_ + count_ - 1) % SAMPLES];
+        for (int i = 0; i < count_ - 1; i++) {
+            const Sample& s = samples_[(first_ + i) % SAMPLES];
+            if (now_us - s.us > PREDICTION_VELOCITY_US) continue;
+
+            uint64_t span = last.us - s.us;
+            if (span >= PREDICTION_MIN_SPAN_US) {
+                vx_ = (last.x - s.x) / span;
+                vy_ = (last.y - s.y) / span;
+            }
+            return;
+        }
+    }
+
+    uint64_t lead_us_ = 0;
+    Sample samples_[SAMPLES] = {};
+    int first_ = 0;
+    int count_ = 0;
+    double vx_ = 0;   // pixels per microsecond
+    double vy_ = 0;
+    double corr_x_ = 0;  // shown minus predicted when the last move arrived
+    double corr_y_ = 0;
+    uint64_t corr_us_ = 0;
+    int buttons_ = 0;
+    uint64_t hold_until_us_ = 0;
+};
+
+// Client side: moves the cursor through a PointerPredictor, and keeps it
+// moving between moves on a thread of its own. The caller's dispatch mutex
+// orders those updates with the frames it applies, as in KeyRepeater. Call
+// everything but start() and stop() with that mutex held.
+class CursorPredictor {
+public:
+    using MoveFn = std::function<void(int x, int y)>;  // inject an absolute move
+
+    CursorPredictor(std::mutex& dispatch_mutex, MoveFn move)
+        : dispatch_mutex_(dispatch_mutex), move_(std::move(move)) {}
+
+    ~CursorPredictor() {
+        stop();
+    }
+
+    CursorPredictor(const CursorPredictor&) = delete;
+    CursorPredictor& operator=(const CursorPredictor&) = delete;
+
+    // lead_us 0 leaves prediction off: every move is injected as it comes
+    void start(uint64_t lead_us) {
+        model_.set_lead(lead_us);
+        if (lead_us == 0) return;
+        running_ = true;
+        thread_ = std::thread(&CursorPredictor::thread_func, this);
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_ = false;
+        }
+        cv_.notify_all();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    // A MOUSE_MOVE put the cursor at (x, y)
+    void move(int x, int y) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (model_.lead_us() == 0) {
+                move_(x, y);
+                return;
+            }
+            uint64_t now = get_timestamp_us();
+            model_.on_move(now, x, y);
+            show(now);
+            moving_ = true;
+        }
+        cv_.notify_all();
+    }
+
+    // Before injecting a button: the cursor goes back to (x, y), the real
+    // position, so the click lands there
+    void button(bool pressed, int x, int y) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (model_.lead_us() == 0) return;
+        model_.on_button(get_timestamp_us(), pressed);
+        if (shown_x_ != x || shown_y_ != y) {
+            move_(x, y);
+            shown_x_ = x;
+            shown_y_ = y;
+        }
+    }
+
+    // The cursor was put somewhere else (screen switch, key state resync)
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        model_.reset();
+        model_.release_buttons();
+        moving_ = false;
+    }
+
+private:
+    void show(uint64_t now) {
+        double x, y;
+        model_.position(now, x, y);
+        int ix = static_cast<int>(std::lround(x));
+        int iy = static_cast<int>(std::lround(y));
+        if (ix != shown_x_ || iy != shown_y_) {
+            move_(ix, iy);
+            shown_x_ = ix;
+            shown_y_ = iy;
+        }
+    }
+
+    void thread_func() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (running_) {
+            if (!moving_) {
+                cv_.wait(lock, [this] { return !running_ || moving_; });
+                continue;
+            }
+            cv_.wait_for(lock, std::chrono::microseconds(PREDICTION_TICK_US), [this] { return !running_; });
+            if (!running_) break;
+
+            // Dispatch mutex first, as every caller holds it
+            lock.unlock();
+            {
+                std::lock_guard<std::mutex> dispatch(dispatch_mutex_);
+                std::lock_guard<std::mutex> relock(mutex_);
+                uint64_t now = get_timestamp_us();
+                if (running_ && moving_) {
+                    show(now);
+                    moving_ = !model_.settled(now);
+                }
+            }
+            lock.lock();
+        }
+    }
+
+    std::mutex& dispatch_mutex_;
+    MoveFn move_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::thread thread_;
+    bool running_ = false;
+    bool moving_ = false;   // the shown position may still change without a move
+    PointerPredictor model_;
+    int shown_x_ = -1;
+    int shown_y_ = -1;
+};
+
+} // namespace MouseShare
@@ -0,0 +1,261 @@
+#pragma once
+
+#include "common.hpp"
+#include "mapped_file.hpp"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+
+namespace MouseShare {
+
+constexpr uint64_t RECORDING_MAGIC = 0x313030434552534dULL;  // "MSREC001"
+constexpr uint32_t RECORDING_VERSION = 2;      // 1 stored scroll in notches rather than wheel units
+constexpr int32_t RECORDING_V1_SCROLL_UNITS = 120;  // WHEEL_DELTA
+constexpr int RECORDING_FLUSH_MS = 200;
+
+#pragma pack(push, 1)
+
+struct RecordingHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t count;          // filled in when the recording is closed
+    int32_t screen_width;    // of the machine that recorded it
+    int32_t screen_height;
+};
+
+// One InputCapture callback. Fixed size, so a mapped recording can be
+// indexed directly; payload holds the event struct for type.
+struct InputRecord {
+    uint32_t delta_us;       // since the previous record
+    EventType type;          // MOUSE_MOVE, MOUSE_BUTTON, MOUSE_SCROLL, KEY_PRESS or KEY_RELEASE
+    uint8_t size;            // bytes of payload used
+    uint16_t reserved;
+    uint8_t payload[16];
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(MouseMoveEvent) <= sizeof(InputRecord::payload), "payload too small");
+static_assert(sizeof(KeyEvent) <= sizeof(InputRecord::payload), "payload too small");
+
+// Records InputCapture callbacks to a file. The callbacks run on the hook
+// thread, so they only append to a buffer under a short lock; a writer
+// thread flushes it to disk.
+class SessionRecorder {
+public:
+    ~SessionRecorder() {
+        close();
+    }
+
+    bool open(const std::string& path, int screen_width, int screen_height) {
+        close();
+        out_.open(path, std::ios::binary | std::ios::trunc);
+        if (!out_) {
+            std::cerr << "Cannot write recording " << path << "\n";
+            return false;
+        }
+
+        RecordingHeader header = {};
+        header.magic = RECORDING_MAGIC;
+        header.version = RECORDING_VERSION;
+        header.record_size = sizeof(InputRecord);
+        header.screen_width = screen_width;
+        header.screen_height = screen_height;
+        out_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        header_ = header;
+        last_us_ = 0;
+        running_ = true;
+        recording_ = true;
+        writer_thread_ = std::thread(&SessionRecorder::writer_thread_func, this);
+        return true;
+    }
+
+    // Flush everything and write the final record count
+    void close() {
+        if (!recording_) return;
+        recording_ = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_ = false;
+        }
+        cv_.notify_all();
+        if (writer_thread_.joinable()) {
+            writer_thread_.join();
+        }
+
+        out_.seekp(0);
+        out_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+        out_.close();
+    }
+
+    bool is_recording() const { return recording_; }
+
+    void mouse_move(int x, int y, int dx, int dy) {
+        MouseMoveEvent event = {x, y, dx, dy};
+        add(EventType::MOUSE_MOVE, event);
+    }
+
+    void mouse_button(MouseButton button, bool pressed) {
+        MouseButtonEvent event = {button, pressed};
+        add(EventType::MOUSE_BUTTON, event);
+    }
+
+    void mouse_scroll(int dx, int dy) {
+        MouseScrollEvent event = {dx, dy};
+        add(EventType::MOUSE_SCROLL, event);
+    }
+
+    void key(uint32_t vkCode, uint32_t scanCode, uint32_t flags, bool pressed) {
+        KeyEvent event = {vkCode, scanCode, flags};
+        add(pressed ? EventType::KEY_PRESS : EventType::KEY_RELEASE, event);
+    }
+
+private:
+    template<typename T>
+    void add(EventType type, const T& event) {
+        if (!recording_) return;
+
+        InputRecord record = {};
+        record.type = type;
+        record.size = sizeof(T);
+        std::memcpy(record.payload, &event, sizeof(T));
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t now = get_timestamp_us();
+        uint64_t delta = last_us_ ? now - last_us_ : 0;
+        record.delta_us = static_cast<uint32_t>((std::min)(delta, uint64_t(UINT32_MAX)));
+        last_us_ = now;
+        pending_.push_back(record);
+    }
+
+    void writer_thread_func() {
+        std::vector<InputRecord> batch;
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            cv_.wait_for(lock, std::chrono::milliseconds(RECORDING_FLUSH_MS), [this] { return !running_; });
+            batch.swap(pending_);
+            bool stopping = !running_;
+
+            lock.unlock();
+            out_.write(reinterpret_cast<const char*>(batch.data()), batch.size() * sizeof(InputRecord));
+            header_.count += batch.size();
+            batch.clear();
+            lock.lock();
+
+            if (stopping) break;
+        }
+    }
+
+    std::ofstream out_;
+    RecordingHeader header_ = {};
+    uint64_t last_us_ = 0;
+    std::atomic<bool> recording_{false};
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<InputRecord> pending_;
+    bool running_ = false;
+    std::thread writer_thread_;
+};
+
+// Plays a recording back from a read-only mapping
+class SessionReplay {
+public:
+    using EventFn = std::function<void(const InputRecord& record)>;
+
+    bool open(const std::string& path) {
+        if (!file_.open_read(path) || file_.size() < sizeof(RecordingHeader)) {
+            std::cerr << "Cannot read recording " << path << "\n";
+            return false;
+        }
+
+        header_ = static_cast<const RecordingHeader*>(file_.data());
+        if (header_->magic != RECORDING_MAGIC || header_->version < 1 || header_->version > RECORDING_VERSION ||
+            header_->record_size != sizeof(InputRecord)) {
+            std::cerr << path << " is not a MouseShare recording\n";
+            file_.close();
+            return false;
+        }
+
+        // A recording that wasn't closed still has count 0; trust the file size
+        size_t available = (file_.size() - sizeof(RecordingHeader)) / sizeof(InputRecord);
+        count_ = header_->count ? (std::min)(size_t(header_->count), available) : available;
+        records_ = reinterpret_cast<const InputRecord*>(
+            static_cast<const char*>(file_.data()) + sizeof(RecordingHeader));
+        return true;
+    }
+
+    size_t size() const { return count_; }
+    const InputRecord& operator[](size_t i) const { return records_[i]; }
+    int screen_width() const { return header_->screen_width; }
+    int screen_height() const { return header_->screen_height; }
+
+    // Original duration of the recording
+    uint64_t duration_us() const {
+        uint64_t total = 0;
+        for (size_t i = 0; i < count_; i++) total += records_[i].delta_us;
+        return total;
+    }
+
+    // Feed every record to fn. speed 1 keeps the original timing, 2 plays
+    // twice as fast, 0 as fast as possible. Returns false if stopped early.
+    bool play(double speed, const EventFn& fn, const std::atomic<bool>* keep_going = nullptr) {
+        auto start = std::chrono::steady_clock::now();
+        double elapsed_us = 0;
+        for (size_t i = 0; i < count_; i++) {
+            if (keep_going && !*keep_going) return false;
+
+            if (speed > 0) {
+                // Scheduled against the start, so sleep overshoot doesn't accumulate
+                elapsed_us += records_[i].delta_us / speed;
+                std::this_thread::sleep_until(start + std::chrono::microseconds(static_cast<int64_t>(elapsed_us)));
+            }
+            fn(records_[i]);
+        }
+        return true;
+    }
+
+    // A MOUSE_SCROLL record in wheel units, whichever version recorded it
+    MouseScrollEvent scroll(const InputRecord& record) const {
+        MouseScrollEvent event = payload<MouseScrollEvent>(record);
+        if (header_->version == 1) {
+            event.dx *= RECORDING_V1_SCROLL_UNITS;
+            event.dy *= RECORDING_V1_SCROLL_UNITS;
+        }
+        return event;
+    }
+
+    // The frame a server would send for a record
+    std::string to_frame(const InputRecord& record) const {
+        switch (record.type) {
+            case EventType::MOUSE_MOVE: return serialize_packet(record.type, payload<MouseMoveEvent>(record));
+            case EventType::MOUSE_BUTTON: return serialize_packet(record.type, payload<MouseButtonEvent>(record));
+            case EventType::MOUSE_SCROLL: return serialize_packet(record.type, scroll(record));
+            default: return serialize_packet(record.type, payload<KeyEvent>(record));
+        }
+    }
+
+    template<typename T>
+    static T payload(const InputRecord& record) {
+        T event;
+        std::memcpy(&event, record.payload, sizeof(T));
+        return event;
+    }
+
+private:
+    MappedFile file_;
+    const RecordingHeader* header_ = nullptr;
+    const InputRecord* records_ = nullptr;
+    size_t count_ = 0;
+};
+
+} // namespace MouseShare
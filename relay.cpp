@@ -0,0 +1,416 @@
+#include "common.hpp"
+#include "network.hpp"
+#include "metrics_reporter.hpp"
+#include "fanout.hpp"
+#include "outbound_queue.hpp"
+#include "send_batching.hpp"
+#include "session.hpp"
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <list>
+#include <memory>
+#include <random>
+
+using namespace MouseShare;
+
+std::atomic<bool> g_running{true};
+
+BOOL WINAPI console_handler(DWORD signal) {
+    if (signal == CTRL_C_EVENT || signal == CTRL_CLOSE_EVENT) {
+        g_running = false;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+// Sits between one upstream server and many downstream clients, typically on
+// a machine that can reach both subnets. Input frames are forwarded as they
+// came, but the relay is a peer on both sides: it answers the server's
+// keepalives and holds its own session with the server, answers the clients'
+// session hellos itself, and tracks the keys and buttons held so a client
+// that joins or returns can be brought up to date. With a key, both sides
+// are encrypted and frames are opened and resealed for each downstream client.
+class Relay {
+public:
+    Relay(const std::string& upstream_host, uint16_t upstream_port, uint16_t listen_port,
+          int report_interval_s)
+        : upstream_host_(upstream_host), upstream_port_(upstream_port),
+          listen_port_(listen_port), report_interval_s_(report_interval_s) {
+        std::mt19937_64 rng(std::random_device{}());
+        do {
+            downstream_token_ = rng();
+        } while (downstream_token_ == 0);
+    }
+
+    void set_key(const PresharedKey& key) { key_ = key; }
+
+    bool run() {
+        listen_socket_.create();
+        listen_socket_.bind(listen_port_);
+        listen_socket_.listen();
+
+        std::cout << "Relay listening on port " << listen_port_ << "\n";
+
+        upstream_thread_ = std::thread(&Relay::upstream_thread_func, this);
+
+        auto last_report = std::chrono::steady_clock::now();
+
+        while (g_running) {
+            if (listen_socket_.wait_readable(100)) {
+                try {
+                    start_handshake(listen_socket_.accept());
+                } catch (const NetworkError& e) {
+                    std::cerr << "Accept failed: " << e.what() << "\n";
+                }
+            }
+            reap_handshakes(false);
+
+            for (const auto& name : downstream_.prune()) {
+                std::cout << "Downstream " << name << " disconnected\n";
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            if (report_interval_s_ > 0 &&
+                now - last_report >= std::chrono::seconds(report_interval_s_)) {
+                report_latency();
+                last_report = now;
+            }
+        }
+
+        // The upstream thread owns its socket, connect() may even replace
+        // it, so it sees g_running and closes the connection itself
+        if (upstream_thread_.joinable()) {
+            upstream_thread_.join();
+        }
+        reap_handshakes(true);
+        downstream_.clear();
+        listen_socket_.close();
+        return true;
+    }
+
+private:
+    // A downstream connection still in its handshake, which can take a few
+    // seconds (longer from a client that stalls on purpose)
+    struct Handshake {
+        std::thread thread;
+        std::atomic<bool> done{false};
+    };
+
+    // The handshake runs on a thread of its own, so other clients are
+    // accepted, and the group pruned and reported, meanwhile
+    void start_handshake(Socket client) {
+        auto handshake = std::make_unique<Handshake>();
+        Handshake* h = handshake.get();
+        h->thread = std::thread([this, h, client = std::move(client)]() mutable {
+            try {
+                accept_downstream(std::move(client));
+            } catch (const NetworkError& e) {
+                std::cerr << "Accept failed: " << e.what() << "\n";
+            }
+            h->done = true;
+        });
+        handshakes_.push_back(std::move(handshake));
+    }
+
+    // Join finished handshakes (all of them, when shutting down)
+    void reap_handshakes(bool all) {
+        for (auto it = handshakes_.begin(); it != handshakes_.end();) {
+            if (all || (*it)->done) {
+                (*it)->thread.join();
+                it = handshakes_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void accept_downstream(Socket client) {
+        if (key_.set) {
+            client.accept_encryption(key_);
+        }
+        client.accept_shared_memory();
+        client.limit_send_backlog();  // the backlog waits in our queue instead
+
+        sockaddr_in addr{};
+        int addr_len = sizeof(addr);
+        getpeername(client.handle(), reinterpret_cast<sockaddr*>(&addr), &addr_len);
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+
+        SessionHelloEvent hello;
+        bool has_hello = recv_session_hello(client, hello);
+        if (!client.wait_confirmed()) {
+            throw NetworkError("Encryption handshake failed: the client did not prove the key");
+        }
+
+        // Nothing is kept to replay here, but a client that comes back gets
+        // what is held down now, so it releases what it missed the release
+        // of. Late joiners need the server's screen info before any motion.
+        // Both go ahead of the next forwarded frame.
+        {
+            std::lock_guard<std::mutex> lock(state_mutex_);
+            std::vector<SharedFrame> first;
+            if (has_hello) {
+                SessionAcceptEvent reply = {};
+                reply.token = downstream_token_;
+                reply.next_seq = 1;
+                reply.mode = hello.token == downstream_token_ ? SessionResumeMode::SNAPSHOT : SessionResumeMode::NEW;
+                reply.keys = held_.snapshot();
+                first.push_back(make_shared_frame(serialize_packet(EventType::SESSION_ACCEPT, reply)));
+            }
+            if (screen_info_) {
+                first.push_back(screen_info_);
+            }
+            downstream_.add(std::move(client), ip, first);
+        }
+        std::cout << "Downstream " << ip << " connected (" << downstream_.size() << " total)\n";
+    }
+
+    void upstream_thread_func() {
+        ReconnectBackoff backoff;
+
+        while (g_running) {
+            std::cout << "Connecting to upstream " << upstream_host_ << ":" << upstream_port_ << "...\n";
+
+            try {
+                // Our ticket in the opening flight, as a client sends it: the
+                // server answers at once, and after a short outage replays
+                // what the downstream clients missed. No display of our own,
+                // so no refresh rate to resample motion to.
+                std::string hello = serialize_packet(EventType::SESSION_HELLO, session_.hello());
+                upstream_socket_.create();
+                upstream_socket_.connect(upstream_host_, upstream_port_, hello, key_);
+                backoff.reset();
+                std::cout << "Connected to upstream server\n";
+
+                forward_frames();
+
+                std::cout << "Upstream disconnected\n";
+            } catch (const NetworkError& e) {
+                std::cerr << "Upstream connection failed: " << e.what() << "\n";
+            }
+            upstream_socket_.close();
+
+            // Back soon enough to resume, or gone as soon as we stop
+            auto retry = std::chrono::steady_clock::now() + std::chrono::milliseconds(backoff.next_delay_ms());
+            while (g_running && std::chrono::steady_clock::now() < retry) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            }
+        }
+    }
+
+    void forward_frames() {
+        while (g_running) {
+            if (!upstream_socket_.wait_readable(100)) {
+                continue;
+            }
+
+            // Header and payload land in one buffer which every downstream
+            // queue then shares by reference
+            std::string frame;
+            if (!upstream_socket_.recv_frame(frame)) {
+                return;
+            }
+            uint64_t received_us = get_timestamp_us();
+
+            // The server measures its round trip to us; clients aren't asked
+            if (frame_type(frame) == EventType::KEEPALIVE) {
+                std::string reply;
+                if (answer_keepalive(frame.data() + sizeof(PacketHeader), frame.size() - sizeof(PacketHeader), reply)) {
+                    upstream_socket_.send(reply);
+                }
+                continue;
+            }
+
+            // Clipboard and transfer traffic stops here: nothing reads what
+            // the clients would answer (requests, credit), so a clipboard
+            // announcement would leave their pastes waiting and a transfer
+            // would wait on credit forever. Refuse transfers so the sender
+            // gives up on them.
+            if (lane_of(frame_type(frame)) == Lane::BULK) {
+                reject_transfer(frame);
+                continue;
+            }
+
+            // The session is ours with the server, not the clients'
+            if (frame_type(frame) == EventType::SESSION_ACCEPT) {
+                handle_session_accept(frame, received_us);
+                continue;
+            }
+            if (is_session_frame(frame_type(frame))) {
+                session_.frame_received();
+            }
+
+            forward(make_shared_frame(std::move(frame)), received_us);
+        }
+    }
+
+    void reject_transfer(const std::string& frame) {
+        if (frame_type(frame) != EventType::CHANNEL_OPEN ||
+            frame.size() < sizeof(PacketHeader) + sizeof(ChannelOpen)) {
+            return;
+        }
+        ChannelOpen open;
+        std::memcpy(&open, frame.data() + sizeof(PacketHeader), sizeof(open));
+        upstream_socket_.send(serialize_packet(EventType::CHANNEL_CLOSE,
+                                               ChannelClose{open.channel, ChannelStatus::REJECTED}));
+    }
+
+    // To every downstream client, keeping what a client joining later needs
+    void forward(const SharedFrame& frame, uint64_t received_us) {
+        std::lock_guard<std::mutex> lock(state_mutex_);
+        held_.apply_frame(*frame);
+        if (frame_type(*frame) == EventType::SCREEN_INFO) {
+            screen_info_ = frame;
+        }
+        downstream_.broadcast(frame, received_us);
+        frames_forwarded_++;
+    }
+
+    void handle_session_accept(const std::string& frame, uint64_t received_us) {
+        if (frame.size() < sizeof(PacketHeader) + sizeof(SessionAcceptEvent)) {
+            return;
+        }
+        SessionAcceptEvent reply;
+        std::memcpy(&reply, frame.data() + sizeof(PacketHeader), sizeof(reply));
+        session_.accepted(reply);
+
+        if (reply.mode == SessionResumeMode::REPLAY) {
+            std::cout << "Upstream session resumed\n";
+            return;
+        }
+
+        // Whatever was held down before the outage, the clients hold it too
+        // (or the server restarted and holds nothing): pass on what it holds now
+        forward(make_shared_frame(serialize_packet(EventType::KEY_STATE, reply.keys)), received_us);
+    }
+
+    void report_latency() {
+        auto stats = downstream_.collect_stats();
+        std::cout << "Forwarded " << frames_forwarded_ << " frames to "
+                  << stats.size() << " downstream client(s)\n";
+
+        for (const auto& entry : stats) {
+            const PeerStats& s = entry.second;
+            std::cout << "  " << entry.first
+                      << ": hop avg " << s.avg_latency_us << " us"
+                      << ", max " << s.max_latency_us << " us"
+                      << ", queued " << s.queued_frames
+                      << ", lag " << s.lag_us << " us"
+                      << ", merged " << s.merged_frames << "\n";
+        }
+    }
+
+    std::string upstream_host_;
+    uint16_t upstream_port_;
+    uint16_t listen_port_;
+    int report_interval_s_;
+    PresharedKey key_;
+
+    Socket listen_socket_;
+    Socket upstream_socket_;  // upstream thread only
+    std::thread upstream_thread_;
+    SessionResume session_;  // Our ticket with the server (upstream thread only)
+
+    FanoutGroup downstream_;
+    std::list<std::unique_ptr<Handshake>> handshakes_;  // main thread only
+
+    std::mutex state_mutex_;  // Forwarding, and a client joining, one at a time
+    SharedFrame screen_info_;
+    KeyStateTracker held_;    // Keys and buttons held, as of the frames forwarded
+    uint64_t downstream_token_ = 0;  // The session a returning client asks for
+
+    std::atomic<uint64_t> frames_forwarded_{0};
+};
+
+void print_usage(const char* program) {
+    std::cout << "Usage: " << program << " <server-host> [options]\n"
+              << "Options:\n"
+              << "  -p, --port PORT      Upstream server port (default: 24800)\n"
+              << "  -l, --listen PORT    Port to accept clients on (default: 24800)\n"
+              << "  -r, --report SECS    Latency report interval, 0 to disable (default: 10)\n"
+              << "  -s, --stats FILE     Write metrics to FILE every second\n"
+              << "  -k, --key PASSPHRASE Encrypt both sides; server and clients need the same passphrase\n"
+              << "  -h, --help           Show this help\n";
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    std::string server_host;
+    uint16_t port = DEFAULT_PORT;
+    std::string stats_path;
+    uint16_t listen_port = DEFAULT_PORT;
+    int report_interval = 10;
+    std::string passphrase;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "-h" || arg == "--help") {
+            print_usage(argv[0]);
+            return 0;
+        } else if ((arg == "-s" || arg == "--stats") && i + 1 < argc) {
+            stats_path = argv[++i];
+        } else if ((arg == "-p" || arg == "--port") && i + 1 < argc) {
+            port = std::stoi(argv[++i]);
+        } else if ((arg == "-l" || arg == "--listen") && i + 1 < argc) {
+            listen_port = std::stoi(argv[++i]);
+        } else if ((arg == "-r" || arg == "--report") && i + 1 < argc) {
+            report_interval = std::stoi(argv[++i]);
+        } else if ((arg == "-k" || arg == "--key") && i + 1 < argc) {
+            passphrase = argv[++i];
+        } else if (server_host.empty() && arg[0] != '-') {
+            server_host = arg;
+        }
+    }
+
+    if (server_host.empty()) {
+        std::cerr << "Server host is required\n";
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // Initialize Winsock
+    if (!init_winsock()) {
+        std::cerr << "Failed to initialize Winsock\n";
+        return 1;
+    }
+
+    // Set console handler
+    SetConsoleCtrlHandler(console_handler, TRUE);
+    
+    MetricsReporter metrics_reporter;
+    if (!stats_path.empty()) {
+        metrics_reporter.start(stats_path);
+    }
+
+    Relay relay(server_host, port, listen_port, report_interval);
+    bool key_ok = true;
+    if (!passphrase.empty()) {
+        try {
+            relay.set_key(derive_preshared_key(passphrase));
+        } catch (const CryptoError& e) {
+            std::cerr << "Cannot use the key: " << e.what() << "\n";
+            key_ok = false;
+        }
+    }
+    bool result = false;
+    if (key_ok) {
+        try {
+            result = relay.run();
+        } catch (const NetworkError& e) {
+            std::cerr << "Relay failed: " << e.what() << "\n";
+        }
+    }
+
+    metrics_reporter.stop();
+    cleanup_winsock();
+    return result ? 0 : 1;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "common.hpp"
+#include <string>
+#include <atomic>
+#include <algorithm>
+
+namespace MouseShare {
+
+// How long the send queue may gather input into one send, from the link's
+// round trip time and the input rate. On a LAN every event goes out at
+// once. Once the round trip passes LAN_RTT_US, because the link is long or
+// because a queue somewhere is filling, a batch waits up to an eighth of
+// it (at most MAX_GATHER_US) for the events that will arrive meanwhile.
+// At an input rate too low to expect another event in that time, waiting
+// would only add delay, so nothing waits.
+constexpr uint64_t KEEPALIVE_INTERVAL_US = 1000000;  // one ping a second
+constexpr uint64_t LAN_RTT_US = 1000;
+constexpr uint64_t MAX_GATHER_US = 2000;
+constexpr uint64_t INPUT_IDLE_US = 100000;  // a gap this long starts a new burst
+
+// A KEEPALIVE carrying a ping; the peer sends the same payload back as a reply
+inline std::string make_keepalive(uint64_t sent_us, bool reply) {
+    KeepaliveEvent event;
+    event.sent_us = sent_us;
+    event.reply = reply ? 1 : 0;
+    return serialize_packet(EventType::KEEPALIVE, event);
+}
+
+// Peer side: the answer to a ping, or false if this KEEPALIVE wants none
+// (an empty one from an older version, or itself a reply)
+inline bool answer_keepalive(const char* payload, size_t size, std::string& reply) {
+    if (size < sizeof(KeepaliveEvent)) return false;
+    KeepaliveEvent event;
+    std::memcpy(&event, payload, sizeof(event));
+    if (event.reply) return false;
+    reply = make_keepalive(event.sent_us, true);
+    return true;
+}
+
+// Sending side: pings the peer, keeps the smoothed round trip time (the
+// way TCP does, 1/8 per sample) and the input rate, and picks the window.
+// Any thread may call any of it.
+class SendBatching {
+public:
+    // A new connection: nothing is known about it yet
+    void reset() {
+        srtt_us_ = 0;
+        next_ping_us_ = 0;
+        g_metrics.set(Gauge::SEND_RTT_US, 0);
+    }
+
+    // An input event was queued
+    void on_input(uint64_t now_us) {
+        uint64_t last = last_input_us_.exchange(now_us, std::memory_order_relaxed);
+        uint64_t gap = now_us - last;
+        if (last == 0 || gap >= INPUT_IDLE_US) {
+            interval_us_ = INPUT_IDLE_US;
+            return;
+        }
+        uint64_t interval = interval_us_.load(std::memory_order_relaxed);
+        interval_us_.store(interval - interval / 8 + gap / 8, std::memory_order_relaxed);
+    }
+
+    // A ping frame to send if one is due
+    bool ping_due(uint64_t now_us, std::string& frame) {
+        if (now_us < next_ping_us_) return false;
+        next_ping_us_ = now_us + KEEPALIVE_INTERVAL_US;
+        frame = make_keepalive(now_us, false);
+        return true;
+    }
+
+    // A KEEPALIVE from the peer; false if it wasn't the reply to our ping
+    bool on_keepalive(const char* payload, size_t size, uint64_t now_us) {
+        if (size < sizeof(KeepaliveEvent)) return false;
+        KeepaliveEvent event;
+        std::memcpy(&event, payload, sizeof(event));
+        if (!event.reply || event.sent_us > now_us) return false;
+
+        uint64_t rtt = now_us - event.sent_us;
+        uint64_t srtt = srtt_us_.load(std::memory_order_relaxed);
+        srtt = srtt == 0 ? rtt : srtt - srtt / 8 + rtt / 8;
+        srtt_us_.store(srtt, std::memory_order_relaxed);
+        g_metrics.set(Gauge::SEND_RTT_US, srtt);
+        return true;
+    }
+
+    uint64_t window_us() const {
+        uint64_t srtt = srtt_us_.load(std::memory_order_relaxed);
+        if (srtt < LAN_RTT_US) return 0;  // including not measured yet
+
+        uint64_t window = (std::min)(srtt / 8, MAX_GATHER_US);
+        if (event_interval_us() >= window) return 0;
+        return window;
+    }
+
+    uint64_t srtt_us() const { return srtt_us_.load(std::memory_order_relaxed); }
+
+    // Smoothed time between input events; INPUT_IDLE_US when idle
+    uint64_t event_interval_us() const {
+        uint64_t last = last_input_us_.load(std::memory_order_relaxed);
+        if (last == 0 || get_timestamp_us() - last >= INPUT_IDLE_US) return INPUT_IDLE_US;
+        return interval_us_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> srtt_us_{0};           // 0 until the first reply
+    std::atomic<uint64_t> last_input_us_{0};
+    std::atomic<uint64_t> interval_us_{INPUT_IDLE_US};
+    std::atomic<uint64_t> next_ping_us_{0};
+};
+
+} // namespace MouseShare
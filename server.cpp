@@ -1,18 +1,40 @@
 #include "common.hpp"
 #include "network.hpp"
+#include "metrics_reporter.hpp"
 #include "input_capture.hpp"
+#include "session.hpp"
+#include "outbound_queue.hpp"
+#include "send_batching.hpp"
+#include "key_repeat.hpp"
+#include "recording.hpp"
+#include "clipboard.hpp"
+#include "file_transfer.hpp"
 #include <iostream>
 #include <chrono>
 #include <atomic>
 #include <thread>
+#include <mutex>
+#include <vector>
 
 using namespace MouseShare;
 
 std::atomic<bool> g_running{true};
+std::string g_trace_path;
 
 BOOL WINAPI console_handler(DWORD signal) {
     if (signal == CTRL_C_EVENT || signal == CTRL_CLOSE_EVENT) {
         g_running = false;
+        
+        // The main thread may be blocked; write the trace from here. If main
+        // gets there first, this waits for it and writes nothing.
+        if (!g_trace_path.empty() && g_tracer.write_chrome_trace_once(g_trace_path)) {
+            std::cout << "Trace written to " << g_trace_path << "\n";
+        }
+        return TRUE;
+    }
+    if (signal == CTRL_BREAK_EVENT) {
+        // Ctrl+Break: save the flight recorder's last seconds
+        g_flight.trigger(true);
         return TRUE;
     }
     return FALSE;
@@ -20,8 +42,37 @@ BOOL WINAPI console_handler(DWORD signal) {
 
 class Server {
 public:
-    Server(uint16_t port, ScreenEdge switch_edge)
-        : port_(port), switch_edge_(switch_edge), active_on_client_(false) {}
+    Server(uint16_t port, ScreenEdge switch_edge, int report_interval_s)
+        : port_(port), switch_edge_(switch_edge), report_interval_s_(report_interval_s),
+          active_on_client_(false),
+          outbound_([this](const std::vector<std::string>& frames) { return send_frames(frames); }),
+          channels_([this](std::string frame) { return send_bulk(std::move(frame)); }),
+          files_(channels_),
+          clipboard_([this](std::string frame) { return send_bulk(std::move(frame)); }, channels_) {}
+    
+    void set_clipboard(bool enabled) { clipboard_enabled_ = enabled; }
+    
+    // Encrypt every connection; clients must hold the same key (--key)
+    void set_key(const PresharedKey& key) { key_ = key; }
+    
+    // Where files from the client go; empty refuses them
+    void set_receive_directory(const std::string& directory) { files_.set_directory(directory); }
+    
+    // Send these files to the client once it connects (--send)
+    void set_send_files(const std::vector<std::string>& paths) { send_paths_ = paths; }
+    
+    // Record every input callback to path (--record)
+    void set_record_path(const std::string& path) { record_path_ = path; }
+    
+    // Drive the handlers from a recording instead of the hooks (--replay).
+    // speed 1 is the original timing, 0 as fast as possible.
+    void set_replay(const std::string& path, double speed) {
+        replay_path_ = path;
+        replay_speed_ = speed;
+    }
+    
+    // Motion frames a second per client display refresh; 0 sends every move
+    void set_motion_multiple(uint32_t multiple) { motion_multiple_ = multiple; }
     
     bool run() {
         // Initialize input capture
@@ -33,11 +84,29 @@ public:
         std::cout << "Screen size: " << input_.screen_width() << "x" 
                   << input_.screen_height() << "\n";
         
+        if (!record_path_.empty()) {
+            if (!recorder_.open(record_path_, input_.screen_width(), input_.screen_height())) return false;
+            std::cout << "Recording input to " << record_path_ << "\n";
+        }
+        if (!replay_path_.empty() && !replay_.open(replay_path_)) {
+            return false;
+        }
+        
         // Set up input callbacks
         setup_callbacks();
         
-        // Start capturing events
-        input_.start();
+        // Start capturing events; a replay stands in for the hooks
+        if (replay_path_.empty()) {
+            input_.start();
+        }
+        outbound_.start();
+        channels_.start();
+        for (const auto& path : send_paths_) {
+            send_file(channels_, path);
+        }
+        if (clipboard_enabled_) {
+            clipboard_.start();
+        }
         
         // Create server socket
         socket_.create();
@@ -53,20 +122,138 @@ public:
             std::cout << "Waiting for client connection...\n";
             
             try {
-                client_socket_ = socket_.accept();
-                connected_ = true;
+                Socket client = socket_.accept();
+                if (key_.set) {
+                    client.accept_encryption(key_);
+                }
+                client.accept_shared_memory();
+                client.limit_send_backlog();  // the backlog waits in our queue instead
+                if (g_tracer.enabled()) {
+                    client.enable_kernel_timestamps();
+                }
+                
+                // Read outside the lock: the input hooks must never wait on it.
+                // It came in the client's opening flight, so this doesn't wait.
+                SessionHelloEvent hello;
+                bool has_hello = recv_session_hello(client, hello);
+                
+                // An encrypted opening flight may be a replay until the client
+                // proves the key. Answer the hello at once all the same, since
+                // the client's first input waits on it, but only take the
+                // session over (and replay what it holds) once confirmed.
+                SessionHelloEvent resume_from = hello;
+                bool answered = has_hello && client.is_encrypted();
+                if (answered) {
+                    SessionAcceptEvent offer;
+                    {
+                        std::lock_guard<std::mutex> lock(session_mutex_);
+                        offer = session_.offer(hello);
+                    }
+                    client.send(serialize_packet(EventType::SESSION_ACCEPT, offer));
+                    resume_from = SessionLog::after_offer(hello, offer);
+                }
+                if (!client.wait_confirmed()) {
+                    std::cerr << "Encryption handshake failed: the client did not prove the key\n";
+                    continue;
+                }
+                
+                // No point sending motion faster than the client can show it
+                uint32_t motion_rate = has_hello ? hello.refresh_hz * motion_multiple_ : 0;
+                outbound_.set_motion_rate(motion_rate);
+                if (motion_rate) {
+                    std::cout << "Client display " << hello.refresh_hz << " Hz: motion sent at "
+                              << motion_rate << " frames/s\n";
+                }
+                
+                {
+                    // Replay what a returning client missed before any new
+                    // frames, with our screen info in the same send. The
+                    // writer records meanwhile but sends after the flight.
+                    std::lock_guard<std::mutex> send_lock(send_mutex_);
+                    client_socket_ = std::move(client);
+                    std::vector<std::string> flight;
+                    SessionResumeMode mode;
+                    {
+                        std::lock_guard<std::mutex> lock(session_mutex_);
+                        mode = session_.resume_flight(resume_from, has_hello,
+                                                      {serialize_packet(EventType::SCREEN_INFO, screen_info())}, flight,
+                                                      answered);
+                        connection_++;
+                        connected_ = true;
+                        resumable_until_us_ = UINT64_MAX;
+                    }
+                    if (!flight.empty()) {
+                        client_socket_.send_frames(flight);
+                    }
+                    switch (mode) {
+                        case SessionResumeMode::NEW:
+                            std::cout << "Client connected!\n";
+                            break;
+                        case SessionResumeMode::REPLAY:
+                            std::cout << "Client reconnected, session resumed\n";
+                            break;
+                        case SessionResumeMode::SNAPSHOT:
+                            std::cout << "Client reconnected, key state resynced\n";
+                            break;
+                    }
+                }
                 
-                std::cout << "Client connected!\n";
+                clipboard_.announce();
+                channels_.connected();
                 
-                // Send our screen info
-                send_screen_info();
+                // The first client to connect receives the replay
+                if (!replay_path_.empty() && !replay_thread_.joinable()) {
+                    replay_thread_ = std::thread(&Server::replay_thread_func, this);
+                }
                 
                 // Main loop while client is connected
+                auto last_report = std::chrono::steady_clock::now();
+                batching_.reset();
                 while (g_running && connected_) {
-                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                    std::string ping;
+                    if (batching_.ping_due(get_timestamp_us(), ping)) {
+                        outbound_.push(std::move(ping));
+                    }
+                    outbound_.set_gather_window(batching_.window_us());
+                    
+                    // The client only sends clipboard and transfer traffic,
+                    // and answers our pings
+                    if (client_socket_.wait_readable(10)) {
+                        std::string frame;
+                        if (!client_socket_.recv_frame(frame)) {
+                            connected_ = false;
+                            break;
+                        }
+                        EventType type = frame_type(frame);
+                        const char* payload = frame.data() + sizeof(PacketHeader);
+                        size_t size = frame.size() - sizeof(PacketHeader);
+                        if (type == EventType::KEEPALIVE) {
+                            batching_.on_keepalive(payload, size, get_timestamp_us());
+                        } else if (!clipboard_.handle_frame(type, payload, size)) {
+                            channels_.handle_frame(type, payload, size);
+                        }
+                    }
+                    
+                    auto now = std::chrono::steady_clock::now();
+                    if (report_interval_s_ > 0 &&
+                        now - last_report >= std::chrono::seconds(report_interval_s_)) {
+                        report_latency();
+                        last_report = now;
+                    }
                 }
                 
-                client_socket_.close();
+                // A send stalled on the gone peer fails now instead of holding send_mutex_
+                client_socket_.shutdown();
+                {
+                    std::lock_guard<std::mutex> send_lock(send_mutex_);
+                    std::lock_guard<std::mutex> lock(session_mutex_);
+                    connected_ = false;
+                    client_socket_.close();
+                    session_.detach();
+                    resumable_until_us_ = get_timestamp_us() + SESSION_RESUME_WINDOW_US;
+                }
+                clipboard_.disconnected();
+                channels_.disconnected();
                 std::cout << "Client disconnected\n";
                 
             } catch (const NetworkError& e) {
@@ -74,97 +261,193 @@ public:
             }
         }
         
+        if (replay_thread_.joinable()) {
+            replay_thread_.join();
+        }
         input_.stop();
+        recorder_.close();
+        clipboard_.stop();
+        channels_.stop();
+        outbound_.stop();
         return true;
     }
     
 private:
+    // Clipboard and transfer frames queue behind input, for a connected client only
+    bool send_bulk(std::string frame) {
+        if (!connected_) return false;
+        outbound_.push(std::move(frame));
+        return true;
+    }
+    
     void setup_callbacks() {
-        // Set all callbacks
+        // Every callback is recorded first (with --record), then handled
         input_.set_callbacks(
-            // Move callback
             [this](int x, int y, int dx, int dy) {
-                if (!connected_) return;
-                
-                // Check for edge switching
-                bool at_edge = false;
-                int edge_pos = 0;
-                
-                switch (switch_edge_) {
-                    case ScreenEdge::LEFT:
-                        at_edge = (x <= 0);
-                        edge_pos = y;
-                        break;
-                    case ScreenEdge::RIGHT:
-                        at_edge = (x >= input_.screen_width() - 1);
-                        edge_pos = y;
-                        break;
-                    case ScreenEdge::TOP:
-                        at_edge = (y <= 0);
-                        edge_pos = x;
-                        break;
-                    case ScreenEdge::BOTTOM:
-                        at_edge = (y >= input_.screen_height() - 1);
-                        edge_pos = x;
-                        break;
-                    default:
-                        break;
-                }
-                
-                if (at_edge && !active_on_client_) {
-                    // Switch to client
-                    switch_to_client(edge_pos);
-                } else if (active_on_client_) {
-                    // Send relative movement to client
-                    MouseMoveEvent event;
-                    event.x = x;
-                    event.y = y;
-                    event.dx = dx;
-                    event.dy = dy;
-                    send_event(EventType::MOUSE_MOVE, event);
-                }
+                recorder_.mouse_move(x, y, dx, dy);
+                on_mouse_move(x, y, dx, dy);
             },
-            // Button callback
             [this](MouseButton button, bool pressed) {
-                if (!connected_ || !active_on_client_) return;
-                
-                MouseButtonEvent event;
-                event.button = button;
-                event.pressed = pressed;
-                send_event(EventType::MOUSE_BUTTON, event);
+                recorder_.mouse_button(button, pressed);
+                on_mouse_button(button, pressed);
             },
-            // Scroll callback
             [this](int dx, int dy) {
-                if (!connected_ || !active_on_client_) return;
-                
-                MouseScrollEvent event;
-                event.dx = dx;
-                event.dy = dy;
-                send_event(EventType::MOUSE_SCROLL, event);
+                recorder_.mouse_scroll(dx, dy);
+                on_mouse_scroll(dx, dy);
             },
-            // Key callback
             [this](uint32_t vkCode, uint32_t scanCode, uint32_t flags, bool pressed) {
-                // Check for Scroll Lock to toggle
-                if (vkCode == VK_SCROLL && pressed) {
-                    if (active_on_client_) {
-                        switch_to_server();
-                    } else if (connected_) {
-                        switch_to_client(input_.screen_height() / 2);
-                    }
-                    return;
-                }
-                
-                if (!connected_ || !active_on_client_) return;
-                
-                KeyEvent event;
-                event.vkCode = vkCode;
-                event.scanCode = scanCode;
-                event.flags = flags;
-                send_event(pressed ? EventType::KEY_PRESS : EventType::KEY_RELEASE, event);
+                recorder_.key(vkCode, scanCode, flags, pressed);
+                on_key(vkCode, scanCode, flags, pressed);
             }
         );
     }
     
+    void on_mouse_move(int x, int y, int dx, int dy) {
+        if (!has_client()) return;
+        
+        // Check for edge switching
+        bool at_edge = false;
+        int edge_pos = 0;
+        
+        switch (switch_edge_) {
+            case ScreenEdge::LEFT:
+                at_edge = (x <= 0);
+                edge_pos = y;
+                break;
+            case ScreenEdge::RIGHT:
+                at_edge = (x >= input_.screen_width() - 1);
+                edge_pos = y;
+                break;
+            case ScreenEdge::TOP:
+                at_edge = (y <= 0);
+                edge_pos = x;
+                break;
+            case ScreenEdge::BOTTOM:
+                at_edge = (y >= input_.screen_height() - 1);
+                edge_pos = x;
+                break;
+            default:
+                break;
+        }
+        
+        if (at_edge && !active_on_client_) {
+            // Switch to client
+            switch_to_client(edge_pos);
+        } else if (active_on_client_) {
+            // Send relative movement to client
+            MouseMoveEvent event;
+            event.x = x;
+            event.y = y;
+            event.dx = dx;
+            event.dy = dy;
+            send_event(EventType::MOUSE_MOVE, event);
+        }
+    }
+    
+    void on_mouse_button(MouseButton button, bool pressed) {
+        if (!has_client() || !active_on_client_) return;
+        
+        MouseButtonEvent event;
+        event.button = button;
+        event.pressed = pressed;
+        send_event(EventType::MOUSE_BUTTON, event);
+    }
+    
+    void on_mouse_scroll(int dx, int dy) {
+        if (!has_client() || !active_on_client_) return;
+        
+        MouseScrollEvent event;
+        event.dx = dx;
+        event.dy = dy;
+        send_event(EventType::MOUSE_SCROLL, event);
+    }
+    
+    void on_key(uint32_t vkCode, uint32_t scanCode, uint32_t flags, bool pressed) {
+        // Check for Scroll Lock to toggle
+        if (vkCode == VK_SCROLL && pressed) {
+            if (active_on_client_) {
+                switch_to_server();
+            } else if (has_client()) {
+                switch_to_client(input_.screen_height() / 2);
+            }
+            return;
+        }
+        
+        // Seen even while input is local, so it knows which keys are down
+        KeyDown down = KeyDown::PRESS;
+        uint32_t interval_us = 0;
+        bool was_repeating = false;
+        if (pressed) {
+            down = repeats_.on_press(vkCode, get_timestamp_us(), interval_us);
+        } else {
+            was_repeating = repeats_.on_release(vkCode);
+        }
+        
+        // A repeating client key stops only when told
+        if (!has_client() || !(active_on_client_ || was_repeating)) return;
+        if (down == KeyDown::SUPPRESS) return;
+        
+        KeyEvent event;
+        event.vkCode = vkCode;
+        event.scanCode = scanCode;
+        event.flags = flags;
+        if (down == KeyDown::REPEAT) {
+            KeyRepeatEvent repeat;
+            repeat.key = event;
+            repeat.interval_us = interval_us;
+            send_event(EventType::KEY_REPEAT, repeat);
+            return;
+        }
+        send_event(pressed ? EventType::KEY_PRESS : EventType::KEY_RELEASE, event);
+    }
+    
+    // Feed a recording through the same handlers as live input
+    void replay_thread_func() {
+        std::cout << "Replaying " << replay_.size() << " events ("
+                  << replay_.duration_us() / 1000 << " ms recorded) at "
+                  << (replay_speed_ > 0 ? std::to_string(replay_speed_) + "x" : std::string("full speed")) << "\n";
+        
+        auto start = std::chrono::steady_clock::now();
+        bool finished = replay_.play(replay_speed_, [this](const InputRecord& record) {
+            trace_begin(TraceStage::HOOK);
+            switch (record.type) {
+                case EventType::MOUSE_MOVE: {
+                    auto e = SessionReplay::payload<MouseMoveEvent>(record);
+                    on_mouse_move(e.x, e.y, e.dx, e.dy);
+                    break;
+                }
+                case EventType::MOUSE_BUTTON: {
+                    auto e = SessionReplay::payload<MouseButtonEvent>(record);
+                    on_mouse_button(e.button, e.pressed);
+                    break;
+                }
+                case EventType::MOUSE_SCROLL: {
+                    MouseScrollEvent e = replay_.scroll(record);
+                    on_mouse_scroll(e.dx, e.dy);
+                    break;
+                }
+                case EventType::KEY_PRESS:
+                case EventType::KEY_RELEASE: {
+                    auto e = SessionReplay::payload<KeyEvent>(record);
+                    on_key(e.vkCode, e.scanCode, e.flags, record.type == EventType::KEY_PRESS);
+                    break;
+                }
+                default:
+                    break;
+            }
+        }, &g_running);
+        
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        if (finished) {
+            std::cout << "Replay finished in " << elapsed << " ms\n";
+        }
+        
+        // Let the outbound queue drain, then stop the server
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        g_running = false;
+    }
+    
     void switch_to_client(int edge_position) {
         std::cout << "Switching to client\n";
         active_on_client_ = true;
@@ -178,7 +461,8 @@ private:
         event.position = edge_position;
         send_event(EventType::SWITCH_SCREEN, event);
         
-        // Move cursor away from edge
+        // Move cursor away from edge (a replay never moved the real one)
+        if (!replay_path_.empty()) return;
         int x, y;
         input_.get_cursor_position(x, y);
         
@@ -208,25 +492,81 @@ private:
         input_.capture_input(false);
     }
     
+    // Connected, or briefly disconnected with a session the client can
+    // resume. The hook thread calls this: it never takes a lock.
+    bool has_client() {
+        return connected_ || get_timestamp_us() < resumable_until_us_;
+    }
+    
+    // Events are queued by priority lane; the hook thread never blocks on the socket
     template<typename T>
     void send_event(EventType type, const T& payload) {
-        if (!connected_) return;
+        if (!has_client()) return;
+        batching_.on_input(get_timestamp_us());
+        outbound_.push(serialize_packet(type, payload));
+    }
+    
+    // Outbound queue writer: frames leave here in their final order
+    bool send_frames(const std::vector<std::string>& frames) {
+        uint64_t connection;
+        {
+            std::lock_guard<std::mutex> lock(session_mutex_);
+            if (!connected_ && !session_.is_resumable()) return true;
+            
+            // Recorded even while disconnected, for replay on resume
+            for (const auto& frame : frames) {
+                if (is_session_frame(frame_type(frame))) {
+                    session_.record(frame);
+                }
+            }
+            if (!connected_) return true;
+            connection = connection_;
+        }
         
-        auto data = serialize_packet(type, payload);
-        int sent = client_socket_.send(data);
+        // Not under session_mutex_: a stalled peer may block here
+        std::lock_guard<std::mutex> lock(send_mutex_);
+        if (!connected_ || connection != connection_) return true;  // the resume flight replayed them
         
+        int sent = client_socket_.send_frames(frames);
         if (sent <= 0) {
             connected_ = false;
         }
+        return true;
     }
     
-    void send_screen_info() {
+    void report_latency() {
+        std::cout << "Queue latency (p50 / p99 / max):\n";
+        for (int i = 0; i < LANE_COUNT; i++) {
+            Lane lane = static_cast<Lane>(i);
+            HistogramSnapshot h = outbound_.take_latency(lane);
+            std::cout << "  " << lane_name(lane) << ": " << h.total << " frames, "
+                      << h.percentile(50) << " / " << h.percentile(99) << " / " << h.max << " us\n";
+        }
+        QueueDepth depth = outbound_.depth();
+        std::cout << "  queued: " << depth.frames << " frames, " << depth.bytes << " bytes, oldest "
+                  << depth.age_us << " us";
+        int unsent = client_socket_.unsent_bytes();
+        if (unsent >= 0) {
+            std::cout << "; " << unsent << " bytes unsent in the kernel";
+        }
+        std::cout << "\n";
+        
+        HistogramSnapshot batches = outbound_.take_batch_sizes();
+        uint64_t interval = batching_.event_interval_us();
+        std::cout << "  rtt " << batching_.srtt_us() << " us, "
+                  << (interval < INPUT_IDLE_US ? 1000000 / (std::max)(interval, uint64_t(1)) : 0) << " events/s, "
+                  << "gather window " << batching_.window_us() << " us, "
+                  << "frames per send p50 " << batches.percentile(50) << " / p99 " << batches.percentile(99)
+                  << " / max " << batches.max << "\n";
+    }
+    
+    ScreenInfo screen_info() {
         ScreenInfo info;
         info.width = input_.screen_width();
         info.height = input_.screen_height();
         info.x = 0;
         info.y = 0;
-        send_event(EventType::SCREEN_INFO, info);
+        return info;
     }
     
     static ScreenEdge opposite_edge(ScreenEdge edge) {
@@ -251,13 +591,40 @@ private:
     
     uint16_t port_;
     ScreenEdge switch_edge_;
+    int report_interval_s_;
     
     InputCapture input_;
+    KeyRepeatDetector repeats_;  // Hook thread only
+    PresharedKey key_;
+    std::string record_path_;
+    SessionRecorder recorder_;
+    std::string replay_path_;
+    double replay_speed_ = 1.0;
+    SessionReplay replay_;
+    uint32_t motion_multiple_ = MOTION_REFRESH_MULTIPLE;
+    std::thread replay_thread_;
+    
     Socket socket_;
     Socket client_socket_;
     
+    SessionLog session_;
+    std::mutex session_mutex_;  // Orders session_ records; never held across socket I/O
+    std::mutex send_mutex_;     // Writes to client_socket_; taken before session_mutex_ when both are
+    uint64_t connection_ = 0;   // Which connection client_socket_ is; changes under both mutexes
+    std::atomic<uint64_t> resumable_until_us_{0};  // For has_client(): UINT64_MAX while connected
+    
     std::atomic<bool> connected_{false};
     std::atomic<bool> active_on_client_{false};
+    
+    SendBatching batching_;
+    OutboundQueue outbound_;  // Its writer thread uses the members above
+    
+    // Last: these send through outbound_
+    ChannelMux channels_;
+    FileReceiver files_;
+    std::vector<std::string> send_paths_;
+    bool clipboard_enabled_ = true;
+    ClipboardSync clipboard_;
 };
 
 void print_usage(const char* program) {
@@ -265,12 +632,36 @@ void print_usage(const char* program) {
               << "Options:\n"
               << "  -p, --port PORT      Port to listen on (default: 24800)\n"
               << "  -e, --edge EDGE      Edge to switch screens (left/right/top/bottom)\n"
+              << "  -r, --report SECS    Queue latency report interval, 0 to disable (default: 0)\n"
+              << "  -s, --stats FILE     Write metrics to FILE every second\n"
+              << "  -t, --trace FILE     Trace every event; Chrome trace JSON is written on exit\n"
+              << "  -f, --flight FILE    Flight recorder ring file (default: %TEMP%\\mouse-share-server.flight)\n"
+              << "      --no-flight      Disable the flight recorder\n"
+              << "  -k, --key PASSPHRASE Encrypt the connection; the client needs the same passphrase\n"
+              << "      --no-clipboard   Don't share the clipboard\n"
+              << "      --receive-dir DIR  Accept files sent by the client into DIR\n"
+              << "      --send FILE      Send FILE to the client once it connects (repeatable)\n"
+              << "      --record FILE    Record all captured input to FILE\n"
+              << "      --replay FILE    Send a recording to the first client instead of live input, then exit\n"
+              << "      --speed X        Replay speed: 1 original timing, 2 twice as fast, 0 no delays (default: 1)\n"
+              << "      --motion-rate N  Motion frames per client display refresh, 0 to send every move (default: 2)\n"
               << "  -h, --help           Show this help\n";
 }
 
 int main(int argc, char* argv[]) {
     uint16_t port = DEFAULT_PORT;
+    std::string stats_path;
+    std::string flight_path = FlightRecorder::default_path("server");
     ScreenEdge edge = ScreenEdge::RIGHT;  // Default: client is to the right
+    int report_interval = 0;
+    std::string record_path;
+    std::string replay_path;
+    double replay_speed = 1.0;
+    uint32_t motion_multiple = MOTION_REFRESH_MULTIPLE;
+    bool clipboard = true;
+    std::string receive_dir;
+    std::vector<std::string> send_paths;
+    std::string passphrase;
     
     for (int i = 1; i < argc; i++) {
         std::string arg = argv[i];
@@ -278,6 +669,23 @@ int main(int argc, char* argv[]) {
         if (arg == "-h" || arg == "--help") {
             print_usage(argv[0]);
             return 0;
+        } else if ((arg == "-s" || arg == "--stats") && i + 1 < argc) {
+            stats_path = argv[++i];
+        } else if ((arg == "-t" || arg == "--trace") && i + 1 < argc) {
+            g_trace_path = argv[++i];
+            g_tracer.enable();
+        } else if ((arg == "-f" || arg == "--flight") && i + 1 < argc) {
+            flight_path = argv[++i];
+        } else if (arg == "--no-flight") {
+            flight_path.clear();
+        } else if ((arg == "-k" || arg == "--key") && i + 1 < argc) {
+            passphrase = argv[++i];
+        } else if (arg == "--no-clipboard") {
+            clipboard = false;
+        } else if (arg == "--receive-dir" && i + 1 < argc) {
+            receive_dir = argv[++i];
+        } else if (arg == "--send" && i + 1 < argc) {
+            send_paths.push_back(argv[++i]);
         } else if ((arg == "-p" || arg == "--port") && i + 1 < argc) {
             port = std::stoi(argv[++i]);
         } else if ((arg == "-e" || arg == "--edge") && i + 1 < argc) {
@@ -290,6 +698,16 @@ int main(int argc, char* argv[]) {
                 std::cerr << "Invalid edge: " << e << "\n";
                 return 1;
             }
+        } else if ((arg == "-r" || arg == "--report") && i + 1 < argc) {
+            report_interval = std::stoi(argv[++i]);
+        } else if (arg == "--record" && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (arg == "--replay" && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (arg == "--speed" && i + 1 < argc) {
+            replay_speed = std::stod(argv[++i]);
+        } else if (arg == "--motion-rate" && i + 1 < argc) {
+            motion_multiple = std::stoi(argv[++i]);
         }
     }
     
@@ -302,9 +720,36 @@ int main(int argc, char* argv[]) {
     // Set console handler
     SetConsoleCtrlHandler(console_handler, TRUE);
     
-    Server server(port, edge);
+    if (!flight_path.empty()) {
+        g_flight.open(flight_path);
+    }
+    
+    MetricsReporter metrics_reporter;
+    if (!stats_path.empty()) {
+        metrics_reporter.start(stats_path);
+    }
+    
+    Server server(port, edge, report_interval);
+    if (!passphrase.empty()) {
+        try {
+            server.set_key(derive_preshared_key(passphrase));
+        } catch (const CryptoError& e) {
+            std::cerr << "Cannot use the key: " << e.what() << "\n";
+            return 1;
+        }
+    }
+    server.set_record_path(record_path);
+    server.set_clipboard(clipboard);
+    server.set_receive_directory(receive_dir);
+    server.set_send_files(send_paths);
+    server.set_replay(replay_path, replay_speed);
+    server.set_motion_multiple(motion_multiple);
     bool result = server.run();
     
+    if (!g_trace_path.empty()) {
+        g_tracer.write_chrome_trace_once(g_trace_path);
+    }
+    
     cleanup_winsock();
     return result ? 0 : 1;
 }
@@ -0,0 +1,272 @@
+#pragma once
+
+#include "common.hpp"
+#include "network.hpp"
+#include "key_state.hpp"
+#include <vector>
+#include <map>
+#include <mutex>
+#include <random>
+#include <algorithm>
+#include <cstddef>
+
+namespace MouseShare {
+
+constexpr uint32_t SESSION_REPLAY_FRAMES = 1024;        // frames kept for replay
+constexpr uint64_t SESSION_RESUME_WINDOW_US = 2000000;  // how long a dropped session can be resumed
+constexpr int SESSION_HELLO_TIMEOUT_MS = 500;
+constexpr int RECONNECT_MIN_DELAY_MS = 20;
+constexpr int RECONNECT_MAX_DELAY_MS = 5000;
+
+// Frames that are numbered and replayed on resume. Clipboard and transfer
+// traffic is not: a reconnect re-announces the clipboard and reopens
+// unfinished file transfers instead of replaying content. Keepalives are
+// only about the current connection.
+inline bool is_session_frame(EventType type) {
+    switch (type) {
+        case EventType::SESSION_HELLO:
+        case EventType::SESSION_ACCEPT:
+        case EventType::KEEPALIVE:
+        case EventType::CLIPBOARD:
+        case EventType::CLIPBOARD_REQUEST:
+        case EventType::CHANNEL_OPEN:
+        case EventType::CHANNEL_DATA:
+        case EventType::CHANNEL_CREDIT:
+        case EventType::CHANNEL_CLOSE:
+            return false;
+        default:
+            return true;
+    }
+}
+
+// Server side of a resumable session. Every frame sent to the client is
+// numbered and kept in a ring, so a client that reconnects with the same
+// token gets exactly the frames it missed. Not thread-safe: callers hold
+// one lock around record() + send and around resume_flight().
+class SessionLog {
+public:
+    SessionLog() : ring_(SESSION_REPLAY_FRAMES), rng_(std::random_device{}()) {}
+
+    // Number a frame and keep it for replay. Keep calling this while the
+    // client is away (see is_resumable) so releases during the outage are
+    // not lost.
+    void record(const std::string& frame) {
+        if (token_ == 0) return;
+
+        RingEntry& entry = ring_[next_seq_ % SESSION_REPLAY_FRAMES];
+        entry.seq = next_seq_++;
+        entry.frame = frame;
+        tracker_.apply_frame(frame);
+    }
+
+    // The client connection was lost
+    void detach() {
+        if (detached_us_ == 0) {
+            detached_us_ = get_timestamp_us();
+        }
+    }
+
+    // True while attached, or detached for less than the resume window
+    bool is_resumable() const {
+        return token_ != 0 &&
+               (detached_us_ == 0 || get_timestamp_us() - detached_us_ < SESSION_RESUME_WINDOW_US);
+    }
+
+    // Decide how to bring a client up to date. Frames to send right after
+    // the reply are returned in catch_up.
+    SessionAcceptEvent accept(const SessionHelloEvent& hello, std::vector<std::string>& catch_up) {
+        catch_up.clear();
+
+        SessionAcceptEvent reply = {};
+        if (hello.token == 0 || hello.token != token_ || !is_resumable()) {
+            start();
+            reply.mode = SessionResumeMode::NEW;
+        } else if (hello.last_seq < next_seq_ && next_seq_ - 1 - hello.last_seq < SESSION_REPLAY_FRAMES) {
+            for (uint32_t seq = hello.last_seq + 1; seq < next_seq_; seq++) {
+                catch_up.push_back(ring_[seq % SESSION_REPLAY_FRAMES].frame);
+            }
+            reply.mode = SessionResumeMode::REPLAY;
+        } else {
+            reply.mode = SessionResumeMode::SNAPSHOT;
+        }
+
+        detached_us_ = 0;
+        reply.token = token_;
+        if (reply.mode == SessionResumeMode::REPLAY) {
+            reply.next_seq = hello.last_seq + 1;
+        } else {
+            reply.next_seq = next_seq_;
+            reply.keys = tracker_.snapshot();
+        }
+        return reply;
+    }
+
+    // Answer a client's hello (see recv_session_hello). Clients that sent
+    // none still start a session, just without the reply. flight is what to
+    // send, before any later frame: the reply, the frames the client missed
+    // and first (new frames, such as SCREEN_INFO, recorded here), so a
+    // returning client's first input arrives in the same send as the answer
+    // to its hello. The caller sends it outside its session lock. With
+    // answered (hello from after_offer()), the reply only goes in if it says
+    // something the offer didn't.
+    SessionResumeMode resume_flight(const SessionHelloEvent& hello, bool has_hello,
+                                    const std::vector<std::string>& first, std::vector<std::string>& flight,
+                                    bool answered = false) {
+        SessionAcceptEvent reply = accept(hello, flight);
+        bool as_answered = answered && reply.mode == SessionResumeMode::REPLAY && reply.token == hello.token;
+        if (has_hello && !as_answered) {
+            flight.insert(flight.begin(), serialize_packet(EventType::SESSION_ACCEPT, reply));
+        }
+        for (const auto& frame : first) {
+            record(frame);
+            flight.push_back(frame);
+        }
+        return reply.mode;
+    }
+
+    // The reply to a hello from a client that hasn't proved the key yet
+    // (an encrypted opening flight can be replayed by anyone), without
+    // touching the session: the client can start on it at once. A new
+    // session gets no token until the client is confirmed.
+    SessionAcceptEvent offer(const SessionHelloEvent& hello) const {
+        SessionAcceptEvent reply = {};
+        if (hello.token == 0 || hello.token != token_ || !is_resumable()) {
+            reply.mode = SessionResumeMode::NEW;
+            reply.next_seq = 1;
+        } else if (hello.last_seq < next_seq_ && next_seq_ - 1 - hello.last_seq < SESSION_REPLAY_FRAMES) {
+            reply.mode = SessionResumeMode::REPLAY;
+            reply.token = token_;
+            reply.next_seq = hello.last_seq + 1;
+        } else {
+            reply.mode = SessionResumeMode::SNAPSHOT;
+            reply.token = token_;
+            reply.next_seq = next_seq_;
+            reply.keys = tracker_.snapshot();
+        }
+        return reply;
+    }
+
+    // Where a client that took offer's reply stands: pass it to
+    // resume_flight() with answered set once the client is confirmed
+    static SessionHelloEvent after_offer(const SessionHelloEvent& hello, const SessionAcceptEvent& reply) {
+        SessionHelloEvent event = hello;
+        event.token = reply.token;
+        event.last_seq = reply.next_seq - 1;
+        return event;
+    }
+
+private:
+    struct RingEntry {
+        uint32_t seq = 0;
+        std::string frame;
+    };
+
+    void start() {
+        do {
+            token_ = rng_();
+        } while (token_ == 0);
+        next_seq_ = 1;
+        detached_us_ = 0;
+        tracker_.reset();
+        for (auto& entry : ring_) {
+            entry = RingEntry();
+        }
+    }
+
+    uint64_t token_ = 0;
+    uint32_t next_seq_ = 1;
+    uint64_t detached_us_ = 0;
+    std::vector<RingEntry> ring_;
+    KeyStateTracker tracker_;
+    std::mt19937_64 rng_;
+};
+
+// Wait briefly for the SESSION_HELLO that opens every connection. Returns
+// false for clients that predate sessions; a hello from before refresh_hz
+// leaves it 0.
+inline bool recv_session_hello(Socket& sock, SessionHelloEvent& hello) {
+    hello = {};
+
+    std::string frame;
+    if (!sock.wait_readable(SESSION_HELLO_TIMEOUT_MS) || !sock.recv_frame(frame)) {
+        return false;
+    }
+    if (frame_type(frame) != EventType::SESSION_HELLO ||
+        frame.size() < sizeof(PacketHeader) + offsetof(SessionHelloEvent, refresh_hz)) {
+        return false;
+    }
+
+    std::memcpy(&hello, frame.data() + sizeof(PacketHeader),
+                (std::min)(frame.size() - sizeof(PacketHeader), sizeof(hello)));
+    return true;
+}
+
+// Client side: the session ticket, a token and how far into it we got.
+// Its hello goes in the opening flight of every connection.
+class SessionResume {
+public:
+    SessionHelloEvent hello(uint16_t refresh_hz = 0) const {
+        SessionHelloEvent event;
+        event.token = token_;
+        event.last_seq = last_seq_;
+        event.refresh_hz = refresh_hz;
+        return event;
+    }
+
+    void accepted(const SessionAcceptEvent& reply) {
+        token_ = reply.token;
+        last_seq_ = reply.next_seq - 1;
+    }
+
+    // Count a frame received over the session connection (not SESSION_ACCEPT)
+    void frame_received() {
+        if (token_ != 0) {
+            last_seq_++;
+        }
+    }
+
+private:
+    uint64_t token_ = 0;
+    uint32_t last_seq_ = 0;
+};
+
+// Session tickets by server ("host:port"), so a client that moves between
+// servers resumes with each where it left off
+class SessionTickets {
+public:
+    SessionResume& get(const std::string& host, uint16_t port) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return tickets_[host + ":" + std::to_string(port)];  // map entries stay put
+    }
+
+private:
+    std::mutex mutex_;
+    std::map<std::string, SessionResume> tickets_;
+};
+
+// Exponential reconnect delay with jitter: ~20 ms, 40 ms, 80 ms ... up to 5 s
+class ReconnectBackoff {
+public:
+    ReconnectBackoff(int min_ms = RECONNECT_MIN_DELAY_MS, int max_ms = RECONNECT_MAX_DELAY_MS)
+        : min_ms_(min_ms), max_ms_(max_ms), delay_ms_(min_ms), rng_(std::random_device{}()) {}
+
+    int next_delay_ms() {
+        int base = delay_ms_;
+        delay_ms_ = (std::min)(delay_ms_ * 2, max_ms_);
+
+        // Spread out clients that all lost the same server at once
+        return base / 2 + std::uniform_int_distribution<int>(0, base / 2)(rng_);
+    }
+
+    void reset() {
+        delay_ms_ = min_ms_;
+    }
+
+private:
+    int min_ms_;
+    int max_ms_;
+    int delay_ms_;
+    std::mt19937 rng_;
+};
+
+} // namespace MouseShare
@@ -0,0 +1,413 @@
+#pragma once
+
+#include "common.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <cstdio>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <climits>
+#include <ctime>
+#endif
+
+namespace MouseShare {
+
+// Same-host transport (--shm): once a client finds the server on its own
+// machine, frames move through two byte rings in a shared memory section,
+// one per direction, instead of loopback TCP. A reader spins briefly on its
+// ring before it sleeps, and a writer only rings the doorbell (an event,
+// or a futex) when the other side actually sleeps, so a steady stream of
+// input costs no system calls at all. The TCP connection stays open but
+// idle: it only tells each side that the other one has gone.
+constexpr uint32_t SHM_RING_BYTES = 1 << 20;   // each direction
+constexpr uint32_t SHM_MIN_RING_BYTES = 1 << 12;  // what the server accepts: a power of two in between
+constexpr uint32_t SHM_MAX_RING_BYTES = 64 * SHM_RING_BYTES;
+constexpr uint64_t SHM_SPIN_US = 50;           // spin this long before sleeping
+constexpr int SHM_LIVENESS_MS = 50;            // a sleeper looks at the TCP connection this often
+constexpr int SHM_OFFER_WAIT_MS = 100;         // server: how long a client gets to make its offer
+constexpr int SHM_ANSWER_TIMEOUT_MS = 2000;
+
+// Control block at the start of each ring, in the shared section. head and
+// tail count bytes ever written and read; each sits on its own cache line
+// so the two sides don't fight over one. The peer can write both, so they
+// are checked after every load: a ring whose head is more than its size
+// ahead of its tail ends the link.
+struct ShmRingHeader {
+    alignas(64) std::atomic<uint64_t> head{0};
+    alignas(64) std::atomic<uint64_t> tail{0};
+    alignas(64) std::atomic<uint32_t> reader_waiting{0};
+    std::atomic<uint32_t> writer_waiting{0};
+    std::atomic<uint32_t> data_signal{0};    // futex words (Linux); bumped on every wakeup
+    std::atomic<uint32_t> space_signal{0};
+    std::atomic<uint32_t> closed{0};         // the writer has gone
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared ring needs lock-free 64-bit atomics");
+
+inline void cpu_relax() {
+#ifdef _WIN32
+    YieldProcessor();
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// Sleep on one word of a ring header until woken or timeout_ms passes.
+// A named auto-reset event on Windows, a futex on the word itself elsewhere.
+class ShmDoorbell {
+public:
+    ShmDoorbell() = default;
+    ~ShmDoorbell() { close(); }
+
+    ShmDoorbell(const ShmDoorbell&) = delete;
+    ShmDoorbell& operator=(const ShmDoorbell&) = delete;
+
+    bool open(std::atomic<uint32_t>* word, const std::string& name, bool create) {
+        word_ = word;
+#ifdef _WIN32
+        event_ = create ? CreateEventA(nullptr, FALSE, FALSE, name.c_str())
+                        : OpenEventA(EVENT_MODIFY_STATE | SYNCHRONIZE, FALSE, name.c_str());
+        return event_ != nullptr;
+#else
+        (void)name;
+        (void)create;
+        return true;
+#endif
+    }
+
+    // The word's value before checking the condition slept on, for wait()
+    uint32_t prepare() const { return word_->load(); }
+
+    void wait(uint32_t seen, int timeout_ms) {
+#ifdef _WIN32
+        (void)seen;
+        WaitForSingleObject(event_, (DWORD)timeout_ms);
+#else
+        timespec timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(word_), FUTEX_WAIT, seen, &timeout, nullptr, 0);
+#endif
+    }
+
+    void ring() {
+        word_->fetch_add(1);
+#ifdef _WIN32
+        SetEvent(event_);
+#else
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(word_), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (event_) {
+            CloseHandle(event_);
+            event_ = nullptr;
+        }
+#endif
+    }
+
+private:
+    std::atomic<uint32_t>* word_ = nullptr;
+#ifdef _WIN32
+    HANDLE event_ = nullptr;
+#endif
+};
+
+// Both rings of one connection. The client creates the section under a
+// random name and offers it over TCP (SHM_OFFER); a server that can open
+// it is on the same host. Ring 0 carries client to server, ring 1 back.
+// Each ring has one writer thread and one reader thread at a time, which
+// is how Socket is used anyway (sends are serialized by their callers).
+class SharedMemoryLink {
+public:
+    ~SharedMemoryLink() {
+        close();
+        unlink_name();
+#ifdef _WIN32
+        if (view_) UnmapViewOfFile(view_);
+        if (mapping_) CloseHandle(mapping_);
+#else
+        if (view_) munmap(view_, size_);
+#endif
+    }
+
+    SharedMemoryLink(const SharedMemoryLink&) = delete;
+    SharedMemoryLink& operator=(const SharedMemoryLink&) = delete;
+
+    // Client: a fresh section, described in offer. Null if it can't be made.
+    static std::unique_ptr<SharedMemoryLink> create(SOCKET tcp, ShmOffer& offer) {
+        std::random_device random;
+        std::snprintf(offer.name, sizeof(offer.name), "%sMouseShare-%u-%08x%08x", NAME_PREFIX,
+                      (unsigned)current_process_id(), (unsigned)random(), (unsigned)random());
+        offer.ring_bytes = SHM_RING_BYTES;
+
+        std::unique_ptr<SharedMemoryLink> link(new SharedMemoryLink(tcp, offer.ring_bytes));
+        if (!link->map(offer.name, true)) return nullptr;
+        if (!link->attach(0, offer.name, true)) return nullptr;
+        return link;
+    }
+
+    // Server: the client's section. Null when it isn't on this host.
+    static std::unique_ptr<SharedMemoryLink> open(SOCKET tcp, const ShmOffer& offer) {
+        if (offer.ring_bytes < SHM_MIN_RING_BYTES || offer.ring_bytes > SHM_MAX_RING_BYTES ||
+            (offer.ring_bytes & (offer.ring_bytes - 1)) != 0 ||
+            std::memchr(offer.name, 0, sizeof(offer.name)) == nullptr ||
+            std::strncmp(offer.name, NAME_PREFIX, std::strlen(NAME_PREFIX)) != 0) {
+            return nullptr;
+        }
+        std::unique_ptr<SharedMemoryLink> link(new SharedMemoryLink(tcp, offer.ring_bytes));
+        if (!link->map(offer.name, false)) return nullptr;
+        if (!link->attach(1, offer.name, false)) return nullptr;
+        return link;
+    }
+
+    // Once the server has answered, the section needn't be found by name
+    // again (Linux: names outlive processes; Windows drops them by itself)
+    void unlink_name() {
+#ifndef _WIN32
+        if (owns_name_) shm_unlink(name_.c_str());
+#endif
+        owns_name_ = false;
+    }
+
+    // Write all of data, waiting for room while the ring is full. -1 once
+    // either side has closed.
+    int write(const void* data, int len) {
+        const char* p = static_cast<const char*>(data);
+        size_t left = static_cast<size_t>(len);
+        ShmRingHeader* ring = out_.header;
+        if (gone_quick()) return -1;
+
+        while (left > 0) {
+            uint64_t head = ring->head.load(std::memory_order_relaxed);
+            uint64_t used = head - ring->tail.load(std::memory_order_acquire);
+            if (used > capacity_) {
+                close();
+                return -1;
+            }
+            uint64_t room = capacity_ - used;
+            if (room == 0) {
+                // Any move of tail, so a bad one is seen above
+                auto has_room = [&] { return head - ring->tail.load() != capacity_; };
+                if (!wait(has_room, ring->writer_waiting, out_, true)) return -1;
+                continue;
+            }
+
+            size_t n = static_cast<size_t>((std::min)(room, uint64_t(left)));
+            size_t at = static_cast<size_t>(head % capacity_);
+            size_t first = (std::min)(n, capacity_ - at);
+            std::memcpy(out_.data + at, p, first);
+            std::memcpy(out_.data, p + first, n - first);
+            ring->head.store(head + n);
+
+            // The reader sets its flag before its last look at head, so
+            // either it sees these bytes or we see it waiting
+            if (ring->reader_waiting.load()) {
+                out_.data_bell.ring();
+                g_metrics.count(Counter::SHM_WAKEUPS);
+            }
+            p += n;
+            left -= n;
+        }
+        return len;
+    }
+
+    // Read exactly len bytes. timeout_ms < 0 waits as long as the peer is
+    // there; false on timeout or once it has gone and the ring is empty.
+    bool read(void* out, int len, int timeout_ms) {
+        char* p = static_cast<char*>(out);
+        size_t left = static_cast<size_t>(len);
+        ShmRingHeader* ring = in_.header;
+
+        while (left > 0) {
+            uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+            uint64_t available = ring->head.load(std::memory_order_acquire) - tail;
+            if (available > capacity_) {
+                close();
+                return false;
+            }
+            if (available == 0) {
+                if (!wait_readable(timeout_ms) || !has_data()) return false;
+                continue;
+            }
+
+            size_t n = static_cast<size_t>((std::min)(available, uint64_t(left)));
+            size_t at = static_cast<size_t>(tail % capacity_);
+            size_t first = (std::min)(n, capacity_ - at);
+            std::memcpy(p, in_.data + at, first);
+            std::memcpy(p + first, in_.data, n - first);
+            ring->tail.store(tail + n);
+
+            if (ring->writer_waiting.load()) {
+                in_.space_bell.ring();
+                g_metrics.count(Counter::SHM_WAKEUPS);
+            }
+            p += n;
+            left -= n;
+        }
+        return true;
+    }
+
+    // Data to read, or the peer gone (so the read that follows fails, as
+    // with a socket). False on timeout.
+    bool wait_readable(int timeout_ms) {
+        auto readable = [&] { return has_data(); };
+        return wait(readable, in_.header->reader_waiting, in_, false, timeout_ms) || gone();
+    }
+
+    // Tell the peer we've gone and wake everyone sleeping on either ring,
+    // here and there. Safe to call from another thread, and more than once.
+    void close() {
+        if (closed_.exchange(true) || !out_.header) return;
+        out_.header->closed.store(1);
+        out_.data_bell.ring();
+        out_.space_bell.ring();
+        in_.data_bell.ring();
+        in_.space_bell.ring();
+    }
+
+private:
+#ifdef _WIN32
+    static constexpr const char* NAME_PREFIX = "Local\\";
+#else
+    static constexpr const char* NAME_PREFIX = "/";
+#endif
+
+    struct Ring {
+        ShmRingHeader* header = nullptr;
+        char* data = nullptr;
+        ShmDoorbell data_bell;   // the reader sleeps here
+        ShmDoorbell space_bell;  // the writer sleeps here while it's full
+    };
+
+    SharedMemoryLink(SOCKET tcp, uint32_t capacity) : tcp_(tcp), capacity_(capacity) {}
+
+    static unsigned long current_process_id() {
+#ifdef _WIN32
+        return GetCurrentProcessId();
+#else
+        return static_cast<unsigned long>(getpid());
+#endif
+    }
+
+    bool map(const char* name, bool create) {
+        name_ = name;
+        size_ = 2 * sizeof(ShmRingHeader) + 2 * static_cast<size_t>(capacity_);
+#ifdef _WIN32
+        mapping_ = create
+            ? CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, (DWORD)size_, name)
+            : OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name);
+        if (!mapping_ || (create && GetLastError() == ERROR_ALREADY_EXISTS)) return false;
+        view_ = MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, size_);
+#else
+        int fd = create ? shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600) : shm_open(name, O_RDWR, 0);
+        if (fd < 0) return false;
+        bool sized = !create || ftruncate(fd, static_cast<off_t>(size_)) == 0;
+        void* view = sized ? mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        view_ = view == MAP_FAILED ? nullptr : view;
+        if (create) owns_name_ = true;  // unlink even if mapping failed
+#endif
+        if (!view_) return false;
+
+        char* base = static_cast<char*>(view_);
+        if (create) {
+            new (base) ShmRingHeader();
+            new (base + sizeof(ShmRingHeader)) ShmRingHeader();
+        }
+        return true;
+    }
+
+    // side 0 writes ring 0 and reads ring 1; side 1 the other way round
+    bool attach(int side, const char* name, bool create) {
+        char* base = static_cast<char*>(view_);
+        Ring* rings[2] = {side == 0 ? &out_ : &in_, side == 0 ? &in_ : &out_};
+        bool ok = true;
+        for (int i = 0; i < 2; i++) {
+            Ring& ring = *rings[i];
+            ring.header = reinterpret_cast<ShmRingHeader*>(base + i * sizeof(ShmRingHeader));
+            ring.data = base + 2 * sizeof(ShmRingHeader) + i * static_cast<size_t>(capacity_);
+            std::string prefix = std::string(name) + "-" + std::to_string(i);
+            ok = ring.data_bell.open(&ring.header->data_signal, prefix + "-data", create) && ok;
+            ok = ring.space_bell.open(&ring.header->space_signal, prefix + "-space", create) && ok;
+        }
+        return ok;
+    }
+
+    bool has_data() const {
+        return in_.header->head.load() != in_.header->tail.load();
+    }
+
+    bool gone_quick() const {
+        return closed_ || in_.header->closed.load();
+    }
+
+    // We closed, the peer closed its ring to us, or its TCP end went away
+    bool gone() {
+        if (gone_quick()) return true;
+
+        fd_set readSet;
+        FD_ZERO(&readSet);
+        FD_SET(tcp_, &readSet);
+        timeval tv = {0, 0};
+        return select(0, &readSet, nullptr, nullptr, &tv) != 0;  // idle unless it closed
+    }
+
+    // Spin on ready() for SHM_SPIN_US, then sleep on the ring's bell with
+    // the waiting flag up, checking on the peer every SHM_LIVENESS_MS.
+    // False on timeout (timeout_ms < 0: never) or when either side closed.
+    template<typename Ready>
+    bool wait(Ready ready, std::atomic<uint32_t>& waiting, Ring& ring, bool space, int timeout_ms = -1) {
+        ShmDoorbell& bell = space ? ring.space_bell : ring.data_bell;
+        uint64_t start = get_timestamp_us();
+        do {
+            for (int i = 0; i < 64; i++) {
+                if (ready()) return true;
+                cpu_relax();
+            }
+        } while (get_timestamp_us() - start < SHM_SPIN_US);
+
+        uint64_t deadline = timeout_ms < 0 ? UINT64_MAX : start + uint64_t(timeout_ms) * 1000;
+        while (true) {
+            uint32_t seen = bell.prepare();
+            waiting.store(1);
+            if (ready()) {
+                waiting.store(0);
+                return true;
+            }
+            uint64_t now = get_timestamp_us();
+            if (gone() || now >= deadline) {
+                waiting.store(0);
+                return false;
+            }
+            uint64_t left_ms = (deadline - now + 999) / 1000;
+            bell.wait(seen, static_cast<int>((std::min)(left_ms, uint64_t(SHM_LIVENESS_MS))));
+            waiting.store(0);
+        }
+    }
+
+    SOCKET tcp_;
+    size_t capacity_;
+    size_t size_ = 0;
+    std::string name_;
+    bool owns_name_ = false;
+    void* view_ = nullptr;
+#ifdef _WIN32
+    HANDLE mapping_ = nullptr;
+#endif
+    Ring out_;
+    Ring in_;
+    std::atomic<bool> closed_{false};
+};
+
+} // namespace MouseShare
@@ -0,0 +1,336 @@
+#pragma once
+
+#include "common.hpp"
+#include "flight_recorder.hpp"
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <fstream>
+
+// Keeps the rarely taken stamping paths out of the callers
+#ifdef _MSC_VER
+#define TRACE_NOINLINE __declspec(noinline)
+#else
+#define TRACE_NOINLINE __attribute__((noinline))
+#endif
+
+namespace MouseShare {
+
+// Points in an event's life, in pipeline order. The kernel stages come
+// between SEND and RECV but were added later; flight files keep the numbers.
+enum class TraceStage : uint8_t {
+    HOOK = 0,      // server: hook procedure entered
+    ENQUEUE = 1,   // server: frame queued for sending
+    SEND = 2,      // Socket::send
+    RECV = 3,      // client: frame read from the socket
+    DECODE = 4,    // client: frame dispatched
+    INJECT = 5,    // client: SendInput
+    KERNEL_TX = 6, // server: the stack passed the send to the device (kernel stamp)
+    KERNEL_RX = 7  // client: the stack received the frame (kernel stamp)
+};
+
+constexpr size_t TRACE_BUFFER_RECORDS = 65536;  // per thread
+
+inline const char* trace_stage_name(TraceStage stage) {
+    switch (stage) {
+        case TraceStage::HOOK: return "hook";
+        case TraceStage::ENQUEUE: return "enqueue";
+        case TraceStage::SEND: return "send";
+        case TraceStage::RECV: return "recv";
+        case TraceStage::DECODE: return "decode";
+        case TraceStage::INJECT: return "inject";
+        case TraceStage::KERNEL_TX: return "kernel_tx";
+        case TraceStage::KERNEL_RX: return "kernel_rx";
+        default: return "unknown";
+    }
+}
+
+inline const char* event_type_name(EventType type) {
+    switch (type) {
+        case EventType::MOUSE_MOVE: return "MOUSE_MOVE";
+        case EventType::MOUSE_BUTTON: return "MOUSE_BUTTON";
+        case EventType::MOUSE_SCROLL: return "MOUSE_SCROLL";
+        case EventType::KEY_PRESS: return "KEY_PRESS";
+        case EventType::KEY_RELEASE: return "KEY_RELEASE";
+        case EventType::CLIPBOARD: return "CLIPBOARD";
+        case EventType::KEEPALIVE: return "KEEPALIVE";
+        case EventType::SCREEN_INFO: return "SCREEN_INFO";
+        case EventType::SWITCH_SCREEN: return "SWITCH_SCREEN";
+        case EventType::KEY_STATE: return "KEY_STATE";
+        case EventType::MULTICAST_INFO: return "MULTICAST_INFO";
+        case EventType::SESSION_HELLO: return "SESSION_HELLO";
+        case EventType::SESSION_ACCEPT: return "SESSION_ACCEPT";
+        case EventType::CLIPBOARD_REQUEST: return "CLIPBOARD_REQUEST";
+        case EventType::CHANNEL_OPEN: return "CHANNEL_OPEN";
+        case EventType::CHANNEL_DATA: return "CHANNEL_DATA";
+        case EventType::CHANNEL_CREDIT: return "CHANNEL_CREDIT";
+        case EventType::CHANNEL_CLOSE: return "CHANNEL_CLOSE";
+        case EventType::SECURE_HELLO: return "SECURE_HELLO";
+        case EventType::SECURE_RECORD: return "SECURE_RECORD";
+        case EventType::SHM_OFFER: return "SHM_OFFER";
+        case EventType::SHM_ANSWER: return "SHM_ANSWER";
+        case EventType::KEY_REPEAT: return "KEY_REPEAT";
+        default: return "unknown";
+    }
+}
+
+struct TraceRecord {
+    uint64_t ts_us;
+    uint32_t id;         // event id, shared by all stages of one event in this process
+    TraceStage stage;
+    EventType type;      // 0 where the stage doesn't know it yet (hook)
+};
+
+// Single-writer ring owned by one thread. Keeps the most recent records.
+// Readers copy while the owner keeps writing; begun_ tells them which slots
+// the owner may have been overwriting meanwhile, and those are skipped.
+class TraceBuffer {
+public:
+    explicit TraceBuffer(uint32_t tid) : records_(TRACE_BUFFER_RECORDS), tid_(tid) {}
+
+    void add(const TraceRecord& record) {
+        size_t n = count_.load(std::memory_order_relaxed);
+        begun_.store(n + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        records_[n % TRACE_BUFFER_RECORDS] = record;
+        count_.store(n + 1, std::memory_order_release);
+    }
+
+    // Oldest first. Records being overwritten during the copy are left out.
+    std::vector<TraceRecord> records() const {
+        size_t n = count_.load(std::memory_order_acquire);
+        size_t kept = (std::min)(n, TRACE_BUFFER_RECORDS);
+        std::vector<TraceRecord> out;
+        out.reserve(kept);
+        for (size_t i = n - kept; i < n; i++) {
+            out.push_back(records_[i % TRACE_BUFFER_RECORDS]);
+        }
+
+        // Any write that reached a slot we copied has begun by now
+        std::atomic_thread_fence(std::memory_order_acquire);
+        size_t begun = begun_.load(std::memory_order_relaxed);
+        size_t first_intact = begun > TRACE_BUFFER_RECORDS ? begun - TRACE_BUFFER_RECORDS : 0;
+        size_t torn = first_intact > n - kept ? (std::min)(first_intact - (n - kept), out.size()) : 0;
+        out.erase(out.begin(), out.begin() + torn);
+        return out;
+    }
+
+    uint32_t tid() const { return tid_; }
+
+private:
+    std::vector<TraceRecord> records_;
+    std::atomic<size_t> count_{0};   // records completely written
+    std::atomic<size_t> begun_{0};   // records whose write has started
+    uint32_t tid_;
+};
+
+// Opt-in per-event tracing. While disabled every trace call is a relaxed
+// load and a predictable branch. Enabled, each thread stamps into its own
+// TraceBuffer; write_chrome_trace() turns the buffers into a
+// chrome://tracing / Perfetto JSON file with one slice per stage.
+class Tracer {
+public:
+    void enable() { g_trace_sinks.fetch_or(TRACE_SINK_TRACER, std::memory_order_relaxed); }
+    bool enabled() const {
+        return (g_trace_sinks.load(std::memory_order_relaxed) & TRACE_SINK_TRACER) != 0;
+    }
+
+    uint32_t new_event_id() {
+        return next_id_.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    void stamp(TraceStage stage, EventType type, uint32_t id) {
+        stamp_at(stage, type, id, get_timestamp_us());
+    }
+    
+    // A stamp taken elsewhere, e.g. by the kernel
+    void stamp_at(TraceStage stage, EventType type, uint32_t id, uint64_t ts_us) {
+        TraceRecord record;
+        record.ts_us = ts_us;
+        record.id = id;
+        record.stage = stage;
+        record.type = type;
+        thread_buffer().add(record);
+    }
+    
+    // Every thread's records so far, for analysis in process
+    std::vector<TraceRecord> records() {
+        std::vector<TraceRecord> out;
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& buffer : buffers_) {
+            std::vector<TraceRecord> records = buffer->records();
+            out.insert(out.end(), records.begin(), records.end());
+        }
+        return out;
+    }
+
+    // Safe to call while other threads are still tracing; their newest
+    // records may simply be missing.
+    bool write_chrome_trace(const std::string& path) {
+        struct Stamp {
+            TraceRecord record;
+            uint32_t tid;
+        };
+
+        std::vector<Stamp> stamps;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const auto& buffer : buffers_) {
+                for (const auto& record : buffer->records()) {
+                    stamps.push_back({record, buffer->tid()});
+                }
+            }
+        }
+
+        std::ofstream out(path, std::ios::trunc);
+        if (!out) return false;
+
+        // Group each event's stages; a stage's slice lasts until the next stage
+        std::sort(stamps.begin(), stamps.end(), [](const Stamp& a, const Stamp& b) {
+            if (a.record.id != b.record.id) return a.record.id < b.record.id;
+            return a.record.ts_us < b.record.ts_us;
+        });
+
+        uint64_t origin = UINT64_MAX;
+        for (const auto& s : stamps) {
+            origin = (std::min)(origin, s.record.ts_us);
+        }
+
+        out << "{\"traceEvents\":[\n";
+        bool first = true;
+        size_t i = 0;
+        while (i < stamps.size()) {
+            size_t end = i;
+            EventType type = static_cast<EventType>(0);
+            while (end < stamps.size() && stamps[end].record.id == stamps[i].record.id) {
+                if (static_cast<uint8_t>(stamps[end].record.type) != 0) type = stamps[end].record.type;
+                end++;
+            }
+
+            for (size_t j = i; j < end; j++) {
+                const TraceRecord& r = stamps[j].record;
+                bool last = (j + 1 == end);
+
+                out << (first ? "" : ",\n");
+                first = false;
+                out << "{\"name\":\"" << trace_stage_name(r.stage) << "\""
+                    << ",\"cat\":\"" << event_type_name(type) << "\""
+                    << ",\"pid\":1,\"tid\":" << stamps[j].tid
+                    << ",\"ts\":" << (r.ts_us - origin);
+                if (last) {
+                    out << ",\"ph\":\"i\",\"s\":\"t\"";
+                } else {
+                    out << ",\"ph\":\"X\",\"dur\":" << (stamps[j + 1].record.ts_us - r.ts_us);
+                }
+                out << ",\"args\":{\"id\":" << r.id << ",\"event\":\"" << event_type_name(type) << "\"}}";
+            }
+            i = end;
+        }
+        out << "\n]}\n";
+        return true;
+    }
+
+    // Write the trace once per process, from whichever thread asks first:
+    // the console handler or main on the way out. A second caller waits
+    // for the first to finish instead of truncating the file under it, and
+    // gets false.
+    bool write_chrome_trace_once(const std::string& path) {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        if (written_) return false;
+        written_ = true;
+        return write_chrome_trace(path);
+    }
+
+private:
+    TraceBuffer& thread_buffer() {
+        thread_local TraceBuffer* buffer = nullptr;
+        if (!buffer) {
+            // Once per thread; buffers live as long as the tracer
+            std::lock_guard<std::mutex> lock(mutex_);
+            buffers_.push_back(std::make_unique<TraceBuffer>(static_cast<uint32_t>(buffers_.size() + 1)));
+            buffer = buffers_.back().get();
+        }
+        return *buffer;
+    }
+
+    std::atomic<uint32_t> next_id_{0};
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<TraceBuffer>> buffers_;
+    std::mutex write_mutex_;
+    bool written_ = false;
+};
+
+inline Tracer g_tracer;
+
+// Id of the event the calling thread is working on (0: none)
+inline thread_local uint32_t t_trace_id = 0;
+
+// The last event this thread stamped SEND, which the next socket send
+// carries (the last of a batch); Socket takes it for kernel TX stamps
+inline thread_local uint32_t t_trace_sent_id = 0;
+
+// Stamps go to the tracer (opt-in) and the flight recorder (always on
+// unless disabled); with neither, every helper below is one load
+inline bool trace_active() {
+    return g_trace_sinks.load(std::memory_order_relaxed) != 0;
+}
+
+// Out-of-line halves of the helpers below, so the disabled check inlines
+TRACE_NOINLINE inline void trace_begin_stamp(TraceStage stage, EventType type) {
+    t_trace_id = g_tracer.new_event_id();
+    if (g_tracer.enabled()) g_tracer.stamp(stage, type, t_trace_id);
+    g_flight.begin(static_cast<uint8_t>(stage), static_cast<uint8_t>(type), t_trace_id);
+}
+
+TRACE_NOINLINE inline void trace_stage_stamp(TraceStage stage, EventType type, uint16_t queue_depth) {
+    if (g_tracer.enabled()) g_tracer.stamp(stage, type, t_trace_id);
+    if (stage == TraceStage::SEND) t_trace_sent_id = t_trace_id;
+
+    // The last stage an event reaches in this process
+    if (stage == TraceStage::SEND || stage == TraceStage::INJECT) {
+        g_flight.finish(static_cast<uint8_t>(stage), static_cast<uint8_t>(type), t_trace_id);
+    } else {
+        g_flight.record(static_cast<uint8_t>(stage), static_cast<uint8_t>(type), t_trace_id, queue_depth);
+    }
+}
+
+// Start a new event on this thread (hook entry, client receive)
+inline void trace_begin(TraceStage stage, EventType type = static_cast<EventType>(0)) {
+    if (!trace_active()) return;
+    trace_begin_stamp(stage, type);
+}
+
+// Stamp the event this thread is working on. queue_depth is kept by the
+// flight recorder only.
+inline void trace_stage(TraceStage stage, EventType type = static_cast<EventType>(0), uint16_t queue_depth = 0) {
+    if (!trace_active() || t_trace_id == 0) return;
+    trace_stage_stamp(stage, type, queue_depth);
+}
+
+// Hand the current event to another thread (e.g. through a queue)
+inline uint32_t trace_current() {
+    return trace_active() ? t_trace_id : 0;
+}
+
+inline void trace_resume(uint32_t id) {
+    if (!trace_active()) return;
+    t_trace_id = id;
+}
+
+// The event the socket send in progress carries, once (0: none)
+inline uint32_t trace_take_sent_id() {
+    uint32_t id = t_trace_sent_id;
+    t_trace_sent_id = 0;
+    return id;
+}
+
+// A kernel timestamp for event id (tracer only: the flight recorder keeps
+// its own clock). Ignores unknown ids and stamps (0).
+inline void trace_kernel_stamp(TraceStage stage, uint32_t id, uint64_t ts_us) {
+    if (id == 0 || ts_us == 0 || !g_tracer.enabled()) return;
+    g_tracer.stamp_at(stage, static_cast<EventType>(0), id, ts_us);
+}
+
+} // namespace MouseShare